@@ -0,0 +1,70 @@
+# Summarizes the histograms in a tlsdated metrics scrape as tab-separated
+#   commit  metric  count  mean  p50  p90  p99
+# Quantiles are interpolated linearly within buckets, as Prometheus'
+# histogram_quantile() does, so they are only as fine as the buckets.
+# Set commit with -v commit=...
+
+function quantile(name, q,    rank, i, prev_le, prev_n, le, n) {
+	rank = q * count[name]
+	prev_le = 0
+	prev_n = 0
+	for (i = 1; i <= nb[name]; i++) {
+		le = bound[name, i]
+		n = cum[name, i]
+		if (n >= rank) {
+			if (le == "+Inf")
+				return prev_le
+			if (n == prev_n)
+				return le
+			return prev_le + (le - prev_le) * (rank - prev_n) / (n - prev_n)
+		}
+		prev_le = le
+		prev_n = n
+	}
+	return prev_le
+}
+
+/^# TYPE .* histogram$/ {
+	order[++nh] = $3
+	next
+}
+
+/_bucket\{le="/ {
+	name = $1
+	sub(/_bucket\{.*/, "", name)
+	le = $1
+	sub(/.*le="/, "", le)
+	sub(/".*/, "", le)
+	nb[name]++
+	bound[name, nb[name]] = le
+	cum[name, nb[name]] = $2
+	next
+}
+
+/_sum / {
+	name = $1
+	sub(/_sum$/, "", name)
+	sum[name] = $2
+	next
+}
+
+/_count / {
+	name = $1
+	sub(/_count$/, "", name)
+	count[name] = $2
+	next
+}
+
+END {
+	for (i = 1; i <= nh; i++) {
+		name = order[i]
+		if (!count[name]) {
+			printf "%s\t%s\t0\tNaN\tNaN\tNaN\tNaN\n", commit, name
+			continue
+		}
+		mean = sum[name] / count[name]
+		printf "%s\t%s\t%d\t%.6g\t%.6g\t%.6g\t%.6g\n", commit, name,
+		       count[name], mean, quantile(name, 0.5),
+		       quantile(name, 0.9), quantile(name, 0.99)
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * backoff.c - retry delays for tlsdated
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Doubling keeps every host that failed at the same moment in lockstep, so
+ * a source coming back from an outage sees the whole fleet at once.
+ * Decorrelated jitter ("Exponential Backoff And Jitter", AWS architecture
+ * blog, 2015) grows about as fast but draws each delay at random from
+ * [base, 3 * last], which spreads the herd out within a few retries.
+ * tlsdate-bench --backoff simulates both.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "src/backoff.h"
+
+int
+backoff_policy_parse (const char *name)
+{
+  if (!strcmp (name, "double"))
+    return BACKOFF_DOUBLE;
+  if (!strcmp (name, "decorrelated"))
+    return BACKOFF_DECORRELATED;
+  return -1;
+}
+
+const char *
+backoff_policy_str (int policy)
+{
+  return policy == BACKOFF_DECORRELATED ? "decorrelated" : "double";
+}
+
+uint32_t
+backoff_next (int policy, uint32_t base, uint32_t cap, uint32_t prev,
+              uint32_t r)
+{
+  uint32_t hi;
+  if (policy != BACKOFF_DECORRELATED)
+    return prev < cap ? prev * 2 : prev;
+  if (base >= cap)
+    return base;
+  hi = prev > cap / 3 ? cap : prev * 3;
+  if (hi <= base)
+    return base;
+  return base + r % (hi - base + 1);
+}
@@ -0,0 +1,30 @@
+/*
+ * backoff.h - retry delays for tlsdated
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+enum backoff_policy_t
+{
+  BACKOFF_DOUBLE = 0,    /* double the delay each time, up to the cap */
+  BACKOFF_DECORRELATED,  /* random, between the base and thrice the last */
+};
+
+/* Returns the policy named |name|, or -1. */
+int backoff_policy_parse (const char *name);
+const char *backoff_policy_str (int policy);
+
+/* The delay before the next retry after one of |prev| seconds, given a
+ * |base| and |cap| in seconds; a |base| above the cap wins.  |r| is
+ * uniformly random; doubling ignores it.
+ */
+uint32_t backoff_next (int policy, uint32_t base, uint32_t cap, uint32_t prev,
+                       uint32_t r);
+
+#endif /* BACKOFF_H */
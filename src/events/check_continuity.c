@@ -11,6 +11,7 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/probes.h"
 #include "src/tlsdate.h"
 #include "src/util.h"
 
@@ -57,6 +58,16 @@ check_continuity (time_t *delta)
   return 0;
 }
 
+void
+action_check_continuity (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_CONTINUITY);
+  trace_event (state, E_CONTINUITY);
+  action_kickoff_time_sync (fd, what, arg);
+}
+
 /* Sets up a wake event just in case there has not been a wake event
  * recently enough to catch clock desynchronization.  This does not
  * invalidate the time like the action_invalidate_time event.
@@ -66,12 +77,13 @@ int setup_event_timer_continuity (struct state *state)
   struct event *event;
   struct timeval interval = { state->opts.continuity_interval, 0 };
   event = event_new (state->base, -1, EV_TIMEOUT|EV_PERSIST,
-                     action_kickoff_time_sync, state);
+                     action_check_continuity, state);
   if (!event)
     {
       error ("Failed to create interval event");
       return 1;
     }
+  state->events[E_CONTINUITY] = event;
   event_priority_set (event, PRI_WAKE);
   return event_add (event, &interval);
 }
@@ -0,0 +1,39 @@
+/*
+ * dns.c - name lookups for queries tlsdated makes itself
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * tlsdate resolves its own host, but Roughtime and NTS queries are sent
+ * from the event loop and have to be looked up without blocking it.  They
+ * share one libevent resolver.
+ */
+
+#include "config.h"
+
+#include <event2/dns.h>
+#include <event2/event.h>
+
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+#define RESOLV_CONF "/etc/resolv.conf"
+
+/* Returns the resolver, set up on first use, with the name servers read
+ * afresh: networks come and go, and their name servers with them.  NULL if
+ * there is none to be had.
+ */
+struct evdns_base *
+fresh_resolver (struct state *state)
+{
+  if (!state->dns && !(state->dns = evdns_base_new (state->base, 0)))
+    {
+      error ("[dns] can't set up a resolver");
+      return NULL;
+    }
+  evdns_base_clear_nameservers_and_suspend (state->dns);
+  if (evdns_base_resolv_conf_parse (state->dns, DNS_OPTIONS_ALL, RESOLV_CONF))
+    verb ("[dns] no usable name servers in " RESOLV_CONF);
+  evdns_base_resume (state->dns);
+  return state->dns;
+}
@@ -0,0 +1,48 @@
+/*
+ * dump_trace.c - write the event trace out on SIGUSR1
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+#include <event2/event.h>
+
+#include "src/conf.h"
+#include "src/probes.h"
+#include "src/trace.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+void
+action_dump_trace (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_DUMP_TRACE);
+  trace_event (state, E_DUMP_TRACE);
+  if (trace_dump (&state->trace, state->trace_path))
+    {
+      perror ("[event:%s] could not write trace to %s", __func__,
+              state->trace_path);
+      return;
+    }
+  info ("[event:%s] wrote event trace to %s", __func__, state->trace_path);
+}
+
+int
+setup_event_dump_trace (struct state *state)
+{
+  state->events[E_DUMP_TRACE] = event_new (state->base, SIGUSR1,
+                                           EV_SIGNAL|EV_PERSIST,
+                                           action_dump_trace, state);
+  if (!state->events[E_DUMP_TRACE])
+    return 1;
+  event_priority_set (state->events[E_DUMP_TRACE], PRI_ANY);
+  return event_add (state->events[E_DUMP_TRACE], NULL);
+}
@@ -0,0 +1,73 @@
+/*
+ * fast_boot.c - first network sync at boot and readiness notification
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * With fast-boot, tlsdated doesn't wait for a route to show up before its
+ * first sync: it keeps retrying every fast-boot-retry seconds, and any
+ * route-up cuts the wait short, until network time lands or
+ * fast-boot-timeout passes.  Readiness is only reported to the service
+ * manager at that point, so units ordered after time-sync.target start as
+ * soon as the clock is trustworthy.
+ */
+
+#include "config.h"
+
+#include <event2/event.h>
+
+#include "src/conf.h"
+#include "src/notify.h"
+#include "src/probes.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+void
+report_ready (struct state *state, const char *status)
+{
+  notify_send ("%sSTATUS=%s", state->ready ? "" : "READY=1\n", status);
+  state->ready = 1;
+}
+
+void
+end_fast_boot (struct state *state)
+{
+  if (!state->booting)
+    return;
+  state->booting = 0;
+  if (state->events[E_BOOT_TIMEOUT])
+    event_del (state->events[E_BOOT_TIMEOUT]);
+  /* Later failures back off from the usual retry wait. */
+  state->backoff = state->opts.wait_between_tries;
+}
+
+void
+action_boot_timeout (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_BOOT_TIMEOUT);
+  trace_event (state, E_BOOT_TIMEOUT);
+  info ("[event:%s] no network time after %d seconds; reporting ready "
+        "with the %s time", __func__, state->opts.fast_boot_timeout,
+        sync_type_str (state->last_sync_type));
+  end_fast_boot (state);
+  report_ready (state, "Network time not available yet");
+}
+
+int
+setup_event_boot_timeout (struct state *state)
+{
+  struct timeval timeout = { state->opts.fast_boot_timeout, 0 };
+  if (!state->opts.fast_boot)
+    return 0;
+  state->events[E_BOOT_TIMEOUT] = event_new (state->base, -1, EV_TIMEOUT,
+                                             action_boot_timeout, state);
+  if (!state->events[E_BOOT_TIMEOUT])
+    return 1;
+  event_priority_set (state->events[E_BOOT_TIMEOUT], PRI_ANY);
+  state->booting = 1;
+  state->backoff = state->opts.fast_boot_retry;
+  notify_send ("STATUS=Waiting for network time");
+  return event_add (state->events[E_BOOT_TIMEOUT], &timeout);
+}
@@ -19,6 +19,8 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/peer.h"
+#include "src/probes.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
@@ -29,12 +31,10 @@ static ctr_drbg_context ctr_drbg;
 static char *pers = "tlsdated";
 #endif
 
-int
-add_jitter (int base, int jitter)
+uint32_t
+random_u32 (void)
 {
-  int n = 0;
-  if (!jitter)
-    return base;
+  uint32_t n = 0;
 #ifdef USE_POLARSSL
   if (0 == random_init)
   {
@@ -52,7 +52,24 @@ add_jitter (int base, int jitter)
   if (RAND_bytes ( (unsigned char *) &n, sizeof (n)) != 1)
     fatal ("RAND_bytes() failed");
 #endif
-  return base + (abs (n) % (2 * jitter)) - jitter;
+  return n;
+}
+
+int
+add_jitter (int base, int jitter)
+{
+  if (!jitter)
+    return base;
+  return base + (int) (random_u32 () % (2 * jitter)) - jitter;
+}
+
+/* How late a wake-triggered sync starts: up to wake-jitter seconds. */
+static int
+wake_delay (const struct state *state)
+{
+  if (state->opts.wake_jitter <= 0)
+    return 0;
+  return random_u32 () % state->opts.wake_jitter;
 }
 
 void
@@ -64,6 +81,7 @@ invalidate_time (struct state *state)
    * This allows forced invalidation to not lose synchronization
    * data.
    */
+  status_page_update (state);
 }
 
 void
@@ -71,6 +89,8 @@ action_invalidate_time (evutil_socket_t fd, short what, void *arg)
 {
   struct state *state = arg;
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_STEADYSTATE);
+  trace_event (state, E_STEADYSTATE);
   /* If time is already invalid and being acquired, do nothing. */
   if (state->last_sync_type == SYNC_TYPE_RTC &&
       event_pending (state->events[E_TLSDATE], EV_TIMEOUT, NULL))
@@ -127,7 +147,7 @@ void action_kickoff_time_sync (evutil_socket_t fd, short what, void *arg)
             state->clock_delta, delta);
       /* Add jitter iff we had network synchronization once before. */
       if (state->clock_delta)
-        jitter = add_jitter (30, 30); /* TODO(wad) make configurable */
+        jitter = wake_delay (state);
       /* Forget the old delta until we have time again. */
       state->clock_delta = 0;
       invalidate_time (state);
@@ -137,6 +157,21 @@ void action_kickoff_time_sync (evutil_socket_t fd, short what, void *arg)
       verb_debug ("[event:%s] time in sync. skipping", __func__);
       return;
     }
+  /* At boot a new route is the likeliest reason the last try failed, so
+   * don't sit out the retry delay.
+   */
+  if (state->booting && !state->running &&
+      event_pending (state->events[E_TLSDATE], EV_TIMEOUT, NULL))
+    {
+      verb_debug ("[event:%s] retrying now for fast-boot", __func__);
+      state->tries = 0;
+      /* The new route may reach peers that weren't reachable before. */
+      if (state->peers)
+        state->peers->tried = 0;
+      event_del (state->events[E_TLSDATE]);
+      if (state->events[E_RESOLVER])
+        event_del (state->events[E_RESOLVER]);
+    }
   /* Keep parity with run_tlsdate: for every wake, allow it to retry again. */
   if (state->tries > 0)
     {
@@ -155,6 +190,12 @@ void action_kickoff_time_sync (evutil_socket_t fd, short what, void *arg)
       verb_debug ("[event:%s] called while tlsdate is pending", __func__);
       return;
     }
+  /* Decorrelated backoff spreads out every wake and the first sync at
+   * boot too, so a fleet waking together doesn't sync together.  Fast
+   * boot is about getting the time soonest, so it is left alone.
+   */
+  if (state->opts.backoff_policy == BACKOFF_DECORRELATED && !state->booting)
+    jitter = wake_delay (state);
   if (!state->events[E_RESOLVER])
     {
       trigger_event (state, E_TLSDATE, jitter);
@@ -0,0 +1,149 @@
+/*
+ * metrics_request.c - serve metrics over a Unix socket
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <event2/event.h>
+
+#include "src/conf.h"
+#include "src/probes.h"
+#include "src/metrics.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+/* Closing a Unix socket with unread data resets the connection, and the
+ * client loses the response along with it.  So after replying, hang on to
+ * the client until it hangs up (or for a second), discarding what it sent.
+ */
+static void
+metrics_linger (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  struct timeval linger = { 1, 0 };
+  char buf[256];
+  ssize_t n;
+  if (what & EV_READ)
+    {
+      while ((n = IGNORE_EINTR (read (fd, buf, sizeof (buf)))) > 0)
+        ;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+          !event_base_once (state->base, fd, EV_READ, metrics_linger, state,
+                            &linger))
+        return;
+    }
+  close (fd);
+}
+
+/* Every connection gets one HTTP/1.0 response and is then closed, so both
+ * `curl --unix-socket` and a plain `socat - UNIX-CONNECT:` work.  Whatever
+ * the client sends is ignored.
+ */
+void
+action_metrics_request (evutil_socket_t fd, short what, void *arg)
+{
+  static const char kHeader[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "\r\n";
+  static char response[METRICS_MAX_RESPONSE];
+  struct state *state = arg;
+  size_t header_len = sizeof (kHeader) - 1;
+  ssize_t sent;
+  int client;
+  int len;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_METRICS);
+  trace_event (state, E_METRICS);
+  client = IGNORE_EINTR (accept4 (fd, NULL, NULL,
+                                  SOCK_NONBLOCK|SOCK_CLOEXEC));
+  if (client < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror ("[event:%s] accept failed", __func__);
+      return;
+    }
+  memcpy (response, kHeader, header_len);
+  len = metrics_render (state, response + header_len,
+                        sizeof (response) - header_len);
+  if (len < 0)
+    {
+      error ("[event:%s] metrics do not fit in %zu bytes", __func__,
+             sizeof (response));
+      close (client);
+      return;
+    }
+  len += header_len;
+  sent = IGNORE_EINTR (write (client, response, len));
+  if (sent != len)
+    verb ("[event:%s] short metrics write (%zd of %d)", __func__, sent, len);
+  shutdown (client, SHUT_WR);
+  metrics_linger (client, EV_READ, state);
+}
+
+/* Must be called before privileges are dropped when the socket lives in a
+ * root-owned directory such as /run/tlsdated.
+ */
+int
+setup_metrics_socket (struct state *state)
+{
+  const char *path = state->opts.metrics_socket;
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      error ("metrics socket path too long: '%s'", path);
+      return 1;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  /* Clean up after an unclean shutdown, but never remove anything else. */
+  if (!lstat (path, &st) && S_ISSOCK (st.st_mode))
+    unlink (path);
+  fd = socket (AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      perror ("metrics socket() failed");
+      return 1;
+    }
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      perror ("can't bind metrics socket '%s'", path);
+      close (fd);
+      return 1;
+    }
+  /* Metrics are read-only and not sensitive; let any local user scrape. */
+  if (chmod (path, 0666) < 0)
+    pinfo ("can't chmod metrics socket '%s'", path);
+  if (listen (fd, 4) < 0)
+    {
+      perror ("can't listen on metrics socket '%s'", path);
+      close (fd);
+      return 1;
+    }
+  state->events[E_METRICS] = event_new (state->base, fd, EV_READ|EV_PERSIST,
+                                        action_metrics_request, state);
+  if (!state->events[E_METRICS])
+    {
+      error ("Failed to allocate metrics event");
+      close (fd);
+      return 1;
+    }
+  event_priority_set (state->events[E_METRICS], PRI_ANY);
+  event_add (state->events[E_METRICS], NULL);
+  return 0;
+}
@@ -0,0 +1,395 @@
+/*
+ * nts.c - ask an NTP server for the time under Network Time Security
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * An NTS source costs one TLS handshake for a jar of cookies: tlsdate runs
+ * NTS-KE against it (-Vnts) with the usual certificate checks and writes
+ * back keys and cookies instead of a time.  Each run after that takes a
+ * cookie and asks the NTP server from the event loop, one UDP round trip,
+ * and the reply refills the jar; only when it is empty, or the server no
+ * longer reads our cookies, does the next run go back to tlsdate.  The jar
+ * is kept in the cache directory so restarts don't cost a handshake.
+ *
+ * As with Roughtime, E_TLSDATE_TIMEOUT bounds the whole run, handshake and
+ * query alike, and the answer goes through handle_tlsdate_sample().
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <event2/dns.h>
+#include <event2/event.h>
+#include <event2/util.h>
+#include <openssl/rand.h>
+
+#include "src/conf.h"
+#include "src/nts.h"
+#include "src/probes.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+struct nts_query
+{
+  struct evdns_getaddrinfo_request *lookup;
+  int fd;
+  int pending;
+  struct source *source;    /* what the run is for; NULL once reloaded */
+  char host[NTS_HOST_LEN];  /* the NTS-KE server |session| is for */
+  char port[16];
+  char path[PATH_MAX];      /* where |session| is kept */
+  struct nts_session session;
+  uint8_t uid[NTS_UID_LEN];
+  uint8_t xmt[8];
+  uint8_t request[NTS_MAX_PACKET];
+  size_t request_len;
+  struct timespec sent;
+};
+
+int
+nts_pending (const struct state *state)
+{
+  return state->nts && state->nts->pending;
+}
+
+void
+nts_cancel (struct state *state)
+{
+  struct nts_query *q = state->nts;
+  if (!q)
+    return;
+  q->pending = 0;
+  if (q->lookup)
+    {
+      evdns_getaddrinfo_cancel (q->lookup);
+      q->lookup = NULL;
+    }
+  if (state->events[E_NTS])
+    {
+      event_free (state->events[E_NTS]);
+      state->events[E_NTS] = NULL;
+    }
+  if (q->fd >= 0)
+    {
+      close (q->fd);
+      q->fd = -1;
+    }
+}
+
+/* The sources are being reloaded; a run in flight no longer has one. */
+void
+nts_forget_source (struct state *state)
+{
+  if (state->nts)
+    state->nts->source = NULL;
+}
+
+/* Ends the run for |src| without a time, as a failed tlsdate would. */
+static void
+fail (struct state *state, struct source *src, enum metrics_failure_t cause)
+{
+  nts_cancel (state);
+  event_del (state->events[E_TLSDATE_TIMEOUT]);
+  metrics_run_failed (&state->metrics, cause);
+  state->running = 0;
+  schedule_tlsdate_retry (state, src);
+}
+
+/* The run took longer than subprocess-timeout. */
+void
+nts_time_out (struct state *state)
+{
+  if (nts_pending (state))
+    fail (state, state->nts->source, F_TIMEOUT);
+}
+
+static void
+save_session (struct nts_query *q)
+{
+  if (nts_session_save (q->path, &q->session))
+    perror ("[nts] can't save cookies to %s", q->path);
+}
+
+/* Points |state->nts| at the cookie jar for |src|, reading it from the
+ * cache if the source has changed.  Returns NULL if out of memory.
+ */
+static struct nts_query *
+query_for_source (struct state *state, struct source *src)
+{
+  struct nts_query *q = state->nts;
+  char name[NTS_HOST_LEN + sizeof (q->port)];
+  size_t i;
+  if (!q)
+    {
+      if (!(q = calloc (1, sizeof (*q))))
+        return NULL;
+      q->fd = -1;
+      state->nts = q;
+    }
+  q->source = src;
+  if (!strcmp (q->host, src->host) && !strcmp (q->port, src->port))
+    return q;
+  snprintf (q->host, sizeof (q->host), "%s", src->host);
+  snprintf (q->port, sizeof (q->port), "%s", src->port);
+  /* The name goes into a path; keep it to one tame component. */
+  snprintf (name, sizeof (name), "%s-%s", q->host, q->port);
+  for (i = 0; name[i]; ++i)
+    if (!isalnum ((unsigned char) name[i]) && !strchr (".-", name[i]))
+      name[i] = '_';
+  snprintf (q->path, sizeof (q->path), "%s/nts-%s", state->opts.base_path,
+            name);
+  if (nts_session_load (q->path, &q->session))
+    memset (&q->session, 0, sizeof (q->session));
+  else
+    verb_debug ("[nts] %u cookies for %s in %s", q->session.num_cookies,
+                q->host, q->path);
+  return q;
+}
+
+/* Converts an NTP timestamp to nanoseconds since the epoch. */
+static int64_t
+ntp_to_ns (uint64_t ts)
+{
+  uint64_t sec = ts >> 32;
+  /* Era 1 starts in 2036. */
+  if (sec < NTS_NTP_UNIX_OFFSET)
+    sec += 1ULL << 32;
+  return (sec - NTS_NTP_UNIX_OFFSET) * 1000000000LL +
+         (int64_t) (((ts & 0xffffffff) * 1000000000ULL) >> 32);
+}
+
+static void
+take_answer (struct state *state, const struct nts_reply *reply)
+{
+  struct nts_query *q = state->nts;
+  struct tlsdate_sample sample;
+  struct timespec now;
+  int64_t rtt_ns, delay_ns, est_ns;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  rtt_ns = (now.tv_sec - q->sent.tv_sec) * 1000000000LL +
+           now.tv_nsec - q->sent.tv_nsec;
+  /* The usual NTP sums, less the time the server sat on the request. */
+  delay_ns = rtt_ns - (ntp_to_ns (reply->transmit) -
+                       ntp_to_ns (reply->receive));
+  if (delay_ns < 0)
+    delay_ns = 0;
+  memset (&sample, 0, sizeof (sample));
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.rtt_ms = (delay_ns + 500000) / 1000000;
+  sample.flags = TLSDATE_SAMPLE_NTS;
+  /* Readers add half of |rtt_ms| back on, as for any sample, which lands
+   * on the NTP estimate: the transmit time plus half the delay.
+   */
+  est_ns = ntp_to_ns (reply->transmit) + delay_ns / 2 -
+           sample.rtt_ms * 500000LL;
+  sample.time = est_ns / 1000000000LL;
+  sample.usec = est_ns % 1000000000LL / 1000;
+  /* What the server says of its own error (NTP short format). */
+  sample.radius_us = ((uint64_t) reply->root_delay / 2 +
+                      reply->root_dispersion) * 1000000 >> 16;
+  verb ("[event:%s] %s says %u.%06u +/- %uus (rtt %ums, %u cookies left)",
+        __func__, q->host, sample.time, sample.usec, sample.radius_us,
+        sample.rtt_ms, q->session.num_cookies);
+  save_session (q);
+  if (!q->source)
+    {
+      info ("[event:%s] %s was reloaded away; dropping its answer", __func__,
+            q->host);
+      fail (state, NULL, F_BAD_RESPONSE);
+      return;
+    }
+  nts_cancel (state);
+  event_del (state->events[E_TLSDATE_TIMEOUT]);
+  state->running = 0;
+  handle_tlsdate_sample (state, q->source, &sample);
+}
+
+void
+action_nts_reply (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  struct nts_query *q = state->nts;
+  struct nts_reply reply;
+  uint8_t buf[NTS_MAX_PACKET];
+  ssize_t len;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_NTS);
+  trace_event (state, E_NTS);
+  /* The socket is connected, so only the server can be heard; anything
+   * that doesn't answer our request is left for the timeout to deal with.
+   */
+  for (;;)
+    {
+      len = IGNORE_EINTR (recv (fd, buf, sizeof (buf), MSG_DONTWAIT));
+      if (len < 0)
+        break;
+      switch (nts_parse_reply (&q->session, q->uid, q->xmt, buf, len, &reply))
+        {
+        case 0:
+          take_answer (state, &reply);
+          return;
+        case 1:
+          /* Our keys are no good to it any more; start over with NTS-KE. */
+          info ("[event:%s] %s refused our cookie", __func__, q->host);
+          memset (&q->session, 0, sizeof (q->session));
+          unlink (q->path);
+          fail (state, q->source, F_BAD_RESPONSE);
+          return;
+        default:
+          info ("[event:%s] ignoring a bad reply from %s", __func__,
+                q->host);
+        }
+    }
+  /* ICMP unreachable shows up as ECONNREFUSED; no sense waiting. */
+  if (errno == ECONNREFUSED)
+    {
+      info ("[event:%s] %s refused the query", __func__, q->host);
+      fail (state, q->source, F_LAUNCH);
+    }
+  else if (errno != EAGAIN && errno != EWOULDBLOCK)
+    perror ("[event:%s] receiving from %s", __func__, q->host);
+}
+
+static void
+send_request (int err, struct evutil_addrinfo *res, void *arg)
+{
+  struct state *state = arg;
+  struct nts_query *q = state->nts;
+  if (err == EVUTIL_EAI_CANCEL)
+    return;
+  q->lookup = NULL;
+  if (err)
+    {
+      error ("[nts] can't resolve the NTP server for %s: %s", q->host,
+             evutil_gai_strerror (err));
+      fail (state, q->source, F_LAUNCH);
+      return;
+    }
+  q->fd = socket (res->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  0);
+  if (q->fd < 0 || connect (q->fd, res->ai_addr, res->ai_addrlen) < 0 ||
+      send (q->fd, q->request, q->request_len, 0) !=
+      (ssize_t) q->request_len)
+    {
+      perror ("[nts] can't query the NTP server for %s", q->host);
+      evutil_freeaddrinfo (res);
+      fail (state, q->source, F_LAUNCH);
+      return;
+    }
+  evutil_freeaddrinfo (res);
+  clock_gettime (CLOCK_MONOTONIC, &q->sent);
+  state->events[E_NTS] = event_new (state->base, q->fd, EV_READ|EV_PERSIST,
+                                    action_nts_reply, state);
+  if (!state->events[E_NTS])
+    {
+      error ("Failed to allocate nts event");
+      fail (state, q->source, F_LAUNCH);
+      return;
+    }
+  event_priority_set (state->events[E_NTS], PRI_NET);
+  event_add (state->events[E_NTS], NULL);
+  verb_debug ("[nts] asked the NTP server for %s", q->host);
+}
+
+/* Spends a cookie on a request and looks the NTP server up to send it.
+ * Returns 0 if it is on its way, 1 if there is no cookie to spend, -1 on
+ * error.
+ */
+static int
+start_query (struct state *state)
+{
+  struct nts_query *q = state->nts;
+  struct evutil_addrinfo hints;
+  struct evdns_base *dns;
+  char port[8];
+  nts_cancel (state);
+  if (!q->session.num_cookies)
+    return 1;
+  if (!(dns = fresh_resolver (state)))
+    return -1;
+  if (RAND_bytes (q->uid, sizeof (q->uid)) != 1 ||
+      RAND_bytes (q->xmt, sizeof (q->xmt)) != 1)
+    {
+      error ("[nts] no randomness for a request");
+      return -1;
+    }
+  if (!(q->request_len = nts_encode_request (&q->session, q->uid, q->xmt,
+                                             q->request)))
+    return -1;
+  /* A cookie is only good once; don't let a restart reuse it. */
+  save_session (q);
+  q->pending = 1;
+  snprintf (port, sizeof (port), "%u", q->session.ntp_port);
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  hints.ai_flags = EVUTIL_AI_ADDRCONFIG;
+  /* Numeric hosts are answered before this returns. */
+  q->lookup = evdns_getaddrinfo (dns, q->session.ntp_server[0] ?
+                                 q->session.ntp_server : q->host,
+                                 port, &hints, send_request, state);
+  return 0;
+}
+
+/* Starts a query to |state->opts.cur_source| with a cookie from the jar.
+ * Returns 0 if it is on its way, 1 if the jar is empty and tlsdate has to
+ * run NTS-KE first, -1 on error.
+ */
+int
+nts_query (struct state *state)
+{
+  struct timespec now;
+  int ret;
+  if (!query_for_source (state, state->opts.cur_source))
+    return -1;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  if (!(ret = start_query (state)))
+    metrics_run_started (&state->metrics, &now, NULL);
+  return ret;
+}
+
+/* Takes the keys and cookies tlsdate got by NTS-KE from |src| and goes
+ * straight on to the NTP server within the same run.  If |src| is NULL, it
+ * was reloaded away while tlsdate ran, and the keys are dropped.
+ */
+void
+nts_take_session (struct state *state, struct source *src,
+                  const struct nts_session *s)
+{
+  struct nts_query *q;
+  if (!src)
+    {
+      info ("[nts] the source was reloaded away; dropping its keys");
+      fail (state, NULL, F_BAD_RESPONSE);
+      return;
+    }
+  q = query_for_source (state, src);
+  if (!q)
+    {
+      fail (state, src, F_LAUNCH);
+      return;
+    }
+  q->session = *s;
+  save_session (q);
+  /* tlsdate may have been reaped already, ending the run. */
+  state->running = 1;
+  if (!event_pending (state->events[E_TLSDATE_TIMEOUT], EV_TIMEOUT, NULL))
+    trigger_event (state, E_TLSDATE_TIMEOUT,
+                   state->opts.subprocess_wait_between_tries);
+  if (start_query (state))
+    {
+      error ("[nts] NTS-KE with %s gave nothing to query with", q->host);
+      fail (state, q->source, F_BAD_RESPONSE);
+    }
+}
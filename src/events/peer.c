@@ -0,0 +1,319 @@
+/*
+ * peer.c - take time from, and give it to, other tlsdated instances
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Before spawning tlsdate, an instance with peers asks them for their last
+ * TLS sample.  A peer that still holds one answers with it, signed with a
+ * shared key and bound to the query's nonce so an old answer can't be
+ * replayed to drag the clock back.  If no good answer comes within
+ * peer-timeout, the instance does its own handshake as usual.  Only
+ * samples from an instance's own handshakes are passed on, so error never
+ * compounds along a chain of peers.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <event2/event.h>
+#include <openssl/rand.h>
+
+#include "src/conf.h"
+#include "src/ntp-shm.h"
+#include "src/peer.h"
+#include "src/probes.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+static uint64_t
+mono_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Would we have asked |host| ourselves? */
+static int
+is_our_source (const struct state *state, const char *host)
+{
+  const struct source *s;
+  for (s = state->opts.sources; s; s = s->next)
+    if (s->host && !strcasecmp (s->host, host))
+      return 1;
+  return 0;
+}
+
+void
+peer_note_sample (struct state *state, const struct source *src,
+                  const struct tlsdate_sample *sample)
+{
+  struct peers *peers = state->peers;
+  struct peer_record *own;
+  uint64_t half_rtt = 0;
+  if (!peers)
+    return;
+  /* Peers vouch for TLS handshakes; Roughtime and NTP answers aren't. */
+  if (sample->magic == TLSDATE_SAMPLE_MAGIC &&
+      (sample->flags & TLSDATE_SAMPLE_SUBSEC))
+    {
+      peers->have_own = 0;
+      return;
+    }
+  own = &peers->own;
+  memset (own, 0, sizeof (*own));
+  strncpy (own->host, src && src->host ? src->host : DEFAULT_HOST,
+           sizeof (own->host) - 1);
+  own->server_time = sample->time;
+  if (sample->magic == TLSDATE_SAMPLE_MAGIC)
+    {
+      own->rtt_ms = sample->rtt_ms;
+      memcpy (own->spki_sha256, sample->spki_sha256, PEER_SPKI_LEN);
+      half_rtt = sample->rtt_ms * 500000ULL;
+    }
+  /* As in metrics_run_succeeded(): stamped half a round trip ago. */
+  own->sync_mono_ns = mono_ns () - half_rtt;
+  peers->have_own = 1;
+}
+
+static void
+answer_query (struct state *state, int fd, const uint8_t *buf, size_t len,
+              const struct sockaddr_in *from)
+{
+  struct peers *peers = state->peers;
+  struct peer_record rec;
+  uint8_t reply[PEER_REPLY_LEN];
+  int key = peer_check_query (peers, buf, len, rec.nonce);
+  if (key < 0)
+    {
+      verb_debug ("[event:%s] ignoring a bad peer query", __func__);
+      return;
+    }
+  /* Only vouch for time we still stand behind ourselves. */
+  if (!peers->have_own || state->last_sync_type != SYNC_TYPE_NET ||
+      state->opts.dry_run ||
+      mono_ns () - peers->own.sync_mono_ns >
+        (uint64_t) state->opts.peer_max_age * 1000000000ULL)
+    return;
+  memcpy (rec.host, peers->own.host, sizeof (rec.host));
+  memcpy (rec.spki_sha256, peers->own.spki_sha256, sizeof (rec.spki_sha256));
+  rec.server_time = peers->own.server_time;
+  rec.rtt_ms = peers->own.rtt_ms;
+  rec.sync_mono_ns = peers->own.sync_mono_ns;
+  rec.sent_mono_ns = mono_ns ();
+  len = peer_encode_reply (peers, key, &rec, reply);
+  if (sendto (fd, reply, len, MSG_DONTWAIT, (const struct sockaddr *) from,
+              sizeof (*from)) < 0)
+    pinfo ("[event:%s] can't answer peer", __func__);
+  else
+    state->metrics.peer_answered++;
+}
+
+static void
+take_reply (struct state *state, const uint8_t *buf, size_t len)
+{
+  struct peers *peers = state->peers;
+  struct peer_record rec;
+  struct timespec now;
+  double rtt, elapsed;
+  time_t t;
+  if (!peers->querying)
+    return;
+  if (peer_decode_reply (peers, buf, len, &rec) ||
+      memcmp (rec.nonce, peers->nonce, PEER_NONCE_LEN) ||
+      rec.sent_mono_ns < rec.sync_mono_ns)
+    {
+      verb_debug ("[event:%s] ignoring a bad peer reply", __func__);
+      state->metrics.peer_rejected++;
+      return;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  rtt = (now.tv_sec - peers->query_sent.tv_sec) +
+        (now.tv_nsec - peers->query_sent.tv_nsec) / 1e9;
+  elapsed = (rec.sent_mono_ns - rec.sync_mono_ns) / 1e9 + rtt / 2;
+  t = rec.server_time + (time_t) (elapsed + 0.5);
+  if (elapsed > state->opts.peer_max_age || !is_our_source (state, rec.host) ||
+      !is_sane_time (t))
+    {
+      info ("[event:%s] rejecting peer sample from %s (%.0fs old)",
+            __func__, rec.host, elapsed);
+      state->metrics.peer_rejected++;
+      return;
+    }
+  info ("[event:%s] took time %ld from a peer's sample of %s", __func__,
+        (long) t, rec.host);
+  peers->querying = 0;
+  peers->tried = 0;
+  event_del (state->events[E_PEER_TIMEOUT]);
+  state->last_sync_type = SYNC_TYPE_NET;
+  state->last_time = t;
+  metrics_peer_succeeded (&state->metrics, t, rtt + rec.rtt_ms / 1000.0);
+  ntp_shm_post (state->ntp_shm, t, NULL);
+  trigger_event (state, E_SAVE, -1);
+  state->tries = 0;
+  state->backoff = state->opts.wait_between_tries;
+  reset_source_tries (&state->opts);
+}
+
+void
+action_peer_packet (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  uint8_t buf[PEER_REPLY_LEN + 1];
+  struct sockaddr_in from;
+  socklen_t from_len;
+  ssize_t len;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_PEER);
+  trace_event (state, E_PEER);
+  for (;;)
+    {
+      from_len = sizeof (from);
+      len = IGNORE_EINTR (recvfrom (fd, buf, sizeof (buf), MSG_DONTWAIT,
+                                    (struct sockaddr *) &from, &from_len));
+      if (len < 0)
+        break;
+      if (len == PEER_QUERY_LEN)
+        answer_query (state, fd, buf, len, &from);
+      else
+        take_reply (state, buf, len);
+    }
+  if (errno != EAGAIN && errno != EWOULDBLOCK)
+    perror ("[event:%s] receiving from peers", __func__);
+}
+
+void
+action_peer_timeout (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_PEER_TIMEOUT);
+  trace_event (state, E_PEER_TIMEOUT);
+  if (!state->peers->querying)
+    return;
+  info ("[event:%s] no peer had a sample; fetching it ourselves", __func__);
+  state->peers->querying = 0;
+  trigger_event (state, E_TLSDATE, 0);
+}
+
+/* Returns 1 if a query went out, so the caller should wait for it. */
+int
+peer_query (struct state *state)
+{
+  struct peers *peers = state->peers;
+  uint8_t buf[PEER_QUERY_LEN];
+  size_t len;
+  int i, sent = 0;
+  int fd = event_get_fd (state->events[E_PEER]);
+  if (peers->tried)
+    return 0;
+  peers->tried = 1;
+  if (RAND_bytes (peers->nonce, PEER_NONCE_LEN) != 1)
+    {
+      error ("[%s] no randomness for a peer query", __func__);
+      return 0;
+    }
+  len = peer_encode_query (peers, buf);
+  clock_gettime (CLOCK_MONOTONIC, &peers->query_sent);
+  for (i = 0; i < peers->num_dests; ++i)
+    if (sendto (fd, buf, len, MSG_DONTWAIT,
+                (const struct sockaddr *) &peers->dests[i],
+                sizeof (peers->dests[i])) == (ssize_t) len)
+      sent++;
+  if (!sent)
+    {
+      pinfo ("[%s] can't reach any peer", __func__);
+      return 0;
+    }
+  verb ("[%s] asked %d peers for a sample", __func__, sent);
+  peers->querying = 1;
+  trigger_event (state, E_PEER_TIMEOUT, state->opts.peer_timeout);
+  return 1;
+}
+
+/* Must be called before privileges are dropped: the key file should only
+ * be readable by root, and the port may be privileged.
+ */
+int
+setup_peers (struct state *state)
+{
+  struct peers *peers;
+  struct sockaddr_in addr;
+  int fd, i, one = 1, ttl = 1;
+  peers = calloc (1, sizeof (*peers));
+  if (!peers)
+    return 1;
+  if (peer_load_keys (peers, state->opts.peer_key_file))
+    goto fail;
+  if (state->opts.peers &&
+      peer_parse_dests (peers, state->opts.peers, state->opts.peer_port))
+    {
+      error ("bad peers list '%s'", state->opts.peers);
+      goto fail;
+    }
+  fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      perror ("peer socket() failed");
+      goto fail;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (state->opts.peer_port);
+  addr.sin_addr.s_addr = htonl (INADDR_ANY);
+  /* Several instances on a host can then share a multicast group. */
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      perror ("can't bind peer port %d", state->opts.peer_port);
+      close (fd);
+      goto fail;
+    }
+  /* Join any group we send to, so we hear the group's queries too. */
+  setsockopt (fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl));
+  for (i = 0; i < peers->num_dests; ++i)
+    if (IN_MULTICAST (ntohl (peers->dests[i].sin_addr.s_addr)))
+      {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = peers->dests[i].sin_addr;
+        mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+        if (setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                        sizeof (mreq)) < 0)
+          pinfo ("can't join peer group");
+      }
+  state->events[E_PEER] = event_new (state->base, fd, EV_READ|EV_PERSIST,
+                                     action_peer_packet, state);
+  state->events[E_PEER_TIMEOUT] = event_new (state->base, -1, EV_TIMEOUT,
+                                             action_peer_timeout, state);
+  if (!state->events[E_PEER] || !state->events[E_PEER_TIMEOUT])
+    {
+      error ("Failed to allocate peer events");
+      for (i = E_PEER; i <= E_PEER_TIMEOUT; ++i)
+        if (state->events[i])
+          {
+            event_free (state->events[i]);
+            state->events[i] = NULL;
+          }
+      close (fd);
+      goto fail;
+    }
+  event_priority_set (state->events[E_PEER], PRI_NET);
+  event_priority_set (state->events[E_PEER_TIMEOUT], PRI_NET);
+  event_add (state->events[E_PEER], NULL);
+  state->peers = peers;
+  verb ("sharing samples with %d peers on port %d", peers->num_dests,
+        state->opts.peer_port);
+  return 0;
+fail:
+  memset (peers, 0, sizeof (*peers));
+  free (peers);
+  return 1;
+}
@@ -0,0 +1,200 @@
+/*
+ * reload_conf.c - re-read tlsdated.conf on SIGHUP or when it changes
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include <event2/event.h>
+
+#include "src/conf.h"
+#include "src/probes.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+/* Editors may write a file in several steps; let them finish first. */
+#define CONF_SETTLE_SECONDS 1
+
+static void
+rearm_timer (struct event *e, int seconds)
+{
+  struct timeval interval = { seconds, 0 };
+  if (!e)
+    return;
+  event_del (e);
+  event_add (e, &interval);
+}
+
+void
+action_reload_conf (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  int steady_state_interval = state->opts.steady_state_interval;
+  int jitter = state->opts.jitter;
+  int continuity_interval = state->opts.continuity_interval;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_RELOAD);
+  trace_event (state, E_RELOAD);
+  if (reload_conf (state))
+    {
+      state->metrics.config_reload_failures++;
+      error ("[event:%s] keeping the old config", __func__);
+      return;
+    }
+  state->metrics.config_reloads++;
+  /* Restarting the countdown is only worth it if the interval moved. */
+  if (state->opts.steady_state_interval != steady_state_interval ||
+      state->opts.jitter != jitter)
+    rearm_timer (state->events[E_STEADYSTATE],
+                 add_jitter (state->opts.steady_state_interval,
+                             state->opts.jitter));
+  if (state->opts.continuity_interval != continuity_interval)
+    rearm_timer (state->events[E_CONTINUITY],
+                 state->opts.continuity_interval);
+  /* Between syncs the backoff is just the retry wait. */
+  if (!state->running && !state->tries)
+    state->backoff = state->opts.wait_between_tries;
+  info ("[event:%s] config reloaded", __func__);
+}
+
+static void
+action_sighup (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_SIGHUP);
+  trace_event (state, E_SIGHUP);
+  trigger_event (state, E_RELOAD, 0);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* The config file's name within the watched directory. */
+static char conf_watch_name[NAME_MAX + 1];
+
+static void
+action_conf_watch (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  char buf[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  const struct inotify_event *ev;
+  ssize_t len;
+  int changed = 0;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_CONF_WATCH);
+  trace_event (state, E_CONF_WATCH);
+  while ((len = read (fd, buf, sizeof (buf))) > 0)
+    {
+      char *p;
+      for (p = buf; p < buf + len; p += sizeof (*ev) + ev->len)
+        {
+          ev = (const struct inotify_event *) p;
+          if (ev->mask & IN_Q_OVERFLOW)
+            changed = 1;
+          else if (ev->len && !strcmp (ev->name, conf_watch_name))
+            changed = 1;
+        }
+    }
+  if (len < 0 && errno != EAGAIN && errno != EINTR)
+    perror ("[event:%s] reading inotify events", __func__);
+  /* Each change pushes the reload back, so a burst of writes is one. */
+  if (changed)
+    trigger_event (state, E_RELOAD, CONF_SETTLE_SECONDS);
+}
+
+/* Watches the directory rather than the file so that editors which
+ * replace the file by renaming over it are noticed too.
+ */
+static int
+setup_conf_watch (struct state *state)
+{
+  const char *path = state->opts.conf_file;
+  char dir[PATH_MAX];
+  const char *slash;
+  int fd;
+  if (!path)
+    path = DEFAULT_CONF_FILE;
+  slash = strrchr (path, '/');
+  if (!slash)
+    {
+      strcpy (dir, ".");
+      slash = path - 1;
+    }
+  else if (slash == path)
+    strcpy (dir, "/");
+  else if (slash - path >= (ptrdiff_t) sizeof (dir))
+    return 1;
+  else
+    {
+      memcpy (dir, path, slash - path);
+      dir[slash - path] = '\0';
+    }
+  if (strlen (slash + 1) >= sizeof (conf_watch_name))
+    return 1;
+  strcpy (conf_watch_name, slash + 1);
+  fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    {
+      perror ("[event:%s] inotify_init1", __func__);
+      return 1;
+    }
+  if (inotify_add_watch (fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                         IN_CREATE | IN_DELETE) < 0)
+    {
+      perror ("[event:%s] can't watch '%s'", __func__, dir);
+      close (fd);
+      return 1;
+    }
+  state->events[E_CONF_WATCH] = event_new (state->base, fd,
+                                           EV_READ|EV_PERSIST,
+                                           action_conf_watch, state);
+  if (!state->events[E_CONF_WATCH])
+    {
+      close (fd);
+      return 1;
+    }
+  event_priority_set (state->events[E_CONF_WATCH], PRI_ANY);
+  verb ("[event:%s] watching '%s' for changes", __func__, path);
+  return event_add (state->events[E_CONF_WATCH], NULL);
+}
+#else
+static int
+setup_conf_watch (struct state *state)
+{
+  info ("watch-config needs inotify; reload with SIGHUP instead");
+  return 0;
+}
+#endif
+
+int
+setup_event_reload_conf (struct state *state)
+{
+  state->events[E_RELOAD] = event_new (state->base, -1, EV_TIMEOUT,
+                                       action_reload_conf, state);
+  if (!state->events[E_RELOAD])
+    return 1;
+  event_priority_set (state->events[E_RELOAD], PRI_ANY);
+  state->events[E_SIGHUP] = event_new (state->base, SIGHUP,
+                                       EV_SIGNAL|EV_PERSIST,
+                                       action_sighup, state);
+  if (!state->events[E_SIGHUP])
+    return 1;
+  event_priority_set (state->events[E_SIGHUP], PRI_ANY);
+  if (event_add (state->events[E_SIGHUP], NULL))
+    return 1;
+  if (state->opts.watch_conf)
+    return setup_conf_watch (state);
+  return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * roughtime.c - ask a Roughtime server for the time
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A source with a roughtime-key is queried from the event loop instead of
+ * spawning tlsdate: one UDP round trip to a server whose answer is checked
+ * against that key alone, with no certificate chain in sight.  The run is
+ * otherwise a tlsdate run like any other: E_TLSDATE_TIMEOUT bounds it, a
+ * failure backs off as a failed child would, and the answer goes through
+ * handle_tlsdate_sample() as a sample with its fraction and radius filled
+ * in.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <event2/dns.h>
+#include <event2/event.h>
+#include <event2/util.h>
+#include <openssl/rand.h>
+
+#include "src/conf.h"
+#include "src/probes.h"
+#include "src/roughtime.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+struct roughtime_query
+{
+  struct evdns_getaddrinfo_request *lookup;
+  int fd;
+  int pending;
+  struct source *source;  /* what the run is for; NULL once reloaded */
+  char host[256];
+  uint8_t key[ROUGHTIME_KEY_LEN];
+  uint8_t nonce[ROUGHTIME_NONCE_LEN];
+  struct timespec sent;
+};
+
+int
+roughtime_pending (const struct state *state)
+{
+  return state->roughtime && state->roughtime->pending;
+}
+
+void
+roughtime_cancel (struct state *state)
+{
+  struct roughtime_query *q = state->roughtime;
+  if (!q)
+    return;
+  q->pending = 0;
+  if (q->lookup)
+    {
+      evdns_getaddrinfo_cancel (q->lookup);
+      q->lookup = NULL;
+    }
+  if (state->events[E_ROUGHTIME])
+    {
+      event_free (state->events[E_ROUGHTIME]);
+      state->events[E_ROUGHTIME] = NULL;
+    }
+  if (q->fd >= 0)
+    {
+      close (q->fd);
+      q->fd = -1;
+    }
+}
+
+/* The sources are being reloaded; a run in flight no longer has one. */
+void
+roughtime_forget_source (struct state *state)
+{
+  if (state->roughtime)
+    state->roughtime->source = NULL;
+}
+
+/* Ends the run for |src| without a time, as a failed tlsdate would. */
+static void
+fail (struct state *state, struct source *src, enum metrics_failure_t cause)
+{
+  roughtime_cancel (state);
+  event_del (state->events[E_TLSDATE_TIMEOUT]);
+  metrics_run_failed (&state->metrics, cause);
+  state->running = 0;
+  schedule_tlsdate_retry (state, src);
+}
+
+/* The run took longer than subprocess-timeout. */
+void
+roughtime_time_out (struct state *state)
+{
+  if (roughtime_pending (state))
+    fail (state, state->roughtime->source, F_TIMEOUT);
+}
+
+static void
+take_answer (struct state *state, const struct roughtime_result *res)
+{
+  struct roughtime_query *q = state->roughtime;
+  struct tlsdate_sample sample;
+  struct timespec now;
+  uint64_t rtt_ns;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  rtt_ns = (now.tv_sec - q->sent.tv_sec) * 1000000000ULL +
+           now.tv_nsec - q->sent.tv_nsec;
+  memset (&sample, 0, sizeof (sample));
+  sample.time = res->midpoint_us / 1000000;
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.rtt_ms = rtt_ns / 1000000;
+  sample.flags = TLSDATE_SAMPLE_ROUGHTIME;
+  sample.usec = res->midpoint_us % 1000000;
+  sample.radius_us = res->radius_us;
+  verb ("[event:%s] %s says %u.%06u +/- %uus (rtt %ums)", __func__, q->host,
+        sample.time, sample.usec, sample.radius_us, sample.rtt_ms);
+  if (!q->source)
+    {
+      info ("[event:%s] %s was reloaded away; dropping its answer", __func__,
+            q->host);
+      fail (state, NULL, F_BAD_RESPONSE);
+      return;
+    }
+  roughtime_cancel (state);
+  event_del (state->events[E_TLSDATE_TIMEOUT]);
+  state->running = 0;
+  handle_tlsdate_sample (state, q->source, &sample);
+}
+
+void
+action_roughtime_reply (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  struct roughtime_query *q = state->roughtime;
+  struct roughtime_result res;
+  uint8_t buf[ROUGHTIME_MAX_REPLY];
+  ssize_t len;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_ROUGHTIME);
+  trace_event (state, E_ROUGHTIME);
+  /* The socket is connected, so only the server can be heard; anything
+   * that doesn't verify is left for the timeout to deal with.
+   */
+  for (;;)
+    {
+      len = IGNORE_EINTR (recv (fd, buf, sizeof (buf), MSG_DONTWAIT));
+      if (len < 0)
+        break;
+      if (roughtime_verify_reply (q->key, q->nonce, buf, len, &res))
+        {
+          info ("[event:%s] ignoring a bad reply from %s", __func__,
+                q->host);
+          continue;
+        }
+      if (res.radius_us > ROUGHTIME_MAX_RADIUS_US)
+        {
+          error ("[event:%s] %s is only sure of its time to %us", __func__,
+                 q->host, res.radius_us / 1000000);
+          fail (state, q->source, F_BAD_RESPONSE);
+          return;
+        }
+      take_answer (state, &res);
+      return;
+    }
+  /* ICMP unreachable shows up as ECONNREFUSED; no sense waiting. */
+  if (errno == ECONNREFUSED)
+    {
+      info ("[event:%s] %s refused the query", __func__, q->host);
+      fail (state, q->source, F_LAUNCH);
+    }
+  else if (errno != EAGAIN && errno != EWOULDBLOCK)
+    perror ("[event:%s] receiving from %s", __func__, q->host);
+}
+
+static void
+send_query (int err, struct evutil_addrinfo *res, void *arg)
+{
+  struct state *state = arg;
+  struct roughtime_query *q = state->roughtime;
+  uint8_t buf[ROUGHTIME_REQUEST_LEN];
+  size_t len;
+  if (err == EVUTIL_EAI_CANCEL)
+    return;
+  q->lookup = NULL;
+  if (err)
+    {
+      error ("[roughtime] can't resolve %s: %s", q->host,
+             evutil_gai_strerror (err));
+      fail (state, q->source, F_LAUNCH);
+      return;
+    }
+  q->fd = socket (res->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  0);
+  len = roughtime_encode_request (q->nonce, buf);
+  if (q->fd < 0 || connect (q->fd, res->ai_addr, res->ai_addrlen) < 0 ||
+      send (q->fd, buf, len, 0) != (ssize_t) len)
+    {
+      perror ("[roughtime] can't query %s", q->host);
+      evutil_freeaddrinfo (res);
+      fail (state, q->source, F_LAUNCH);
+      return;
+    }
+  evutil_freeaddrinfo (res);
+  clock_gettime (CLOCK_MONOTONIC, &q->sent);
+  state->events[E_ROUGHTIME] = event_new (state->base, q->fd,
+                                          EV_READ|EV_PERSIST,
+                                          action_roughtime_reply, state);
+  if (!state->events[E_ROUGHTIME])
+    {
+      error ("Failed to allocate roughtime event");
+      fail (state, q->source, F_LAUNCH);
+      return;
+    }
+  event_priority_set (state->events[E_ROUGHTIME], PRI_NET);
+  event_add (state->events[E_ROUGHTIME], NULL);
+  verb_debug ("[roughtime] asked %s", q->host);
+}
+
+/* Starts a query to |state->opts.cur_source|.  Returns 0 if it is on its
+ * way; the answer, or E_TLSDATE_TIMEOUT, finishes the run.
+ */
+int
+roughtime_query (struct state *state)
+{
+  struct source *src = state->opts.cur_source;
+  struct roughtime_query *q = state->roughtime;
+  struct evutil_addrinfo hints;
+  struct evdns_base *dns;
+  struct timespec now;
+  if (!q)
+    {
+      if (!(q = calloc (1, sizeof (*q))))
+        return 1;
+      q->fd = -1;
+      state->roughtime = q;
+    }
+  roughtime_cancel (state);
+  if (!(dns = fresh_resolver (state)))
+    return 1;
+  if (RAND_bytes (q->nonce, sizeof (q->nonce)) != 1)
+    {
+      error ("[roughtime] no randomness for a nonce");
+      return 1;
+    }
+  q->source = src;
+  strncpy (q->host, src->host, sizeof (q->host) - 1);
+  memcpy (q->key, src->roughtime_key, sizeof (q->key));
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  metrics_run_started (&state->metrics, &now, NULL);
+  q->pending = 1;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  hints.ai_flags = EVUTIL_AI_ADDRCONFIG;
+  /* Numeric hosts are answered before this returns. */
+  q->lookup = evdns_getaddrinfo (dns, src->host, src->port, &hints,
+                                 send_query, state);
+  return 0;
+}
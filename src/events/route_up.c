@@ -15,6 +15,7 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/probes.h"
 #include "src/routeup.h"
 #include "src/tlsdate.h"
 #include "src/util.h"
@@ -24,6 +25,8 @@ void action_stdin_wakeup (evutil_socket_t fd, short what, void *arg)
   struct state *state = arg;
   char buf[1];
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_ROUTEUP);
+  trace_event (state, E_ROUTEUP);
   if (what != EV_READ)
     return;
   if (IGNORE_EINTR (read (fd, buf, sizeof (buf))) != sizeof (buf))
@@ -38,8 +41,11 @@ void action_stdin_wakeup (evutil_socket_t fd, short what, void *arg)
 
 void action_netlink_ready (evutil_socket_t fd, short what, void *arg)
 {
+  struct state *state = arg;
   struct routeup routeup_cfg;
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_ROUTEUP);
+  trace_event (state, E_ROUTEUP);
   routeup_cfg.netlinkfd = fd;
   if (what & EV_READ)
     {
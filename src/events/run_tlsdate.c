@@ -10,15 +10,76 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/probes.h"
 #include "src/dbus.h"
+#include "src/peer.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
+/* The next TLS source after the current one, or NULL if there is none. */
+static struct source *
+hedge_source (struct opts *opts)
+{
+  struct source *s = opts->cur_source;
+  while ((s = s->next ? s->next : opts->sources) != opts->cur_source)
+    {
+      if (!s->roughtime && !s->nts && !source_lacks_time (s) &&
+          source_has_tries (s))
+        return s;
+    }
+  return NULL;
+}
+
+/* Gives the run just started until hedge-percentile of past attempts took
+ * to answer before starting another against the next source.
+ */
+static void
+arm_hedge (struct state *state)
+{
+  struct metrics *m = &state->metrics;
+  struct timeval delay;
+  double secs;
+  if (!state->opts.hedge_percentile ||
+      m->sync_duration.count < HEDGE_MIN_RUNS ||
+      !hedge_source (&state->opts))
+    return;
+  secs = metrics_quantile (&m->sync_duration,
+                           state->opts.hedge_percentile / 100.0);
+  delay.tv_sec = (time_t) secs;
+  delay.tv_usec = (suseconds_t) ((secs - delay.tv_sec) * 1e6);
+  verb_debug ("[event:%s] hedging in %.3fs", __func__, secs);
+  event_add (state->events[E_HEDGE], &delay);
+}
+
+void
+action_hedge_tlsdate (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  struct source *slow = state->opts.cur_source;
+  struct source *src;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_HEDGE);
+  trace_event (state, E_HEDGE);
+  if (!state->running || tlsdate_runs (state) != 1 || !slow ||
+      !(src = hedge_source (&state->opts)))
+    return;
+  info ("[event:%s] %s:%s is slow; also trying %s:%s", __func__,
+        slow->host, slow->port, src->host, src->port);
+  state->opts.cur_source = src;
+  /* The first run carries on either way. */
+  if (tlsdate (state))
+    error ("[event:%s] tlsdate failed to launch a hedge", __func__);
+}
+
 /* TODO(wad) split out backoff logic to make this testable */
 void action_run_tlsdate (evutil_socket_t fd, short what, void *arg)
 {
   struct state *state = arg;
+  const struct source *src;
+  int err;
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_TLSDATE);
+  trace_event (state, E_TLSDATE);
   if (state->last_sync_type == SYNC_TYPE_NET)
     {
       verb ("[event:%s] called, but network time isn't needed",
@@ -44,8 +105,17 @@ void action_run_tlsdate (evutil_socket_t fd, short what, void *arg)
             __func__);
       return;
     }
-  /* Enforce maximum retries here instead of in sigchld.c */
-  if (state->tries < state->opts.max_tries)
+  /* A peer may already have what a handshake would get us. */
+  if (state->peers && !state->tries)
+    {
+      if (state->peers->querying || peer_query (state))
+        return;
+    }
+  /* Enforce maximum retries here instead of in sigchld.c, both overall
+   * and each source's own.
+   */
+  if (state->tries < state->opts.max_tries &&
+      (src = advance_source (&state->opts)))
     {
       state->tries++;
     }
@@ -53,6 +123,9 @@ void action_run_tlsdate (evutil_socket_t fd, short what, void *arg)
     {
       state->tries = 0;
       state->backoff = state->opts.wait_between_tries;
+      reset_source_tries (&state->opts);
+      if (state->peers)
+        state->peers->tried = 0;
       error ("[event:%s] tlsdate tried and failed to get the time", __func__);
       return;
     }
@@ -62,13 +135,28 @@ void action_run_tlsdate (evutil_socket_t fd, short what, void *arg)
   /* Setup a timeout before killing tlsdate */
   trigger_event (state, E_TLSDATE_TIMEOUT,
                  state->opts.subprocess_wait_between_tries);
-  /* Add the response listener event */
+  /* Add the response listener event, with nothing left from before. */
+  drain_tlsdate_responses (state);
   trigger_event (state, E_TLSDATE_STATUS, -1);
-  /* Fire off the child process now! */
-  if (tlsdate (state))
+  /* Fire off the child process now, or ask a Roughtime or NTP server. */
+  if (src->roughtime)
+    err = roughtime_query (state);
+  else
+    {
+      /* With cookies in the jar, an NTS source needs no handshake. */
+      err = src->nts ? nts_query (state) : 1;
+      if (err > 0)
+        {
+          err = tlsdate (state);
+          if (!err && !src->nts)
+            arm_hedge (state);
+        }
+    }
+  if (err)
     {
       /* TODO(wad) Should this be fatal? */
       error ("[event:%s] tlsdate failed to launch!", __func__);
+      metrics_run_failed (&state->metrics, F_LAUNCH);
       state->running = 0;
       state->tries = 0;
       event_del (state->events[E_TLSDATE_TIMEOUT]);
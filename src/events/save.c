@@ -15,6 +15,7 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/probes.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
@@ -24,6 +25,8 @@ void action_sync_and_save (evutil_socket_t fd, short what, void *arg)
   time_t t = state->last_time;
   ssize_t bytes;
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_SAVE);
+  trace_event (state, E_SAVE);
   /* For all non-net sources, don't write to disk by
    * flagging the time negative.  We don't use negative
    * times and this won't effect shutdown (0) writes.
@@ -52,6 +55,8 @@ void action_sync_and_save (evutil_socket_t fd, short what, void *arg)
   if (bytes != sizeof (t))
     pfatal ("[event:%s] unexpected write to time setter (%d)",
             __func__, bytes);
+  if (t)
+    metrics_setter_sent (&state->metrics);
   /* If we're going down and we wrote the time, send a shutdown message. */
   if (state->exitting && t)
     {
@@ -9,21 +9,75 @@
 
 #include <errno.h>
 #include <event2/event.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 
 #include "src/conf.h"
+#include "src/probes.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
+/* Charges |src| for a run of its that gave no time.  Failures inside the
+ * boot window are free; |src| is NULL if it was reloaded away.
+ */
+void
+charge_source (struct state *state, struct source *src)
+{
+  if (!state->booting && src)
+    src->tries++;
+}
+
+/* Backs off and runs tlsdate again after an attempt against |src| failed. */
+void
+schedule_tlsdate_retry (struct state *state, struct source *src)
+{
+  verb_debug ("[event:%s] scheduling a retry", __func__);
+  charge_source (state, src);
+  /* Rerun a failed tlsdate */
+  if (state->booting)
+    {
+      /* Keep trying at the boot pace until the boot window closes. */
+      state->tries = 0;
+      state->backoff = state->opts.fast_boot_retry;
+    }
+  else
+    {
+      state->backoff = backoff_next (state->opts.backoff_policy,
+                                     state->opts.wait_between_tries,
+                                     state->opts.backoff_cap, state->backoff,
+                                     random_u32 ());
+    }
+  /* If there is no resolver, call tlsdate directly. */
+  if (!state->events[E_RESOLVER])
+    {
+      trigger_event (state, E_TLSDATE, state->backoff);
+      return;
+    }
+  /* Run tlsdate even if the resolver doesn't come back. */
+  trigger_event (state, E_TLSDATE, RESOLVER_TIMEOUT + state->backoff);
+  /* Schedule the resolver.  This is always done after tlsdate in case there
+   * is no resolver.
+   */
+  trigger_event (state, E_RESOLVER, state->backoff);
+}
+
 /* Returns 1 if a death was handled, otherwise 0. */
 int
 handle_child_death (struct state *state)
 {
   siginfo_t info;
+  struct rusage usage;
+  struct tlsdate_run *run;
+  struct source *src;
+  int cancelled;
   int ret;
   info.si_pid = 0;
-  ret = waitid (P_ALL, -1, &info, WEXITED|WNOHANG);
+  /* Peek first so we learn who it was, then reap that child with wait4()
+   * to get its own resource usage rather than the running total.
+   */
+  ret = waitid (P_ALL, -1, &info, WEXITED|WNOHANG|WNOWAIT);
   if (ret == -1)
     {
       if (errno == ECHILD)
@@ -35,46 +89,91 @@ handle_child_death (struct state *state)
     {
       return 0;
     }
+  memset (&usage, 0, sizeof (usage));
+  if (wait4 (info.si_pid, NULL, WNOHANG, &usage) != info.si_pid)
+    {
+      perror ("[event:%s] wait4() failed for pid %d", __func__, info.si_pid);
+      return 0;
+    }
+  trace_child (state, E_SIGCHLD, info.si_pid, info.si_status, info.si_code);
   if (info.si_pid == state->setter_pid)
     {
       report_setter_error (&info);
       event_base_loopbreak (state->base);
       return 1;
     }
-  if (info.si_pid != state->tlsdate_pid)
+  if (!(run = find_tlsdate_run (state, info.si_pid)))
     {
       error ("[event:%s] SIGCHLD for an unknown process -- "
              "pid:%d uid:%d status:%d code:%d", __func__,
              info.si_pid, info.si_uid, info.si_status, info.si_code);
       return 1;
     }
+  PROBE3 (child_exit, info.si_pid, info.si_code, info.si_status);
   verb ("[event:%s] tlsdate reaped => "
         "pid:%d uid:%d status:%d code:%d", __func__,
         info.si_pid, info.si_uid, info.si_status, info.si_code);
 
+  cancelled = run->cancelled;
+  if (cancelled)
+    metrics_child_cancelled (&state->metrics, &usage);
+  else
+    {
+      if (info.si_code == CLD_EXITED &&
+          helper_deadline_phase (info.si_status) >= 0)
+        info ("[event:%s] tlsdate ran out of time in the %s phase", __func__,
+              helper_phase_str (helper_deadline_phase (info.si_status)));
+      /* Its server_random held no time to check certificates against. */
+      if (info.si_code == CLD_EXITED &&
+          info.si_status == HELPER_FALSE_TICKER_EXIT && run->source)
+        {
+          struct source *src = run->source;
+          random_time_false_ticker (&src->random);
+          info ("[event:%s] %s:%s is a false ticker; server_random carries %s",
+                __func__, src->host, src->port,
+                random_kind_str (src->random.kind));
+        }
+      /* Its certificate won't be any better next time. */
+      if (info.si_code == CLD_EXITED &&
+          info.si_status == HELPER_BAD_CERT_EXIT && run->source)
+        {
+          struct source *src = run->source;
+          src->rejected = 1;
+          info ("[event:%s] %s:%s's certificate was refused; skipping it "
+                "this sync", __func__, src->host, src->port);
+        }
+      metrics_child_reaped (&state->metrics, &info, &usage);
+      /* What it wrote is on the pipe by now; take it while the run can
+       * still be told from a stale one.
+       */
+      if (info.si_code == CLD_EXITED && info.si_status == 0)
+        take_tlsdate_responses (state);
+    }
+  src = run->source;
+  run->pid = 0;
+  run->cancelled = 0;
+  run->source = NULL;
+  /* The attempt lasts as long as any of its runs. */
+  if (tlsdate_runs (state))
+    {
+      /* The retry waits for the last run, but this run's source is the
+       * one that failed.  A winner has cancelled the rest already.
+       */
+      if (!cancelled && info.si_status != 0)
+        charge_source (state, src);
+      return 1;
+    }
+  /* An NTS run goes on without tlsdate once it has the keys. */
+  if (nts_pending (state))
+    return 1;
   /* If it was still active, remove it. */
   event_del (state->events[E_TLSDATE_TIMEOUT]);
+  event_del (state->events[E_HEDGE]);
   state->running = 0;
-  state->tlsdate_pid = 0;
-  /* Clean exit - don't rerun! */
-  if (info.si_status == 0)
+  /* Clean exit, or another run's - don't rerun! */
+  if (cancelled || info.si_status == 0)
     return 1;
-  verb_debug ("[event:%s] scheduling a retry", __func__);
-  /* Rerun a failed tlsdate */
-  if (state->backoff < MAX_SANE_BACKOFF)
-    state->backoff *= 2;
-  /* If there is no resolver, call tlsdate directly. */
-  if (!state->events[E_RESOLVER])
-    {
-      trigger_event (state, E_TLSDATE, state->backoff);
-      return 1;
-    }
-  /* Run tlsdate even if the resolver doesn't come back. */
-  trigger_event (state, E_TLSDATE, RESOLVER_TIMEOUT + state->backoff);
-  /* Schedule the resolver.  This is always done after tlsdate in case there
-   * is no resolver.
-   */
-  trigger_event (state, E_RESOLVER, state->backoff);
+  schedule_tlsdate_retry (state, src);
   return 1;
 }
 
@@ -96,6 +195,7 @@ handle_child_stop (struct state *state)
     }
   if (info.si_pid == 0)
     return 0;
+  trace_child (state, E_SIGCHLD, info.si_pid, info.si_status, info.si_code);
   info ("[event:%s] a child has been STOPPED or CONTINUED. Killing it.",
          __func__);
   /* Kill it then catch the next SIGCHLD. */
@@ -116,6 +216,7 @@ action_sigchld (evutil_socket_t fd, short what, void *arg)
 {
   struct state *state = arg;
   verb_debug ("[event:%s] a child process has SIGCHLD'd!", __func__);
+  PROBE_ACTION (E_SIGCHLD);
   /* Process SIGCHLDs in two steps: death and stopped until all
    * pending children are sorted.
    */
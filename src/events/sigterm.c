@@ -12,6 +12,7 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/probes.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
@@ -21,6 +22,8 @@ void action_sigterm (evutil_socket_t fd, short what, void *arg)
   struct state *state = arg;
   struct timeval tv;
   info ("[event:%s] starting graceful shutdown . . .", __func__);
+  PROBE_ACTION (E_SIGTERM);
+  trace_event (state, E_SIGTERM);
   state->exitting = 1;
   if (platform->time_get (&tv))
     {
@@ -0,0 +1,373 @@
+/*
+ * sntp_server.c - answer SNTP clients from tlsdated's clock
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * One tlsdated can serve a whole LAN segment: clients send ordinary
+ * SNTPv4 (RFC 4330) requests and get the local clock back, stamped with
+ * how good it is.  Until a network time holds, replies carry the alarm
+ * leap indicator and the INIT kiss code, so clients don't use them.
+ *
+ * Requests are read and answered in batches (recvmmsg/sendmmsg where
+ * available) with the sync state worked out once per batch, which keeps a
+ * single core well past 50k requests a second.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <event2/event.h>
+
+#include "src/conf.h"
+#include "src/probes.h"
+#include "src/sntp.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+/* Seconds from the NTP era (1900) to the Unix epoch. */
+#define NTP_UNIX_OFFSET 2208988800UL
+/* Anything longer than a bare header is extension fields or a MAC, which
+ * an SNTP server ignores; only the header has to fit.
+ */
+#define SNTP_MAX_REQUEST 128
+#define SNTP_BATCH 64
+/* Batches per wakeup, so a flood can't keep the loop from other events. */
+#define SNTP_MAX_BATCHES 16
+/* About a microsecond: what reading the clock costs, not how right it is. */
+#define SNTP_PRECISION -20
+/* ntpd's assumed frequency tolerance, 15 ppm, grows the dispersion. */
+#define SNTP_PHI 15e-6
+/* The server time is whole seconds. */
+#define SNTP_TRUNCATION_ERROR 0.5
+#define SNTP_STRATUM 2
+#define SNTP_RCVBUF (1 << 20)
+
+static void
+put32 (uint8_t *p, uint32_t v)
+{
+  v = htonl (v);
+  memcpy (p, &v, sizeof (v));
+}
+
+/* NTP short format: 16.16 fixed-point seconds, saturating. */
+static uint32_t
+ntp_short (double secs)
+{
+  if (secs <= 0)
+    return 0;
+  if (secs >= 65535)
+    return 0xffffffff;
+  return (uint32_t) (secs * 65536.0);
+}
+
+static void
+put_timestamp (uint8_t *p, const struct timespec *ts)
+{
+  put32 (p, (uint32_t) (ts->tv_sec + NTP_UNIX_OFFSET));
+  put32 (p + 4, (uint32_t) (((uint64_t) ts->tv_nsec << 32) / 1000000000));
+}
+
+int
+sntp_prepare (const struct state *state, const struct timespec *mono,
+              const struct timespec *real, uint8_t reply[SNTP_PACKET_LEN])
+{
+  const struct metrics *m = &state->metrics;
+  struct timespec ref;
+  double age;
+  memset (reply, 0, SNTP_PACKET_LEN);
+  reply[3] = (uint8_t) SNTP_PRECISION;
+  /* A dry run never steers the clock, so it has nothing to vouch for. */
+  if (state->last_sync_type != SYNC_TYPE_NET || state->opts.dry_run ||
+      !m->last_net_sync.tv_sec)
+    {
+      reply[0] = SNTP_LEAP_ALARM << 6;
+      reply[1] = 0;  /* kiss-o'-death, with the code as the reference id */
+      memcpy (reply + 12, "INIT", 4);
+      put32 (reply + 8, 0xffffffff);
+      return 0;
+    }
+  age = (mono->tv_sec - m->last_net_sync.tv_sec) +
+        (mono->tv_nsec - m->last_net_sync.tv_nsec) / 1e9;
+  reply[0] = SNTP_LEAP_NONE << 6;
+  reply[1] = SNTP_STRATUM;
+  put32 (reply + 4, ntp_short (m->last_rtt));
+  put32 (reply + 8, ntp_short (SNTP_TRUNCATION_ERROR + m->last_rtt / 2 +
+                               SNTP_PHI * age));
+  /* Not an address, so clients' loop detection never matches it. */
+  memcpy (reply + 12, "TLS", 4);
+  ref = *real;
+  ref.tv_sec -= mono->tv_sec - m->last_net_sync.tv_sec;
+  ref.tv_nsec -= mono->tv_nsec - m->last_net_sync.tv_nsec;
+  if (ref.tv_nsec < 0)
+    {
+      ref.tv_sec--;
+      ref.tv_nsec += 1000000000;
+    }
+  else if (ref.tv_nsec >= 1000000000)
+    {
+      ref.tv_sec++;
+      ref.tv_nsec -= 1000000000;
+    }
+  put_timestamp (reply + 16, &ref);
+  return 1;
+}
+
+int
+sntp_answer (uint8_t reply[SNTP_PACKET_LEN], const uint8_t *request,
+             size_t len, const struct timespec *rx, const struct timespec *tx)
+{
+  int version;
+  if (len < SNTP_PACKET_LEN)
+    return -1;
+  version = (request[0] >> 3) & 7;
+  if ((request[0] & 7) != SNTP_MODE_CLIENT || version < 1 || version > 4)
+    return -1;
+  reply[0] = (reply[0] & 0xc0) | (version << 3) | SNTP_MODE_SERVER;
+  reply[2] = request[2];  /* poll */
+  /* The client's transmit time comes back as the origin. */
+  memcpy (reply + 24, request + 40, 8);
+  put_timestamp (reply + 32, rx);
+  put_timestamp (reply + 40, tx);
+  return 0;
+}
+
+struct sntp_batch
+{
+  uint8_t request[SNTP_BATCH][SNTP_MAX_REQUEST];
+  uint8_t reply[SNTP_BATCH][SNTP_PACKET_LEN];
+  struct sockaddr_storage peer[SNTP_BATCH];
+  socklen_t peer_len[SNTP_BATCH];
+  size_t len[SNTP_BATCH];
+  int out[SNTP_BATCH];  /* indices of the replies to send */
+};
+
+#ifdef HAVE_RECVMMSG
+static int
+recv_batch (int fd, struct sntp_batch *b)
+{
+  struct mmsghdr msgs[SNTP_BATCH];
+  struct iovec iov[SNTP_BATCH];
+  int i, n;
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < SNTP_BATCH; ++i)
+    {
+      iov[i].iov_base = b->request[i];
+      iov[i].iov_len = sizeof (b->request[i]);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &b->peer[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof (b->peer[i]);
+    }
+  n = IGNORE_EINTR (recvmmsg (fd, msgs, SNTP_BATCH, MSG_DONTWAIT, NULL));
+  for (i = 0; i < n; ++i)
+    {
+      b->len[i] = msgs[i].msg_len;
+      b->peer_len[i] = msgs[i].msg_hdr.msg_namelen;
+    }
+  return n;
+}
+#else
+static int
+recv_batch (int fd, struct sntp_batch *b)
+{
+  int n;
+  for (n = 0; n < SNTP_BATCH; ++n)
+    {
+      ssize_t len;
+      b->peer_len[n] = sizeof (b->peer[n]);
+      len = IGNORE_EINTR (recvfrom (fd, b->request[n], sizeof (b->request[n]),
+                                    MSG_DONTWAIT,
+                                    (struct sockaddr *) &b->peer[n],
+                                    &b->peer_len[n]));
+      if (len < 0)
+        return n ? n : -1;
+      b->len[n] = len;
+    }
+  return n;
+}
+#endif
+
+/* Returns how many of the |count| replies in |b->out| went out. */
+#ifdef HAVE_SENDMMSG
+static int
+send_batch (int fd, struct sntp_batch *b, int count)
+{
+  struct mmsghdr msgs[SNTP_BATCH];
+  struct iovec iov[SNTP_BATCH];
+  int i, next = 0, sent = 0;
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < count; ++i)
+    {
+      int j = b->out[i];
+      iov[i].iov_base = b->reply[j];
+      iov[i].iov_len = SNTP_PACKET_LEN;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &b->peer[j];
+      msgs[i].msg_hdr.msg_namelen = b->peer_len[j];
+    }
+  while (next < count)
+    {
+      int n = IGNORE_EINTR (sendmmsg (fd, msgs + next, count - next,
+                                      MSG_DONTWAIT));
+      if (n > 0)
+        {
+          next += n;
+          sent += n;
+        }
+      else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        /* Skip a reply the kernel won't take (e.g. no route back). */
+        next++;
+      else
+        break;
+    }
+  return sent;
+}
+#else
+static int
+send_batch (int fd, struct sntp_batch *b, int count)
+{
+  int i, sent = 0;
+  for (i = 0; i < count; ++i)
+    {
+      int j = b->out[i];
+      if (IGNORE_EINTR (sendto (fd, b->reply[j], SNTP_PACKET_LEN,
+                                MSG_DONTWAIT, (struct sockaddr *) &b->peer[j],
+                                b->peer_len[j])) == SNTP_PACKET_LEN)
+        sent++;
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+    }
+  return sent;
+}
+#endif
+
+/* Not traced: under load this would push everything else out of the trace
+ * ring within a second.
+ */
+void
+action_sntp_request (evutil_socket_t fd, short what, void *arg)
+{
+  static struct sntp_batch batch;
+  struct state *state = arg;
+  struct metrics *m = &state->metrics;
+  uint8_t prepared[SNTP_PACKET_LEN];
+  struct timespec mono, rx, tx;
+  int batches, n, i, count, synced;
+  PROBE_ACTION (E_SNTP);
+  for (batches = 0; batches < SNTP_MAX_BATCHES; ++batches)
+    {
+      n = recv_batch (fd, &batch);
+      if (n <= 0)
+        {
+          if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            perror ("[event:%s] receiving SNTP requests", __func__);
+          break;
+        }
+      clock_gettime (CLOCK_REALTIME, &rx);
+      clock_gettime (CLOCK_MONOTONIC, &mono);
+      synced = sntp_prepare (state, &mono, &rx, prepared);
+      clock_gettime (CLOCK_REALTIME, &tx);
+      for (i = count = 0; i < n; ++i)
+        {
+          memcpy (batch.reply[i], prepared, SNTP_PACKET_LEN);
+          if (sntp_answer (batch.reply[i], batch.request[i], batch.len[i],
+                           &rx, &tx))
+            m->sntp_dropped++;
+          else
+            batch.out[count++] = i;
+        }
+      i = send_batch (fd, &batch, count);
+      m->sntp_dropped += count - i;
+      if (synced)
+        m->sntp_answered += i;
+      else
+        m->sntp_unsynced += i;
+      if (n < SNTP_BATCH)
+        break;
+    }
+}
+
+static int
+bind_sntp_socket (const char *address, int port, int any)
+{
+  struct addrinfo hints, *res;
+  char service[8];
+  int fd, err, buf = SNTP_RCVBUF;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  snprintf (service, sizeof (service), "%d", port);
+  if ((err = getaddrinfo (address, service, &hints, &res)))
+    {
+      error ("bad sntp-address '%s': %s", address, gai_strerror (err));
+      return -1;
+    }
+  fd = socket (res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+               0);
+  if (fd < 0)
+    {
+      freeaddrinfo (res);
+      return -1;
+    }
+  /* The IPv6 wildcard takes IPv4 clients too. */
+  if (any && res->ai_family == AF_INET6)
+    {
+      int off = 0;
+      setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof (off));
+    }
+  /* Room for bursts while the loop is busy with a sync. */
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof (buf));
+  if (bind (fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+      err = errno;
+      close (fd);
+      errno = err;
+      fd = -1;
+    }
+  freeaddrinfo (res);
+  return fd;
+}
+
+/* Must be called before privileges are dropped to use port 123. */
+int
+setup_sntp_server (struct state *state)
+{
+  const char *address = state->opts.sntp_address;
+  int port = state->opts.sntp_port;
+  int fd;
+  if (address)
+    fd = bind_sntp_socket (address, port, 0);
+  else if ((fd = bind_sntp_socket ("::", port, 1)) < 0)
+    fd = bind_sntp_socket ("0.0.0.0", port, 1);
+  if (fd < 0)
+    {
+      perror ("can't bind SNTP server to %s port %d",
+              address ? address : "*", port);
+      return 1;
+    }
+  state->events[E_SNTP] = event_new (state->base, fd, EV_READ|EV_PERSIST,
+                                     action_sntp_request, state);
+  if (!state->events[E_SNTP])
+    {
+      error ("Failed to allocate SNTP event");
+      close (fd);
+      return 1;
+    }
+  event_priority_set (state->events[E_SNTP], PRI_ANY);
+  event_add (state->events[E_SNTP], NULL);
+  info ("serving SNTP on %s port %d", address ? address : "*", port);
+  return 0;
+}
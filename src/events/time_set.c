@@ -24,6 +24,7 @@
 
 #include "src/conf.h"
 #include "src/dbus.h"
+#include "src/probes.h"
 #include "src/tlsdate.h"
 #include "src/util.h"
 
@@ -39,8 +40,10 @@ handle_time_setter (struct state *state, int status)
        */
       state->last_sync_type = SYNC_TYPE_RTC;
       state->last_time = time (NULL);
+      status_page_update (state);
       break;
     case SETTER_TIME_SET:
+      metrics_setter_done (&state->metrics);
       info ("[event:%s] time set from the %s (%ld)",
             __func__, sync_type_str (state->last_sync_type), state->last_time);
       if (state->last_sync_type == SYNC_TYPE_NET)
@@ -50,7 +53,13 @@ handle_time_setter (struct state *state, int status)
           check_continuity (&state->clock_delta);
           /* Reset the sources list! */
           state->opts.cur_source = NULL;
+          /* The clock can be trusted now; let waiting services start. */
+          end_fast_boot (state);
+          report_ready (state, "Synchronized to network time");
+          status_page_net_synced (state);
         }
+      else
+        status_page_update (state);
       /* Share our success. */
       if (state->opts.should_dbus)
         dbus_announce (state);
@@ -87,7 +96,9 @@ action_time_set (evutil_socket_t fd, short what, void *arg)
   int status = -1;
   ssize_t bytes = 0;
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_TIME_SET);
   bytes = IGNORE_EINTR (read (fd, &status, sizeof (status)));
+  trace_child (state, E_TIME_SET, state->setter_pid, status, 0);
   if (bytes == -1 && errno == EAGAIN)
     return;  /* Catch next wake up */
   /* Catch the rest of the errnos and any truncation. */
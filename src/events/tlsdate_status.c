@@ -9,8 +9,10 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -18,71 +20,198 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/ntp-shm.h"
+#include "src/peer.h"
+#include "src/probes.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
-/* Returns < 0 on error, > 0 on eagain, and 0 on success */
+/* Reads one response, leaving any after it on the pipe.
+ * Returns < 0 on error, > 0 on eagain, and 0 on success
+ */
 int
-read_tlsdate_response (int fd, time_t *t)
+read_tlsdate_response (int fd, union tlsdate_response *resp)
 {
-  /* TLS passes time as a 32-bit value. */
-  uint32_t server_time = 0;
-  ssize_t ret = IGNORE_EINTR (read (fd, &server_time, sizeof (server_time)));
+  struct tlsdate_sample *sample = &resp->sample;
+  const size_t head = sizeof (sample->time) + sizeof (sample->magic);
+  size_t len = 0;
+  ssize_t ret;
+  memset (resp, 0, sizeof (*resp));
+  /* Each response went out in one write(2) under PIPE_BUF, so all of it is
+   * there once its start is.  The magic after the first uint32_t says how
+   * long it is.
+   */
+  ret = IGNORE_EINTR (read (fd, resp, head));
   if (ret == -1 && errno == EAGAIN)
     {
       /* Full response isn't ready yet. */
       return 1;
     }
-  if (ret != sizeof (server_time))
+  /* TLS passes time as a 32-bit value (-Vraw), with nothing after it. */
+  if (ret == sizeof (sample->time))
+    return 0;
+  /* -Vsample appends the rest of a struct tlsdate_sample. */
+  if (ret == (ssize_t) head && sample->magic == TLSDATE_SAMPLE_MAGIC)
+    len = sizeof (*sample);
+  /* -Vnts writes what NTS-KE got instead. */
+  else if (ret == (ssize_t) head && resp->nts.magic == NTS_SESSION_MAGIC)
+    len = sizeof (resp->nts);
+  if (len)
     {
-      /* End of pipe (0) or truncated: death probable. */
-      error ("[event:(%s)] invalid time read from tlsdate (rd:%d,ret:%zd).",
-             __func__, server_time, ret);
-      return -1;
+      ret = IGNORE_EINTR (read (fd, (char *) resp + head, len - head));
+      if (ret == (ssize_t) (len - head))
+        return 0;
+      if (ret >= 0)
+        ret += head;
     }
-  /* uint32_t moves to signed long so there is room for silliness. */
-  *t = server_time;
-  return 0;
+  /* End of pipe (0) or truncated: death probable. */
+  error ("[event:(%s)] invalid time read from tlsdate (rd:%u,ret:%zd).",
+         __func__, sample->time, ret);
+  return -1;
 }
 
+/* Throws away whatever is waiting on the monitor pipe, once nothing on it
+ * can be wanted: the rest of a hedged attempt that has its time, or what
+ * runs of an earlier attempt left behind.
+ */
 void
-action_tlsdate_timeout (evutil_socket_t fd, short what, void *arg)
+drain_tlsdate_responses (struct state *state)
 {
-  struct state *state = arg;
-  info ("[event:%s] tlsdate timed out", __func__);
-  /* Force kill it and let action_sigchld rerun. */
-  if (state->tlsdate_pid)
-    kill (state->tlsdate_pid, SIGKILL);
+  char buf[PIPE_BUF];
+  int fd;
+  if (!state->events[E_TLSDATE_STATUS])
+    return;
+  fd = event_get_fd (state->events[E_TLSDATE_STATUS]);
+  while (IGNORE_EINTR (read (fd, buf, sizeof (buf))) > 0)
+    ;
+}
+
+/* The run in flight that wrote |resp|, or NULL if it is stale: from a run
+ * that was cancelled or has been reaped.  A response that doesn't say
+ * whose it is (-Vraw) goes to the run in flight.
+ */
+static struct tlsdate_run *
+response_run (struct state *state, const union tlsdate_response *resp)
+{
+  pid_t pid = 0;
+  struct tlsdate_run *run;
+  int i;
+  if (resp->sample.magic == TLSDATE_SAMPLE_MAGIC)
+    pid = (pid_t) resp->sample.pid;
+  else if (resp->nts.magic == NTS_SESSION_MAGIC)
+    pid = (pid_t) resp->nts.pid;
+  if (pid)
+    run = find_tlsdate_run (state, pid);
+  else
+    for (i = 0, run = NULL; i < MAX_TLSDATE_RUNS && !run; ++i)
+      if (state->runs[i].pid)
+        run = &state->runs[i];
+  if (!run || run->cancelled)
+    return NULL;
+  return run;
 }
 
 void
-action_tlsdate_status (evutil_socket_t fd, short what, void *arg)
+action_tlsdate_timeout (evutil_socket_t fd, short what, void *arg)
 {
   struct state *state = arg;
-  time_t t = 0;
-  int ret = read_tlsdate_response (fd, &t);
-  verb_debug ("[event:%s] fired", __func__);
-  if (ret < 0)
+  int i;
+  info ("[event:%s] tlsdate timed out", __func__);
+  PROBE_ACTION (E_TLSDATE_TIMEOUT);
+  trace_child (state, E_TLSDATE_TIMEOUT, state->runs[0].pid, 0, 0);
+  if (roughtime_pending (state))
     {
-      verb_debug ("[event:%s] forcibly timing out tlsdate", __func__);
-      trigger_event (state, E_TLSDATE_TIMEOUT, 0);
+      roughtime_time_out (state);
       return;
     }
-  if (ret)
+  if (nts_pending (state))
     {
-      /* EAGAIN'd: wait for the rest. */
-      trigger_event (state, E_TLSDATE_STATUS, -1);
+      nts_time_out (state);
       return;
     }
+  event_del (state->events[E_HEDGE]);
+  /* Force kill them and let action_sigchld rerun. */
+  for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
+    {
+      if (!state->runs[i].pid)
+        continue;
+      state->metrics.run_killed = 1;
+      kill (state->runs[i].pid, SIGKILL);
+    }
+}
+
+/* Learns from |sample| whether |src| puts its clock in server_random.
+ * Returns 1 if the time it gave came from there and can't be trusted; a
+ * retry is then under way, over HTTP if the source allows it, unless
+ * another run of the attempt is still out.
+ */
+static int
+check_server_random (struct state *state, struct source *src,
+                     const struct tlsdate_sample *sample)
+{
+  int http = sample->flags & TLSDATE_SAMPLE_HTTP;
+  struct timespec mono;
+  int was = src->random.kind;
+  int kind;
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  kind = random_time_observe (&src->random, sample->random_time, mono.tv_sec,
+                              http ? sample->time : 0);
+  if (kind != was)
+    info ("[event:%s] server_random from %s:%s carries %s", __func__,
+          src->host, src->port, random_kind_str (kind));
+  if (http || !random_kind_lacks_time (kind))
+    return 0;
+  metrics_run_failed (&state->metrics, F_NO_TIME);
+  /* This run is still counted until it is reaped. */
+  if (tlsdate_runs (state) > 1)
+    {
+      error ("[event:%s] %s:%s gave no time; waiting on the other run",
+             __func__, src->host, src->port);
+      charge_source (state, src);
+      return 1;
+    }
+  error ("[event:%s] %s:%s gave no time; %s", __func__, src->host, src->port,
+         source_uses_http (src) ? "retrying over HTTP" : "retrying");
+  schedule_tlsdate_retry (state, src);
+  return 1;
+}
+
+/* Takes the time from a run's |sample|, whatever the source; |src| is
+ * the source it came from, or NULL if that is no longer known.  Returns 1
+ * if the time was taken, 0 if it was turned down.
+ */
+int
+handle_tlsdate_sample (struct state *state, struct source *src,
+                       const struct tlsdate_sample *sample)
+{
+  /* uint32_t moves to signed long so there is room for silliness. */
+  time_t t = sample->time;
+  int taken = 0;
+  if (src && sample->magic == TLSDATE_SAMPLE_MAGIC &&
+      !(sample->flags & TLSDATE_SAMPLE_SUBSEC) &&
+      check_server_random (state, src, sample))
+    return 0;
   if (is_sane_time (t))
     {
       /* Note that last_time is from an online source */
       state->last_sync_type = SYNC_TYPE_NET;
       state->last_time = t;
+      metrics_run_succeeded (&state->metrics, t, sample);
+      ntp_shm_post (state->ntp_shm, t, sample);
+      peer_note_sample (state, src, sample);
+      if (src && sample->magic == TLSDATE_SAMPLE_MAGIC &&
+          !(sample->flags & TLSDATE_SAMPLE_SUBSEC))
+        {
+          struct timespec mono;
+          clock_gettime (CLOCK_MONOTONIC, &mono);
+          note_verified_chain (src, sample, mono.tv_sec);
+        }
       trigger_event (state, E_SAVE, -1);
+      taken = 1;
     }
   else
     {
+      metrics_run_failed (&state->metrics, F_INSANE_TIME);
       error ("[event:%s] invalid time received from tlsdate: %ld",
              __func__, t);
     }
@@ -91,7 +220,71 @@ action_tlsdate_status (evutil_socket_t fd, short what, void *arg)
    */
   state->tries = 0;
   state->backoff = state->opts.wait_between_tries;
-  return;
+  reset_source_tries (&state->opts);
+  if (state->peers)
+    state->peers->tried = 0;
+  return taken;
+}
+
+/* Acts on what the runs in flight have written to the monitor pipe, one
+ * response at a time, until it is empty or one of them fails to read.
+ * Stale responses are dropped.
+ */
+void
+take_tlsdate_responses (struct state *state)
+{
+  union tlsdate_response resp;
+  struct tlsdate_run *run;
+  int fd;
+  int ret;
+  if (!state->events[E_TLSDATE_STATUS])
+    return;
+  fd = event_get_fd (state->events[E_TLSDATE_STATUS]);
+  while (!(ret = read_tlsdate_response (fd, &resp)))
+    {
+      if (!(run = response_run (state, &resp)))
+        {
+          verb_debug ("[event:%s] dropping a response from a run that is "
+                      "over", __func__);
+          continue;
+        }
+      if (resp.nts.magic == NTS_SESSION_MAGIC)
+        {
+          nts_take_session (state, run->source, &resp.nts);
+          continue;
+        }
+      /* Credited to the run's own source: a hedge has moved on.  The
+       * first sample of a hedged attempt that is taken wins; one turned
+       * down leaves the other run to go on.
+       */
+      if (handle_tlsdate_sample (state, run->source, &resp.sample))
+        {
+          event_del (state->events[E_HEDGE]);
+          if (tlsdate_runs (state) > 1)
+            cancel_tlsdate_runs (state);
+        }
+      else if (tlsdate_runs (state) <= 1)
+        event_del (state->events[E_HEDGE]);
+    }
+  if (ret < 0)
+    {
+      metrics_run_failed (&state->metrics, F_BAD_RESPONSE);
+      verb_debug ("[event:%s] forcibly timing out tlsdate", __func__);
+      trigger_event (state, E_TLSDATE_TIMEOUT, 0);
+      return;
+    }
+  /* EAGAIN'd: wait for the rest. */
+  trigger_event (state, E_TLSDATE_STATUS, -1);
+}
+
+void
+action_tlsdate_status (evutil_socket_t fd, short what, void *arg)
+{
+  struct state *state = arg;
+  verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_TLSDATE_STATUS);
+  trace_event (state, E_TLSDATE_STATUS);
+  take_tlsdate_responses (state);
 }
 
 /* Returns 0 on success and populates |fds| */
@@ -144,5 +337,13 @@ setup_tlsdate_status (struct state *state)
       return 1;
     }
   event_priority_set (state->events[E_TLSDATE_TIMEOUT], PRI_SAVE);
+  state->events[E_HEDGE] = event_new (state->base, -1, EV_TIMEOUT,
+                                      action_hedge_tlsdate, state);
+  if (!state->events[E_HEDGE])
+    {
+      error ("Failed to allocate tlsdate hedge event");
+      return 1;
+    }
+  event_priority_set (state->events[E_HEDGE], PRI_NET);
   return 0;
 }
@@ -0,0 +1,300 @@
+/*
+ * helper-argv.c - tlsdate command line to tlsdate-helper argv
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Shared by the tlsdate wrapper and tlsdated, which runs the helper
+ * directly rather than paying for an extra exec through tlsdate.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/helper-argv.h"
+#include "src/tlsdate.h"
+
+const char *
+helper_phase_str (int phase)
+{
+  switch (phase)
+    {
+    case HELPER_RESOLVE:
+      return "resolve";
+    case HELPER_CONNECT:
+      return "connect";
+    case HELPER_PROXY:
+      return "proxy";
+    case HELPER_HANDSHAKE:
+      return "handshake";
+    case HELPER_HTTP:
+      return "http";
+    default:
+      return "unknown";
+    }
+}
+
+int
+helper_parse_deadlines (const char *s, double deadlines[HELPER_PHASES])
+{
+  int i;
+  for (i = 0; i < HELPER_PHASES; i++)
+    {
+      char *end;
+      deadlines[i] = strtod (s, &end);
+      if (end == s ||
+          !(deadlines[i] >= 0 && deadlines[i] <= HELPER_MAX_DEADLINE) ||
+          *end != (i + 1 < HELPER_PHASES ? ',' : '\0'))
+        return 1;
+      s = end + 1;
+    }
+  return 0;
+}
+
+static int
+base64_value (char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+int
+helper_parse_pin (const char *s, uint8_t digest[HELPER_PIN_DIGEST_LEN])
+{
+  uint32_t bits = 0;
+  int i, n = 0;
+  if (strncmp (s, HELPER_PIN_PREFIX, strlen (HELPER_PIN_PREFIX)))
+    return 1;
+  s += strlen (HELPER_PIN_PREFIX);
+  /* 32 bytes take 44 characters of base64, the last one padding. */
+  if (strlen (s) != 44 || s[43] != '=')
+    return 1;
+  for (i = 0; i < 43; i++)
+    {
+      int v = base64_value (s[i]);
+      if (v < 0)
+        return 1;
+      bits = bits << 6 | v;
+      if (i % 4 == 3)
+        {
+          digest[n++] = bits >> 16;
+          digest[n++] = bits >> 8;
+          digest[n++] = bits;
+          bits = 0;
+        }
+    }
+  /* Three characters left over: 18 bits, the last two unused. */
+  if (bits & 3)
+    return 1;
+  digest[n++] = bits >> 10;
+  digest[n++] = bits >> 2;
+  return 0;
+}
+
+int
+helper_parse_chain (const char *s, uint8_t digest[HELPER_CHAIN_DIGEST_LEN])
+{
+  int i;
+  if (strlen (s) != HELPER_CHAIN_HEX_LEN)
+    return 1;
+  for (i = 0; i < HELPER_CHAIN_DIGEST_LEN; i++)
+    {
+      char pair[3] = { s[2 * i], s[2 * i + 1], '\0' };
+      if (!isxdigit ((unsigned char) pair[0]) ||
+          !isxdigit ((unsigned char) pair[1]))
+        return 1;
+      digest[i] = strtoul (pair, NULL, 16);
+    }
+  return 0;
+}
+
+void
+helper_opts_init (struct helper_opts *opts)
+{
+  memset (opts, 0, sizeof (*opts));
+  opts->host = DEFAULT_HOST;
+  opts->port = DEFAULT_PORT;
+  opts->protocol = DEFAULT_PROTOCOL;
+  opts->ca_cert_container = DEFAULT_CERTFILE;
+  opts->helper = TLSDATE_HELPER;
+  opts->ca_racket = 1;
+  opts->setclock = 1;
+}
+
+int
+helper_opts_parse (struct helper_opts *opts, int argc, char **argv)
+{
+  static struct option long_options[] =
+  {
+    {"verbose", 0, 0, 'v'},
+    {"showtime", 2, 0, 'V'},
+    {"skip-verification", 0, 0, 's'},
+    {"help", 0, 0, 'h'},
+    {"host", 0, 0, 'H'},
+    {"port", 0, 0, 'p'},
+    {"protocol", 0, 0, 'P'},
+    {"dont-set-clock", 0, 0, 'n'},
+    {"certcontainer", 0, 0, 'C'},
+    {"timewarp", 0, 0, 't'},
+    {"leap", 0, 0, 'l'},
+    {"proxy", 0, 0, 'x'},
+    {"http", 0, 0, 'w'},
+    {"deadlines", 1, 0, 'd'},
+    {"pin", 1, 0, 'k'},
+    {"cached-chain", 1, 0, 'c'},
+    {"helper", 1, 0, 'e'},
+    {0, 0, 0, 0}
+  };
+  /* tlsdated parses a fresh command line for every run. */
+#ifdef __GLIBC__
+  optind = 0;
+#else
+  optind = 1;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+  optreset = 1;
+#endif
+#endif
+  while (1)
+    {
+      int option_index = 0;
+      int c;
+      c = getopt_long (argc, argv, "vV::shH:p:P:nC:tlx:wd:k:c:e:",
+                       long_options, &option_index);
+      if (c == -1)
+        break;
+      switch (c)
+        {
+        case 'v':
+          opts->verbose = 1;
+          break;
+        case 'V':
+          opts->showtime = 1;
+          if (optarg && 0 == strcmp ("raw", optarg))
+            opts->showtime = 2;
+          else if (optarg && 0 == strcmp ("sample", optarg))
+            opts->showtime = 3;
+          else if (optarg && 0 == strcmp ("nts", optarg))
+            opts->showtime = 4;
+          break;
+        case 's':
+          opts->ca_racket = 0;
+          break;
+        case 'h':
+          opts->help = 1;
+          break;
+        case 'H':
+          opts->host = optarg;
+          break;
+        case 'p':
+          opts->port = optarg;
+          break;
+        case 'P':
+          opts->protocol = optarg;
+          break;
+        case 'n':
+          opts->setclock = 0;
+          break;
+        case 'C':
+          opts->ca_cert_container = optarg;
+          break;
+        case 't':
+          opts->timewarp = 1;
+          break;
+        case 'l':
+          opts->leap = 1;
+          break;
+        case 'x':
+          opts->proxy = optarg;
+          break;
+        case 'w':
+          opts->http = 1;
+          break;
+        case 'd':
+          {
+            double deadlines[HELPER_PHASES];
+            if (helper_parse_deadlines (optarg, deadlines) ||
+                snprintf (opts->deadlines, sizeof (opts->deadlines), "%s%s",
+                          HELPER_DEADLINES_WORD, optarg)
+                >= (int) sizeof (opts->deadlines))
+              return 1;
+          }
+          break;
+        case 'k':
+          {
+            uint8_t digest[HELPER_PIN_DIGEST_LEN];
+            if (helper_parse_pin (optarg, digest) ||
+                snprintf (opts->pin, sizeof (opts->pin), "%s%s",
+                          HELPER_PIN_WORD, optarg)
+                >= (int) sizeof (opts->pin))
+              return 1;
+          }
+          break;
+        case 'c':
+          {
+            uint8_t digest[HELPER_CHAIN_DIGEST_LEN];
+            if (helper_parse_chain (optarg, digest) ||
+                snprintf (opts->chain, sizeof (opts->chain), "%s%s",
+                          HELPER_CHAIN_WORD, optarg)
+                >= (int) sizeof (opts->chain))
+              return 1;
+          }
+          break;
+        case 'e':
+          opts->helper = optarg;
+          break;
+        case '?':
+          break;
+        default:
+          return 1;
+        }
+    }
+  return 0;
+}
+
+void
+helper_argv (const struct helper_opts *opts, const char *ids,
+             char *argv[HELPER_MAX_ARGC + 1])
+{
+  int i = 0;
+  argv[i++] = (char *) "tlsdate";
+  argv[i++] = (char *) opts->host;
+  argv[i++] = (char *) opts->port;
+  argv[i++] = (char *) opts->protocol;
+  argv[i++] = (char *) (opts->ca_racket ? "racket" : "unchecked");
+  argv[i++] = (char *) (opts->verbose ? "verbose" : "quiet");
+  argv[i++] = (char *) opts->ca_cert_container;
+  argv[i++] = (char *) (opts->setclock ? "setclock" : "dont-set-clock");
+  argv[i++] = (char *) (opts->showtime == 4 ? "showtime=nts" :
+                        opts->showtime == 3 ? "showtime=sample" :
+                        opts->showtime == 2 ? "showtime=raw" :
+                        opts->showtime ? "showtime" : "no-showtime");
+  argv[i++] = (char *) (opts->timewarp ? "timewarp" : "no-fun");
+  argv[i++] = (char *) (opts->leap ? "leapaway" : "holdfast");
+  argv[i++] = (char *) (opts->proxy ? opts->proxy : "none");
+  argv[i++] = (char *) (opts->http ? "http" : "tls");
+  if (ids)
+    argv[i++] = (char *) ids;
+  if (opts->deadlines[0])
+    argv[i++] = (char *) opts->deadlines;
+  if (opts->pin[0])
+    argv[i++] = (char *) opts->pin;
+  if (opts->chain[0])
+    argv[i++] = (char *) opts->chain;
+  argv[i] = NULL;
+}
@@ -0,0 +1,130 @@
+/*
+ * helper-argv.h - tlsdate command line to tlsdate-helper argv
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef HELPER_ARGV_H
+#define HELPER_ARGV_H
+
+#include <stdint.h>
+
+/* tlsdate-helper takes its options positionally: argv[0] plus 12 words,
+ * then optionally "ids=UID:GID" naming the unprivileged user,
+ * "deadlines=..." bounding each phase of the fetch, "pin=sha256/..."
+ * naming the key to trust and "chain=..." naming a chain already
+ * verified, in any order.
+ */
+#define HELPER_ARGC 13
+#define HELPER_MAX_ARGC (HELPER_ARGC + 4)
+
+/* The phases of a fetch the helper gives their own deadlines. */
+enum helper_phase_t
+{
+  HELPER_RESOLVE = 0,
+  HELPER_CONNECT,
+  HELPER_PROXY,
+  HELPER_HANDSHAKE,
+  HELPER_HTTP,       /* the HTTP Date header, or the NTS-KE exchange */
+  HELPER_PHASES
+};
+
+#define HELPER_DEADLINES_WORD "deadlines="
+#define HELPER_DEADLINES_LEN 64
+#define HELPER_MAX_DEADLINE 3600  /* seconds */
+
+/* The helper's own exit statuses: verdicts on the server from 38 up, and
+ * deadlines from HELPER_DEADLINE_EXIT up, one per phase.  The ranges are
+ * kept apart so no phase, or a stray -1, can be read as a verdict.
+ */
+
+/* The helper exits with this when the server's certificate is refused, so
+ * there is no point asking that server again soon.
+ */
+#define HELPER_BAD_CERT_EXIT 38
+
+/* The helper exits with this when server_random holds no sane time and it
+ * had nothing else to check certificates against.
+ */
+#define HELPER_FALSE_TICKER_EXIT 39
+
+/* The helper exits with this plus the phase whose deadline ran out. */
+#define HELPER_DEADLINE_EXIT 50
+
+#if HELPER_DEADLINE_EXIT <= HELPER_FALSE_TICKER_EXIT + 1 || \
+    HELPER_DEADLINE_EXIT <= HELPER_BAD_CERT_EXIT + 1
+#error "the helper's deadline exit statuses overlap its verdicts"
+#endif
+
+/* The phase the helper ran out of time in, from its exit status, or -1. */
+static inline int helper_deadline_phase (int status)
+{
+  if (status < HELPER_DEADLINE_EXIT ||
+      status >= HELPER_DEADLINE_EXIT + HELPER_PHASES)
+    return -1;
+  return status - HELPER_DEADLINE_EXIT;
+}
+
+#define HELPER_PIN_WORD "pin="
+#define HELPER_PIN_PREFIX "sha256/"
+#define HELPER_PIN_LEN 64
+#define HELPER_PIN_DIGEST_LEN 32
+
+#define HELPER_CHAIN_WORD "chain="
+#define HELPER_CHAIN_DIGEST_LEN 32  /* a SHA-256 */
+#define HELPER_CHAIN_HEX_LEN (2 * HELPER_CHAIN_DIGEST_LEN)
+#define HELPER_CHAIN_LEN 80
+
+struct helper_opts
+{
+  const char *host;
+  const char *port;
+  const char *protocol;
+  const char *ca_cert_container;
+  const char *proxy;
+  const char *helper;  /* the tlsdate-helper to run */
+  int verbose;
+  int ca_racket;
+  int showtime;  /* 0 none, 1 human, 2 raw, 3 sample, 4 nts */
+  int setclock;
+  int timewarp;
+  int leap;
+  int http;
+  int help;
+  /* HELPER_DEADLINES_WORD and the list, or empty for no deadlines. */
+  char deadlines[HELPER_DEADLINES_LEN];
+  /* HELPER_PIN_WORD and the pin, or empty to trust the CA store. */
+  char pin[HELPER_PIN_LEN];
+  /* HELPER_CHAIN_WORD and the hash, or empty to verify in full. */
+  char chain[HELPER_CHAIN_LEN];
+};
+
+const char *helper_phase_str (int phase);
+/* Reads |s|, seconds for each phase in order separated by commas, into
+ * |deadlines|; 0 leaves a phase unbounded.  Returns 0 on success.
+ */
+int helper_parse_deadlines (const char *s, double deadlines[HELPER_PHASES]);
+/* Reads |s|, "sha256/" and the base64 SHA-256 of a SubjectPublicKeyInfo,
+ * into |digest|.  Returns 0 on success.
+ */
+int helper_parse_pin (const char *s, uint8_t digest[HELPER_PIN_DIGEST_LEN]);
+/* Reads |s|, the SHA-256 of a certificate chain in hex, into |digest|.
+ * Returns 0 on success.
+ */
+int helper_parse_chain (const char *s,
+                        uint8_t digest[HELPER_CHAIN_DIGEST_LEN]);
+
+void helper_opts_init (struct helper_opts *opts);
+/* Parses tlsdate's own command line.  Returns 0 on success, 1 for an
+ * unknown option.
+ */
+int helper_opts_parse (struct helper_opts *opts, int argc, char **argv);
+/* Fills |argv| (HELPER_MAX_ARGC + 1 entries) for execv()ing the helper.
+ * |ids| is the "ids=UID:GID" word or NULL.  Strings point into |opts|
+ * and static storage.
+ */
+void helper_argv (const struct helper_opts *opts, const char *ids,
+                  char *argv[HELPER_MAX_ARGC + 1]);
+
+#endif /* HELPER_ARGV_H */
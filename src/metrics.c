@@ -0,0 +1,530 @@
+/*
+ * metrics.c - tlsdated counters and histograms
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Recording is a handful of integer and double updates on fixed-size
+ * storage in struct state, so it is safe to do from any event handler.
+ * Rendering to the Prometheus text format only happens when someone
+ * connects to the metrics socket (see events/metrics_request.c).
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "src/helper-argv.h"
+#include "src/metrics.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+/* Upper bounds in seconds. */
+static const double kLatencyBounds[] =
+{
+  0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+  0.25, 0.5, 1, 2.5, 5, 10
+};
+static const double kRttBounds[] =
+{
+  0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2, 5, 10, 30
+};
+static const double kOffsetBounds[] =
+{
+  0.5, 1, 2, 5, 10, 30, 60, 300, 3600, 86400
+};
+static const double kCpuBounds[] =
+{
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1
+};
+/* Bytes. */
+static const double kRssBounds[] =
+{
+  1 << 20, 2 << 20, 4 << 20, 8 << 20, 16 << 20, 32 << 20, 64 << 20, 128 << 20
+};
+
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof ((a)[0]))
+
+static void
+histogram_init (struct histogram *h, const double *bounds, int nbounds)
+{
+  memset (h, 0, sizeof (*h));
+  h->bounds = bounds;
+  h->nbounds = min (nbounds, METRICS_MAX_BUCKETS);
+}
+
+void
+metrics_init (struct metrics *m)
+{
+  memset (m, 0, sizeof (*m));
+  histogram_init (&m->spawn_latency, kLatencyBounds,
+                  ARRAY_SIZE (kLatencyBounds));
+  histogram_init (&m->handshake_rtt, kRttBounds, ARRAY_SIZE (kRttBounds));
+  histogram_init (&m->sync_duration, kRttBounds, ARRAY_SIZE (kRttBounds));
+  histogram_init (&m->sync_offset, kOffsetBounds, ARRAY_SIZE (kOffsetBounds));
+  histogram_init (&m->child_cpu, kCpuBounds, ARRAY_SIZE (kCpuBounds));
+  histogram_init (&m->child_rss, kRssBounds, ARRAY_SIZE (kRssBounds));
+  histogram_init (&m->connect_latency, kLatencyBounds,
+                  ARRAY_SIZE (kLatencyBounds));
+  histogram_init (&m->tls_handshake, kLatencyBounds,
+                  ARRAY_SIZE (kLatencyBounds));
+  histogram_init (&m->verify_latency, kLatencyBounds,
+                  ARRAY_SIZE (kLatencyBounds));
+  histogram_init (&m->delivery, kLatencyBounds, ARRAY_SIZE (kLatencyBounds));
+  histogram_init (&m->setter_latency, kLatencyBounds,
+                  ARRAY_SIZE (kLatencyBounds));
+}
+
+/* Buckets are stored individually and accumulated by metrics_render(). */
+void
+metrics_observe (struct histogram *h, double value)
+{
+  int i;
+  for (i = 0; i < h->nbounds; ++i)
+    {
+      if (value <= h->bounds[i])
+        {
+          h->buckets[i]++;
+          break;
+        }
+    }
+  h->count++;
+  h->sum += value;
+}
+
+static double
+timespec_diff (const struct timespec *end, const struct timespec *start)
+{
+  return (end->tv_sec - start->tv_sec) +
+         (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint64_t
+timespec_ns (const struct timespec *ts)
+{
+  return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+/* Observes |end| - |start| nanoseconds if both are known and in order. */
+static void
+observe_phase (struct histogram *h, uint64_t start, uint64_t end)
+{
+  if (start && end >= start)
+    metrics_observe (h, (end - start) / 1e9);
+}
+
+static double
+timeval_secs (const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* |before| and |after| bracket the fork() of tlsdate. */
+void
+metrics_run_started (struct metrics *m, const struct timespec *before,
+                     const struct timespec *after)
+{
+  m->attempts++;
+  m->run_failed = 0;
+  m->run_killed = 0;
+  m->run_start = *before;
+  /* Nothing is spawned for a Roughtime source. */
+  if (after)
+    metrics_observe (&m->spawn_latency, timespec_diff (after, before));
+}
+
+/* A second run in the same attempt; run_start stays with the first, so
+ * sync_duration is what the attempt as a whole took.
+ */
+void
+metrics_hedge_started (struct metrics *m, const struct timespec *before,
+                       const struct timespec *after)
+{
+  m->hedges++;
+  metrics_observe (&m->spawn_latency, timespec_diff (after, before));
+}
+
+void
+metrics_run_failed (struct metrics *m, enum metrics_failure_t cause)
+{
+  if (cause < 0 || cause >= F_MAX)
+    return;
+  m->failures[cause]++;
+  m->run_failed = 1;
+}
+
+void
+metrics_run_succeeded (struct metrics *m, time_t t,
+                       const struct tlsdate_sample *sample)
+{
+  struct timespec now, real;
+  double offset;
+  if (clock_gettime (CLOCK_MONOTONIC, &now) < 0 ||
+      clock_gettime (CLOCK_REALTIME, &real) < 0)
+    return;
+  m->successes++;
+  m->last_net_sync = now;
+  metrics_observe (&m->sync_duration, timespec_diff (&now, &m->run_start));
+  offset = t - (real.tv_sec + real.tv_nsec / 1e9);
+  /* Without a sample, the whole run bounds the round trip. */
+  m->last_rtt = timespec_diff (&now, &m->run_start);
+  m->last_radius = 0;
+  if (sample && sample->magic == TLSDATE_SAMPLE_MAGIC)
+    {
+      m->last_rtt = sample->rtt_ms / 1000.0;
+      if (sample->flags & TLSDATE_SAMPLE_CHAIN_CACHED)
+        m->chain_cache_hits++;
+      metrics_observe (&m->handshake_rtt, sample->rtt_ms / 1000.0);
+      /* The server stamped its time roughly half a round trip ago. */
+      offset += sample->rtt_ms / 2000.0;
+      if (sample->flags & TLSDATE_SAMPLE_SUBSEC)
+        {
+          offset += sample->usec / 1e6;
+          m->last_radius = sample->radius_us / 1e6;
+        }
+      /* The helper stamps the same CLOCK_MONOTONIC we do. */
+      if (sample->connected_ns)
+        observe_phase (&m->connect_latency, timespec_ns (&m->run_start),
+                       sample->connected_ns);
+      observe_phase (&m->tls_handshake, sample->connected_ns,
+                     sample->handshake_ns);
+      observe_phase (&m->verify_latency, sample->handshake_ns,
+                     sample->verified_ns);
+      observe_phase (&m->delivery, sample->sent_ns, timespec_ns (&now));
+    }
+  m->last_offset = offset;
+  metrics_observe (&m->sync_offset, offset < 0 ? -offset : offset);
+}
+
+void
+metrics_peer_succeeded (struct metrics *m, time_t t, double rtt)
+{
+  struct timespec real;
+  if (clock_gettime (CLOCK_MONOTONIC, &m->last_net_sync) < 0 ||
+      clock_gettime (CLOCK_REALTIME, &real) < 0)
+    return;
+  m->peer_accepted++;
+  m->last_rtt = rtt;
+  m->last_offset = t - (real.tv_sec + real.tv_nsec / 1e9);
+  metrics_observe (&m->sync_offset,
+                   m->last_offset < 0 ? -m->last_offset : m->last_offset);
+}
+
+static void
+observe_usage (struct metrics *m, const struct rusage *usage)
+{
+  double user, sys;
+  if (!usage)
+    return;
+  user = timeval_secs (&usage->ru_utime);
+  sys = timeval_secs (&usage->ru_stime);
+  metrics_observe (&m->child_cpu, user + sys);
+  /* Linux reports ru_maxrss in kilobytes. */
+  metrics_observe (&m->child_rss, usage->ru_maxrss * 1024.0);
+  m->child_user_cpu += user;
+  m->child_sys_cpu += sys;
+}
+
+/* Called once tlsdate has been reaped.  |usage| is that run's own
+ * resource usage from wait4(), or NULL if it is not known.  run_killed
+ * stays set until the next attempt: E_TLSDATE_TIMEOUT kills every run.
+ */
+void
+metrics_child_reaped (struct metrics *m, const siginfo_t *info,
+                      const struct rusage *usage)
+{
+  observe_usage (m, usage);
+  if (!m->run_failed)
+    {
+      if (info->si_code == CLD_EXITED)
+        {
+          int phase = helper_deadline_phase (info->si_status);
+          if (phase >= 0)
+            metrics_run_failed (m, F_RESOLVE_TIMEOUT + phase);
+          else if (info->si_status == HELPER_FALSE_TICKER_EXIT)
+            metrics_run_failed (m, F_NO_TIME);
+          else if (info->si_status == HELPER_BAD_CERT_EXIT)
+            metrics_run_failed (m, F_BAD_CERT);
+          else if (info->si_status != 0)
+            metrics_run_failed (m, F_EXIT);
+        }
+      else
+        {
+          metrics_run_failed (m, m->run_killed ? F_TIMEOUT : F_SIGNAL);
+        }
+    }
+  m->run_failed = 0;
+}
+
+void
+metrics_child_cancelled (struct metrics *m, const struct rusage *usage)
+{
+  observe_usage (m, usage);
+}
+
+/* Interpolates within the bucket the quantile falls in, as Prometheus'
+ * histogram_quantile() does; past the last bound, that bound is the answer.
+ */
+double
+metrics_quantile (const struct histogram *h, double q)
+{
+  double rank = q * h->count;
+  double lower = 0;
+  uint64_t seen = 0;
+  int i;
+  if (!h->count)
+    return 0;
+  for (i = 0; i < h->nbounds; ++i)
+    {
+      if (seen + h->buckets[i] >= rank && h->buckets[i])
+        return lower + (h->bounds[i] - lower) *
+               (rank - seen) / h->buckets[i];
+      seen += h->buckets[i];
+      lower = h->bounds[i];
+    }
+  return h->nbounds ? h->bounds[h->nbounds - 1] : 0;
+}
+
+/* Brackets one write to the time setter and its acknowledgement. */
+void
+metrics_setter_sent (struct metrics *m)
+{
+  if (clock_gettime (CLOCK_MONOTONIC, &m->setter_sent) < 0)
+    memset (&m->setter_sent, 0, sizeof (m->setter_sent));
+}
+
+void
+metrics_setter_done (struct metrics *m)
+{
+  struct timespec now;
+  if (!m->setter_sent.tv_sec)
+    return;
+  if (!clock_gettime (CLOCK_MONOTONIC, &now))
+    metrics_observe (&m->setter_latency, timespec_diff (&now, &m->setter_sent));
+  memset (&m->setter_sent, 0, sizeof (m->setter_sent));
+}
+
+const char *
+metrics_failure_str (enum metrics_failure_t cause)
+{
+  switch (cause)
+    {
+    case F_LAUNCH:
+      return "launch";
+    case F_TIMEOUT:
+      return "timeout";
+    case F_EXIT:
+      return "exit";
+    case F_SIGNAL:
+      return "signal";
+    case F_BAD_RESPONSE:
+      return "bad-response";
+    case F_INSANE_TIME:
+      return "insane-time";
+    case F_NO_TIME:
+      return "no-time";
+    case F_BAD_CERT:
+      return "bad-cert";
+    case F_RESOLVE_TIMEOUT:
+      return "resolve-timeout";
+    case F_CONNECT_TIMEOUT:
+      return "connect-timeout";
+    case F_PROXY_TIMEOUT:
+      return "proxy-timeout";
+    case F_HANDSHAKE_TIMEOUT:
+      return "handshake-timeout";
+    case F_HTTP_TIMEOUT:
+      return "http-timeout";
+    default:
+      return "error";
+    }
+}
+
+struct metrics_out
+{
+  char *buf;
+  size_t len;
+  size_t used;
+  int truncated;
+};
+
+static void
+emit (struct metrics_out *out, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+  if (out->truncated)
+    return;
+  va_start (ap, fmt);
+  n = vsnprintf (out->buf + out->used, out->len - out->used, fmt, ap);
+  va_end (ap);
+  if (n < 0 || (size_t) n >= out->len - out->used)
+    {
+      out->truncated = 1;
+      return;
+    }
+  out->used += n;
+}
+
+static void
+emit_histogram (struct metrics_out *out, const char *name, const char *help,
+                const struct histogram *h)
+{
+  uint64_t cumulative = 0;
+  int i;
+  emit (out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (i = 0; i < h->nbounds; ++i)
+    {
+      cumulative += h->buckets[i];
+      emit (out, "%s_bucket{le=\"%g\"} %llu\n", name, h->bounds[i],
+            (unsigned long long) cumulative);
+    }
+  emit (out, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+        (unsigned long long) h->count);
+  emit (out, "%s_sum %.9g\n%s_count %llu\n", name, h->sum, name,
+        (unsigned long long) h->count);
+}
+
+static void
+emit_gauge (struct metrics_out *out, const char *name, const char *help,
+            double value)
+{
+  emit (out, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+  /* printf spells it "nan"; the exposition format wants "NaN". */
+  if (value != value)
+    emit (out, "%s NaN\n", name);
+  else
+    emit (out, "%s %.9g\n", name, value);
+}
+
+/* Renders the Prometheus text exposition format into |buf|.
+ * Returns the number of bytes used, or -1 if |buf| was too small.
+ */
+int
+metrics_render (struct state *state, char *buf, size_t len)
+{
+  static const int kSyncTypes[] =
+  {
+    SYNC_TYPE_NONE, SYNC_TYPE_BUILD, SYNC_TYPE_DISK, SYNC_TYPE_RTC,
+    SYNC_TYPE_PLATFORM, SYNC_TYPE_NET
+  };
+  const struct metrics *m = &state->metrics;
+  struct metrics_out out = { buf, len, 0, 0 };
+  struct timespec now;
+  double age = NAN;
+  size_t i;
+  if (m->last_net_sync.tv_sec && !clock_gettime (CLOCK_MONOTONIC, &now))
+    age = timespec_diff (&now, &m->last_net_sync);
+  emit_histogram (&out, "tlsdated_spawn_latency_seconds",
+                  "Time spent forking tlsdate.", &m->spawn_latency);
+  emit_histogram (&out, "tlsdated_handshake_rtt_seconds",
+                  "Connect and handshake round trip reported by tlsdate.",
+                  &m->handshake_rtt);
+  emit_histogram (&out, "tlsdated_sync_duration_seconds",
+                  "Time from spawning tlsdate to reading its response.",
+                  &m->sync_duration);
+  emit_histogram (&out, "tlsdated_sync_offset_seconds",
+                  "Absolute offset between network and local time per sync.",
+                  &m->sync_offset);
+  emit_histogram (&out, "tlsdated_child_cpu_seconds",
+                  "User and system CPU time used per tlsdate run.",
+                  &m->child_cpu);
+  emit_histogram (&out, "tlsdated_child_peak_rss_bytes",
+                  "Peak resident set size per tlsdate run.", &m->child_rss);
+  emit_histogram (&out, "tlsdated_connect_latency_seconds",
+                  "Time from spawning tlsdate to its TCP connection.",
+                  &m->connect_latency);
+  emit_histogram (&out, "tlsdated_tls_handshake_seconds",
+                  "Time from TCP connection to completed TLS handshake.",
+                  &m->tls_handshake);
+  emit_histogram (&out, "tlsdated_verify_seconds",
+                  "Time spent verifying the server certificate.",
+                  &m->verify_latency);
+  emit_histogram (&out, "tlsdated_delivery_seconds",
+                  "Time from tlsdate writing its sample to reading it.",
+                  &m->delivery);
+  emit_histogram (&out, "tlsdated_setter_latency_seconds",
+                  "Time from sending a time to the setter to its reply.",
+                  &m->setter_latency);
+  emit (&out, "# HELP tlsdated_attempts_total tlsdate runs spawned.\n"
+        "# TYPE tlsdated_attempts_total counter\n"
+        "tlsdated_attempts_total %llu\n", (unsigned long long) m->attempts);
+  emit (&out, "# HELP tlsdated_hedges_total Second tlsdate runs started "
+        "against a slow first.\n"
+        "# TYPE tlsdated_hedges_total counter\n"
+        "tlsdated_hedges_total %llu\n", (unsigned long long) m->hedges);
+  emit (&out, "# HELP tlsdated_chain_cache_hits_total tlsdate runs whose "
+        "chain matched one verified before.\n"
+        "# TYPE tlsdated_chain_cache_hits_total counter\n"
+        "tlsdated_chain_cache_hits_total %llu\n",
+        (unsigned long long) m->chain_cache_hits);
+  emit (&out, "# HELP tlsdated_successes_total tlsdate runs that returned "
+        "a sane time.\n"
+        "# TYPE tlsdated_successes_total counter\n"
+        "tlsdated_successes_total %llu\n", (unsigned long long) m->successes);
+  emit (&out, "# HELP tlsdated_failures_total Failed tlsdate runs by cause.\n"
+        "# TYPE tlsdated_failures_total counter\n");
+  for (i = 0; i < F_MAX; ++i)
+    emit (&out, "tlsdated_failures_total{cause=\"%s\"} %llu\n",
+          metrics_failure_str (i), (unsigned long long) m->failures[i]);
+  emit (&out, "# HELP tlsdated_config_reloads_total Config reloads by "
+        "result.\n"
+        "# TYPE tlsdated_config_reloads_total counter\n"
+        "tlsdated_config_reloads_total{result=\"ok\"} %llu\n"
+        "tlsdated_config_reloads_total{result=\"error\"} %llu\n",
+        (unsigned long long) m->config_reloads,
+        (unsigned long long) m->config_reload_failures);
+  emit (&out, "# HELP tlsdated_sntp_requests_total SNTP requests by "
+        "outcome.\n"
+        "# TYPE tlsdated_sntp_requests_total counter\n"
+        "tlsdated_sntp_requests_total{result=\"synced\"} %llu\n"
+        "tlsdated_sntp_requests_total{result=\"unsynced\"} %llu\n"
+        "tlsdated_sntp_requests_total{result=\"dropped\"} %llu\n",
+        (unsigned long long) m->sntp_answered,
+        (unsigned long long) m->sntp_unsynced,
+        (unsigned long long) m->sntp_dropped);
+  emit (&out, "# HELP tlsdated_peer_samples_total Samples shared with "
+        "peers.\n"
+        "# TYPE tlsdated_peer_samples_total counter\n"
+        "tlsdated_peer_samples_total{result=\"accepted\"} %llu\n"
+        "tlsdated_peer_samples_total{result=\"rejected\"} %llu\n"
+        "tlsdated_peer_samples_total{result=\"answered\"} %llu\n",
+        (unsigned long long) m->peer_accepted,
+        (unsigned long long) m->peer_rejected,
+        (unsigned long long) m->peer_answered);
+  emit (&out, "# HELP tlsdated_child_cpu_seconds_total CPU time of reaped "
+        "children.\n"
+        "# TYPE tlsdated_child_cpu_seconds_total counter\n"
+        "tlsdated_child_cpu_seconds_total{mode=\"user\"} %.6f\n"
+        "tlsdated_child_cpu_seconds_total{mode=\"system\"} %.6f\n",
+        m->child_user_cpu, m->child_sys_cpu);
+  emit_gauge (&out, "tlsdated_backoff_seconds",
+              "Delay before the next retry.", state->backoff);
+  emit_gauge (&out, "tlsdated_tries", "Attempts in the current sync.",
+              state->tries);
+  emit_gauge (&out, "tlsdated_running", "Whether tlsdate is running.",
+              state->running);
+  emit_gauge (&out, "tlsdated_tlsdate_runs", "tlsdate runs in flight.",
+              tlsdate_runs (state));
+  emit_gauge (&out, "tlsdated_last_offset_seconds",
+              "Signed offset (server - local) of the last sync.",
+              m->last_offset);
+  emit_gauge (&out, "tlsdated_last_network_sync_age_seconds",
+              "Time since the last network sync.", age);
+  emit (&out, "# HELP tlsdated_last_sync_type Source of the current time.\n"
+        "# TYPE tlsdated_last_sync_type gauge\n");
+  for (i = 0; i < ARRAY_SIZE (kSyncTypes); ++i)
+    emit (&out, "tlsdated_last_sync_type{type=\"%s\"} %d\n",
+          sync_type_str (kSyncTypes[i]),
+          state->last_sync_type == kSyncTypes[i]);
+  if (out.truncated)
+    return -1;
+  return out.used;
+}
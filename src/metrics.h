@@ -0,0 +1,118 @@
+/*
+ * metrics.h - tlsdated counters and histograms
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "src/sample.h"
+
+/* Why a tlsdate run did not yield a usable time. */
+enum metrics_failure_t
+{
+  F_LAUNCH = 0,    /* tlsdate could not be spawned */
+  F_TIMEOUT,       /* killed by E_TLSDATE_TIMEOUT */
+  F_EXIT,          /* exited with a non-zero status */
+  F_SIGNAL,        /* killed by a signal we didn't send */
+  F_BAD_RESPONSE,  /* truncated response on the monitor pipe */
+  F_INSANE_TIME,   /* response failed is_sane_time() */
+  F_NO_TIME,       /* the source's server_random carries no time */
+  F_BAD_CERT,      /* the source's certificate was refused */
+  /* The helper ran out of time in one phase; in enum helper_phase_t order. */
+  F_RESOLVE_TIMEOUT,
+  F_CONNECT_TIMEOUT,
+  F_PROXY_TIMEOUT,
+  F_HANDSHAKE_TIMEOUT,
+  F_HTTP_TIMEOUT,
+  F_MAX
+};
+
+#define METRICS_MAX_BUCKETS 16
+
+/* Cumulative histogram in the Prometheus sense; |bounds| are upper bounds. */
+struct histogram
+{
+  const double *bounds;
+  int nbounds;
+  uint64_t buckets[METRICS_MAX_BUCKETS];
+  uint64_t count;
+  double sum;
+};
+
+/* Everything in here is fixed-size so recording never allocates. */
+struct metrics
+{
+  struct histogram spawn_latency;   /* seconds spent in fork() */
+  struct histogram handshake_rtt;   /* seconds, as reported by the helper */
+  struct histogram sync_duration;   /* seconds from spawn to response */
+  struct histogram sync_offset;     /* |server - local| seconds */
+  struct histogram child_cpu;       /* user+sys seconds per tlsdate run */
+  struct histogram child_rss;       /* peak RSS bytes per tlsdate run */
+  /* Phases of a run, from the CLOCK_MONOTONIC stamps in the sample. */
+  struct histogram connect_latency; /* spawn to TCP connected */
+  struct histogram tls_handshake;   /* TCP connected to handshake done */
+  struct histogram verify_latency;  /* handshake done to verified */
+  struct histogram delivery;        /* sample written to sample read */
+  struct histogram setter_latency;  /* time sent to setter to acked */
+  uint64_t attempts;
+  uint64_t hedges;                  /* second runs started within an attempt */
+  uint64_t chain_cache_hits;        /* runs that skipped the CA store */
+  uint64_t successes;
+  uint64_t failures[F_MAX];
+  uint64_t config_reloads;
+  uint64_t config_reload_failures;
+  uint64_t sntp_answered;           /* SNTP replies while synchronized */
+  uint64_t sntp_unsynced;           /* ...and while not */
+  uint64_t sntp_dropped;            /* malformed or unsendable */
+  uint64_t peer_accepted;           /* samples taken from peers */
+  uint64_t peer_rejected;
+  uint64_t peer_answered;           /* our samples handed to peers */
+  double last_offset;
+  double last_rtt;                  /* seconds; of the last good run */
+  double last_radius;               /* seconds; a Roughtime server's own */
+  double child_user_cpu;            /* totals over reaped tlsdate runs */
+  double child_sys_cpu;
+  struct timespec run_start;        /* CLOCK_MONOTONIC at spawn */
+  struct timespec last_net_sync;    /* CLOCK_MONOTONIC; zero if never */
+  struct timespec setter_sent;      /* CLOCK_MONOTONIC; zero if idle */
+  int run_failed;                   /* a failure was already counted */
+  int run_killed;                   /* E_TLSDATE_TIMEOUT sent SIGKILL */
+};
+
+/* Largest response served on the metrics socket. */
+#define METRICS_MAX_RESPONSE 32768
+
+struct rusage;
+struct state;
+
+void metrics_init (struct metrics *m);
+void metrics_observe (struct histogram *h, double value);
+void metrics_run_started (struct metrics *m, const struct timespec *before,
+                          const struct timespec *after);
+void metrics_run_failed (struct metrics *m, enum metrics_failure_t cause);
+void metrics_run_succeeded (struct metrics *m, time_t t,
+                            const struct tlsdate_sample *sample);
+/* |rtt| covers both our round trip to the peer and the peer's own. */
+void metrics_peer_succeeded (struct metrics *m, time_t t, double rtt);
+void metrics_hedge_started (struct metrics *m, const struct timespec *before,
+                            const struct timespec *after);
+void metrics_child_reaped (struct metrics *m, const siginfo_t *info,
+                           const struct rusage *usage);
+/* A run that lost to a hedge: only its resource usage counts. */
+void metrics_child_cancelled (struct metrics *m, const struct rusage *usage);
+/* Estimates the |q| quantile of |h| from its buckets; 0 if it is empty. */
+double metrics_quantile (const struct histogram *h, double q);
+void metrics_setter_sent (struct metrics *m);
+void metrics_setter_done (struct metrics *m);
+const char *metrics_failure_str (enum metrics_failure_t cause);
+int metrics_render (struct state *state, char *buf, size_t len);
+
+#endif /* METRICS_H */
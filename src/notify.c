@@ -0,0 +1,92 @@
+/*
+ * notify.c - service manager readiness notification
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Speaks the sd_notify(3) datagram protocol directly so tlsdated doesn't
+ * need libsystemd: each message is a single newline-separated list of
+ * VAR=value assignments sent to the AF_UNIX socket named by $NOTIFY_SOCKET.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "src/notify.h"
+#include "src/util.h"
+
+static struct sockaddr_un notify_addr;
+static socklen_t notify_addr_len;
+
+int
+notify_init (void)
+{
+  const char *path = getenv ("NOTIFY_SOCKET");
+  size_t len;
+  notify_addr_len = 0;
+  if (!path || !*path)
+    return 0;
+  len = strlen (path);
+  /* Only filesystem and abstract (leading '@') sockets make sense here. */
+  if ((path[0] != '/' && path[0] != '@') ||
+      len >= sizeof (notify_addr.sun_path))
+    {
+      error ("ignoring unusable NOTIFY_SOCKET '%s'", path);
+      unsetenv ("NOTIFY_SOCKET");
+      return 0;
+    }
+  memset (&notify_addr, 0, sizeof (notify_addr));
+  notify_addr.sun_family = AF_UNIX;
+  memcpy (notify_addr.sun_path, path, len);
+  if (path[0] == '@')
+    notify_addr.sun_path[0] = '\0';
+  notify_addr_len = offsetof (struct sockaddr_un, sun_path) + len;
+  unsetenv ("NOTIFY_SOCKET");
+  return 1;
+}
+
+int
+notify_send (const char *fmt, ...)
+{
+  char msg[512];
+  va_list ap;
+  int len;
+  int fd;
+  ssize_t sent;
+  if (!notify_addr_len)
+    return 0;
+  va_start (ap, fmt);
+  len = vsnprintf (msg, sizeof (msg), fmt, ap);
+  va_end (ap);
+  if (len < 0 || len >= (int) sizeof (msg))
+    {
+      error ("service notification too long");
+      return 1;
+    }
+  fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0)
+    {
+      perror ("can't create notification socket");
+      return 1;
+    }
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+  sent = IGNORE_EINTR (sendto (fd, msg, len, MSG_NOSIGNAL,
+                               (struct sockaddr *) &notify_addr,
+                               notify_addr_len));
+  close (fd);
+  if (sent != len)
+    {
+      perror ("can't notify the service manager");
+      return 1;
+    }
+  verb_debug ("notified service manager: %s", msg);
+  return 0;
+}
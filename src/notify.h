@@ -0,0 +1,21 @@
+/*
+ * notify.h - service manager readiness notification
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+/* Takes $NOTIFY_SOCKET out of the environment so tlsdate and the setter
+ * don't inherit it.  Returns 1 if a service manager is listening.
+ */
+int notify_init (void);
+/* Sends one sd_notify(3)-style message, e.g. "READY=1\nSTATUS=...".
+ * Does nothing if notify_init() found no socket.  Returns 0 on success.
+ */
+int notify_send (const char *fmt, ...)
+  __attribute__ ((format (printf, 1, 2)));
+
+#endif /* NOTIFY_H */
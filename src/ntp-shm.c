@@ -0,0 +1,103 @@
+/*
+ * ntp-shm.c - feed network time to ntpd or chronyd as an SHM refclock
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Each good network sample is written into the segment an NTP daemon polls
+ * with "refclock SHM <unit>" (chronyd) or server 127.127.28.<unit> (ntpd),
+ * so the daemon can weigh tlsdate's authenticated time against its other
+ * sources.  Nothing here touches the clock; pair it with dry-run to leave
+ * that to the NTP daemon.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <time.h>
+
+#include "src/ntp-shm.h"
+#include "src/util.h"
+
+/* The server sends whole seconds, so it is good to half of one. */
+#define NTP_SHM_PRECISION -1
+
+struct ntp_shm_time *
+ntp_shm_open (int unit)
+{
+  struct ntp_shm_time *shm;
+  int id = shmget (NTP_SHM_KEY + unit, sizeof (*shm),
+                   IPC_CREAT | (unit <= 1 ? 0600 : 0666));
+  if (id < 0)
+    {
+      perror ("can't get NTP SHM segment for unit %d", unit);
+      return NULL;
+    }
+  shm = shmat (id, NULL, 0);
+  if (shm == (void *) -1)
+    {
+      perror ("can't attach NTP SHM segment for unit %d", unit);
+      return NULL;
+    }
+  shm->valid = 0;
+  shm->mode = 1;
+  return shm;
+}
+
+void
+ntp_shm_post (struct ntp_shm_time *shm, time_t t,
+              const struct tlsdate_sample *sample)
+{
+  struct timespec now;
+  long half_rtt_ns = 0;
+  /* Truncated to the second, so its middle is the best guess. */
+  long usec = 500000;
+  int precision = NTP_SHM_PRECISION;
+  if (!shm || clock_gettime (CLOCK_REALTIME, &now) < 0)
+    return;
+  /* The server stamped its time roughly half a round trip ago, as in
+   * metrics_run_succeeded().
+   */
+  if (sample && sample->magic == TLSDATE_SAMPLE_MAGIC)
+    half_rtt_ns = sample->rtt_ms * 500000L;
+  /* Roughtime and NTS give the fraction too, and say how far off it may
+   * be.
+   */
+  if (sample && sample->magic == TLSDATE_SAMPLE_MAGIC &&
+      (sample->flags & TLSDATE_SAMPLE_SUBSEC))
+    {
+      usec = sample->usec;
+      for (precision = -20; precision < NTP_SHM_PRECISION &&
+           (1000000L >> -precision) < (long) sample->radius_us; ++precision)
+        ;
+    }
+  now.tv_sec -= half_rtt_ns / 1000000000L;
+  now.tv_nsec -= half_rtt_ns % 1000000000L;
+  if (now.tv_nsec < 0)
+    {
+      now.tv_sec--;
+      now.tv_nsec += 1000000000L;
+    }
+  /* Readers take the sample only if |count| didn't move while they copied
+   * it and |valid| was set, and clear |valid| once they have.
+   */
+  shm->valid = 0;
+  shm->count++;
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  shm->clock_sec = t;
+  shm->clock_usec = usec;
+  shm->clock_nsec = usec * 1000;
+  shm->receive_sec = now.tv_sec;
+  shm->receive_usec = now.tv_nsec / 1000;
+  shm->receive_nsec = now.tv_nsec;
+  shm->leap = 0;
+  shm->precision = precision;
+  shm->nsamples = 0;
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  shm->count++;
+  shm->valid = 1;
+}
@@ -0,0 +1,47 @@
+/*
+ * ntp-shm.h - feed network time to ntpd or chronyd as an SHM refclock
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NTP_SHM_H
+#define NTP_SHM_H
+
+#include <time.h>
+
+#include "src/sample.h"
+
+/* Unit N lives at SysV shared memory key NTP_SHM_KEY + N. */
+#define NTP_SHM_KEY 0x4e545030  /* "NTP0" */
+#define NTP_SHM_MAX_UNIT 255
+
+/* The segment layout ntpd's and chronyd's SHM drivers read. */
+struct ntp_shm_time
+{
+  int mode;  /* 1: the count/valid protocol below */
+  volatile int count;
+  time_t clock_sec;  /* the reference's time... */
+  int clock_usec;
+  time_t receive_sec;  /* ...and the local clock at the same instant */
+  int receive_usec;
+  int leap;
+  int precision;  /* log2 seconds */
+  int nsamples;
+  volatile int valid;
+  unsigned clock_nsec;
+  unsigned receive_nsec;
+  int dummy[8];
+};
+
+/* Attaches (creating if needed) the segment for |unit|.  Units 0 and 1
+ * are root-only, as in ntpd.  Returns NULL on failure.
+ */
+struct ntp_shm_time *ntp_shm_open (int unit);
+/* Posts server time |t| from the run described by |sample|, which may be
+ * a bare -Vraw time.
+ */
+void ntp_shm_post (struct ntp_shm_time *shm, time_t t,
+                   const struct tlsdate_sample *sample);
+
+#endif /* NTP_SHM_H */
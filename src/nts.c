@@ -0,0 +1,557 @@
+/*
+ * nts.c - Network Time Security (RFC 8915) packets
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * NTS-KE runs once over TLS and leaves the client two keys and a jar of
+ * cookies it can't read.  Each NTP request then carries one cookie and is
+ * sealed with the client-to-server key; the server finds the keys in the
+ * cookie, seals its reply with the other key and puts fresh cookies inside,
+ * so requests can't be linked to one another.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "src/nts.h"
+#include "src/tlsdate.h"
+#include "src/util.h"
+
+#define BLOCK 16
+
+static uint16_t
+get16 (const uint8_t *p)
+{
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t
+get32 (const uint8_t *p)
+{
+  return (uint32_t) get16 (p) << 16 | get16 (p + 2);
+}
+
+static uint64_t
+get64 (const uint8_t *p)
+{
+  return (uint64_t) get32 (p) << 32 | get32 (p + 4);
+}
+
+static void
+put16 (uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static size_t
+pad4 (size_t len)
+{
+  return (len + 3) & ~(size_t) 3;
+}
+
+size_t
+nts_ke_put_record (uint8_t *p, uint16_t type, int critical, const void *body,
+                   size_t len)
+{
+  put16 (p, type | (critical ? NTS_KE_CRITICAL : 0));
+  put16 (p + 2, len);
+  if (len)
+    memcpy (p + 4, body, len);
+  return 4 + len;
+}
+
+size_t
+nts_ke_encode_request (uint8_t *buf)
+{
+  uint8_t proto[2], aead[2];
+  size_t len = 0;
+  put16 (proto, NTS_KE_PROTOCOL_NTPV4);
+  put16 (aead, NTS_AEAD_AES_SIV_CMAC_256);
+  len += nts_ke_put_record (buf + len, NTS_KE_NEXT_PROTOCOL, 1, proto, 2);
+  len += nts_ke_put_record (buf + len, NTS_KE_AEAD, 0, aead, 2);
+  len += nts_ke_put_record (buf + len, NTS_KE_END, 1, NULL, 0);
+  return len;
+}
+
+int
+nts_ke_parse_response (const uint8_t *buf, size_t len, struct nts_session *s)
+{
+  size_t off = 0;
+  int have_proto = 0, have_aead = 0;
+  memset (s, 0, sizeof (*s));
+  s->magic = NTS_SESSION_MAGIC;
+  s->ntp_port = NTS_NTP_PORT;
+  while (off + 4 <= len)
+    {
+      uint16_t type = get16 (buf + off) & ~NTS_KE_CRITICAL;
+      int critical = !! (get16 (buf + off) & NTS_KE_CRITICAL);
+      size_t body_len = get16 (buf + off + 2);
+      const uint8_t *body = buf + off + 4;
+      if (off + 4 + body_len > len)
+        return 1;
+      off += 4 + body_len;
+      switch (type)
+        {
+        case NTS_KE_END:
+          if (!have_proto || !have_aead || !s->num_cookies)
+            {
+              verb_debug ("[nts] NTS-KE response is missing a record");
+              return -1;
+            }
+          return 0;
+        case NTS_KE_NEXT_PROTOCOL:
+          if (body_len != 2 || get16 (body) != NTS_KE_PROTOCOL_NTPV4)
+            {
+              verb_debug ("[nts] server won't do NTPv4");
+              return -1;
+            }
+          have_proto = 1;
+          break;
+        case NTS_KE_ERROR:
+          verb_debug ("[nts] server sent error %u",
+                      body_len == 2 ? get16 (body) : 0xffff);
+          return -1;
+        case NTS_KE_AEAD:
+          if (body_len != 2 || get16 (body) != NTS_AEAD_AES_SIV_CMAC_256)
+            {
+              verb_debug ("[nts] server chose an AEAD we didn't offer");
+              return -1;
+            }
+          s->aead = NTS_AEAD_AES_SIV_CMAC_256;
+          have_aead = 1;
+          break;
+        case NTS_KE_NEW_COOKIE:
+          if (body_len && body_len <= NTS_MAX_COOKIE_LEN &&
+              s->num_cookies < NTS_MAX_COOKIES)
+            {
+              memcpy (s->cookies[s->num_cookies], body, body_len);
+              s->cookie_len[s->num_cookies++] = body_len;
+            }
+          break;
+        case NTS_KE_SERVER:
+          if (!body_len || body_len >= sizeof (s->ntp_server) ||
+              memchr (body, 0, body_len))
+            return -1;
+          memcpy (s->ntp_server, body, body_len);
+          s->ntp_server[body_len] = '\0';
+          break;
+        case NTS_KE_PORT:
+          if (body_len != 2 || !get16 (body))
+            return -1;
+          s->ntp_port = get16 (body);
+          break;
+        default:
+          if (critical)
+            {
+              verb_debug ("[nts] unknown critical record %u", type);
+              return -1;
+            }
+        }
+    }
+  return 1;
+}
+
+void
+nts_exporter_context (uint16_t aead, int server_to_client,
+                      uint8_t context[5])
+{
+  put16 (context, NTS_KE_PROTOCOL_NTPV4);
+  put16 (context + 2, aead);
+  context[4] = !!server_to_client;
+}
+
+/*
+ * AES-SIV (RFC 5297) from AES alone.  OpenSSL's own SIV mode, where there
+ * is one, refuses to seal an empty plaintext, and that is what every NTS
+ * request carries.
+ */
+
+/* Doubling in GF(2^128). */
+static void
+dbl (uint8_t b[BLOCK])
+{
+  uint8_t carry = b[0] >> 7;
+  int i;
+  for (i = 0; i < BLOCK - 1; ++i)
+    b[i] = b[i] << 1 | b[i + 1] >> 7;
+  b[BLOCK - 1] = b[BLOCK - 1] << 1 ^ (carry ? 0x87 : 0);
+}
+
+static void
+xor_block (uint8_t *dst, const uint8_t *src)
+{
+  int i;
+  for (i = 0; i < BLOCK; ++i)
+    dst[i] ^= src[i];
+}
+
+static int
+encrypt_block (EVP_CIPHER_CTX *ecb, const uint8_t in[BLOCK],
+               uint8_t out[BLOCK])
+{
+  int len;
+  return EVP_EncryptUpdate (ecb, out, &len, in, BLOCK) != 1 || len != BLOCK;
+}
+
+/* AES-CMAC (RFC 4493) of |len| bytes at |msg| under |ecb|'s key. */
+static int
+cmac (EVP_CIPHER_CTX *ecb, const uint8_t *msg, size_t len,
+      uint8_t out[BLOCK])
+{
+  uint8_t k1[BLOCK], last[BLOCK];
+  size_t full = len ? (len - 1) / BLOCK : 0;
+  size_t i;
+  memset (k1, 0, sizeof (k1));
+  if (encrypt_block (ecb, k1, k1))
+    return 1;
+  dbl (k1);
+  memset (last, 0, sizeof (last));
+  if (len)
+    memcpy (last, msg + full * BLOCK, len - full * BLOCK);
+  if (len && len % BLOCK == 0)
+    xor_block (last, k1);
+  else
+    {
+      last[len - full * BLOCK] = 0x80;
+      dbl (k1);
+      xor_block (last, k1);
+    }
+  memset (out, 0, BLOCK);
+  for (i = 0; i < full; ++i)
+    {
+      xor_block (out, msg + i * BLOCK);
+      if (encrypt_block (ecb, out, out))
+        return 1;
+    }
+  xor_block (out, last);
+  return encrypt_block (ecb, out, out);
+}
+
+/* S2V over the associated data and then |len| bytes at |plain|. */
+static int
+s2v (const uint8_t key[BLOCK], const struct iovec *ad, int num_ad,
+     const uint8_t *plain, size_t len, uint8_t out[BLOCK])
+{
+  static const uint8_t zero[BLOCK];
+  uint8_t d[BLOCK], mac[BLOCK], t[NTS_MAX_PACKET];
+  EVP_CIPHER_CTX *ecb = EVP_CIPHER_CTX_new ();
+  int i, err = 1;
+  if (len > sizeof (t) || !ecb ||
+      EVP_EncryptInit_ex (ecb, EVP_aes_128_ecb (), NULL, key, NULL) != 1)
+    goto out;
+  EVP_CIPHER_CTX_set_padding (ecb, 0);
+  if (cmac (ecb, zero, BLOCK, d))
+    goto out;
+  for (i = 0; i < num_ad; ++i)
+    {
+      if (cmac (ecb, ad[i].iov_base, ad[i].iov_len, mac))
+        goto out;
+      dbl (d);
+      xor_block (d, mac);
+    }
+  if (len >= BLOCK)
+    {
+      memcpy (t, plain, len);
+      xor_block (t + len - BLOCK, d);
+    }
+  else
+    {
+      dbl (d);
+      memset (t, 0, BLOCK);
+      if (len)
+        memcpy (t, plain, len);
+      t[len] = 0x80;
+      xor_block (t, d);
+      len = BLOCK;
+    }
+  err = cmac (ecb, t, len, out);
+out:
+  EVP_CIPHER_CTX_free (ecb);
+  return err;
+}
+
+/* AES-CTR from the synthetic IV |siv| with the bits RFC 5297 clears. */
+static int
+ctr (const uint8_t key[BLOCK], const uint8_t siv[BLOCK], const uint8_t *in,
+     size_t len, uint8_t *out)
+{
+  uint8_t q[BLOCK];
+  EVP_CIPHER_CTX *ctx;
+  int out_len, err = 1;
+  if (!len)
+    return 0;
+  memcpy (q, siv, BLOCK);
+  q[8] &= 0x7f;
+  q[12] &= 0x7f;
+  ctx = EVP_CIPHER_CTX_new ();
+  if (ctx && EVP_EncryptInit_ex (ctx, EVP_aes_128_ctr (), NULL, key, q) == 1 &&
+      EVP_EncryptUpdate (ctx, out, &out_len, in, len) == 1)
+    err = 0;
+  EVP_CIPHER_CTX_free (ctx);
+  return err;
+}
+
+int
+nts_aead_seal (const uint8_t key[NTS_KEY_LEN], const struct iovec *ad,
+               int num_ad, const uint8_t *in, size_t len, uint8_t *out)
+{
+  if (s2v (key, ad, num_ad, in, len, out))
+    return 1;
+  return ctr (key + BLOCK, out, in, len, out + NTS_SIV_LEN);
+}
+
+int
+nts_aead_open (const uint8_t key[NTS_KEY_LEN], const struct iovec *ad,
+               int num_ad, const uint8_t *in, size_t len, uint8_t *out)
+{
+  uint8_t siv[BLOCK];
+  if (len < NTS_SIV_LEN ||
+      ctr (key + BLOCK, in, in + NTS_SIV_LEN, len - NTS_SIV_LEN, out) ||
+      s2v (key, ad, num_ad, out, len - NTS_SIV_LEN, siv) ||
+      CRYPTO_memcmp (siv, in, BLOCK))
+    {
+      memset (out, 0, len - (len < NTS_SIV_LEN ? len : NTS_SIV_LEN));
+      return 1;
+    }
+  return 0;
+}
+
+int
+nts_next_ef (const uint8_t *pkt, size_t len, size_t *off, uint16_t *type,
+             const uint8_t **body, size_t *body_len)
+{
+  size_t ef_len;
+  if (*off == len)
+    return 0;
+  if (*off + 4 > len)
+    return -1;
+  ef_len = get16 (pkt + *off + 2);
+  if (ef_len < 4 || ef_len % 4 || *off + ef_len > len)
+    return -1;
+  *type = get16 (pkt + *off);
+  *body = pkt + *off + 4;
+  *body_len = ef_len - 4;
+  *off += ef_len;
+  return 1;
+}
+
+size_t
+nts_put_ef (uint8_t *p, uint16_t type, const void *body, size_t len)
+{
+  size_t ef_len = 4 + pad4 (len);
+  put16 (p, type);
+  put16 (p + 2, ef_len);
+  memset (p + 4, 0, ef_len - 4);
+  if (body)
+    memcpy (p + 4, body, len);
+  return ef_len;
+}
+
+size_t
+nts_seal_packet (const uint8_t key[NTS_KEY_LEN], uint8_t *pkt, size_t len,
+                 const uint8_t *plain, size_t plain_len)
+{
+  size_t ct_len = NTS_SIV_LEN + plain_len;
+  size_t ef_len = 4 + 4 + pad4 (NTS_NONCE_LEN) + pad4 (ct_len);
+  uint8_t *p = pkt + len;
+  struct iovec ad[2];
+  if (len + ef_len > NTS_MAX_PACKET || ef_len > 0xffff)
+    return 0;
+  memset (p, 0, ef_len);
+  put16 (p, NTS_EF_AUTH);
+  put16 (p + 2, ef_len);
+  put16 (p + 4, NTS_NONCE_LEN);
+  put16 (p + 6, ct_len);
+  if (RAND_bytes (p + 8, NTS_NONCE_LEN) != 1)
+    return 0;
+  ad[0].iov_base = pkt;
+  ad[0].iov_len = len;
+  ad[1].iov_base = p + 8;
+  ad[1].iov_len = NTS_NONCE_LEN;
+  if (nts_aead_seal (key, ad, 2, plain, plain_len,
+                     p + 8 + pad4 (NTS_NONCE_LEN)))
+    return 0;
+  return len + ef_len;
+}
+
+int
+nts_open_packet (const uint8_t key[NTS_KEY_LEN], const uint8_t *pkt,
+                 size_t len, size_t *auth_off, uint8_t *plain,
+                 size_t *plain_len)
+{
+  size_t off = NTS_NTP_HEADER_LEN, start, nonce_len, ct_len, body_len;
+  const uint8_t *body;
+  struct iovec ad[2];
+  uint16_t type;
+  int ret;
+  if (len < NTS_NTP_HEADER_LEN)
+    return 1;
+  for (;;)
+    {
+      start = off;
+      ret = nts_next_ef (pkt, len, &off, &type, &body, &body_len);
+      if (ret <= 0)
+        return 1;
+      if (type == NTS_EF_AUTH)
+        break;
+    }
+  if (body_len < 4)
+    return 1;
+  nonce_len = get16 (body);
+  ct_len = get16 (body + 2);
+  if (!nonce_len || ct_len < NTS_SIV_LEN ||
+      ct_len - NTS_SIV_LEN > NTS_MAX_PACKET ||
+      4 + pad4 (nonce_len) + pad4 (ct_len) > body_len)
+    return 1;
+  ad[0].iov_base = (void *) pkt;
+  ad[0].iov_len = start;
+  ad[1].iov_base = (void *) (body + 4);
+  ad[1].iov_len = nonce_len;
+  if (nts_aead_open (key, ad, 2, body + 4 + pad4 (nonce_len), ct_len, plain))
+    return 1;
+  *auth_off = start;
+  *plain_len = ct_len - NTS_SIV_LEN;
+  return 0;
+}
+
+size_t
+nts_encode_request (struct nts_session *s, const uint8_t uid[NTS_UID_LEN],
+                    const uint8_t xmt[8], uint8_t *buf)
+{
+  size_t len = NTS_NTP_HEADER_LEN, cookie_len;
+  uint32_t i, n;
+  if (!s->num_cookies)
+    return 0;
+  n = --s->num_cookies;
+  cookie_len = s->cookie_len[n];
+  memset (buf, 0, NTS_NTP_HEADER_LEN);
+  buf[0] = 4 << 3 | 3;  /* no leap warning, NTPv4, client */
+  memcpy (buf + 40, xmt, 8);
+  len += nts_put_ef (buf + len, NTS_EF_UNIQUE_ID, uid, NTS_UID_LEN);
+  len += nts_put_ef (buf + len, NTS_EF_COOKIE, s->cookies[n], cookie_len);
+  /* Each placeholder, as big as the cookie, earns one more back. */
+  for (i = n + 1; i < NTS_MAX_COOKIES; ++i)
+    len += nts_put_ef (buf + len, NTS_EF_COOKIE_PLACEHOLDER, NULL,
+                       cookie_len);
+  memset (s->cookies[n], 0, sizeof (s->cookies[n]));
+  s->cookie_len[n] = 0;
+  return nts_seal_packet (s->c2s_key, buf, len, NULL, 0);
+}
+
+int
+nts_parse_reply (struct nts_session *s, const uint8_t uid[NTS_UID_LEN],
+                 const uint8_t xmt[8], const uint8_t *buf, size_t len,
+                 struct nts_reply *out)
+{
+  uint8_t plain[NTS_MAX_PACKET];
+  size_t off = NTS_NTP_HEADER_LEN, uid_end = 0, auth_off, plain_len;
+  size_t body_len;
+  const uint8_t *body;
+  uint16_t type;
+  int ret;
+  if (len < NTS_NTP_HEADER_LEN || (buf[0] & 7) != 4 ||
+      memcmp (buf + 24, xmt, 8))
+    return -1;
+  while ((ret = nts_next_ef (buf, len, &off, &type, &body, &body_len)) > 0)
+    if (type == NTS_EF_UNIQUE_ID && body_len == NTS_UID_LEN &&
+        !CRYPTO_memcmp (body, uid, NTS_UID_LEN))
+      {
+        uid_end = off;
+        break;
+      }
+  if (!uid_end)
+    {
+      verb_debug ("[nts] reply doesn't echo our unique id");
+      return -1;
+    }
+  /* A NAK can't be authenticated: the server couldn't read our keys. */
+  if (buf[1] == 0 && !memcmp (buf + 12, NTS_NAK, 4))
+    return 1;
+  if (nts_open_packet (s->s2c_key, buf, len, &auth_off, plain, &plain_len) ||
+      uid_end > auth_off)
+    {
+      verb_debug ("[nts] reply isn't authenticated");
+      return -1;
+    }
+  out->leap = buf[0] >> 6;
+  out->stratum = buf[1];
+  out->root_delay = get32 (buf + 4);
+  out->root_dispersion = get32 (buf + 8);
+  out->receive = get64 (buf + 32);
+  out->transmit = get64 (buf + 40);
+  if (out->leap == 3 || !out->stratum || out->stratum > 15 || !out->transmit)
+    {
+      verb_debug ("[nts] server isn't synchronized");
+      return -1;
+    }
+  off = 0;
+  while ((ret = nts_next_ef (plain, plain_len, &off, &type, &body,
+                             &body_len)) > 0)
+    if (type == NTS_EF_COOKIE && body_len && body_len <= NTS_MAX_COOKIE_LEN &&
+        s->num_cookies < NTS_MAX_COOKIES)
+      {
+        memcpy (s->cookies[s->num_cookies], body, body_len);
+        s->cookie_len[s->num_cookies++] = body_len;
+      }
+  return 0;
+}
+
+int
+nts_session_load (const char *path, struct nts_session *s)
+{
+  uint32_t i;
+  ssize_t n;
+  int fd = open (path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    return 1;
+  n = IGNORE_EINTR (read (fd, s, sizeof (*s)));
+  close (fd);
+  if (n != sizeof (*s) || s->magic != NTS_SESSION_MAGIC ||
+      s->aead != NTS_AEAD_AES_SIV_CMAC_256 ||
+      s->num_cookies > NTS_MAX_COOKIES || !s->ntp_port ||
+      !memchr (s->ntp_server, 0, sizeof (s->ntp_server)))
+    return 1;
+  for (i = 0; i < s->num_cookies; ++i)
+    if (!s->cookie_len[i] || s->cookie_len[i] > NTS_MAX_COOKIE_LEN)
+      return 1;
+  return 0;
+}
+
+int
+nts_session_save (const char *path, const struct nts_session *s)
+{
+  char tmp[PATH_MAX];
+  int fd;
+  if (snprintf (tmp, sizeof (tmp), "%s%s", path, DEFAULT_DAEMON_TMPSUFFIX) >=
+      (int) sizeof (tmp))
+    return 1;
+  /* The keys in it are as good as the cookies to anyone who reads it. */
+  fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+             0600);
+  if (fd < 0)
+    return 1;
+  if (IGNORE_EINTR (write (fd, s, sizeof (*s))) != sizeof (*s))
+    {
+      close (fd);
+      unlink (tmp);
+      return 1;
+    }
+  if (close (fd) || rename (tmp, path))
+    {
+      unlink (tmp);
+      return 1;
+    }
+  return 0;
+}
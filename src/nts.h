@@ -0,0 +1,162 @@
+/*
+ * nts.h - Network Time Security (RFC 8915) packets
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NTS_H
+#define NTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define NTS_KE_ALPN "\x07ntske/1"  /* length-prefixed, for ALPN */
+#define NTS_KE_ALPN_LEN 8
+#define NTS_EXPORTER_LABEL "EXPORTER-network-time-security"
+#define NTS_NTP_PORT 123
+
+/* NTS-KE records: a 16-bit type, its top bit marking it critical, a
+ * 16-bit body length, then the body; all big-endian.
+ */
+#define NTS_KE_CRITICAL 0x8000
+#define NTS_KE_END 0
+#define NTS_KE_NEXT_PROTOCOL 1
+#define NTS_KE_ERROR 2
+#define NTS_KE_WARNING 3
+#define NTS_KE_AEAD 4
+#define NTS_KE_NEW_COOKIE 5
+#define NTS_KE_SERVER 6
+#define NTS_KE_PORT 7
+#define NTS_KE_PROTOCOL_NTPV4 0
+#define NTS_KE_REQUEST_LEN 16
+#define NTS_KE_MAX_RESPONSE 8192
+
+#define NTS_AEAD_AES_SIV_CMAC_256 15
+#define NTS_KEY_LEN 32
+#define NTS_SIV_LEN 16   /* the synthetic IV leads every ciphertext */
+#define NTS_NONCE_LEN 16
+#define NTS_UID_LEN 32
+
+/* NTPv4 extension fields */
+#define NTS_EF_UNIQUE_ID 0x0104
+#define NTS_EF_COOKIE 0x0204
+#define NTS_EF_COOKIE_PLACEHOLDER 0x0304
+#define NTS_EF_AUTH 0x0404
+
+#define NTS_NTP_HEADER_LEN 48
+#define NTS_NTP_UNIX_OFFSET 2208988800ULL  /* 1900 to 1970, in seconds */
+#define NTS_MAX_PACKET 4096
+#define NTS_MAX_COOKIES 8
+#define NTS_MAX_COOKIE_LEN 256
+#define NTS_HOST_LEN 256
+
+/* The kiss code a server sends when it can't read our cookie. */
+#define NTS_NAK "NTSN"
+
+/* "TDK1" - marks an nts_session written by `tlsdate -Vnts`. */
+#define NTS_SESSION_MAGIC 0x54444b31
+
+/*
+ * What NTS-KE leaves us with: keys and cookies for the NTP server.  The
+ * helper writes one to tlsdated in a single write(2), well under PIPE_BUF,
+ * and tlsdated keeps it in its cache directory.  The magic sits where a
+ * tlsdate_sample has its own so one read tells the two apart.
+ */
+struct nts_session
+{
+  uint32_t pid;          /* the helper's, as in a tlsdate_sample */
+  uint32_t magic;        /* NTS_SESSION_MAGIC */
+  uint16_t aead;         /* NTS_AEAD_* */
+  uint16_t ntp_port;     /* host order */
+  uint32_t num_cookies;  /* the last one is used first */
+  char ntp_server[NTS_HOST_LEN];  /* empty for the NTS-KE server itself */
+  uint8_t c2s_key[NTS_KEY_LEN];
+  uint8_t s2c_key[NTS_KEY_LEN];
+  uint16_t cookie_len[NTS_MAX_COOKIES];
+  uint8_t cookies[NTS_MAX_COOKIES][NTS_MAX_COOKIE_LEN];
+};
+
+/* The parts of an authenticated NTP reply tlsdated uses. */
+struct nts_reply
+{
+  uint8_t leap;
+  uint8_t stratum;
+  uint32_t root_delay;       /* NTP short format */
+  uint32_t root_dispersion;
+  uint64_t receive;          /* NTP timestamps */
+  uint64_t transmit;
+};
+
+/* Appends a record to |p|; returns its length. */
+size_t nts_ke_put_record (uint8_t *p, uint16_t type, int critical,
+                          const void *body, size_t len);
+/* Fills |buf| with a request for NTPv4 under AES-SIV-CMAC-256; returns its
+ * length, NTS_KE_REQUEST_LEN.
+ */
+size_t nts_ke_encode_request (uint8_t *buf);
+/* Reads a server's response so far into |s| (all but the keys).  Returns
+ * 0 once it is whole and usable, 1 if more is needed, -1 if it is no good.
+ */
+int nts_ke_parse_response (const uint8_t *buf, size_t len,
+                           struct nts_session *s);
+/* The TLS exporter context for |aead| keys one way or the other. */
+void nts_exporter_context (uint16_t aead, int server_to_client,
+                           uint8_t context[5]);
+
+/* AES-SIV-CMAC-256 (RFC 5297) over the |num_ad| strings in |ad|.  Seal
+ * writes NTS_SIV_LEN + |len| bytes to |out|; open takes as many from |in|
+ * and writes |len| - NTS_SIV_LEN to |out|.  Both return 0 on success.
+ */
+int nts_aead_seal (const uint8_t key[NTS_KEY_LEN], const struct iovec *ad,
+                   int num_ad, const uint8_t *in, size_t len, uint8_t *out);
+int nts_aead_open (const uint8_t key[NTS_KEY_LEN], const struct iovec *ad,
+                   int num_ad, const uint8_t *in, size_t len, uint8_t *out);
+
+/* Steps through the extension fields of the NTP packet |pkt| from |*off|
+ * (NTS_NTP_HEADER_LEN to start).  Returns 1 with the next one, 0 at the
+ * end, or -1 if they are malformed.
+ */
+int nts_next_ef (const uint8_t *pkt, size_t len, size_t *off,
+                 uint16_t *type, const uint8_t **body, size_t *body_len);
+/* Appends an extension field, zero-filled if |body| is NULL and padded to
+ * four bytes; returns its length.
+ */
+size_t nts_put_ef (uint8_t *p, uint16_t type, const void *body, size_t len);
+/* Appends an authenticator over the |len| bytes of |pkt| that carries
+ * |plain| encrypted under |key|.  Returns the new length, or 0.
+ */
+size_t nts_seal_packet (const uint8_t key[NTS_KEY_LEN], uint8_t *pkt,
+                        size_t len, const uint8_t *plain, size_t plain_len);
+/* Checks the authenticator of |pkt| under |key| and decrypts what it
+ * carries into |plain| (NTS_MAX_PACKET bytes).  Returns 0 on success, with
+ * |*auth_off| where the authenticator starts.
+ */
+int nts_open_packet (const uint8_t key[NTS_KEY_LEN], const uint8_t *pkt,
+                     size_t len, size_t *auth_off, uint8_t *plain,
+                     size_t *plain_len);
+
+/* Takes a cookie from |s| and writes an authenticated client request to
+ * |buf| (NTS_MAX_PACKET bytes), asking for enough cookies to fill the jar
+ * again.  |uid| and |xmt| are random and must come back in the reply.
+ * Returns its length, or 0 if there is no cookie.
+ */
+size_t nts_encode_request (struct nts_session *s,
+                           const uint8_t uid[NTS_UID_LEN],
+                           const uint8_t xmt[8], uint8_t *buf);
+/* Checks |buf| answers the request made with |uid| and |xmt| and adds the
+ * cookies it brings to |s|.  Returns 0 for a good reply, 1 for an NTS NAK
+ * (the cookies are no good any more), -1 for anything else.
+ */
+int nts_parse_reply (struct nts_session *s, const uint8_t uid[NTS_UID_LEN],
+                     const uint8_t xmt[8], const uint8_t *buf, size_t len,
+                     struct nts_reply *out);
+
+/* Reads |s| from, or writes it to, a cache file.  Both return 0 on
+ * success; the file is written atomically and readable only by us.
+ */
+int nts_session_load (const char *path, struct nts_session *s);
+int nts_session_save (const char *path, const struct nts_session *s);
+
+#endif /* NTS_H */
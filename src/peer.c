@@ -0,0 +1,298 @@
+/*
+ * peer.c - share verified samples between tlsdated instances
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Wire format and keys for src/events/peer.c.  Every field is big-endian at
+ * a fixed offset and each packet ends in an HMAC-SHA256 over everything
+ * before it, keyed by the shared secret its key id names.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "src/peer.h"
+#include "src/util.h"
+
+static void
+put32 (uint8_t **p, uint32_t v)
+{
+  v = htonl (v);
+  memcpy (*p, &v, 4);
+  *p += 4;
+}
+
+static void
+put64 (uint8_t **p, uint64_t v)
+{
+  put32 (p, (uint32_t) (v >> 32));
+  put32 (p, (uint32_t) v);
+}
+
+static void
+put_bytes (uint8_t **p, const void *src, size_t len)
+{
+  memcpy (*p, src, len);
+  *p += len;
+}
+
+static uint32_t
+get32 (const uint8_t **p)
+{
+  uint32_t v;
+  memcpy (&v, *p, 4);
+  *p += 4;
+  return ntohl (v);
+}
+
+static uint64_t
+get64 (const uint8_t **p)
+{
+  uint64_t hi = get32 (p);
+  return (hi << 32) | get32 (p);
+}
+
+static void
+get_bytes (const uint8_t **p, void *dst, size_t len)
+{
+  memcpy (dst, *p, len);
+  *p += len;
+}
+
+static const struct peer_key *
+find_key (const struct peers *peers, uint32_t id, int *index)
+{
+  int i;
+  for (i = 0; i < peers->num_keys; ++i)
+    if (peers->keys[i].id == id)
+      {
+        if (index)
+          *index = i;
+        return &peers->keys[i];
+      }
+  return NULL;
+}
+
+static void
+sign (const struct peer_key *key, const uint8_t *buf, size_t len,
+      uint8_t mac[PEER_MAC_LEN])
+{
+  unsigned int mac_len = PEER_MAC_LEN;
+  HMAC (EVP_sha256 (), key->secret, key->len, buf, len, mac, &mac_len);
+}
+
+/* Checks the MAC that ends the |len| bytes at |buf|. */
+static int
+verify (const struct peer_key *key, const uint8_t *buf, size_t len)
+{
+  uint8_t mac[PEER_MAC_LEN];
+  sign (key, buf, len - PEER_MAC_LEN, mac);
+  return !CRYPTO_memcmp (mac, buf + len - PEER_MAC_LEN, PEER_MAC_LEN);
+}
+
+static int
+hex_digit (int c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = tolower (c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+int
+peer_load_keys (struct peers *peers, const char *path)
+{
+  char line[256];
+  int lineno = 0;
+  FILE *f = fopen (path, "r");
+  if (!f)
+    {
+      perror ("can't open peer key file '%s'", path);
+      return 1;
+    }
+  peers->num_keys = 0;
+  while (fgets (line, sizeof (line), f))
+    {
+      struct peer_key *key;
+      unsigned long id;
+      char *p, *end;
+      lineno++;
+      for (p = line; isspace ((unsigned char) *p); ++p)
+        ;
+      if (!*p || *p == '#')
+        continue;
+      if (peers->num_keys == PEER_MAX_KEYS)
+        {
+          error ("%s:%d: more than %d peer keys", path, lineno,
+                 PEER_MAX_KEYS);
+          goto fail;
+        }
+      key = &peers->keys[peers->num_keys];
+      errno = 0;
+      id = strtoul (p, &end, 10);
+      if (errno || end == p || id > UINT32_MAX || !isspace ((unsigned char) *end))
+        {
+          error ("%s:%d: bad peer key id", path, lineno);
+          goto fail;
+        }
+      key->id = id;
+      for (p = end; isspace ((unsigned char) *p); ++p)
+        ;
+      for (key->len = 0; hex_digit (p[0]) >= 0 && hex_digit (p[1]) >= 0;
+           p += 2)
+        {
+          if (key->len == PEER_MAX_KEY_LEN)
+            break;
+          key->secret[key->len++] = hex_digit (p[0]) << 4 | hex_digit (p[1]);
+        }
+      while (isspace ((unsigned char) *p))
+        p++;
+      /* Anything shorter than SHA-256's output weakens the MAC. */
+      if (*p || key->len < 32)
+        {
+          error ("%s:%d: peer key must be 32 to %d bytes of hex", path,
+                 lineno, PEER_MAX_KEY_LEN);
+          goto fail;
+        }
+      if (find_key (peers, key->id, NULL))
+        {
+          error ("%s:%d: duplicate peer key id %u", path, lineno, key->id);
+          goto fail;
+        }
+      peers->num_keys++;
+    }
+  fclose (f);
+  if (!peers->num_keys)
+    {
+      error ("no keys in peer key file '%s'", path);
+      return 1;
+    }
+  return 0;
+fail:
+  fclose (f);
+  memset (peers->keys, 0, sizeof (peers->keys));
+  peers->num_keys = 0;
+  return 1;
+}
+
+int
+peer_parse_dests (struct peers *peers, const char *list, int port)
+{
+  char buf[64];
+  const char *p = list;
+  peers->num_dests = 0;
+  while (*p)
+    {
+      struct sockaddr_in *addr;
+      size_t len = strcspn (p, " \t,");
+      char *colon;
+      if (!len)
+        {
+          p++;
+          continue;
+        }
+      if (len >= sizeof (buf) || peers->num_dests == PEER_MAX_DESTS)
+        return 1;
+      memcpy (buf, p, len);
+      buf[len] = '\0';
+      p += len;
+      addr = &peers->dests[peers->num_dests];
+      memset (addr, 0, sizeof (*addr));
+      addr->sin_family = AF_INET;
+      addr->sin_port = htons (port);
+      if ((colon = strchr (buf, ':')))
+        {
+          char *end;
+          long n = strtol (colon + 1, &end, 10);
+          if (*end || n <= 0 || n > 65535)
+            return 1;
+          addr->sin_port = htons (n);
+          *colon = '\0';
+        }
+      if (inet_pton (AF_INET, buf, &addr->sin_addr) != 1)
+        return 1;
+      peers->num_dests++;
+    }
+  return !peers->num_dests;
+}
+
+size_t
+peer_encode_query (const struct peers *peers, uint8_t *buf)
+{
+  uint8_t *p = buf;
+  put32 (&p, PEER_MAGIC_QUERY);
+  put32 (&p, peers->keys[0].id);
+  put_bytes (&p, peers->nonce, PEER_NONCE_LEN);
+  sign (&peers->keys[0], buf, p - buf, p);
+  return PEER_QUERY_LEN;
+}
+
+int
+peer_check_query (const struct peers *peers, const uint8_t *buf, size_t len,
+                  uint8_t nonce[PEER_NONCE_LEN])
+{
+  const struct peer_key *key;
+  const uint8_t *p = buf;
+  int index;
+  if (len != PEER_QUERY_LEN || get32 (&p) != PEER_MAGIC_QUERY)
+    return -1;
+  if (!(key = find_key (peers, get32 (&p), &index)) ||
+      !verify (key, buf, len))
+    return -1;
+  get_bytes (&p, nonce, PEER_NONCE_LEN);
+  return index;
+}
+
+size_t
+peer_encode_reply (const struct peers *peers, int key,
+                   const struct peer_record *rec, uint8_t *buf)
+{
+  uint8_t *p = buf;
+  put32 (&p, PEER_MAGIC_REPLY);
+  put32 (&p, peers->keys[key].id);
+  put_bytes (&p, rec->nonce, PEER_NONCE_LEN);
+  memset (p, 0, PEER_HOST_LEN);
+  strncpy ((char *) p, rec->host, PEER_HOST_LEN - 1);
+  p += PEER_HOST_LEN;
+  put_bytes (&p, rec->spki_sha256, PEER_SPKI_LEN);
+  put32 (&p, rec->server_time);
+  put32 (&p, rec->rtt_ms);
+  put64 (&p, rec->sync_mono_ns);
+  put64 (&p, rec->sent_mono_ns);
+  sign (&peers->keys[key], buf, p - buf, p);
+  return PEER_REPLY_LEN;
+}
+
+int
+peer_decode_reply (const struct peers *peers, const uint8_t *buf, size_t len,
+                   struct peer_record *rec)
+{
+  const struct peer_key *key;
+  const uint8_t *p = buf;
+  if (len != PEER_REPLY_LEN || get32 (&p) != PEER_MAGIC_REPLY)
+    return -1;
+  if (!(key = find_key (peers, get32 (&p), NULL)) || !verify (key, buf, len))
+    return -1;
+  get_bytes (&p, rec->nonce, PEER_NONCE_LEN);
+  get_bytes (&p, rec->host, PEER_HOST_LEN);
+  rec->host[PEER_HOST_LEN - 1] = '\0';
+  get_bytes (&p, rec->spki_sha256, PEER_SPKI_LEN);
+  rec->server_time = get32 (&p);
+  rec->rtt_ms = get32 (&p);
+  rec->sync_mono_ns = get64 (&p);
+  rec->sent_mono_ns = get64 (&p);
+  return 0;
+}
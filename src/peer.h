@@ -0,0 +1,90 @@
+/*
+ * peer.h - share verified samples between tlsdated instances
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef PEER_H
+#define PEER_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PEER_MAGIC_QUERY 0x54445131  /* "TDQ1" */
+#define PEER_MAGIC_REPLY 0x54445231  /* "TDR1" */
+#define PEER_NONCE_LEN 16
+#define PEER_MAC_LEN 32  /* HMAC-SHA256 */
+#define PEER_SPKI_LEN 32
+#define PEER_HOST_LEN 64  /* incl. NUL */
+#define PEER_MAX_KEYS 8
+#define PEER_MAX_KEY_LEN 64
+#define PEER_MAX_DESTS 16
+
+/* magic, key id, nonce, mac */
+#define PEER_QUERY_LEN (4 + 4 + PEER_NONCE_LEN + PEER_MAC_LEN)
+/* magic, key id, nonce, host, spki, time, rtt, sync and sent anchors, mac */
+#define PEER_REPLY_LEN (4 + 4 + PEER_NONCE_LEN + PEER_HOST_LEN + \
+                        PEER_SPKI_LEN + 4 + 4 + 8 + 8 + PEER_MAC_LEN)
+
+struct peer_key
+{
+  uint32_t id;
+  size_t len;
+  uint8_t secret[PEER_MAX_KEY_LEN];
+};
+
+/* A sample as one peer hands it to another. */
+struct peer_record
+{
+  uint8_t nonce[PEER_NONCE_LEN];
+  char host[PEER_HOST_LEN];  /* the source it came from */
+  uint8_t spki_sha256[PEER_SPKI_LEN];  /* of that source's leaf key */
+  uint32_t server_time;
+  uint32_t rtt_ms;
+  /* The sender's CLOCK_MONOTONIC when the server stamped |server_time| and
+   * when it replied; only their difference means anything to a receiver.
+   */
+  uint64_t sync_mono_ns;
+  uint64_t sent_mono_ns;
+};
+
+struct peers
+{
+  struct peer_key keys[PEER_MAX_KEYS];  /* keys[0] signs queries */
+  int num_keys;
+  struct sockaddr_in dests[PEER_MAX_DESTS];
+  int num_dests;
+  struct peer_record own;  /* our last TLS sample, for others */
+  int have_own;
+  uint8_t nonce[PEER_NONCE_LEN];  /* of the query in flight */
+  struct timespec query_sent;
+  int querying;
+  int tried;  /* already asked this round */
+};
+
+/* Reads "<id> <hex secret>" lines ('#' starts a comment).  Returns 0 on
+ * success.
+ */
+int peer_load_keys (struct peers *peers, const char *path);
+/* Parses space-separated numeric IPv4 "addr[:port]"s.  Returns 0 on
+ * success.
+ */
+int peer_parse_dests (struct peers *peers, const char *list, int port);
+/* Fills |buf| with a query for |peers->nonce|; returns its length. */
+size_t peer_encode_query (const struct peers *peers, uint8_t *buf);
+/* Returns the index of the key that signed a good query, or -1, and
+ * copies its nonce out.
+ */
+int peer_check_query (const struct peers *peers, const uint8_t *buf,
+                      size_t len, uint8_t nonce[PEER_NONCE_LEN]);
+/* Fills |buf| with |rec| signed by keys[|key|]; returns its length. */
+size_t peer_encode_reply (const struct peers *peers, int key,
+                          const struct peer_record *rec, uint8_t *buf);
+/* Returns 0 and fills |rec| if |buf| is a reply signed by a known key. */
+int peer_decode_reply (const struct peers *peers, const uint8_t *buf,
+                       size_t len, struct peer_record *rec);
+
+#endif /* PEER_H */
@@ -19,6 +19,7 @@
 
 #include "src/dbus.h"
 #include "src/platform.h"
+#include "src/probes.h"
 #include "src/tlsdate.h"
 #include "src/util.h"
 
@@ -360,6 +361,8 @@ action_resolve_proxy (evutil_socket_t fd, short what, void *arg)
   DBusConnection *conn = dbus_state->conn;
   struct source *src = ctx->state->opts.sources;
   verb_debug ("[event:%s] fired", __func__);
+  PROBE_ACTION (E_RESOLVER);
+  trace_event (ctx->state, E_RESOLVER);
   /* Emulate tlsdate-monitor.c:build_argv and choose the next source */
   if (ctx->state->opts.cur_source && ctx->state->opts.cur_source->next)
     src = ctx->state->opts.cur_source->next;
@@ -0,0 +1,51 @@
+/*
+ * probes.h - USDT probe points for tlsdate and tlsdated
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * With <sys/sdt.h> available (systemtap-sdt-dev), each probe is a single
+ * nop plus an ELF note, so an unattached probe costs nothing and there is
+ * no runtime dependency.  Without it they compile away.  List them with
+ *   bpftrace -l 'usdt:/usr/sbin/tlsdated:*'
+ * and see contrib/tlsdate-phases.bt for an example.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "config.h"
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE0(name) DTRACE_PROBE (tlsdate, name)
+#define PROBE1(name, a) DTRACE_PROBE1 (tlsdate, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2 (tlsdate, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3 (tlsdate, name, a, b, c)
+
+static inline void
+probe_action_return (const int *id)
+{
+  PROBE1 (action_return, *id);
+}
+
+/* Fires action_entry now and action_return on every way out of the
+ * enclosing handler.  Takes an enum event_id_t.
+ */
+#define PROBE_ACTION(id) \
+  const int probe_action_id_ __attribute__ ((cleanup (probe_action_return))) \
+    = (id); \
+  PROBE1 (action_entry, probe_action_id_)
+
+#else
+
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE_ACTION(id) do { } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* PROBES_H */
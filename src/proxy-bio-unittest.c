@@ -245,6 +245,79 @@ TEST_F (test_bio, socks5_connect_fail)
   EXPECT_EQ (0, BIO_test_output_left (self->test));
 }
 
+TEST_F (test_bio, socks5_optimistic)
+{
+  unsigned const char kTestInput[] = { 0xde, 0xad, 0xbe, 0xef };
+  unsigned const char kTestOutput[] = { 0xca, 0xfe };
+  unsigned char buf[sizeof (kTestOutput)];
+  BIO *proxy = proxy_bio (self->test, "socks5");
+  BIO_proxy_set_optimistic (proxy, 1);
+  /* Nothing from the proxy yet: the write mustn't wait on it. */
+  EXPECT_EQ (4, BIO_write (proxy, kTestInput, sizeof (kTestInput)));
+  EXPECT_EQ (0, need_out_bytes (self->test, kSocks5AuthRequest,
+                                sizeof (kSocks5AuthRequest)));
+  EXPECT_EQ (0, need_out_bytes (self->test, kSocks5ConnectRequest,
+                                sizeof (kSocks5ConnectRequest)));
+  EXPECT_EQ (0, need_out_bytes (self->test, kTestInput,
+                                sizeof (kTestInput)));
+  EXPECT_EQ (0, BIO_test_output_left (self->test));
+  put_bytes (self->test, kSocks5AuthReply, sizeof (kSocks5AuthReply));
+  put_bytes (self->test, kSocks5ConnectReply, sizeof (kSocks5ConnectReply));
+  put_bytes (self->test, kTestOutput, sizeof (kTestOutput));
+  EXPECT_EQ (2, BIO_read (proxy, buf, sizeof (buf)));
+  EXPECT_EQ (0, memcmp (buf, kTestOutput, sizeof (kTestOutput)));
+  /* Once up, writes go straight through. */
+  EXPECT_EQ (4, BIO_write (proxy, kTestInput, sizeof (kTestInput)));
+  EXPECT_EQ (0, need_out_bytes (self->test, kTestInput,
+                                sizeof (kTestInput)));
+  EXPECT_EQ (0, BIO_test_output_left (self->test));
+}
+
+TEST_F (test_bio, socks5_optimistic_auth_fail)
+{
+  unsigned const char kTestInput[] = { 0xde, 0xad, 0xbe, 0xef };
+  unsigned const char kAuthFail[] =
+  {
+    0x05,
+    0xff,
+  };
+  unsigned char buf[4];
+  BIO *proxy = proxy_bio (self->test, "socks5");
+  BIO_proxy_set_optimistic (proxy, 1);
+  EXPECT_EQ (4, BIO_write (proxy, kTestInput, sizeof (kTestInput)));
+  put_bytes (self->test, kAuthFail, sizeof (kAuthFail));
+  put_bytes (self->test, kSocks5ConnectReply, sizeof (kSocks5ConnectReply));
+  EXPECT_EQ (0, BIO_read (proxy, buf, sizeof (buf)));
+}
+
+TEST_F (test_bio, http_optimistic)
+{
+  unsigned const char kTestInput[] = { 0xde, 0xad, 0xbe, 0xef };
+  unsigned const char kTestOutput[] = { 0xca, 0xfe };
+  unsigned char buf[sizeof (kTestOutput)];
+  BIO *proxy = proxy_bio (self->test, "http");
+  char kConnectRequest[1024];
+  char kConnectResponse[] = "HTTP/1.0 200 OK\r\n"
+                            "Uninteresting-Header: foobar\r\n"
+                            "\r\n";
+  BIO_proxy_set_optimistic (proxy, 1);
+  snprintf (kConnectRequest, sizeof (kConnectRequest),
+            "CONNECT %s:%d HTTP/1.1\r\nHost: %s:%d\r\n\r\n",
+            kTestHost, TEST_PORT, kTestHost, TEST_PORT);
+  EXPECT_EQ (4, BIO_write (proxy, kTestInput, sizeof (kTestInput)));
+  EXPECT_EQ (0, need_out_bytes (self->test,
+                                (unsigned char *) kConnectRequest,
+                                strlen (kConnectRequest)));
+  EXPECT_EQ (0, need_out_bytes (self->test, kTestInput,
+                                sizeof (kTestInput)));
+  EXPECT_EQ (0, BIO_test_output_left (self->test));
+  put_bytes (self->test, (unsigned char *) kConnectResponse,
+             strlen (kConnectResponse));
+  put_bytes (self->test, kTestOutput, sizeof (kTestOutput));
+  EXPECT_EQ (2, BIO_read (proxy, buf, sizeof (buf)));
+  EXPECT_EQ (0, memcmp (buf, kTestOutput, sizeof (kTestOutput)));
+}
+
 TEST_F (test_bio, http_success)
 {
   unsigned const char kTestInput[] = { 0xde, 0xad, 0xbe, 0xef };
@@ -35,8 +35,15 @@
 #include "src/common/strnlen.h"
 #endif
 
+#include "src/probes.h"
 #include "src/proxy-bio.h"
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define BIO_get_data(b) ((b)->ptr)
+#define BIO_set_data(b, data) ((b)->ptr = (data))
+#define BIO_set_init(b, v) ((b)->init = (v))
+#endif
+
 int socks4a_connect (BIO *b);
 int socks5_connect (BIO *b);
 int http_connect (BIO *b);
@@ -50,33 +57,82 @@ int proxy_new (BIO *b)
   ctx->connect = NULL;
   ctx->host = NULL;
   ctx->port = 0;
-  b->init = 1;
-  b->flags = 0;
-  b->ptr = ctx;
+  ctx->optimistic = 0;
+  ctx->requested = 0;
+  ctx->early = NULL;
+  ctx->early_len = 0;
+  BIO_set_init (b, 1);
+  BIO_set_data (b, ctx);
   return 1;
 }
 
 int proxy_free (BIO *b)
 {
   struct proxy_ctx *c;
-  if (!b || !b->ptr)
+  if (!b || !BIO_get_data (b))
     return 1;
-  c = (struct proxy_ctx *) b->ptr;
+  c = (struct proxy_ctx *) BIO_get_data (b);
   if (c->host)
     free (c->host);
   c->host = NULL;
-  b->ptr = NULL;
+  BIO_set_data (b, NULL);
   free (c);
   return 1;
 }
 
+/*
+ * Sends the |sz| byte request in |buf| to the proxy, along with the write
+ * proxy_write() was given if there is one, so both share a flight.  Returns
+ * 1 on success, 0 on a short write and -1 on error.
+ */
+static int send_request (BIO *b, const void *buf, size_t sz)
+{
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
+  size_t len = sz;
+  unsigned char *flight = (unsigned char *) buf;
+  int r;
+  if (ctx->early)
+    {
+      len += ctx->early_len;
+      flight = malloc (len);
+      if (!flight)
+        return -1;
+      memcpy (flight, buf, sz);
+      memcpy (flight + sz, ctx->early, ctx->early_len);
+    }
+  r = BIO_write (BIO_next (b), flight, len);
+  if (flight != buf)
+    free (flight);
+  if ( -1 == r )
+    return -1;
+  if ( (size_t) r != len)
+    return 0;
+  ctx->requested = 1;
+  return 1;
+}
+
+static int socks5_read_method (BIO *b)
+{
+  unsigned char buf[2];
+  if (BIO_read (BIO_next (b), buf, 2) != 2)
+    return 0;
+  if (buf[0] != 0x05 || buf[1] != 0x00)
+    {
+      verb ("V: proxy5: auth error %02x %02x", buf[0], buf[1]);
+      return 0;
+    }
+  return 1;
+}
+
 int socks4a_connect (BIO *b)
 {
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
   int r;
   unsigned char buf[NI_MAXHOST + 16];
   uint16_t port_n = htons (ctx->port);
   size_t sz = 0;
+  if (ctx->requested)
+    goto reply;
   verb ("V: proxy4: connecting %s:%d", ctx->host, ctx->port);
   /*
    * Packet layout:
@@ -102,13 +158,15 @@ int socks4a_connect (BIO *b)
 
   memcpy (buf + sz, ctx->host, strlen (ctx->host) + 1);
   sz += strlen (ctx->host) + 1;
-  r = BIO_write (b->next_bio, buf, sz);
-  if ( -1 == r )
-    return -1;
-  if ( (size_t) r != sz)
-    return 0;
+  r = send_request (b, buf, sz);
+  if (r != 1)
+    return r;
+  /* the reply waits for the first read */
+  if (ctx->early)
+    return 1;
+reply:
   /* server reply: 1 + 1 + 2 + 4 */
-  r = BIO_read (b->next_bio, buf, 8);
+  r = BIO_read (BIO_next (b), buf, 8);
   if ( -1 == r )
     return -1;
   if ( (size_t) r != 8)
@@ -126,9 +184,11 @@ int socks5_connect (BIO *b)
 {
   unsigned char buf[NI_MAXHOST + 16];
   int r;
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
   uint16_t port_n = htons (ctx->port);
   size_t sz = 0;
+  if (ctx->requested)
+    goto reply;
   /* the length for SOCKS addresses is only one byte. */
   if (strnlen (ctx->host, UINT8_MAX + 1) == UINT8_MAX + 1)
     return 0;
@@ -140,21 +200,21 @@ int socks5_connect (BIO *b)
    * nb: method types
    *
    * We support only one method (no auth, 0x00). Others listed in RFC
-   * 1928.
+   * 1928.  Since that is the only answer we'd go on with, an optimistic
+   * proxy gets the connect packet right behind it.
    */
   buf[0] = 0x05;
   buf[1] = 0x01;
   buf[2] = 0x00;
-  r = BIO_write (b->next_bio, buf, 3);
-  if (r != 3)
-    return 0;
-  r = BIO_read (b->next_bio, buf, 2);
-  if (r != 2)
-    return 0;
-  if (buf[0] != 0x05 || buf[1] != 0x00)
+  sz += 3;
+  if (!ctx->optimistic)
     {
-      verb ("V: proxy5: auth error %02x %02x", buf[0], buf[1]);
-      return 0;
+      r = BIO_write (BIO_next (b), buf, 3);
+      if (r != 3)
+        return 0;
+      if (!socks5_read_method (b))
+        return 0;
+      sz = 0;
     }
   /*
    * Connect packet layout:
@@ -165,20 +225,23 @@ int socks5_connect (BIO *b)
    * nb: addr len (1b) + addr bytes, no null termination
    * 2b: port, network byte order
    */
-  buf[0] = 0x05;
-  buf[1] = 0x01;
-  buf[2] = 0x00;
-  buf[3] = 0x03;
-  buf[4] = strlen (ctx->host);
+  buf[sz + 0] = 0x05;
+  buf[sz + 1] = 0x01;
+  buf[sz + 2] = 0x00;
+  buf[sz + 3] = 0x03;
+  buf[sz + 4] = strlen (ctx->host);
   sz += 5;
-  memcpy (buf + 5, ctx->host, strlen (ctx->host));
+  memcpy (buf + sz, ctx->host, strlen (ctx->host));
   sz += strlen (ctx->host);
   memcpy (buf + sz, &port_n, sizeof (port_n));
   sz += sizeof (port_n);
-  r = BIO_write (b->next_bio, buf, sz);
-  if ( -1 == r )
-    return -1;
-  if ( (size_t) r != sz)
+  r = send_request (b, buf, sz);
+  if (r != 1)
+    return r;
+  if (ctx->early)
+    return 1;
+reply:
+  if (ctx->optimistic && !socks5_read_method (b))
     return 0;
   /*
    * Server's response:
@@ -190,7 +253,7 @@ int socks5_connect (BIO *b)
    * 2b: port, network byte order
    */
   /* grab up through the addr type */
-  r = BIO_read (b->next_bio, buf, 4);
+  r = BIO_read (BIO_next (b), buf, 4);
   if ( -1 == r )
     return -1;
   if (r != 4)
@@ -203,14 +266,14 @@ int socks5_connect (BIO *b)
   if (buf[3] == 0x03)
     {
       unsigned int len;
-      r = BIO_read (b->next_bio, buf + 4, 1);
+      r = BIO_read (BIO_next (b), buf + 4, 1);
       if (r != 1)
         return 0;
       /* host (buf[4] bytes) + port (2 bytes) */
       len = buf[4] + 2;
       while (len)
         {
-          r = BIO_read (b->next_bio, buf + 5, min (len, sizeof (buf)));
+          r = BIO_read (BIO_next (b), buf + 5, min (len, sizeof (buf)));
           if (r <= 0)
             return 0;
           len -= min (len, r);
@@ -219,7 +282,7 @@ int socks5_connect (BIO *b)
   else if (buf[3] == 0x01)
     {
       /* 4 bytes ipv4 addr, 2 bytes port */
-      r = BIO_read (b->next_bio, buf + 4, 6);
+      r = BIO_read (BIO_next (b), buf + 4, 6);
       if (r != 6)
         return 0;
     }
@@ -248,30 +311,22 @@ int sock_gets (BIO *b, char *buf, size_t sz)
 int http_connect (BIO *b)
 {
   int r;
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
   char buf[4096];
   int retcode;
-  snprintf (buf, sizeof (buf), "CONNECT %s:%d HTTP/1.1\r\n",
-            ctx->host, ctx->port);
-  r = BIO_write (b->next_bio, buf, strlen (buf));
-  if ( -1 == r )
-    return -1;
-  if ( (size_t) r != strlen(buf))
-    return 0;
-  /* required by RFC 2616 14.23 */
-  snprintf (buf, sizeof (buf), "Host: %s:%d\r\n", ctx->host, ctx->port);
-  r = BIO_write (b->next_bio, buf, strlen (buf));
-  if ( -1 == r )
-    return -1;
-  if ( (size_t) r != strlen(buf))
-    return 0;
-  strcpy (buf, "\r\n");
-  r = BIO_write (b->next_bio, buf, strlen (buf));
-  if ( -1 == r )
-    return -1;
-  if ( (size_t) r != strlen(buf))
-    return 0;
-  r = sock_gets (b->next_bio, buf, sizeof (buf));
+  if (ctx->requested)
+    goto reply;
+  /* Host is required by RFC 2616 14.23 */
+  snprintf (buf, sizeof (buf),
+            "CONNECT %s:%d HTTP/1.1\r\nHost: %s:%d\r\n\r\n",
+            ctx->host, ctx->port, ctx->host, ctx->port);
+  r = send_request (b, buf, strlen (buf));
+  if (r != 1)
+    return r;
+  if (ctx->early)
+    return 1;
+reply:
+  r = sock_gets (BIO_next (b), buf, sizeof (buf));
   if (r)
     return 0;
   /* use %*s to ignore the version */
@@ -279,7 +334,7 @@ int http_connect (BIO *b)
     return 0;
   if (retcode < 200 || retcode > 299)
     return 0;
-  while (! (r = sock_gets (b->next_bio, buf, sizeof (buf))))
+  while (! (r = sock_gets (BIO_next (b), buf, sizeof (buf))))
     {
       if (!strcmp (buf, "\r\n"))
         {
@@ -291,23 +346,46 @@ int http_connect (BIO *b)
   return 0;
 }
 
+/* Sets up the tunnel, or in optimistic mode whichever half of it is next. */
+static int proxy_connect (BIO *b)
+{
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
+  int r;
+  assert (ctx->connect);
+  if (!ctx->requested)
+    PROBE0 (proxy_start);
+  r = ctx->connect (b);
+  if (r <= 0 || ctx->connected)
+    PROBE1 (proxy_done, r);
+  return r;
+}
+
 int proxy_write (BIO *b, const char *buf, int sz)
 {
   int r;
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
 
   assert (buf);
   if (sz <= 0)
     return 0;
-  if (!b->next_bio)
+  if (!BIO_next (b))
     return 0;
   if (!ctx->connected)
     {
-      assert (ctx->connect);
-      if (!ctx->connect (b))
-        return 0;
+      if (ctx->optimistic && !ctx->requested)
+        {
+          ctx->early = buf;
+          ctx->early_len = sz;
+        }
+      r = proxy_connect (b);
+      ctx->early = NULL;
+      if (r <= 0)
+        return r;
+      /* |buf| went out with the request */
+      if (!ctx->connected)
+        return sz;
     }
-  r = BIO_write (b->next_bio, buf, sz);
+  r = BIO_write (BIO_next (b), buf, sz);
   BIO_clear_retry_flags (b);
   BIO_copy_next_retry (b);
   return r;
@@ -316,18 +394,18 @@ int proxy_write (BIO *b, const char *buf, int sz)
 int proxy_read (BIO *b, char *buf, int sz)
 {
   int r;
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
 
   assert (buf);
-  if (!b->next_bio)
+  if (!BIO_next (b))
     return 0;
   if (!ctx->connected)
     {
-      assert (ctx->connect);
-      if (!ctx->connect (b))
+      r = proxy_connect (b);
+      if (!r)
         return 0;
     }
-  r = BIO_read (b->next_bio, buf, sz);
+  r = BIO_read (BIO_next (b), buf, sz);
   BIO_clear_retry_flags (b);
   BIO_copy_next_retry (b);
   return r;
@@ -337,43 +415,50 @@ long proxy_ctrl (BIO *b, int cmd, long num, void *ptr)
 {
   long ret;
   struct proxy_ctx *ctx;
-  if (!b->next_bio)
+  if (!BIO_next (b))
     return 0;
-  ctx = (struct proxy_ctx *) b->ptr;
+  ctx = (struct proxy_ctx *) BIO_get_data (b);
   assert (ctx);
   switch (cmd)
     {
     case BIO_C_DO_STATE_MACHINE:
       BIO_clear_retry_flags (b);
-      ret = BIO_ctrl (b->next_bio, cmd, num, ptr);
+      ret = BIO_ctrl (BIO_next (b), cmd, num, ptr);
       BIO_copy_next_retry (b);
+      /* Once the transport is up, BIO_do_connect() also sets up the
+       * tunnel, so the caller can time it apart from what runs over it.
+       * An optimistic tunnel waits for the first write to go with it.
+       */
+      if (ret > 0 && !ctx->connected && !ctx->optimistic && ctx->connect)
+        ret = proxy_connect (b);
       break;
     case BIO_CTRL_DUP:
       ret = 0;
       break;
     default:
-      ret = BIO_ctrl (b->next_bio, cmd, num, ptr);
+      ret = BIO_ctrl (BIO_next (b), cmd, num, ptr);
     }
   return ret;
 }
 
 int proxy_gets (BIO *b, char *buf, int size)
 {
-  return BIO_gets (b->next_bio, buf, size);
+  return BIO_gets (BIO_next (b), buf, size);
 }
 
 int proxy_puts (BIO *b, const char *str)
 {
-  return BIO_puts (b->next_bio, str);
+  return BIO_puts (BIO_next (b), str);
 }
 
 long proxy_callback_ctrl (BIO *b, int cmd, bio_info_cb *fp)
 {
-  if (!b->next_bio)
+  if (!BIO_next (b))
     return 0;
-  return BIO_callback_ctrl (b->next_bio, cmd, fp);
+  return BIO_callback_ctrl (BIO_next (b), cmd, fp);
 }
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
 BIO_METHOD proxy_methods =
 {
   BIO_TYPE_MEM,
@@ -392,6 +477,28 @@ BIO_METHOD *BIO_f_proxy()
 {
   return &proxy_methods;
 }
+#else
+/* BIO_METHOD is opaque from 1.1.0 on; build it the first time it's asked
+ * for. */
+BIO_METHOD *BIO_f_proxy()
+{
+  static BIO_METHOD *proxy_methods;
+  if (proxy_methods)
+    return proxy_methods;
+  proxy_methods = BIO_meth_new (BIO_TYPE_MEM, "proxy");
+  if (!proxy_methods)
+    return NULL;
+  BIO_meth_set_write (proxy_methods, proxy_write);
+  BIO_meth_set_read (proxy_methods, proxy_read);
+  BIO_meth_set_puts (proxy_methods, proxy_puts);
+  BIO_meth_set_gets (proxy_methods, proxy_gets);
+  BIO_meth_set_ctrl (proxy_methods, proxy_ctrl);
+  BIO_meth_set_create (proxy_methods, proxy_new);
+  BIO_meth_set_destroy (proxy_methods, proxy_free);
+  BIO_meth_set_callback_ctrl (proxy_methods, proxy_callback_ctrl);
+  return proxy_methods;
+}
+#endif
 
 /* API starts here */
 
@@ -402,7 +509,7 @@ BIO API *BIO_new_proxy()
 
 int API BIO_proxy_set_type (BIO *b, const char *type)
 {
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
   if (!strcmp (type, "socks5"))
     ctx->connect = socks5_connect;
   else if (!strcmp (type, "socks4a"))
@@ -416,7 +523,7 @@ int API BIO_proxy_set_type (BIO *b, const char *type)
 
 int API BIO_proxy_set_host (BIO *b, const char *host)
 {
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
   if (strnlen (host, NI_MAXHOST) == NI_MAXHOST)
     return 1;
   ctx->host = strdup (host);
@@ -425,6 +532,12 @@ int API BIO_proxy_set_host (BIO *b, const char *host)
 
 void API BIO_proxy_set_port (BIO *b, uint16_t port)
 {
-  struct proxy_ctx *ctx = (struct proxy_ctx *) b->ptr;
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
   ctx->port = port;
 }
+
+void API BIO_proxy_set_optimistic (BIO *b, int optimistic)
+{
+  struct proxy_ctx *ctx = (struct proxy_ctx *) BIO_get_data (b);
+  ctx->optimistic = optimistic;
+}
@@ -20,6 +20,12 @@ struct proxy_ctx {
   uint16_t port;
   int connected;
   int (*connect)(BIO *b);
+  /* Optimistic mode: the request goes out with the first write and its
+   * reply is read ahead of the first read. */
+  int optimistic;
+  int requested;       /* the request is out, its reply not yet read */
+  const char *early;   /* the write to send along with the request */
+  int early_len;
 };
 
 BIO *BIO_new_proxy();
@@ -28,5 +34,8 @@ BIO *BIO_new_proxy();
 int BIO_proxy_set_type (BIO *b, const char *type);
 int BIO_proxy_set_host (BIO *b, const char *host);
 void BIO_proxy_set_port (BIO *b, uint16_t port);
+/* Sends the proxy request, the first write and (for SOCKS5) the greeting in
+ * one flight rather than waiting on the proxy between them. */
+void BIO_proxy_set_optimistic (BIO *b, int optimistic);
 
 #endif /* !PROXY_BIO_H */
@@ -33,6 +33,51 @@
 #include "src/proxy-polarssl.h"
 #include "src/util.h"
 
+/*
+ * Sends the |sz| byte request in |buf| to the proxy, along with the write
+ * proxy_polarssl_send() was given if there is one, so both share a flight.
+ * Returns 1 on success.
+ */
+static int send_request(proxy_polarssl_ctx *ctx, const unsigned char *buf,
+                        size_t sz)
+{
+  size_t len = sz;
+  unsigned char *flight = (unsigned char *) buf;
+  int r;
+
+  if (ctx->early) {
+    len += ctx->early_len;
+    flight = malloc(len);
+    if (!flight)
+      return 0;
+    memcpy(flight, buf, sz);
+    memcpy(flight + sz, ctx->early, ctx->early_len);
+  }
+
+  r = ctx->f_send(ctx->p_send, flight, len);
+  if (flight != buf)
+    free(flight);
+  if (r < 0 || (size_t) r != len)
+    return 0;
+
+  ctx->requested = 1;
+  return 1;
+}
+
+static int socks5_read_method(proxy_polarssl_ctx *ctx)
+{
+  unsigned char buf[2];
+
+  if (ctx->f_recv(ctx->p_recv, buf, 2) != 2)
+    return 0;
+
+  if (buf[0] != 0x05 || buf[1] != 0x00) {
+    verb("V: proxy5: auth error %02x %02x", buf[0], buf[1]);
+    return 0;
+  }
+  return 1;
+}
+
 int socks4a_connect(proxy_polarssl_ctx *ctx)
 {
   int r;
@@ -43,6 +88,9 @@ int socks4a_connect(proxy_polarssl_ctx *ctx)
   if (!ctx)
     return 0;
 
+  if (ctx->requested)
+    goto reply;
+
   verb("V: proxy4: connecting %s:%d", ctx->host, ctx->port);
 
   port_n = htons(ctx->port);
@@ -75,10 +123,14 @@ int socks4a_connect(proxy_polarssl_ctx *ctx)
   memcpy(buf + sz, ctx->host, strlen(ctx->host) + 1);
   sz += strlen(ctx->host) + 1;
 
-  r = ctx->f_send(ctx->p_send, buf, sz);
-  if (r != sz)
+  if (!send_request(ctx, buf, sz))
     return 0;
 
+  /* the reply waits for the first read */
+  if (ctx->early)
+    return 1;
+
+reply:
   /* server reply: 1 + 1 + 2 + 4 */
   r = ctx->f_recv(ctx->p_recv, buf, 8);
   if (r != 8)
@@ -102,6 +154,9 @@ int socks5_connect(proxy_polarssl_ctx *ctx)
   if (!ctx)
     return 0;
 
+  if (ctx->requested)
+    goto reply;
+
   /* the length for SOCKS addresses is only one byte. */
   if (strnlen(ctx->host, UINT8_MAX + 1) == UINT8_MAX + 1)
     return 0;
@@ -117,23 +172,22 @@ int socks5_connect(proxy_polarssl_ctx *ctx)
    * nb: method types
    *
    * We support only one method (no auth, 0x00). Others listed in RFC
-   * 1928.
+   * 1928.  Since that is the only answer we'd go on with, an optimistic
+   * proxy gets the connect packet right behind it.
    */
   buf[0] = 0x05;
   buf[1] = 0x01;
   buf[2] = 0x00;
+  sz += 3;
 
-  r = ctx->f_send(ctx->p_send, buf, 3);
-  if (r != 3)
-    return 0;
-
-  r = ctx->f_recv(ctx->p_recv, buf, 2);
-  if (r != 2)
-    return 0;
+  if (!ctx->optimistic) {
+    r = ctx->f_send(ctx->p_send, buf, 3);
+    if (r != 3)
+      return 0;
 
-  if (buf[0] != 0x05 || buf[1] != 0x00) {
-    verb("V: proxy5: auth error %02x %02x", buf[0], buf[1]);
-    return 0;
+    if (!socks5_read_method(ctx))
+      return 0;
+    sz = 0;
   }
 
   /*
@@ -145,19 +199,25 @@ int socks5_connect(proxy_polarssl_ctx *ctx)
    * nb: addr len (1b) + addr bytes, no null termination
    * 2b: port, network byte order
    */
-  buf[0] = 0x05;
-  buf[1] = 0x01;
-  buf[2] = 0x00;
-  buf[3] = 0x03;
-  buf[4] = strlen(ctx->host);
+  buf[sz + 0] = 0x05;
+  buf[sz + 1] = 0x01;
+  buf[sz + 2] = 0x00;
+  buf[sz + 3] = 0x03;
+  buf[sz + 4] = strlen(ctx->host);
   sz += 5;
-  memcpy(buf + 5, ctx->host, strlen(ctx->host));
+  memcpy(buf + sz, ctx->host, strlen(ctx->host));
   sz += strlen(ctx->host);
   memcpy(buf + sz, &port_n, sizeof(port_n));
   sz += sizeof(port_n);
 
-  r = ctx->f_send(ctx->p_send, buf, sz);
-  if (r != sz)
+  if (!send_request(ctx, buf, sz))
+    return 0;
+
+  if (ctx->early)
+    return 1;
+
+reply:
+  if (ctx->optimistic && !socks5_read_method(ctx))
     return 0;
 
   /*
@@ -226,21 +286,20 @@ int http_connect(proxy_polarssl_ctx *ctx)
   char buf[4096];
   int retcode;
 
-  snprintf(buf, sizeof(buf), "CONNECT %s:%d HTTP/1.1\r\n",
-           ctx->host, ctx->port);
-  r = ctx->f_send(ctx->p_send, (unsigned char *) buf, strlen(buf));
-  if (r != strlen(buf))
-    return 0;
-  /* required by RFC 2616 14.23 */
-  snprintf(buf, sizeof(buf), "Host: %s:%d\r\n", ctx->host, ctx->port);
-  r = ctx->f_send(ctx->p_send, (unsigned char *) buf, strlen(buf));
-  if (r != strlen(buf))
-    return 0;
-  strcpy(buf, "\r\n");
-  r = ctx->f_send(ctx->p_send, (unsigned char *) buf, strlen(buf));
-  if (r != strlen(buf))
+  if (ctx->requested)
+    goto reply;
+
+  /* Host is required by RFC 2616 14.23 */
+  snprintf(buf, sizeof(buf),
+           "CONNECT %s:%d HTTP/1.1\r\nHost: %s:%d\r\n\r\n",
+           ctx->host, ctx->port, ctx->host, ctx->port);
+  if (!send_request(ctx, (unsigned char *) buf, strlen(buf)))
     return 0;
 
+  if (ctx->early)
+    return 1;
+
+reply:
   r = sock_gets(ctx, buf, sizeof(buf));
   if (r)
     return 0;
@@ -322,6 +381,11 @@ void API proxy_polarssl_set_port(proxy_polarssl_ctx *ctx, uint16_t port)
   ctx->port = port;
 }
 
+void API proxy_polarssl_set_optimistic(proxy_polarssl_ctx *ctx, int optimistic)
+{
+  ctx->optimistic = optimistic;
+}
+
 int API proxy_polarssl_recv(void *ctx, unsigned char *data, size_t len)
 {
   proxy_polarssl_ctx *proxy = (proxy_polarssl_ctx *) ctx;
@@ -332,9 +396,9 @@ int API proxy_polarssl_recv(void *ctx, unsigned char *data, size_t len)
 
   if (!proxy->connected)
   {
-    r = proxy->f_connect(ctx);
-    if (r)
-      return (r);
+    r = proxy->f_connect(proxy);
+    if (r != 1)
+      return -1;
   }
 
   return proxy->f_recv(proxy->p_recv, data, len);
@@ -351,9 +415,17 @@ int API proxy_polarssl_send(void *ctx, const unsigned char *data, size_t len)
 
   if (!proxy->connected)
   {
-    r = proxy->f_connect(ctx);
-    if (r)
-      return (r);
+    if (proxy->optimistic && !proxy->requested) {
+      proxy->early = data;
+      proxy->early_len = len;
+    }
+    r = proxy->f_connect(proxy);
+    proxy->early = NULL;
+    if (r != 1)
+      return -1;
+    /* |data| went out with the request */
+    if (!proxy->connected)
+      return len;
   }
 
   return proxy->f_send(proxy->p_send, data, len);
@@ -28,6 +28,11 @@ struct _proxy_polarssl_ctx {
 
   void *p_recv;               /*!< context for reading operations   */
   void *p_send;               /*!< context for writing operations   */
+
+  int optimistic;             /*!< send the request with the first write */
+  int requested;              /*!< request sent, reply not yet read  */
+  const unsigned char *early; /*!< the write to send with the request */
+  size_t early_len;
 };
 
 int proxy_polarssl_init(proxy_polarssl_ctx *proxy);
@@ -39,6 +44,7 @@ void proxy_polarssl_set_bio(proxy_polarssl_ctx *ctx,
 int proxy_polarssl_set_scheme(proxy_polarssl_ctx *ctx, const char *scheme);
 int proxy_polarssl_set_host(proxy_polarssl_ctx *ctx, const char *host);
 void proxy_polarssl_set_port(proxy_polarssl_ctx *ctx, uint16_t port);
+void proxy_polarssl_set_optimistic(proxy_polarssl_ctx *ctx, int optimistic);
 
 int proxy_polarssl_recv(void *ctx, unsigned char *data, size_t len);
 int proxy_polarssl_send(void *ctx, const unsigned char *data, size_t len);
@@ -0,0 +1,84 @@
+/*
+ * random-time.c - does a source's server_random carry its clock?
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * RFC 5246 had servers lead server_random with their clock, which is
+ * where tlsdate takes the time from.  Many now fill all of it with random
+ * bytes, and a random value can still land in the sane range, so a
+ * single sample proves little.  Each one is checked against
+ * the HTTP Date header when there is one, or else against the last
+ * timestamp from the same source advanced by the time since.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "src/random-time.h"
+#include "src/tlsdate.h"
+
+const char *
+random_kind_str (int kind)
+{
+  switch (kind)
+    {
+    case RANDOM_TIME:
+      return "time";
+    case RANDOM_NOISE:
+      return "random";
+    case RANDOM_ZERO:
+      return "zero";
+    default:
+      return "unknown";
+    }
+}
+
+int
+random_kind_lacks_time (int kind)
+{
+  return kind == RANDOM_NOISE || kind == RANDOM_ZERO;
+}
+
+static void
+settle (struct random_time *r, int kind, int conclusive)
+{
+  if (kind == r->pending)
+    r->votes++;
+  else
+    {
+      r->pending = kind;
+      r->votes = 1;
+    }
+  if (conclusive || r->votes >= RANDOM_TIME_VOTES)
+    r->kind = kind;
+}
+
+int
+random_time_observe (struct random_time *r, uint32_t t, time_t mono,
+                     uint32_t ref)
+{
+  int64_t expected = 0;
+  if (ref)
+    expected = ref;
+  else if (r->last_mono)
+    expected = (int64_t) r->last + (mono - r->last_mono);
+  r->last = t;
+  r->last_mono = mono;
+  if (!t)
+    settle (r, RANDOM_ZERO, 1);
+  else if (!is_sane_time (t))
+    settle (r, RANDOM_NOISE, 1);
+  else if (expected)
+    settle (r, llabs ((int64_t) t - expected) <= RANDOM_TIME_SLOP ?
+            RANDOM_TIME : RANDOM_NOISE, 0);
+  return r->kind;
+}
+
+void
+random_time_false_ticker (struct random_time *r)
+{
+  r->last_mono = 0;
+  settle (r, RANDOM_NOISE, 1);
+}
@@ -0,0 +1,51 @@
+/*
+ * random-time.h - does a source's server_random carry its clock?
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef RANDOM_TIME_H
+#define RANDOM_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+enum random_kind_t
+{
+  RANDOM_UNKNOWN = 0,  /* not enough seen yet */
+  RANDOM_TIME,         /* the first four bytes are the server's clock */
+  RANDOM_NOISE,        /* all of it is random */
+  RANDOM_ZERO,         /* the first four bytes are zero */
+};
+
+/* How far a timestamp may stray from what it is checked against. */
+#define RANDOM_TIME_SLOP 600
+/* Agreeing observations needed to settle on a kind, unless one rules
+ * timestamps out on its own.
+ */
+#define RANDOM_TIME_VOTES 2
+
+struct random_time
+{
+  int kind;          /* enum random_kind_t, settled */
+  int pending;       /* the kind the last observations agree on... */
+  int votes;         /* ...and how many of them there are */
+  uint32_t last;     /* the last timestamp seen... */
+  time_t last_mono;  /* ...and when, in CLOCK_MONOTONIC seconds; 0 if none */
+};
+
+const char *random_kind_str (int kind);
+/* Whether a source of |kind| can't give the time over plain TLS. */
+int random_kind_lacks_time (int kind);
+/* Notes the first four bytes of server_random, |t|, seen at |mono|.  |ref|
+ * is a time known good for the same moment, such as the HTTP Date header,
+ * or 0; without one, |t| is checked against the last timestamp seen.
+ * Returns the settled kind.
+ */
+int random_time_observe (struct random_time *r, uint32_t t, time_t mono,
+                         uint32_t ref);
+/* Notes a run the helper gave up on as a false ticker. */
+void random_time_false_ticker (struct random_time *r);
+
+#endif /* RANDOM_TIME_H */
@@ -0,0 +1,290 @@
+/*
+ * roughtime.c - Roughtime client packets
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The original Roughtime protocol (roughtime.googlesource.com).  A message
+ * is a little-endian tag count N, N-1 value offsets, N tags in increasing
+ * order, then the values, every part a multiple of four bytes long.  A
+ * server answers a padded request holding a nonce with the nonce's place
+ * in a Merkle tree of the requests it batched, the tree's root, its time
+ * and a radius, all signed by a short-lived key that its long-term key
+ * has delegated to.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#include "src/roughtime.h"
+#include "src/util.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+static uint32_t
+get32 (const uint8_t *p)
+{
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+         (uint32_t) p[3] << 24;
+}
+
+static uint64_t
+get64 (const uint8_t *p)
+{
+  return (uint64_t) get32 (p) | (uint64_t) get32 (p + 4) << 32;
+}
+
+static void
+put32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static int
+hex_digit (int c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = tolower (c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+int
+roughtime_parse_key (const char *text, uint8_t key[ROUGHTIME_KEY_LEN])
+{
+  uint8_t buf[3 * 64 / 4];
+  size_t len = strlen (text);
+  int i, n;
+  if (len == 2 * ROUGHTIME_KEY_LEN)
+    {
+      for (i = 0; i < ROUGHTIME_KEY_LEN; ++i)
+        {
+          int hi = hex_digit (text[2 * i]), lo = hex_digit (text[2 * i + 1]);
+          if (hi < 0 || lo < 0)
+            break;
+          key[i] = hi << 4 | lo;
+        }
+      if (i == ROUGHTIME_KEY_LEN)
+        return 0;
+    }
+  /* 32 bytes take 44 characters of base64, the last one padding. */
+  if (len != 44 || text[43] != '=' || text[42] == '=')
+    return 1;
+  n = EVP_DecodeBlock (buf, (const unsigned char *) text, len);
+  if (n != ROUGHTIME_KEY_LEN + 1)
+    return 1;
+  memcpy (key, buf, ROUGHTIME_KEY_LEN);
+  return 0;
+}
+
+size_t
+roughtime_encode_request (const uint8_t nonce[ROUGHTIME_NONCE_LEN],
+                          uint8_t buf[ROUGHTIME_REQUEST_LEN])
+{
+  /* Two tags: NONC, then PAD filling the rest. */
+  memset (buf, 0, ROUGHTIME_REQUEST_LEN);
+  put32 (buf, 2);
+  put32 (buf + 4, ROUGHTIME_NONCE_LEN);
+  put32 (buf + 8, ROUGHTIME_NONC);
+  put32 (buf + 12, ROUGHTIME_PAD);
+  memcpy (buf + 16, nonce, ROUGHTIME_NONCE_LEN);
+  return ROUGHTIME_REQUEST_LEN;
+}
+
+int
+roughtime_find_tag (const uint8_t *msg, size_t len, uint32_t tag,
+                    const uint8_t **value, size_t *value_len)
+{
+  uint32_t n, i, prev_tag = 0, prev_off = 0;
+  size_t header, body;
+  if (len < 4 || len % 4)
+    return -1;
+  n = get32 (msg);
+  if (!n || n > len / 8)
+    return -1;
+  header = 8 * (size_t) n;
+  body = len - header;
+  for (i = 0; i < n; ++i)
+    {
+      uint32_t t = get32 (msg + 4 * n + 4 * i);
+      uint32_t off = i ? get32 (msg + 4 * i) : 0;
+      uint32_t end = i + 1 < n ? get32 (msg + 4 * (i + 1)) : body;
+      if ((i && t <= prev_tag) || off % 4 || end % 4 || off < prev_off ||
+          end > body || off > end)
+        return -1;
+      if (t == tag)
+        {
+          *value = msg + header + off;
+          *value_len = end - off;
+          return 0;
+        }
+      prev_tag = t;
+      prev_off = off;
+    }
+  return -1;
+}
+
+/* Finds a tag whose value must be exactly |want| bytes long. */
+static const uint8_t *
+find_fixed (const uint8_t *msg, size_t len, uint32_t tag, size_t want)
+{
+  const uint8_t *value;
+  size_t value_len;
+  if (roughtime_find_tag (msg, len, tag, &value, &value_len) ||
+      value_len != want)
+    return NULL;
+  return value;
+}
+
+static int
+verify_sig (const uint8_t key[ROUGHTIME_KEY_LEN], const char *context,
+            const uint8_t *msg, size_t len, const uint8_t *sig)
+{
+#ifdef HAVE_EVP_PKEY_NEW_RAW_PUBLIC_KEY
+  uint8_t signed_buf[ROUGHTIME_MAX_REPLY + 64];
+  size_t context_len = strlen (context) + 1;
+  EVP_PKEY *pkey;
+  EVP_MD_CTX *ctx;
+  int ok = 0;
+  if (len > sizeof (signed_buf) - context_len)
+    return 0;
+  memcpy (signed_buf, context, context_len);
+  memcpy (signed_buf + context_len, msg, len);
+  pkey = EVP_PKEY_new_raw_public_key (EVP_PKEY_ED25519, NULL, key,
+                                      ROUGHTIME_KEY_LEN);
+  ctx = EVP_MD_CTX_new ();
+  if (pkey && ctx && EVP_DigestVerifyInit (ctx, NULL, NULL, NULL, pkey) == 1)
+    ok = EVP_DigestVerify (ctx, sig, ROUGHTIME_SIG_LEN, signed_buf,
+                           context_len + len) == 1;
+  EVP_MD_CTX_free (ctx);
+  EVP_PKEY_free (pkey);
+  return ok;
+#else
+  /* No Ed25519 before OpenSSL 1.1.1; tlsdated refuses the config. */
+  return 0;
+#endif
+}
+
+/* SHA-512 of |tweak| then |len_a| bytes at |a| and |len_b| at |b|. */
+static void
+tree_hash (uint8_t tweak, const uint8_t *a, size_t len_a, const uint8_t *b,
+           size_t len_b, uint8_t out[ROUGHTIME_HASH_LEN])
+{
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new ();
+  if (!ctx || EVP_DigestInit_ex (ctx, EVP_sha512 (), NULL) != 1 ||
+      EVP_DigestUpdate (ctx, &tweak, 1) != 1 ||
+      EVP_DigestUpdate (ctx, a, len_a) != 1 ||
+      EVP_DigestUpdate (ctx, b, len_b) != 1 ||
+      EVP_DigestFinal_ex (ctx, out, NULL) != 1)
+    /* Matches no root a server could sign. */
+    memset (out, 0, ROUGHTIME_HASH_LEN);
+  EVP_MD_CTX_free (ctx);
+}
+
+void
+roughtime_leaf_hash (const uint8_t nonce[ROUGHTIME_NONCE_LEN],
+                     uint8_t out[ROUGHTIME_HASH_LEN])
+{
+  tree_hash (0, nonce, ROUGHTIME_NONCE_LEN, NULL, 0, out);
+}
+
+/* Walks from the nonce's leaf up |path| and compares with |root|. */
+static int
+check_path (const uint8_t nonce[ROUGHTIME_NONCE_LEN], uint32_t index,
+            const uint8_t *path, size_t path_len, const uint8_t *root)
+{
+  uint8_t hash[ROUGHTIME_HASH_LEN];
+  size_t i;
+  if (path_len % ROUGHTIME_HASH_LEN)
+    return 0;
+  roughtime_leaf_hash (nonce, hash);
+  for (i = 0; i < path_len; i += ROUGHTIME_HASH_LEN)
+    {
+      if (index & 1)
+        tree_hash (1, path + i, ROUGHTIME_HASH_LEN, hash, ROUGHTIME_HASH_LEN,
+                   hash);
+      else
+        tree_hash (1, hash, ROUGHTIME_HASH_LEN, path + i, ROUGHTIME_HASH_LEN,
+                   hash);
+      index >>= 1;
+    }
+  return !index && !CRYPTO_memcmp (hash, root, ROUGHTIME_HASH_LEN);
+}
+
+int
+roughtime_verify_reply (const uint8_t key[ROUGHTIME_KEY_LEN],
+                        const uint8_t nonce[ROUGHTIME_NONCE_LEN],
+                        const uint8_t *buf, size_t len,
+                        struct roughtime_result *out)
+{
+  const uint8_t *sig, *srep, *cert, *dele, *dele_sig, *pubk, *root, *midp;
+  const uint8_t *radi, *mint, *maxt, *indx, *path;
+  size_t srep_len, cert_len, dele_len, path_len;
+  uint64_t midpoint;
+  if (!(sig = find_fixed (buf, len, ROUGHTIME_SIG, ROUGHTIME_SIG_LEN)) ||
+      roughtime_find_tag (buf, len, ROUGHTIME_SREP, &srep, &srep_len) ||
+      roughtime_find_tag (buf, len, ROUGHTIME_CERT, &cert, &cert_len) ||
+      roughtime_find_tag (buf, len, ROUGHTIME_PATH, &path, &path_len) ||
+      !(indx = find_fixed (buf, len, ROUGHTIME_INDX, 4)))
+    {
+      verb_debug ("[roughtime] reply is missing a tag");
+      return -1;
+    }
+  if (roughtime_find_tag (cert, cert_len, ROUGHTIME_DELE, &dele, &dele_len) ||
+      !(dele_sig = find_fixed (cert, cert_len, ROUGHTIME_SIG,
+                               ROUGHTIME_SIG_LEN)) ||
+      !(pubk = find_fixed (dele, dele_len, ROUGHTIME_PUBK,
+                           ROUGHTIME_KEY_LEN)) ||
+      !(mint = find_fixed (dele, dele_len, ROUGHTIME_MINT, 8)) ||
+      !(maxt = find_fixed (dele, dele_len, ROUGHTIME_MAXT, 8)))
+    {
+      verb_debug ("[roughtime] reply has a malformed certificate");
+      return -1;
+    }
+  if (!(root = find_fixed (srep, srep_len, ROUGHTIME_ROOT,
+                           ROUGHTIME_HASH_LEN)) ||
+      !(midp = find_fixed (srep, srep_len, ROUGHTIME_MIDP, 8)) ||
+      !(radi = find_fixed (srep, srep_len, ROUGHTIME_RADI, 4)))
+    {
+      verb_debug ("[roughtime] reply has a malformed signed response");
+      return -1;
+    }
+  if (!verify_sig (key, ROUGHTIME_DELE_CONTEXT, dele, dele_len, dele_sig))
+    {
+      verb_debug ("[roughtime] delegation isn't signed by the server's key");
+      return -1;
+    }
+  if (!verify_sig (pubk, ROUGHTIME_SREP_CONTEXT, srep, srep_len, sig))
+    {
+      verb_debug ("[roughtime] response isn't signed by the delegated key");
+      return -1;
+    }
+  midpoint = get64 (midp);
+  if (midpoint < get64 (mint) || midpoint > get64 (maxt))
+    {
+      verb_debug ("[roughtime] midpoint is outside the delegation's validity");
+      return -1;
+    }
+  if (!check_path (nonce, get32 (indx), path, path_len, root))
+    {
+      verb_debug ("[roughtime] our nonce isn't in the signed tree");
+      return -1;
+    }
+  out->midpoint_us = midpoint;
+  out->radius_us = get32 (radi);
+  return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * roughtime.h - Roughtime client packets
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef ROUGHTIME_H
+#define ROUGHTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROUGHTIME_REQUEST_LEN 1024  /* requests are padded to this */
+#define ROUGHTIME_MAX_REPLY 4096
+#define ROUGHTIME_NONCE_LEN 64
+#define ROUGHTIME_KEY_LEN 32        /* Ed25519 public key */
+#define ROUGHTIME_SIG_LEN 64
+#define ROUGHTIME_HASH_LEN 64       /* SHA-512 */
+
+/* Tags are four ASCII bytes read as a little-endian word. */
+#define ROUGHTIME_TAG(a, b, c, d) \
+  ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | \
+   (uint32_t) (d) << 24)
+#define ROUGHTIME_CERT ROUGHTIME_TAG ('C', 'E', 'R', 'T')
+#define ROUGHTIME_DELE ROUGHTIME_TAG ('D', 'E', 'L', 'E')
+#define ROUGHTIME_INDX ROUGHTIME_TAG ('I', 'N', 'D', 'X')
+#define ROUGHTIME_MAXT ROUGHTIME_TAG ('M', 'A', 'X', 'T')
+#define ROUGHTIME_MIDP ROUGHTIME_TAG ('M', 'I', 'D', 'P')
+#define ROUGHTIME_MINT ROUGHTIME_TAG ('M', 'I', 'N', 'T')
+#define ROUGHTIME_NONC ROUGHTIME_TAG ('N', 'O', 'N', 'C')
+#define ROUGHTIME_PAD ROUGHTIME_TAG ('P', 'A', 'D', 0xff)
+#define ROUGHTIME_PATH ROUGHTIME_TAG ('P', 'A', 'T', 'H')
+#define ROUGHTIME_PUBK ROUGHTIME_TAG ('P', 'U', 'B', 'K')
+#define ROUGHTIME_RADI ROUGHTIME_TAG ('R', 'A', 'D', 'I')
+#define ROUGHTIME_ROOT ROUGHTIME_TAG ('R', 'O', 'O', 'T')
+#define ROUGHTIME_SIG ROUGHTIME_TAG ('S', 'I', 'G', 0)
+#define ROUGHTIME_SREP ROUGHTIME_TAG ('S', 'R', 'E', 'P')
+
+/* Signatures cover one of these, NUL included, then the signed message. */
+#define ROUGHTIME_DELE_CONTEXT "RoughTime v1 delegation signature--"
+#define ROUGHTIME_SREP_CONTEXT "RoughTime v1 response signature"
+
+/* Replies with a wider radius than this tell us too little to be used. */
+#define ROUGHTIME_MAX_RADIUS_US (10 * 1000000)
+
+struct roughtime_result
+{
+  uint64_t midpoint_us;  /* server time, microseconds since the epoch */
+  uint32_t radius_us;    /* the server's bound on its own error */
+};
+
+/* Parses an Ed25519 public key given as base64 or hex.  Returns 0 on
+ * success.
+ */
+int roughtime_parse_key (const char *text, uint8_t key[ROUGHTIME_KEY_LEN]);
+/* Fills |buf| with a request for |nonce|; returns its length. */
+size_t roughtime_encode_request (const uint8_t nonce[ROUGHTIME_NONCE_LEN],
+                                 uint8_t buf[ROUGHTIME_REQUEST_LEN]);
+/* Finds |tag| in the message at |msg|.  Returns 0 and points |value| at it
+ * if the message is well formed and has the tag.
+ */
+int roughtime_find_tag (const uint8_t *msg, size_t len, uint32_t tag,
+                        const uint8_t **value, size_t *value_len);
+/* Checks that |buf| answers |nonce| under the long-term |key|: the key
+ * signed the delegation, the delegated key signed the response, the
+ * midpoint lies in the delegation's validity and the nonce is in the
+ * signed Merkle tree.  Returns 0 and fills |out| if all of that holds.
+ */
+int roughtime_verify_reply (const uint8_t key[ROUGHTIME_KEY_LEN],
+                            const uint8_t nonce[ROUGHTIME_NONCE_LEN],
+                            const uint8_t *buf, size_t len,
+                            struct roughtime_result *out);
+/* SHA-512 of a Merkle tree leaf holding |nonce|, as the root of a tree of
+ * one; for servers.
+ */
+void roughtime_leaf_hash (const uint8_t nonce[ROUGHTIME_NONCE_LEN],
+                          uint8_t out[ROUGHTIME_HASH_LEN]);
+
+#endif /* ROUGHTIME_H */
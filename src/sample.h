@@ -0,0 +1,85 @@
+/*
+ * sample.h - tlsdate-helper to tlsdated result format
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+
+/* "TDS1" - marks a tlsdate_sample written by `tlsdate -Vsample`. */
+#define TLSDATE_SAMPLE_MAGIC 0x54445331
+
+/* tlsdate_sample.flags */
+#define TLSDATE_SAMPLE_HTTP 0x1  /* time came from an HTTP Date header */
+#define TLSDATE_SAMPLE_ROUGHTIME 0x2  /* from a Roughtime server; |usec| and
+                                       * |radius_us| are set */
+#define TLSDATE_SAMPLE_NTS 0x4  /* from NTS-protected NTP; likewise */
+/* Either of the above: the sample is finer than a second. */
+#define TLSDATE_SAMPLE_SUBSEC (TLSDATE_SAMPLE_ROUGHTIME | TLSDATE_SAMPLE_NTS)
+/* The helper asked for TCP Fast Open.  connect() then returns before the
+ * SYN goes out, so |connected_ns| doesn't cover the TCP handshake; it lands
+ * in the next phase, along with the first write.
+ */
+#define TLSDATE_SAMPLE_TFO_TRIED 0x8
+#define TLSDATE_SAMPLE_TFO 0x10  /* ...and the server took our SYN's data */
+/* The chain matched the one tlsdated passed with -c and was still in date,
+ * so the CA store was never loaded.
+ */
+#define TLSDATE_SAMPLE_CHAIN_CACHED 0x20
+
+/*
+ * `tlsdate -Vraw` writes a single host-order uint32_t holding the server
+ * time.  `tlsdate -Vsample` writes this structure instead; its first member
+ * is that same uint32_t, and the magic after it tells a reader how much
+ * more to read.  The whole structure is written with one write(2) and is
+ * far smaller than PIPE_BUF, so it is never split on the monitor pipe.
+ */
+struct tlsdate_sample
+{
+  uint32_t time;        /* server time in seconds since the epoch */
+  uint32_t magic;       /* TLSDATE_SAMPLE_MAGIC */
+  uint32_t rtt_ms;      /* connect + handshake round trip in the helper */
+  uint32_t flags;       /* TLSDATE_SAMPLE_* */
+  /* CLOCK_MONOTONIC nanoseconds at the end of each phase of the fetch, so
+   * tlsdated can line them up with its own spawn and read times.  Zero when
+   * the helper could not tell.
+   */
+  uint64_t connected_ns;  /* TCP connection (to the proxy, if any) is up */
+  uint64_t handshake_ns;  /* TLS handshake (and HTTP Date read) done */
+  uint64_t verified_ns;   /* certificate and key checks done */
+  uint64_t sent_ns;       /* just before this sample was written */
+  uint64_t start_ns;      /* about to resolve the host (or proxy) */
+  uint64_t resolved_ns;   /* name resolved, if that could be told apart */
+  uint64_t proxied_ns;    /* proxy tunnel is up; zero without a proxy */
+  uint64_t tls_ns;        /* TLS handshake done, before any HTTP request */
+  /* The first four bytes of server_random in host order, whichever way the
+   * time was taken; servers that follow RFC 5246 put their clock there.
+   */
+  uint32_t random_time;
+  /* The helper's pid, which is the run tlsdated spawned, so a sample from
+   * a run it has given up on can be told apart; zero if unknown.
+   */
+  uint32_t pid;
+  /* SHA-256 of the leaf certificate's SubjectPublicKeyInfo; zero when the
+   * helper could not tell.
+   */
+  uint8_t spki_sha256[32];
+  /* Sub-second part of |time| and the server's bound on its error, for
+   * sources that give them.
+   */
+  uint32_t usec;
+  uint32_t radius_us;
+  /* SHA-256 over the SHA-256s of the DER of every certificate the server
+   * sent, leaf first, and the earliest notAfter among them in seconds since
+   * the epoch (zero if unknown).  Only set when the chain passed the CA
+   * store, on this run or, with TLSDATE_SAMPLE_CHAIN_CACHED, an earlier one.
+   */
+  uint8_t chain_sha256[32];
+  int64_t not_after;
+};
+
+#endif /* SAMPLE_H */
@@ -0,0 +1,41 @@
+/*
+ * sntp.h - SNTPv4 (RFC 4330) server packets
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef SNTP_H
+#define SNTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SNTP_PACKET_LEN 48
+#define SNTP_DEFAULT_PORT 123
+
+#define SNTP_LEAP_NONE 0
+#define SNTP_LEAP_ALARM 3  /* not synchronized */
+#define SNTP_MODE_CLIENT 3
+#define SNTP_MODE_SERVER 4
+
+struct state;
+
+/* Fills the parts of a reply that depend only on tlsdated's sync state
+ * (leap, stratum, precision, root delay and dispersion, reference id and
+ * timestamp) into |reply|, as of |mono| and |real|.  Returns 1 if the
+ * clock is synchronized to network time and 0 if replies say it isn't.
+ */
+int sntp_prepare (const struct state *state, const struct timespec *mono,
+                  const struct timespec *real,
+                  uint8_t reply[SNTP_PACKET_LEN]);
+/* Completes |reply|, prepared as above, as the answer to the |len| byte
+ * |request| received at |rx| and sent at |tx|.  Returns 0, or -1 if the
+ * request should be dropped.
+ */
+int sntp_answer (uint8_t reply[SNTP_PACKET_LEN], const uint8_t *request,
+                 size_t len, const struct timespec *rx,
+                 const struct timespec *tx);
+
+#endif /* SNTP_H */
@@ -0,0 +1,140 @@
+/*
+ * status-page.c - publish tlsdated's view of the clock in shared memory
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Writer side of src/tlsdate-status.h.  Updates are a few stores under a
+ * sequence lock, so they are cheap enough to make on every state change.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/tlsdate-status.h"
+#include "src/util.h"
+#include "src/tlsdate.h"
+
+/* Half a second: the server only sends whole seconds. */
+#define TRUNCATION_ERROR_NS 500000000LL
+
+/* Opens the page in place, so readers that mapped it under a previous
+ * tlsdated keep working.  Call before dropping privileges; the mapping
+ * stays writable afterwards.
+ */
+int
+status_page_open (struct state *state)
+{
+  const char *path = state->opts.status_page;
+  struct tlsdate_status_page *page;
+  uint32_t seq;
+  int fd;
+  fd = open (path, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      perror ("can't open status page '%s'", path);
+      return 1;
+    }
+  /* Readable by everyone regardless of umask; it holds nothing secret. */
+  if (fchmod (fd, 0644) < 0 ||
+      ftruncate (fd, TLSDATE_STATUS_PAGE_SIZE) < 0)
+    {
+      perror ("can't size status page '%s'", path);
+      close (fd);
+      return 1;
+    }
+  page = mmap (NULL, TLSDATE_STATUS_PAGE_SIZE, PROT_READ|PROT_WRITE,
+               MAP_SHARED, fd, 0);
+  close (fd);
+  if (page == MAP_FAILED)
+    {
+      perror ("can't map status page '%s'", path);
+      return 1;
+    }
+  /* Start over, but hold readers off while doing it.  The sequence keeps
+   * counting so a reader can't mistake the new contents for the old.
+   */
+  seq = page->seq | 1;
+  __atomic_store_n (&page->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  memset (&page->status, 0, sizeof (page->status));
+  page->magic = TLSDATE_STATUS_MAGIC;
+  page->version = TLSDATE_STATUS_VERSION;
+  __atomic_store_n (&page->seq, seq + 1, __ATOMIC_RELEASE);
+  state->status = page;
+  status_page_update (state);
+  return 0;
+}
+
+static int64_t
+mono_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Republishes sync type and flags.  |net_synced| is nonzero right after a
+ * network time was set, which also refreshes the sync details.
+ */
+static void
+publish (struct state *state, int net_synced)
+{
+  struct tlsdate_status_page *page = state->status;
+  struct tlsdate_status *st;
+  uint32_t seq;
+  if (!page)
+    return;
+  st = &page->status;
+  seq = page->seq;
+  __atomic_store_n (&page->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  st->generation++;
+  st->sync_type = state->last_sync_type;
+  st->last_time = state->last_time;
+  st->flags = 0;
+  if (state->clock_delta)
+    st->flags |= TLSDATE_STATUS_NET_SYNCED;
+  if (state->opts.dry_run)
+    st->flags |= TLSDATE_STATUS_DRY_RUN;
+  if (net_synced)
+    {
+      int64_t now = mono_ns ();
+      int64_t offset = (int64_t) (state->metrics.last_offset * 1e9);
+      /* The clock was set at the last network sync, so everything it has
+       * drifted since then shows up as this sync's offset.  Whole-second
+       * server times make this coarse until syncs are hours apart.
+       */
+      if (st->net_sync_mono && !state->opts.dry_run &&
+          now > st->net_sync_mono)
+        st->drift_ppb = (int64_t) (-(double) offset * 1e9 /
+                                   (now - st->net_sync_mono));
+      st->net_sync_time = state->last_time;
+      st->net_sync_mono = now;
+      st->offset_ns = offset;
+      st->error_ns = (uint64_t) (state->metrics.last_rtt * 5e8 +
+                                 state->metrics.last_radius * 1e9) +
+                     TRUNCATION_ERROR_NS;
+    }
+  __atomic_store_n (&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+status_page_update (struct state *state)
+{
+  publish (state, 0);
+}
+
+void
+status_page_net_synced (struct state *state)
+{
+  publish (state, 1);
+}
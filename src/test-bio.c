@@ -18,6 +18,12 @@
 #include "src/test-bio.h"
 #include "src/util.h"
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define BIO_get_data(b) ((b)->ptr)
+#define BIO_set_data(b, data) ((b)->ptr = (data))
+#define BIO_set_init(b, v) ((b)->init = (v))
+#endif
+
 int verbose;
 int verbose_debug;
 
@@ -34,7 +40,7 @@ struct test_ctx
 
 static struct test_ctx *bio_ctx (BIO *b)
 {
-  struct test_ctx *ctx = b->ptr;
+  struct test_ctx *ctx = BIO_get_data (b);
   assert (ctx->magic == kMagic);
   return ctx;
 }
@@ -70,16 +76,15 @@ int test_new (BIO *b)
   ctx->insz = 0;
   ctx->out = NULL;
   ctx->outsz = 0;
-  b->init = 1;
-  b->flags = 0;
-  b->ptr = ctx;
+  BIO_set_init (b, 1);
+  BIO_set_data (b, ctx);
   return 1;
 }
 
 int test_free (BIO *b)
 {
   struct test_ctx *ctx;
-  if (!b || !b->ptr)
+  if (!b || !BIO_get_data (b))
     return 1;
   ctx = bio_ctx (b);
   free (ctx->in);
@@ -114,6 +119,7 @@ long test_callback_ctrl (BIO *b, int cmd, bio_info_cb *fp)
   return 0;
 }
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
 BIO_METHOD test_methods =
 {
   BIO_TYPE_SOCKET,
@@ -132,6 +138,24 @@ BIO_METHOD *BIO_s_test()
 {
   return &test_methods;
 }
+#else
+BIO_METHOD *BIO_s_test()
+{
+  static BIO_METHOD *test_methods;
+  if (test_methods)
+    return test_methods;
+  test_methods = BIO_meth_new (BIO_TYPE_SOCKET, "test");
+  if (!test_methods)
+    return NULL;
+  BIO_meth_set_write (test_methods, test_write);
+  BIO_meth_set_read (test_methods, test_read);
+  BIO_meth_set_ctrl (test_methods, test_ctrl);
+  BIO_meth_set_create (test_methods, test_new);
+  BIO_meth_set_destroy (test_methods, test_free);
+  BIO_meth_set_callback_ctrl (test_methods, test_callback_ctrl);
+  return test_methods;
+}
+#endif
 
 BIO API *BIO_new_test()
 {
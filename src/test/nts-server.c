@@ -0,0 +1,444 @@
+/*
+ * nts-server.c - minimal NTS-KE and NTS-protected NTP server for tests
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Hands out keys and cookies over TLS and answers NTP requests carrying
+ * them on the loopback interface, with the local time plus an offset, so
+ * NTS sources can be tried without a network.  Cookies are the two keys
+ * sealed under a master key made at start-up, so nothing is remembered
+ * per client.  tlsdated-unittest links the packet code directly; built as
+ * a program it serves until killed.
+ *
+ * Usage: nts-server -c cert.pem -k key.pem [-p port] [-o offset]
+ * The NTS-KE port (ephemeral with -p 0, the default) and the NTP port it
+ * sends clients to are printed on stdout.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <openssl/rand.h>
+
+#include "src/test/nts-server.h"
+
+static uint16_t
+get16 (const uint8_t *p)
+{
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static void
+put16 (uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void
+put32 (uint8_t *p, uint32_t v)
+{
+  put16 (p, v >> 16);
+  put16 (p + 2, v);
+}
+
+static void
+put64 (uint8_t *p, uint64_t v)
+{
+  put32 (p, v >> 32);
+  put32 (p + 4, v);
+}
+
+int
+nts_server_init (struct nts_server *srv)
+{
+  return RAND_bytes (srv->master, sizeof (srv->master)) != 1;
+}
+
+size_t
+nts_server_cookie (const struct nts_server *srv,
+                   const uint8_t c2s[NTS_KEY_LEN],
+                   const uint8_t s2c[NTS_KEY_LEN], uint8_t *out)
+{
+  uint8_t keys[2 * NTS_KEY_LEN];
+  struct iovec ad;
+  memcpy (keys, c2s, NTS_KEY_LEN);
+  memcpy (keys + NTS_KEY_LEN, s2c, NTS_KEY_LEN);
+  if (RAND_bytes (out, NTS_NONCE_LEN) != 1)
+    return 0;
+  ad.iov_base = out;
+  ad.iov_len = NTS_NONCE_LEN;
+  if (nts_aead_seal (srv->master, &ad, 1, keys, sizeof (keys),
+                     out + NTS_NONCE_LEN))
+    return 0;
+  return NTS_SERVER_COOKIE_LEN;
+}
+
+/* Recovers the keys from a cookie.  Returns 0 on success. */
+static int
+open_cookie (const struct nts_server *srv, const uint8_t *cookie, size_t len,
+             uint8_t keys[2 * NTS_KEY_LEN])
+{
+  struct iovec ad;
+  if (len != NTS_SERVER_COOKIE_LEN)
+    return 1;
+  ad.iov_base = (void *) cookie;
+  ad.iov_len = NTS_NONCE_LEN;
+  return nts_aead_open (srv->master, &ad, 1, cookie + NTS_NONCE_LEN,
+                        len - NTS_NONCE_LEN, keys);
+}
+
+/* Returns 1 if the |len| byte list of 16-bit values has |want|. */
+static int
+list_has (const uint8_t *body, size_t len, uint16_t want)
+{
+  size_t i;
+  for (i = 0; i + 2 <= len; i += 2)
+    if (get16 (body + i) == want)
+      return 1;
+  return 0;
+}
+
+size_t
+nts_server_ke_response (const struct nts_server *srv,
+                        const uint8_t *request, size_t len,
+                        const uint8_t c2s[NTS_KEY_LEN],
+                        const uint8_t s2c[NTS_KEY_LEN], int num_cookies,
+                        const char *ntp_server, uint16_t ntp_port,
+                        uint8_t *out)
+{
+  uint8_t value[2], cookie[NTS_SERVER_COOKIE_LEN];
+  size_t off = 0, out_len = 0;
+  int ntpv4 = 0, siv = 0, ended = 0, i;
+  while (!ended && off + 4 <= len)
+    {
+      uint16_t type = get16 (request + off) & ~NTS_KE_CRITICAL;
+      size_t body_len = get16 (request + off + 2);
+      const uint8_t *body = request + off + 4;
+      if (off + 4 + body_len > len)
+        return 0;
+      off += 4 + body_len;
+      if (type == NTS_KE_END)
+        ended = 1;
+      else if (type == NTS_KE_NEXT_PROTOCOL)
+        ntpv4 = list_has (body, body_len, NTS_KE_PROTOCOL_NTPV4);
+      else if (type == NTS_KE_AEAD)
+        siv = list_has (body, body_len, NTS_AEAD_AES_SIV_CMAC_256);
+    }
+  if (!ended || !ntpv4 || !siv)
+    return 0;
+  put16 (value, NTS_KE_PROTOCOL_NTPV4);
+  out_len += nts_ke_put_record (out + out_len, NTS_KE_NEXT_PROTOCOL, 1,
+                                value, 2);
+  put16 (value, NTS_AEAD_AES_SIV_CMAC_256);
+  out_len += nts_ke_put_record (out + out_len, NTS_KE_AEAD, 1, value, 2);
+  for (i = 0; i < num_cookies; ++i)
+    {
+      if (!nts_server_cookie (srv, c2s, s2c, cookie))
+        return 0;
+      out_len += nts_ke_put_record (out + out_len, NTS_KE_NEW_COOKIE, 0,
+                                    cookie, sizeof (cookie));
+    }
+  if (ntp_server)
+    out_len += nts_ke_put_record (out + out_len, NTS_KE_SERVER, 1,
+                                  ntp_server, strlen (ntp_server));
+  put16 (value, ntp_port);
+  out_len += nts_ke_put_record (out + out_len, NTS_KE_PORT, 1, value, 2);
+  out_len += nts_ke_put_record (out + out_len, NTS_KE_END, 1, NULL, 0);
+  return out_len;
+}
+
+size_t
+nts_server_reply (const struct nts_server *srv, const uint8_t *request,
+                  size_t len, uint64_t now, uint8_t *out)
+{
+  uint8_t keys[2 * NTS_KEY_LEN], plain[NTS_MAX_PACKET];
+  uint8_t cookie[NTS_SERVER_COOKIE_LEN];
+  const uint8_t *uid = NULL, *their_cookie = NULL, *body;
+  size_t off = NTS_NTP_HEADER_LEN, uid_len = 0, cookie_len = 0, body_len;
+  size_t auth_off, plain_len, out_len;
+  int placeholders = 0, i;
+  uint16_t type;
+  if (len < NTS_NTP_HEADER_LEN || (request[0] & 7) != 3)
+    return 0;
+  while (nts_next_ef (request, len, &off, &type, &body, &body_len) > 0)
+    {
+      if (type == NTS_EF_UNIQUE_ID && !uid)
+        {
+          uid = body;
+          uid_len = body_len;
+        }
+      else if (type == NTS_EF_COOKIE && !their_cookie)
+        {
+          their_cookie = body;
+          cookie_len = body_len;
+        }
+      else if (type == NTS_EF_COOKIE_PLACEHOLDER)
+        placeholders++;
+    }
+  if (!uid || !their_cookie)
+    return 0;
+  memset (out, 0, NTS_NTP_HEADER_LEN);
+  out[0] = 4 << 3 | 4;  /* NTPv4, server */
+  memcpy (out + 24, request + 40, 8);
+  if (open_cookie (srv, their_cookie, cookie_len, keys))
+    {
+      /* Kiss of death: the client has to go back to NTS-KE. */
+      out[0] |= 3 << 6;
+      memcpy (out + 12, NTS_NAK, 4);
+      return NTS_NTP_HEADER_LEN + nts_put_ef (out + NTS_NTP_HEADER_LEN,
+                                              NTS_EF_UNIQUE_ID, uid, uid_len);
+    }
+  if (nts_open_packet (keys, request, len, &auth_off, plain, &plain_len))
+    return 0;
+  out[1] = 1;     /* stratum */
+  out[2] = request[2];
+  out[3] = 0xec;  /* precision: 2^-20 s */
+  put32 (out + 8, 1 << 6);  /* root dispersion: about 1ms */
+  memcpy (out + 12, "LOCL", 4);
+  put64 (out + 16, now);
+  put64 (out + 32, now);
+  put64 (out + 40, now);
+  out_len = NTS_NTP_HEADER_LEN;
+  out_len += nts_put_ef (out + out_len, NTS_EF_UNIQUE_ID, uid, uid_len);
+  plain_len = 0;
+  for (i = 0; i <= placeholders; ++i)
+    {
+      if (!nts_server_cookie (srv, keys, keys + NTS_KEY_LEN, cookie))
+        return 0;
+      plain_len += nts_put_ef (plain + plain_len, NTS_EF_COOKIE, cookie,
+                               sizeof (cookie));
+    }
+  return nts_seal_packet (keys + NTS_KEY_LEN, out, out_len, plain, plain_len);
+}
+
+#ifdef NTS_SERVER_MAIN
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+int verbose;
+int verbose_debug;
+
+/* src/nts.c logs through this; util.c would drag in much more. */
+void
+logat (int isverbose, const char *fmt, ...)
+{
+  va_list ap;
+  if (isverbose && !verbose)
+    return;
+  va_start (ap, fmt);
+  vfprintf (stderr, fmt, ap);
+  fputc ('\n', stderr);
+  va_end (ap);
+}
+
+static long time_offset;
+
+static uint64_t
+ntp_now (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_REALTIME, &now);
+  return (uint64_t) (now.tv_sec + time_offset + NTS_NTP_UNIX_OFFSET) << 32 |
+         (uint64_t) now.tv_nsec * (1ULL << 32) / 1000000000;
+}
+
+static int
+select_alpn (SSL *ssl, const unsigned char **out, unsigned char *out_len,
+             const unsigned char *in, unsigned int in_len, void *arg)
+{
+  unsigned char *selected;
+  if (SSL_select_next_proto (&selected, out_len,
+                             (const unsigned char *) NTS_KE_ALPN,
+                             NTS_KE_ALPN_LEN, in, in_len) !=
+      OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_ALERT_FATAL;
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+static int
+export_key (SSL *ssl, int s2c, uint8_t key[NTS_KEY_LEN])
+{
+  uint8_t context[5];
+  nts_exporter_context (NTS_AEAD_AES_SIV_CMAC_256, s2c, context);
+  return SSL_export_keying_material (ssl, key, NTS_KEY_LEN,
+                                     NTS_EXPORTER_LABEL,
+                                     strlen (NTS_EXPORTER_LABEL),
+                                     context, sizeof (context), 1) != 1;
+}
+
+/* Runs one NTS-KE exchange on |conn|. */
+static void
+serve_ke (const struct nts_server *srv, SSL_CTX *ctx, int conn,
+          uint16_t ntp_port)
+{
+  struct timeval idle = { 5, 0 };
+  uint8_t request[1024], response[NTS_KE_MAX_RESPONSE];
+  uint8_t c2s[NTS_KEY_LEN], s2c[NTS_KEY_LEN];
+  size_t len = 0, out_len = 0;
+  SSL *ssl = SSL_new (ctx);
+  setsockopt (conn, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof (idle));
+  if (!ssl || SSL_set_fd (ssl, conn) != 1 || SSL_accept (ssl) != 1)
+    {
+      ERR_print_errors_fp (stderr);
+      SSL_free (ssl);
+      return;
+    }
+  while (len < sizeof (request))
+    {
+      int n = SSL_read (ssl, request + len, sizeof (request) - len);
+      if (n <= 0)
+        break;
+      len += n;
+      if (export_key (ssl, 0, c2s) || export_key (ssl, 1, s2c))
+        break;
+      out_len = nts_server_ke_response (srv, request, len, c2s, s2c,
+                                        NTS_MAX_COOKIES, "127.0.0.1",
+                                        ntp_port, response);
+      if (out_len)
+        break;
+    }
+  if (out_len)
+    SSL_write (ssl, response, out_len);
+  else
+    fprintf (stderr, "bad NTS-KE request\n");
+  SSL_shutdown (ssl);
+  SSL_free (ssl);
+}
+
+static void
+usage (const char *argv0)
+{
+  fprintf (stderr, "usage: %s -c cert -k key [-p port] [-o offset]\n",
+           argv0);
+  exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *cert = NULL, *key = NULL;
+  struct nts_server srv;
+  struct sockaddr_in addr;
+  struct pollfd fds[2];
+  socklen_t addr_len = sizeof (addr);
+  uint16_t ntp_port;
+  SSL_CTX *ctx;
+  int port = 0, one = 1, opt;
+  while ((opt = getopt (argc, argv, "c:k:p:o:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'c':
+          cert = optarg;
+          break;
+        case 'k':
+          key = optarg;
+          break;
+        case 'p':
+          port = atoi (optarg);
+          break;
+        case 'o':
+          time_offset = atol (optarg);
+          break;
+        default:
+          usage (argv[0]);
+        }
+    }
+  if (!cert || !key)
+    usage (argv[0]);
+  signal (SIGPIPE, SIG_IGN);
+  ctx = SSL_CTX_new (SSLv23_server_method ());
+  if (!ctx || nts_server_init (&srv) ||
+#ifdef TLS1_3_VERSION
+      /* NTS-KE is TLS 1.3 only (RFC 8915, section 3). */
+      SSL_CTX_set_min_proto_version (ctx, TLS1_3_VERSION) != 1 ||
+#endif
+      SSL_CTX_use_certificate_chain_file (ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey_file (ctx, key, SSL_FILETYPE_PEM) != 1)
+    {
+      ERR_print_errors_fp (stderr);
+      return 1;
+    }
+  SSL_CTX_set_alpn_select_cb (ctx, select_alpn, NULL);
+  fds[0].fd = socket (AF_INET, SOCK_STREAM, 0);
+  fds[1].fd = socket (AF_INET, SOCK_DGRAM, 0);
+  if (fds[0].fd < 0 || fds[1].fd < 0)
+    {
+      perror ("socket");
+      return 1;
+    }
+  setsockopt (fds[0].fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (fds[1].fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+      getsockname (fds[1].fd, (struct sockaddr *) &addr, &addr_len))
+    {
+      perror ("bind");
+      return 1;
+    }
+  ntp_port = ntohs (addr.sin_port);
+  addr.sin_port = htons (port);
+  if (bind (fds[0].fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+      listen (fds[0].fd, 16) ||
+      getsockname (fds[0].fd, (struct sockaddr *) &addr, &addr_len))
+    {
+      perror ("bind");
+      return 1;
+    }
+  printf ("%d\n%d\n", ntohs (addr.sin_port), ntp_port);
+  fflush (stdout);
+  fds[0].events = fds[1].events = POLLIN;
+  for (;;)
+    {
+      if (poll (fds, 2, -1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("poll");
+          return 1;
+        }
+      if (fds[0].revents)
+        {
+          int conn = accept (fds[0].fd, NULL, NULL);
+          if (conn >= 0)
+            {
+              serve_ke (&srv, ctx, conn, ntp_port);
+              close (conn);
+            }
+        }
+      if (fds[1].revents)
+        {
+          uint8_t request[NTS_MAX_PACKET], reply[NTS_MAX_PACKET];
+          struct sockaddr_in from;
+          socklen_t from_len = sizeof (from);
+          size_t len;
+          ssize_t n = recvfrom (fds[1].fd, request, sizeof (request), 0,
+                                (struct sockaddr *) &from, &from_len);
+          if (n > 0 &&
+              (len = nts_server_reply (&srv, request, n, ntp_now (), reply)))
+            sendto (fds[1].fd, reply, len, 0, (struct sockaddr *) &from,
+                    from_len);
+        }
+    }
+}
+
+#endif /* NTS_SERVER_MAIN */
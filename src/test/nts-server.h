@@ -0,0 +1,52 @@
+/*
+ * nts-server.h - minimal NTS-KE and NTS-protected NTP server for tests
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NTS_SERVER_H
+#define NTS_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/nts.h"
+
+/* A nonce, then both keys sealed under the master key. */
+#define NTS_SERVER_COOKIE_LEN (NTS_NONCE_LEN + NTS_SIV_LEN + 2 * NTS_KEY_LEN)
+
+struct nts_server
+{
+  uint8_t master[NTS_KEY_LEN];  /* seals the keys into cookies */
+};
+
+/* Gives |srv| a fresh master key.  Returns 0 on success. */
+int nts_server_init (struct nts_server *srv);
+/* Writes a cookie for the keys |c2s| and |s2c| to |out|; returns its
+ * length, NTS_SERVER_COOKIE_LEN, or 0.
+ */
+size_t nts_server_cookie (const struct nts_server *srv,
+                          const uint8_t c2s[NTS_KEY_LEN],
+                          const uint8_t s2c[NTS_KEY_LEN], uint8_t *out);
+/* Answers the NTS-KE |request| for the keys exported from the TLS session
+ * with |num_cookies| cookies, sending NTP to |ntp_server| (NULL for this
+ * host) at |ntp_port|.  Writes the response (NTS_KE_MAX_RESPONSE bytes) to
+ * |out| and returns its length, or 0 if the request is no good.
+ */
+size_t nts_server_ke_response (const struct nts_server *srv,
+                               const uint8_t *request, size_t len,
+                               const uint8_t c2s[NTS_KEY_LEN],
+                               const uint8_t s2c[NTS_KEY_LEN],
+                               int num_cookies, const char *ntp_server,
+                               uint16_t ntp_port, uint8_t *out);
+/* Answers the |len| byte NTP |request| with |now| (an NTP timestamp) as
+ * both its receive and transmit time, or with a NAK if the cookie can't be
+ * read.  Writes the reply (NTS_MAX_PACKET bytes) to |out| and returns its
+ * length, or 0 if the request should be dropped.
+ */
+size_t nts_server_reply (const struct nts_server *srv,
+                         const uint8_t *request, size_t len, uint64_t now,
+                         uint8_t *out);
+
+#endif /* NTS_SERVER_H */
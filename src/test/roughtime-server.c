@@ -0,0 +1,311 @@
+/*
+ * roughtime-server.c - minimal Roughtime server for tests
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Answers each request on its own (a Merkle tree of one) on the loopback
+ * interface, with the local time plus an offset, so Roughtime sources can
+ * be tried without a network.  tlsdated-unittest links the signing code
+ * directly; built as a program it serves until killed.
+ *
+ * Usage: roughtime-server [-p port] [-o offset] [-r radius_us] [-k seed]
+ * The port (ephemeral with -p 0, the default) and the base64 public key to
+ * put in a source's roughtime-key are printed on stdout.  |seed| is the
+ * long-term private key in hex; a fixed test key is used without it.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "src/test/roughtime-server.h"
+
+#define MAX_TAGS 5
+
+struct tag_value
+{
+  uint32_t tag;
+  const uint8_t *value;
+  size_t len;
+};
+
+static void
+put32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void
+put64 (uint8_t *p, uint64_t v)
+{
+  put32 (p, (uint32_t) v);
+  put32 (p + 4, (uint32_t) (v >> 32));
+}
+
+/* Writes a message of |n| tags to |out|, sorting them; returns its length. */
+static size_t
+encode (struct tag_value *tv, int n, uint8_t *out)
+{
+  size_t off = 0;
+  int i, j;
+  for (i = 1; i < n; ++i)
+    for (j = i; j > 0 && tv[j].tag < tv[j - 1].tag; --j)
+      {
+        struct tag_value t = tv[j];
+        tv[j] = tv[j - 1];
+        tv[j - 1] = t;
+      }
+  put32 (out, n);
+  for (i = 0; i < n; ++i)
+    {
+      if (i)
+        put32 (out + 4 * i, off);
+      put32 (out + 4 * n + 4 * i, tv[i].tag);
+      memcpy (out + 8 * n + off, tv[i].value, tv[i].len);
+      off += tv[i].len;
+    }
+  return 8 * n + off;
+}
+
+/* Ed25519-signs |context| (NUL included) and |msg| with |seed|. */
+static int
+sign (const uint8_t seed[ROUGHTIME_KEY_LEN], const char *context,
+      const uint8_t *msg, size_t len, uint8_t sig[ROUGHTIME_SIG_LEN])
+{
+  uint8_t buf[ROUGHTIME_MAX_REPLY];
+  size_t context_len = strlen (context) + 1;
+  size_t sig_len = ROUGHTIME_SIG_LEN;
+  EVP_PKEY *pkey;
+  EVP_MD_CTX *ctx;
+  int ok = 0;
+  if (len > sizeof (buf) - context_len)
+    return 1;
+  memcpy (buf, context, context_len);
+  memcpy (buf + context_len, msg, len);
+  pkey = EVP_PKEY_new_raw_private_key (EVP_PKEY_ED25519, NULL, seed,
+                                       ROUGHTIME_KEY_LEN);
+  ctx = EVP_MD_CTX_new ();
+  if (pkey && ctx && EVP_DigestSignInit (ctx, NULL, NULL, NULL, pkey) == 1)
+    ok = EVP_DigestSign (ctx, sig, &sig_len, buf, context_len + len) == 1;
+  EVP_MD_CTX_free (ctx);
+  EVP_PKEY_free (pkey);
+  return !ok;
+}
+
+static int
+public_key (const uint8_t seed[ROUGHTIME_KEY_LEN],
+            uint8_t pub[ROUGHTIME_KEY_LEN])
+{
+  size_t len = ROUGHTIME_KEY_LEN;
+  EVP_PKEY *pkey = EVP_PKEY_new_raw_private_key (EVP_PKEY_ED25519, NULL, seed,
+                                                 ROUGHTIME_KEY_LEN);
+  int ok = pkey && EVP_PKEY_get_raw_public_key (pkey, pub, &len) == 1;
+  EVP_PKEY_free (pkey);
+  return !ok;
+}
+
+int
+roughtime_server_init (struct roughtime_server *srv,
+                       const uint8_t seed[ROUGHTIME_KEY_LEN])
+{
+  uint8_t online_pub[ROUGHTIME_KEY_LEN], mint[8], maxt[8];
+  uint8_t dele[24 + 8 + 8 + ROUGHTIME_KEY_LEN], sig[ROUGHTIME_SIG_LEN];
+  struct tag_value tv[3];
+  size_t dele_len;
+  if (public_key (seed, srv->public_key) ||
+      RAND_bytes (srv->online_seed, sizeof (srv->online_seed)) != 1 ||
+      public_key (srv->online_seed, online_pub))
+    return 1;
+  put64 (mint, 0);
+  put64 (maxt, UINT64_MAX);
+  tv[0] = (struct tag_value) { ROUGHTIME_PUBK, online_pub,
+                               sizeof (online_pub) };
+  tv[1] = (struct tag_value) { ROUGHTIME_MINT, mint, sizeof (mint) };
+  tv[2] = (struct tag_value) { ROUGHTIME_MAXT, maxt, sizeof (maxt) };
+  dele_len = encode (tv, 3, dele);
+  if (sign (seed, ROUGHTIME_DELE_CONTEXT, dele, dele_len, sig))
+    return 1;
+  tv[0] = (struct tag_value) { ROUGHTIME_DELE, dele, dele_len };
+  tv[1] = (struct tag_value) { ROUGHTIME_SIG, sig, sizeof (sig) };
+  encode (tv, 2, srv->cert);
+  return 0;
+}
+
+size_t
+roughtime_server_reply (const struct roughtime_server *srv,
+                        const uint8_t *request, size_t len,
+                        uint64_t midpoint_us, uint32_t radius_us,
+                        uint8_t *out)
+{
+  uint8_t root[ROUGHTIME_HASH_LEN], midp[8], radi[4], indx[4];
+  uint8_t srep[24 + 4 + 8 + ROUGHTIME_HASH_LEN], sig[ROUGHTIME_SIG_LEN];
+  struct tag_value tv[MAX_TAGS];
+  const uint8_t *nonce;
+  size_t nonce_len, srep_len;
+  if (len < ROUGHTIME_REQUEST_LEN ||
+      roughtime_find_tag (request, len, ROUGHTIME_NONC, &nonce, &nonce_len) ||
+      nonce_len != ROUGHTIME_NONCE_LEN)
+    return 0;
+  roughtime_leaf_hash (nonce, root);
+  put64 (midp, midpoint_us);
+  put32 (radi, radius_us);
+  put32 (indx, 0);
+  tv[0] = (struct tag_value) { ROUGHTIME_ROOT, root, sizeof (root) };
+  tv[1] = (struct tag_value) { ROUGHTIME_MIDP, midp, sizeof (midp) };
+  tv[2] = (struct tag_value) { ROUGHTIME_RADI, radi, sizeof (radi) };
+  srep_len = encode (tv, 3, srep);
+  if (sign (srv->online_seed, ROUGHTIME_SREP_CONTEXT, srep, srep_len, sig))
+    return 0;
+  tv[0] = (struct tag_value) { ROUGHTIME_SIG, sig, sizeof (sig) };
+  tv[1] = (struct tag_value) { ROUGHTIME_PATH, NULL, 0 };
+  tv[2] = (struct tag_value) { ROUGHTIME_SREP, srep, srep_len };
+  tv[3] = (struct tag_value) { ROUGHTIME_CERT, srv->cert,
+                               sizeof (srv->cert) };
+  tv[4] = (struct tag_value) { ROUGHTIME_INDX, indx, sizeof (indx) };
+  return encode (tv, 5, out);
+}
+
+#ifdef ROUGHTIME_SERVER_MAIN
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+int verbose;
+int verbose_debug;
+
+/* src/roughtime.c logs through this; util.c would drag in much more. */
+void
+logat (int isverbose, const char *fmt, ...)
+{
+  va_list ap;
+  if (isverbose && !verbose)
+    return;
+  va_start (ap, fmt);
+  vfprintf (stderr, fmt, ap);
+  fputc ('\n', stderr);
+  va_end (ap);
+}
+
+static const uint8_t kTestSeed[ROUGHTIME_KEY_LEN] =
+{
+  0x74, 0x6c, 0x73, 0x64, 0x61, 0x74, 0x65, 0x20,
+  0x72, 0x6f, 0x75, 0x67, 0x68, 0x74, 0x69, 0x6d,
+  0x65, 0x20, 0x74, 0x65, 0x73, 0x74, 0x20, 0x6b,
+  0x65, 0x79, 0x20, 0x6f, 0x6e, 0x6c, 0x79, 0x21,
+};
+
+static void
+usage (const char *argv0)
+{
+  fprintf (stderr, "usage: %s [-p port] [-o offset] [-r radius_us] "
+           "[-k seed]\n", argv0);
+  exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct roughtime_server srv;
+  uint8_t seed[ROUGHTIME_KEY_LEN];
+  unsigned char b64[64];
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+  long offset = 0;
+  uint32_t radius = 1000000;
+  int port = 0;
+  int fd, opt, i;
+  memcpy (seed, kTestSeed, sizeof (seed));
+  while ((opt = getopt (argc, argv, "p:o:r:k:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'p':
+          port = atoi (optarg);
+          break;
+        case 'o':
+          offset = atol (optarg);
+          break;
+        case 'r':
+          radius = strtoul (optarg, NULL, 10);
+          break;
+        case 'k':
+          if (strlen (optarg) != 2 * ROUGHTIME_KEY_LEN)
+            usage (argv[0]);
+          for (i = 0; i < ROUGHTIME_KEY_LEN; ++i)
+            {
+              unsigned int byte;
+              if (sscanf (optarg + 2 * i, "%2x", &byte) != 1)
+                usage (argv[0]);
+              seed[i] = byte;
+            }
+          break;
+        default:
+          usage (argv[0]);
+        }
+    }
+  if (roughtime_server_init (&srv, seed))
+    {
+      fprintf (stderr, "can't make keys; is Ed25519 supported?\n");
+      return 1;
+    }
+  fd = socket (AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    {
+      perror ("socket");
+      return 1;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (port);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+      getsockname (fd, (struct sockaddr *) &addr, &addr_len))
+    {
+      perror ("bind");
+      return 1;
+    }
+  EVP_EncodeBlock (b64, srv.public_key, sizeof (srv.public_key));
+  printf ("%d\n%s\n", ntohs (addr.sin_port), b64);
+  fflush (stdout);
+  for (;;)
+    {
+      uint8_t request[ROUGHTIME_MAX_REPLY], reply[ROUGHTIME_MAX_REPLY];
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof (from);
+      struct timespec now;
+      uint64_t midpoint;
+      size_t len;
+      ssize_t n = recvfrom (fd, request, sizeof (request), 0,
+                            (struct sockaddr *) &from, &from_len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("recvfrom");
+          return 1;
+        }
+      clock_gettime (CLOCK_REALTIME, &now);
+      midpoint = (uint64_t) (now.tv_sec + offset) * 1000000 +
+                 now.tv_nsec / 1000;
+      if (!(len = roughtime_server_reply (&srv, request, n, midpoint, radius,
+                                          reply)))
+        continue;
+      sendto (fd, reply, len, 0, (struct sockaddr *) &from, from_len);
+    }
+}
+
+#endif /* ROUGHTIME_SERVER_MAIN */
@@ -0,0 +1,41 @@
+/*
+ * roughtime-server.h - minimal Roughtime server for tests
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef ROUGHTIME_SERVER_H
+#define ROUGHTIME_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/roughtime.h"
+
+/* DELE (three tags, two times and a key) and SIG in a message of two. */
+#define ROUGHTIME_CERT_LEN (16 + 24 + 8 + 8 + ROUGHTIME_KEY_LEN + \
+                            ROUGHTIME_SIG_LEN)
+
+struct roughtime_server
+{
+  uint8_t public_key[ROUGHTIME_KEY_LEN];   /* long-term; clients pin this */
+  uint8_t online_seed[ROUGHTIME_KEY_LEN];  /* delegated signing key */
+  uint8_t cert[ROUGHTIME_CERT_LEN];
+};
+
+/* Sets |srv| up with the long-term key made from |seed|, delegating to a
+ * fresh key for all time.  Returns 0 on success.
+ */
+int roughtime_server_init (struct roughtime_server *srv,
+                           const uint8_t seed[ROUGHTIME_KEY_LEN]);
+/* Answers the |len| byte |request| in |out| (ROUGHTIME_MAX_REPLY bytes)
+ * with |midpoint_us| and |radius_us|.  Returns the reply's length, or 0
+ * if the request is no good.
+ */
+size_t roughtime_server_reply (const struct roughtime_server *srv,
+                               const uint8_t *request, size_t len,
+                               uint64_t midpoint_us, uint32_t radius_us,
+                               uint8_t *out);
+
+#endif /* ROUGHTIME_SERVER_H */
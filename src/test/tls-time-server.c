@@ -0,0 +1,497 @@
+/*
+ * tls-time-server.c - local TLS server with a controllable clock and faults
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A stand-in for a real tlsdate source, used by bench/run-bench.  It listens
+ * on the loopback interface, stamps its ServerHello random with the local
+ * time plus an offset and, if the client sends an HTTP request after the
+ * handshake, answers with a matching Date header.  Each connection is served
+ * by its own child process.
+ *
+ * Usage: tls-time-server -c cert.pem -k key.pem [-p port] [-o offset]
+ *                        [-d delay_ms] [-n connections] [-s script]
+ * With -p 0 (the default) an ephemeral port is picked and printed on stdout.
+ *
+ * A script misbehaves on purpose.  Line N (blank lines and #-comments aside)
+ * applies to the Nth connection, wrapping around at the end, and holds any
+ * of these space-separated words:
+ *   ok               no faults; the defaults from the command line
+ *   offset=S         server time is S seconds off local time
+ *   random-time      server time is random
+ *   close            close the connection right after accepting it
+ *   stall=MS         wait MS ms after accepting; -1 waits for the client to
+ *                    give up
+ *   trickle=MS       send the server's bytes one at a time, MS ms apart
+ *   drop=N           cut the connection after sending N bytes
+ *   cert=PATH        serve this chain instead (e.g. expired or self-signed)
+ *   key=PATH         ... with this key
+ *   header-bytes=N   pad the HTTP response with an N byte header
+ *   bad-date         send an unparseable HTTP Date header
+ *   no-date          leave the Date header out
+ * For example, "drop=200" then "ok" fails every other handshake.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#define MAX_SCRIPT_LINES 256
+
+struct fault
+{
+  long offset;
+  int random_time;
+  int close_now;
+  long stall_ms;
+  long trickle_ms;
+  long drop_after;      /* bytes; 0 means never */
+  const char *cert;
+  const char *key;
+  long header_bytes;
+  int bad_date;
+  int no_date;
+};
+
+static long time_offset;
+static int random_time;
+
+/* OpenSSL stamps the ServerHello with time(NULL); defining it here makes
+ * the library pick up the skewed clock without patching it.
+ */
+time_t
+time (time_t *t)
+{
+  struct timespec ts;
+  time_t now = 0;
+  if (random_time)
+    now = (time_t) (uint32_t) random ();
+  else if (!clock_gettime (CLOCK_REALTIME, &ts))
+    now = ts.tv_sec + time_offset;
+  if (t)
+    *t = now;
+  return now;
+}
+
+static void
+sleep_ms (long ms)
+{
+  struct timespec delay = { ms / 1000, (ms % 1000) * 1000000 };
+  while (nanosleep (&delay, &delay) && errno == EINTR)
+    ;
+}
+
+/* Parses one script line into |f|, which already holds the defaults.
+ * Returns 0 on success.  Keeps pointers into |line|.
+ */
+static int
+parse_fault (char *line, struct fault *f)
+{
+  char *save = NULL;
+  char *word;
+  for (word = strtok_r (line, " \t\n", &save); word;
+       word = strtok_r (NULL, " \t\n", &save))
+    {
+      char *value = strchr (word, '=');
+      if (value)
+        *value++ = '\0';
+      if (!strcmp (word, "ok"))
+        continue;
+      else if (!strcmp (word, "random-time"))
+        f->random_time = 1;
+      else if (!strcmp (word, "close"))
+        f->close_now = 1;
+      else if (!strcmp (word, "bad-date"))
+        f->bad_date = 1;
+      else if (!strcmp (word, "no-date"))
+        f->no_date = 1;
+      else if (!value)
+        return 1;
+      else if (!strcmp (word, "offset"))
+        f->offset = atol (value);
+      else if (!strcmp (word, "stall"))
+        f->stall_ms = atol (value);
+      else if (!strcmp (word, "trickle"))
+        f->trickle_ms = atol (value);
+      else if (!strcmp (word, "drop"))
+        f->drop_after = atol (value);
+      else if (!strcmp (word, "cert"))
+        f->cert = value;
+      else if (!strcmp (word, "key"))
+        f->key = value;
+      else if (!strcmp (word, "header-bytes"))
+        f->header_bytes = atol (value);
+      else
+        return 1;
+    }
+  return 0;
+}
+
+/* Returns the number of lines loaded into |lines|, or -1 on error. */
+static int
+load_script (const char *path, char **lines)
+{
+  char buf[1024];
+  int n = 0;
+  FILE *fp = fopen (path, "r");
+  if (!fp)
+    return -1;
+  while (n < MAX_SCRIPT_LINES && fgets (buf, sizeof (buf), fp))
+    {
+      char *p = buf + strspn (buf, " \t");
+      if (*p == '#' || *p == '\n' || !*p)
+        continue;
+      if (!(lines[n++] = strdup (p)))
+        break;
+    }
+  fclose (fp);
+  return n;
+}
+
+/* Copies bytes between the client and the TLS end of a socketpair,
+ * slowing down or cutting off what the server sends.
+ */
+static void
+relay (int client, int server, const struct fault *f)
+{
+  struct pollfd fds[2];
+  char buf[4096];
+  long sent = 0;
+  int open_ends = 2;
+  fds[0].fd = client;
+  fds[0].events = POLLIN;
+  fds[1].fd = server;
+  fds[1].events = POLLIN;
+  while (open_ends)
+    {
+      ssize_t n, i;
+      if (poll (fds, 2, -1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return;
+        }
+      if (fds[0].revents)
+        {
+          n = read (client, buf, sizeof (buf));
+          if (n <= 0 || write (server, buf, n) != n)
+            {
+              shutdown (server, SHUT_WR);
+              fds[0].fd = -1;
+              open_ends--;
+            }
+        }
+      if (fds[1].revents)
+        {
+          n = read (server, buf, sizeof (buf));
+          if (n <= 0)
+            {
+              shutdown (client, SHUT_WR);
+              fds[1].fd = -1;
+              open_ends--;
+              continue;
+            }
+          for (i = 0; i < n; ++i)
+            {
+              if (f->drop_after && sent >= f->drop_after)
+                return;
+              if (write (client, buf + i, 1) != 1)
+                return;
+              sent++;
+              if (f->trickle_ms)
+                sleep_ms (f->trickle_ms);
+            }
+        }
+    }
+}
+
+static void
+serve_http (SSL *ssl, const struct fault *f)
+{
+  static const char *kDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri",
+                                 "Sat" };
+  static const char *kMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  char buf[1024];
+  char date[64];
+  time_t now;
+  struct tm tm;
+  long pad;
+  int n;
+  /* A client that only wants the handshake closes without a request. */
+  n = SSL_read (ssl, buf, sizeof (buf) - 1);
+  if (n <= 0)
+    return;
+  buf[n] = '\0';
+  if (strncmp (buf, "GET ", 4) && strncmp (buf, "HEAD ", 5))
+    return;
+  now = time (NULL);
+  gmtime_r (&now, &tm);
+  if (f->bad_date)
+    snprintf (date, sizeof (date), "Date: sometime yesterday\r\n");
+  else if (f->no_date)
+    date[0] = '\0';
+  else
+    snprintf (date, sizeof (date),
+              "Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n",
+              kDays[tm.tm_wday], tm.tm_mday, kMonths[tm.tm_mon],
+              tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  SSL_write (ssl, "HTTP/1.0 200 OK\r\n", 17);
+  /* Padding goes first so a capped header reader never sees the date. */
+  if (f->header_bytes > 0)
+    {
+      SSL_write (ssl, "X-Pad: ", 7);
+      memset (buf, 'x', sizeof (buf));
+      for (pad = f->header_bytes; pad > 0; pad -= n)
+        {
+          n = pad < (long) sizeof (buf) ? pad : (long) sizeof (buf);
+          if (SSL_write (ssl, buf, n) <= 0)
+            return;
+        }
+      SSL_write (ssl, "\r\n", 2);
+    }
+  n = snprintf (buf, sizeof (buf),
+                "%sContent-Length: 0\r\nConnection: close\r\n\r\n", date);
+  SSL_write (ssl, buf, n);
+}
+
+static SSL_CTX *
+make_ctx (const char *cert, const char *key)
+{
+  SSL_CTX *ctx = SSL_CTX_new (SSLv23_server_method ());
+  if (!ctx)
+    return NULL;
+  /* The time only travels in the TLS 1.2 and earlier ServerHello. */
+#ifdef SSL_OP_NO_TLSv1_3
+  SSL_CTX_set_options (ctx, SSL_OP_NO_TLSv1_3);
+#endif
+#ifdef SSL_MODE_SEND_SERVERHELLO_TIME
+  SSL_CTX_set_mode (ctx, SSL_MODE_SEND_SERVERHELLO_TIME);
+#endif
+  if (SSL_CTX_use_certificate_chain_file (ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey_file (ctx, key, SSL_FILETYPE_PEM) != 1)
+    {
+      SSL_CTX_free (ctx);
+      return NULL;
+    }
+  return ctx;
+}
+
+/* Runs in a child process per connection. */
+static void
+serve (int conn, SSL_CTX *ctx, const struct fault *f)
+{
+  /* Don't let a client that goes quiet wedge the child. */
+  struct timeval idle = { 5, 0 };
+  SSL *ssl;
+  int fd = conn;
+  int sv[2];
+  time_offset = f->offset;
+  random_time = f->random_time;
+  if (f->close_now)
+    return;
+  if (f->stall_ms < 0)
+    {
+      char c;
+      while (read (conn, &c, 1) > 0)
+        ;
+      return;
+    }
+  if (f->stall_ms)
+    sleep_ms (f->stall_ms);
+  if (f->cert && !(ctx = make_ctx (f->cert, f->key ? f->key : f->cert)))
+    {
+      ERR_print_errors_fp (stderr);
+      return;
+    }
+  if (f->trickle_ms || f->drop_after)
+    {
+      pid_t pid;
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+        {
+          perror ("socketpair");
+          return;
+        }
+      pid = fork ();
+      if (pid < 0)
+        {
+          perror ("fork");
+          return;
+        }
+      if (pid == 0)
+        {
+          close (sv[1]);
+          relay (conn, sv[0], f);
+          _exit (0);
+        }
+      close (sv[0]);
+      close (conn);
+      fd = sv[1];
+    }
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof (idle));
+  ssl = SSL_new (ctx);
+  if (ssl && SSL_set_fd (ssl, fd) == 1 && SSL_accept (ssl) == 1)
+    {
+      serve_http (ssl, f);
+      SSL_shutdown (ssl);
+    }
+  else
+    {
+      ERR_print_errors_fp (stderr);
+    }
+  SSL_free (ssl);
+}
+
+static void
+usage (const char *argv0)
+{
+  fprintf (stderr, "usage: %s -c cert -k key [-p port] [-o offset] "
+           "[-d delay_ms] [-n connections] [-s script]\n", argv0);
+  exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *cert = NULL;
+  const char *key = NULL;
+  const char *script = NULL;
+  char *lines[MAX_SCRIPT_LINES];
+  int nlines = 0;
+  struct fault defaults;
+  int port = 0;
+  long connections = 0;
+  long served = 0;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+  SSL_CTX *ctx;
+  int one = 1;
+  int fd;
+  int opt;
+  memset (&defaults, 0, sizeof (defaults));
+  while ((opt = getopt (argc, argv, "c:k:p:o:d:n:s:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'c':
+          cert = optarg;
+          break;
+        case 'k':
+          key = optarg;
+          break;
+        case 'p':
+          port = atoi (optarg);
+          break;
+        case 'o':
+          defaults.offset = atol (optarg);
+          break;
+        case 'd':
+          defaults.stall_ms = atol (optarg);
+          break;
+        case 'n':
+          connections = atol (optarg);
+          break;
+        case 's':
+          script = optarg;
+          break;
+        default:
+          usage (argv[0]);
+        }
+    }
+  if (!cert || !key)
+    usage (argv[0]);
+  if (script && (nlines = load_script (script, lines)) <= 0)
+    {
+      fprintf (stderr, "could not load script %s\n", script);
+      return 1;
+    }
+  signal (SIGPIPE, SIG_IGN);
+  /* Nobody waits for the per-connection children. */
+  signal (SIGCHLD, SIG_IGN);
+  srandom (getpid ());
+  SSL_load_error_strings ();
+  SSL_library_init ();
+  if (!(ctx = make_ctx (cert, key)))
+    {
+      ERR_print_errors_fp (stderr);
+      return 1;
+    }
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      perror ("socket");
+      return 1;
+    }
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (port);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+      listen (fd, 16) ||
+      getsockname (fd, (struct sockaddr *) &addr, &addr_len))
+    {
+      perror ("bind");
+      return 1;
+    }
+  printf ("%d\n", ntohs (addr.sin_port));
+  fflush (stdout);
+  while (!connections || served < connections)
+    {
+      struct fault f = defaults;
+      /* parse_fault() points |f| into this, and the child gets a copy. */
+      char line[1024];
+      pid_t pid;
+      int conn = accept (fd, NULL, NULL);
+      if (conn < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("accept");
+          return 1;
+        }
+      if (nlines)
+        {
+          snprintf (line, sizeof (line), "%s", lines[served % nlines]);
+          if (parse_fault (line, &f))
+            {
+              fprintf (stderr, "bad script line: %s", lines[served % nlines]);
+              return 1;
+            }
+        }
+      pid = fork ();
+      if (pid < 0)
+        {
+          perror ("fork");
+          return 1;
+        }
+      if (pid == 0)
+        {
+          close (fd);
+          serve (conn, ctx, &f);
+          close (conn);
+          _exit (0);
+        }
+      close (conn);
+      served++;
+    }
+  close (fd);
+  SSL_CTX_free (ctx);
+  return 0;
+}
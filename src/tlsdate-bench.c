@@ -0,0 +1,814 @@
+/*
+ * tlsdate-bench.c - qualify a time source by sampling it repeatedly
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Runs tlsdate-helper against one host N times without touching the clock,
+ * collects the phase stamps from each `showtime=sample` record, and prints
+ * a JSON report: per-phase latency, the round trip tlsdated would correct
+ * for, the offset from the local clock, and whether the server fills
+ * server_random with its time.  See tlsdate-bench(1).
+ *
+ * With --startup it instead times how long a freshly spawned helper (and,
+ * given --tlsdate, the tlsdate wrapper) takes to send its first SYN to a
+ * local listener, which is what tlsdated pays before every sync.
+ *
+ * With --backoff it samples nothing: it simulates a fleet of tlsdated
+ * retrying against a source that is down, and prints the request rate the
+ * source would see under that retry policy.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pwd.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "src/tlsdate.h"
+
+/* The width of each window in the simulated request-rate envelope. */
+#define ENVELOPE_WINDOW 10
+
+/* A server_random this close to our clock is taken to be a timestamp.
+ * Random bytes land within it about once in 600000 tries.
+ */
+#define RANDOM_TIME_SLACK 3600
+
+extern char **environ;
+
+enum phase_t
+{
+  P_DNS = 0,
+  P_CONNECT,
+  P_PROXY,
+  P_HANDSHAKE,
+  P_HTTP,
+  P_VERIFY,
+  P_TOTAL,
+  P_MAX,
+};
+
+static const char *kPhaseNames[P_MAX] =
+{
+  "dns", "connect", "proxy", "handshake", "http", "verify", "total",
+};
+
+struct run
+{
+  int ok;
+  int status;           /* wait status, or -1 if the helper timed out */
+  struct tlsdate_sample sample;
+  double offset;        /* server minus local clock, seconds */
+  int random_is_time;
+  double phase_ms[P_MAX];  /* < 0 where the helper could not tell */
+};
+
+struct stats
+{
+  size_t count;
+  double min, mean, p50, p90, p99, max;
+};
+
+static void
+usage (void)
+{
+  fprintf (stderr, "tlsdate-bench usage:\n"
+           " [-h|--help]\n"
+           " [-n|--samples] [count]\n"
+           " [-i|--interval] [milliseconds]\n"
+           " [-T|--timeout] [seconds]\n"
+           " [-H|--host] [hostname|ip]\n"
+           " [-p|--port] [port number]\n"
+           " [-P|--protocol] [sslv23|sslv3|tlsv1]\n"
+           " [-C|--certcontainer] [dirname|filename]\n"
+           " [-s|--skip-verification]\n"
+           " [-x|--proxy] [url]\n"
+           " [-w|--http]\n"
+           " [-e|--helper] [path]\n"
+           " [-S|--startup]\n"
+           " [-t|--tlsdate] [path]\n"
+           " [-B|--backoff] [double|decorrelated]\n"
+           " [-N|--hosts] [count]\n"
+           " [-O|--outage] [seconds]\n"
+           " [-v|--verbose]\n");
+}
+
+static double
+ns_to_ms (uint64_t from, uint64_t to)
+{
+  if (!from || !to || to < from)
+    return -1;
+  return (to - from) / 1e6;
+}
+
+static void
+fill_phases (struct run *r)
+{
+  const struct tlsdate_sample *s = &r->sample;
+  uint64_t connect_from = s->resolved_ns ? s->resolved_ns : s->start_ns;
+  uint64_t tunnel_up = s->proxied_ns ? s->proxied_ns : s->connected_ns;
+  int i;
+  for (i = 0; i < P_MAX; ++i)
+    r->phase_ms[i] = -1;
+  r->phase_ms[P_DNS] = ns_to_ms (s->start_ns, s->resolved_ns);
+  /* Includes name resolution when that could not be split out. */
+  r->phase_ms[P_CONNECT] = ns_to_ms (connect_from, s->connected_ns);
+  r->phase_ms[P_PROXY] = ns_to_ms (s->connected_ns, s->proxied_ns);
+  r->phase_ms[P_HANDSHAKE] = ns_to_ms (tunnel_up, s->tls_ns);
+  if (s->flags & TLSDATE_SAMPLE_HTTP)
+    r->phase_ms[P_HTTP] = ns_to_ms (s->tls_ns, s->handshake_ns);
+  r->phase_ms[P_VERIFY] = ns_to_ms (s->handshake_ns, s->verified_ns);
+  r->phase_ms[P_TOTAL] = ns_to_ms (s->start_ns, s->verified_ns);
+}
+
+/* Runs the helper once; returns 0 if it produced a sample. */
+static int
+sample_once (const char *helper, char *const argv[], int timeout_s,
+             int verbose, struct run *r)
+{
+  struct timespec mono, real;
+  struct pollfd pfd;
+  size_t got = 0;
+  int timed_out = 0;
+  pid_t pid;
+  int fds[2];
+  int status;
+  memset (r, 0, sizeof (*r));
+  if (pipe (fds) || (pid = fork ()) < 0)
+    {
+      perror ("Failed to start tlsdate-helper");
+      exit (1);
+    }
+  if (pid == 0)
+    {
+      close (fds[0]);
+      if (dup2 (fds[1], STDOUT_FILENO) < 0)
+        _exit (127);
+      if (!verbose)
+        {
+          int null = open ("/dev/null", O_WRONLY);
+          if (null >= 0)
+            dup2 (null, STDERR_FILENO);
+        }
+      execv (helper, argv);
+      perror ("Failed to run tlsdate-helper");
+      _exit (127);
+    }
+  close (fds[1]);
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  while (got < sizeof (r->sample))
+    {
+      ssize_t n;
+      int ready = poll (&pfd, 1, timeout_s * 1000);
+      if (ready < 0 && errno == EINTR)
+        continue;
+      if (ready <= 0)
+        {
+          kill (pid, SIGKILL);
+          timed_out = 1;
+          break;
+        }
+      n = read (fds[0], (char *) &r->sample + got, sizeof (r->sample) - got);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      got += n;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  clock_gettime (CLOCK_REALTIME, &real);
+  close (fds[0]);
+  while (waitpid (pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  r->status = timed_out ? -1 : status;
+  if (timed_out || got != sizeof (r->sample) ||
+      r->sample.magic != TLSDATE_SAMPLE_MAGIC ||
+      !WIFEXITED (status) || WEXITSTATUS (status))
+    return -1;
+  r->ok = 1;
+  fill_phases (r);
+  {
+    uint64_t now_ns = (uint64_t) mono.tv_sec * 1000000000ULL + mono.tv_nsec;
+    uint64_t got_ns = r->sample.tls_ns;
+    double local, age;
+    /* The Date header is read after the TLS handshake. */
+    if (r->sample.flags & TLSDATE_SAMPLE_HTTP)
+      got_ns = r->sample.handshake_ns;
+    if (got_ns && got_ns <= now_ns)
+      age = (now_ns - got_ns) / 1e9;
+    else
+      age = r->sample.rtt_ms / 2000.0;
+    local = real.tv_sec + real.tv_nsec / 1e9 - age;
+    /* Server times are truncated to the second; aim for the middle. */
+    r->offset = r->sample.time + 0.5 - local;
+    r->random_is_time = r->sample.random_time + (double) RANDOM_TIME_SLACK
+                        >= local &&
+                        r->sample.random_time <= local + RANDOM_TIME_SLACK;
+  }
+  return 0;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank quantile of a sorted array. */
+static double
+quantile (const double *v, size_t n, double q)
+{
+  size_t rank = (size_t) (q * n + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  if (rank > n)
+    rank = n;
+  return v[rank - 1];
+}
+
+static void
+compute_stats (double *v, size_t n, struct stats *st)
+{
+  size_t i;
+  double sum = 0;
+  memset (st, 0, sizeof (*st));
+  st->count = n;
+  if (!n)
+    return;
+  qsort (v, n, sizeof (*v), cmp_double);
+  for (i = 0; i < n; ++i)
+    sum += v[i];
+  st->min = v[0];
+  st->max = v[n - 1];
+  st->mean = sum / n;
+  st->p50 = quantile (v, n, 0.5);
+  st->p90 = quantile (v, n, 0.9);
+  st->p99 = quantile (v, n, 0.99);
+}
+
+static void
+print_stats (const char *name, const struct stats *st, const char *sep)
+{
+  if (!st->count)
+    {
+      printf ("    \"%s\": { \"count\": 0 }%s\n", name, sep);
+      return;
+    }
+  printf ("    \"%s\": { \"count\": %zu, \"min\": %.3f, \"mean\": %.3f, "
+          "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }%s\n",
+          name, st->count, st->min, st->mean, st->p50, st->p90, st->p99,
+          st->max, sep);
+}
+
+static void
+print_json_string (const char *s)
+{
+  if (!s)
+    {
+      fputs ("null", stdout);
+      return;
+    }
+  putchar ('"');
+  for (; *s; ++s)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+        printf ("\\%c", c);
+      else if (c < 0x20)
+        printf ("\\u%04x", c);
+      else
+        putchar (c);
+    }
+  putchar ('"');
+}
+
+static void
+print_report (const char *host, const char *port, const char *proxy,
+              int http, const struct run *runs, size_t n)
+{
+  double *v = calloc (n ? n : 1, sizeof (*v));
+  struct stats st;
+  size_t i, k, ok = 0, looks_like_time = 0, tfo_tried = 0, tfo = 0;
+  int p;
+  if (!v)
+    {
+      perror ("calloc");
+      exit (1);
+    }
+  for (i = 0; i < n; ++i)
+    if (runs[i].ok)
+      {
+        ok++;
+        looks_like_time += runs[i].random_is_time;
+        tfo_tried += !! (runs[i].sample.flags & TLSDATE_SAMPLE_TFO_TRIED);
+        tfo += !! (runs[i].sample.flags & TLSDATE_SAMPLE_TFO);
+      }
+  printf ("{\n  \"host\": ");
+  print_json_string (host);
+  printf (",\n  \"port\": ");
+  print_json_string (port);
+  printf (",\n  \"proxy\": ");
+  print_json_string (proxy);
+  printf (",\n  \"mode\": \"%s\",\n", http ? "http" : "tls");
+  printf ("  \"samples\": %zu,\n  \"successes\": %zu,\n  \"failures\": %zu,\n",
+          n, ok, n - ok);
+  printf ("  \"phases_ms\": {\n");
+  for (p = 0; p < P_MAX; ++p)
+    {
+      for (i = 0, k = 0; i < n; ++i)
+        if (runs[i].ok && runs[i].phase_ms[p] >= 0)
+          v[k++] = runs[i].phase_ms[p];
+      compute_stats (v, k, &st);
+      print_stats (kPhaseNames[p], &st, p + 1 < P_MAX ? "," : "");
+    }
+  printf ("  },\n  \"summary\": {\n");
+  for (i = 0, k = 0; i < n; ++i)
+    if (runs[i].ok)
+      v[k++] = runs[i].sample.rtt_ms;
+  compute_stats (v, k, &st);
+  print_stats ("rtt_ms", &st, ",");
+  for (i = 0, k = 0; i < n; ++i)
+    if (runs[i].ok)
+      v[k++] = runs[i].offset;
+  compute_stats (v, k, &st);
+  print_stats ("offset_s", &st, "");
+  printf ("  },\n  \"server_random\": { \"looks_like_time\": %s, "
+          "\"matching\": %zu, \"of\": %zu },\n",
+          ok && looks_like_time == ok ? "true" : "false", looks_like_time, ok);
+  printf ("  \"tcp_fastopen\": { \"tried\": %zu, \"accepted\": %zu, "
+          "\"of\": %zu },\n", tfo_tried, tfo, ok);
+  printf ("  \"runs\": [\n");
+  for (i = 0; i < n; ++i)
+    {
+      const struct run *r = &runs[i];
+      const char *sep = i + 1 < n ? "," : "";
+      if (!r->ok)
+        {
+          if (r->status == -1)
+            printf ("    { \"ok\": false, \"timed_out\": true }%s\n", sep);
+          else if (WIFEXITED (r->status))
+            printf ("    { \"ok\": false, \"exit\": %d }%s\n",
+                    WEXITSTATUS (r->status), sep);
+          else
+            printf ("    { \"ok\": false, \"signal\": %d }%s\n",
+                    WIFSIGNALED (r->status) ? WTERMSIG (r->status) : 0, sep);
+          continue;
+        }
+      printf ("    { \"ok\": true, \"time\": %u, \"offset_s\": %.3f, "
+              "\"rtt_ms\": %u, \"random_time\": %u",
+              r->sample.time, r->offset, r->sample.rtt_ms,
+              r->sample.random_time);
+      if (r->sample.flags & TLSDATE_SAMPLE_TFO_TRIED)
+        printf (", \"tfo\": %s",
+                r->sample.flags & TLSDATE_SAMPLE_TFO ? "true" : "false");
+      for (p = 0; p < P_MAX; ++p)
+        if (r->phase_ms[p] >= 0)
+          printf (", \"%s_ms\": %.3f", kPhaseNames[p], r->phase_ms[p]);
+      printf (" }%s\n", sep);
+    }
+  printf ("  ]\n}\n");
+  free (v);
+}
+
+/* Listens on an ephemeral loopback port for --startup. */
+static int
+listen_loopback (char *port, size_t port_len)
+{
+  struct sockaddr_in sin;
+  socklen_t len = sizeof (sin);
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (fd, (struct sockaddr *) &sin, sizeof (sin)) ||
+      listen (fd, 16) ||
+      getsockname (fd, (struct sockaddr *) &sin, &len))
+    {
+      close (fd);
+      return -1;
+    }
+  snprintf (port, port_len, "%u", ntohs (sin.sin_port));
+  return fd;
+}
+
+/* Spawns |path| the way tlsdated does and returns the milliseconds until
+ * its connection reaches |listen_fd|, or -1 if it never does.  The child
+ * is killed as soon as it connects; nothing past the SYN is measured.
+ */
+static double
+startup_once (const char *path, char *const argv[], int listen_fd,
+              int timeout_s, int verbose)
+{
+  posix_spawn_file_actions_t actions;
+  struct timespec before, after;
+  struct pollfd pfd;
+  double ms = -1;
+  pid_t pid;
+  int err;
+  int ready;
+  posix_spawn_file_actions_init (&actions);
+  posix_spawn_file_actions_addopen (&actions, STDOUT_FILENO, "/dev/null",
+                                    O_WRONLY, 0);
+  if (!verbose)
+    posix_spawn_file_actions_addopen (&actions, STDERR_FILENO, "/dev/null",
+                                      O_WRONLY, 0);
+  clock_gettime (CLOCK_MONOTONIC, &before);
+  err = posix_spawn (&pid, path, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy (&actions);
+  if (err)
+    {
+      fprintf (stderr, "Failed to run %s: %s\n", path, strerror (err));
+      exit (1);
+    }
+  pfd.fd = listen_fd;
+  pfd.events = POLLIN;
+  while ((ready = poll (&pfd, 1, timeout_s * 1000)) < 0 && errno == EINTR)
+    ;
+  if (ready > 0)
+    {
+      int conn;
+      clock_gettime (CLOCK_MONOTONIC, &after);
+      ms = (after.tv_sec - before.tv_sec) * 1e3 +
+           (after.tv_nsec - before.tv_nsec) / 1e6;
+      if ((conn = accept (listen_fd, NULL, NULL)) >= 0)
+        close (conn);
+    }
+  kill (pid, SIGKILL);
+  while (waitpid (pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+  return ms;
+}
+
+static void
+print_startup_report (const char *helper, const char *tlsdate,
+                      double *helper_ms, double *tlsdate_ms, size_t n)
+{
+  struct stats st;
+  size_t i, k;
+  printf ("{\n  \"mode\": \"startup\",\n  \"helper\": ");
+  print_json_string (helper);
+  printf (",\n  \"tlsdate\": ");
+  print_json_string (tlsdate);
+  printf (",\n  \"samples\": %zu,\n  \"spawn_to_syn_ms\": {\n", n);
+  for (i = 0, k = 0; i < n; ++i)
+    if (helper_ms[i] >= 0)
+      helper_ms[k++] = helper_ms[i];
+  compute_stats (helper_ms, k, &st);
+  print_stats ("helper", &st, tlsdate ? "," : "");
+  if (tlsdate)
+    {
+      for (i = 0, k = 0; i < n; ++i)
+        if (tlsdate_ms[i] >= 0)
+          tlsdate_ms[k++] = tlsdate_ms[i];
+      compute_stats (tlsdate_ms, k, &st);
+      print_stats ("tlsdate", &st, "");
+    }
+  printf ("  }\n}\n");
+}
+
+/* xorshift32: the simulation wants to be repeatable, not unpredictable. */
+static uint32_t
+sim_random (uint32_t *x)
+{
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+  return *x;
+}
+
+/*
+ * |hosts| tlsdateds all want the time at once, as after a fleet-wide wake,
+ * from a source that is down for the first |outage_s| seconds.  Each
+ * retries as tlsdated does with its default tunables: after a failure it
+ * waits as |policy| says, gives up after MAX_TRIES, and under decorrelated
+ * jitter its first try is spread over WAKE_JITTER too.  Tries are instant
+ * and succeed once the source is back.
+ */
+static int
+simulate_backoff (int policy, long hosts, long outage_s)
+{
+  const uint32_t base = WAIT_BETWEEN_TRIES;
+  const uint32_t cap = MAX_SANE_BACKOFF;
+  /* No delay exceeds twice the cap, so no host gets past this. */
+  size_t horizon = outage_s + WAKE_JITTER + MAX_TRIES * 2 * cap + 1;
+  uint64_t *rate = calloc (horizon, sizeof (*rate));
+  double *synced = calloc (hosts, sizeof (*synced));
+  uint64_t requests = 0, peak = 0;
+  uint32_t seed = 0x7d15da7e;
+  size_t i, last = 0, nsynced = 0;
+  long h;
+  struct stats st;
+  if (!rate || !synced)
+    {
+      perror ("calloc");
+      exit (1);
+    }
+  for (h = 0; h < hosts; ++h)
+    {
+      uint32_t delay = base;
+      size_t t = 0;
+      int tries;
+      if (policy == BACKOFF_DECORRELATED)
+        t = sim_random (&seed) % WAKE_JITTER;
+      for (tries = 0; tries < MAX_TRIES; ++tries)
+        {
+          rate[t]++;
+          requests++;
+          if (t > last)
+            last = t;
+          if (t >= (size_t) outage_s)
+            {
+              synced[nsynced++] = t - outage_s;
+              break;
+            }
+          delay = backoff_next (policy, base, cap, delay,
+                                sim_random (&seed));
+          t += delay;
+        }
+    }
+  for (i = 0; i <= last; ++i)
+    if (rate[i] > peak)
+      peak = rate[i];
+  printf ("{\n  \"mode\": \"backoff\",\n  \"policy\": \"%s\",\n"
+          "  \"hosts\": %ld,\n  \"outage_s\": %ld,\n"
+          "  \"requests\": %llu,\n  \"peak_rps\": %llu,\n"
+          "  \"gave_up\": %ld,\n  \"recovery_s\": {\n",
+          backoff_policy_str (policy), hosts, outage_s,
+          (unsigned long long) requests, (unsigned long long) peak,
+          hosts - (long) nsynced);
+  compute_stats (synced, nsynced, &st);
+  print_stats ("after_outage", &st, "");
+  printf ("  },\n  \"envelope_window_s\": %d,\n  \"envelope_rps\": [",
+          ENVELOPE_WINDOW);
+  for (i = 0; i <= last; i += ENVELOPE_WINDOW)
+    {
+      uint64_t top = 0;
+      size_t j;
+      for (j = i; j < i + ENVELOPE_WINDOW && j <= last; ++j)
+        if (rate[j] > top)
+          top = rate[j];
+      printf ("%s%llu", i ? ", " : "", (unsigned long long) top);
+    }
+  printf ("]\n}\n");
+  free (synced);
+  free (rate);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *host = DEFAULT_HOST;
+  const char *port = DEFAULT_PORT;
+  const char *protocol = DEFAULT_PROTOCOL;
+  const char *ca_cert_container = DEFAULT_CERTFILE;
+  const char *helper = TLSDATE_HELPER;
+  const char *tlsdate = NULL;
+  const char *proxy = NULL;
+  char *proxy_arg = NULL;
+  char ids[48] = "";
+  char listen_port[8];
+  int listen_fd = -1;
+  int startup = 0;
+  int ca_racket = 1;
+  int verbose = 0;
+  int http = 0;
+  long samples = 10;
+  long interval_ms = 0;
+  long timeout_s = 30;
+  int backoff = -1;
+  long hosts = 10000;
+  long outage_s = 300;
+  struct run *runs;
+  double *helper_ms = NULL;
+  double *tlsdate_ms = NULL;
+  size_t ok = 0;
+  long i;
+
+  while (1)
+    {
+      int option_index = 0;
+      int c;
+      static struct option long_options[] =
+      {
+        {"samples", 1, 0, 'n'},
+        {"interval", 1, 0, 'i'},
+        {"timeout", 1, 0, 'T'},
+        {"verbose", 0, 0, 'v'},
+        {"skip-verification", 0, 0, 's'},
+        {"help", 0, 0, 'h'},
+        {"host", 1, 0, 'H'},
+        {"port", 1, 0, 'p'},
+        {"protocol", 1, 0, 'P'},
+        {"certcontainer", 1, 0, 'C'},
+        {"proxy", 1, 0, 'x'},
+        {"http", 0, 0, 'w'},
+        {"helper", 1, 0, 'e'},
+        {"startup", 0, 0, 'S'},
+        {"tlsdate", 1, 0, 't'},
+        {"backoff", 1, 0, 'B'},
+        {"hosts", 1, 0, 'N'},
+        {"outage", 1, 0, 'O'},
+        {0, 0, 0, 0}
+      };
+
+      c = getopt_long (argc, argv, "n:i:T:vshH:p:P:C:x:we:St:B:N:O:",
+                       long_options, &option_index);
+      if (c == -1)
+        break;
+      switch (c)
+        {
+        case 'n':
+          samples = strtol (optarg, NULL, 0);
+          break;
+        case 'i':
+          interval_ms = strtol (optarg, NULL, 0);
+          break;
+        case 'T':
+          timeout_s = strtol (optarg, NULL, 0);
+          break;
+        case 'v':
+          verbose = 1;
+          break;
+        case 's':
+          ca_racket = 0;
+          break;
+        case 'H':
+          host = optarg;
+          break;
+        case 'p':
+          port = optarg;
+          break;
+        case 'P':
+          protocol = optarg;
+          break;
+        case 'C':
+          ca_cert_container = optarg;
+          break;
+        case 'x':
+          proxy = optarg;
+          break;
+        case 'w':
+          http = 1;
+          break;
+        case 'e':
+          helper = optarg;
+          break;
+        case 'S':
+          startup = 1;
+          break;
+        case 't':
+          tlsdate = optarg;
+          break;
+        case 'B':
+          backoff = backoff_policy_parse (optarg);
+          if (backoff < 0)
+            {
+              usage ();
+              exit (1);
+            }
+          break;
+        case 'N':
+          hosts = strtol (optarg, NULL, 0);
+          break;
+        case 'O':
+          outage_s = strtol (optarg, NULL, 0);
+          break;
+        case 'h':
+        default:
+          usage ();
+          exit (1);
+        }
+    }
+  if (samples < 1 || interval_ms < 0 || timeout_s < 1 || hosts < 1 ||
+      outage_s < 0 || outage_s > 86400)
+    {
+      usage ();
+      exit (1);
+    }
+  if (backoff >= 0)
+    return simulate_backoff (backoff, hosts, outage_s);
+  runs = calloc (samples, sizeof (*runs));
+  helper_ms = calloc (samples, sizeof (*helper_ms));
+  tlsdate_ms = calloc (samples, sizeof (*tlsdate_ms));
+  if (!runs || !helper_ms || !tlsdate_ms)
+    {
+      perror ("calloc");
+      exit (1);
+    }
+  /* Look the unprivileged user up once rather than in every helper run. */
+  if (0 == getuid ())
+    {
+      struct passwd *pw = getpwnam (UNPRIV_USER);
+      struct group *gr = getgrnam (UNPRIV_GROUP);
+      if (pw && gr && pw->pw_gid == gr->gr_gid)
+        snprintf (ids, sizeof (ids), "ids=%lu:%lu",
+                  (unsigned long) pw->pw_uid, (unsigned long) pw->pw_gid);
+    }
+  if (startup)
+    {
+      listen_fd = listen_loopback (listen_port, sizeof (listen_port));
+      if (listen_fd < 0)
+        {
+          perror ("Failed to listen on loopback");
+          exit (1);
+        }
+      host = "127.0.0.1";
+      port = listen_port;
+      proxy = NULL;
+    }
+  for (i = 0; i < samples; ++i)
+    {
+      /* The helper parses the proxy URI in place. */
+      char *args[15];
+      free (proxy_arg);
+      proxy_arg = strdup (proxy ? proxy : DEFAULT_PROXY);
+      if (!proxy_arg)
+        {
+          perror ("strdup");
+          exit (1);
+        }
+      args[0] = (char *) "tlsdate";
+      args[1] = (char *) host;
+      args[2] = (char *) port;
+      args[3] = (char *) protocol;
+      args[4] = (char *) (ca_racket ? "racket" : "unchecked");
+      args[5] = (char *) (verbose ? "verbose" : "quiet");
+      args[6] = (char *) ca_cert_container;
+      args[7] = (char *) "dont-set-clock";
+      args[8] = (char *) "showtime=sample";
+      args[9] = (char *) "no-fun";
+      args[10] = (char *) "holdfast";
+      args[11] = proxy_arg;
+      args[12] = (char *) (http ? "http" : "tls");
+      args[13] = ids[0] ? ids : NULL;
+      args[14] = NULL;
+      if (i && interval_ms)
+        {
+          struct timespec ts = { interval_ms / 1000,
+                                 (interval_ms % 1000) * 1000000 };
+          while (nanosleep (&ts, &ts) < 0 && errno == EINTR)
+            ;
+        }
+      if (startup)
+        {
+          helper_ms[i] = startup_once (helper, args, listen_fd, timeout_s,
+                                       verbose);
+          ok += helper_ms[i] >= 0;
+          if (tlsdate)
+            {
+              char *targs[15];
+              int t = 0;
+              targs[t++] = (char *) "tlsdate";
+              targs[t++] = (char *) "-n";
+              targs[t++] = (char *) "-Vsample";
+              targs[t++] = (char *) "-H";
+              targs[t++] = (char *) host;
+              targs[t++] = (char *) "-p";
+              targs[t++] = (char *) port;
+              targs[t++] = (char *) "-P";
+              targs[t++] = (char *) protocol;
+              targs[t++] = (char *) "-C";
+              targs[t++] = (char *) ca_cert_container;
+              targs[t++] = (char *) "-e";
+              targs[t++] = (char *) helper;
+              if (!ca_racket)
+                targs[t++] = (char *) "-s";
+              targs[t] = NULL;
+              tlsdate_ms[i] = startup_once (tlsdate, targs, listen_fd,
+                                            timeout_s, verbose);
+            }
+          continue;
+        }
+      if (!sample_once (helper, args, timeout_s, verbose, &runs[i]))
+        ok++;
+      if (verbose)
+        fprintf (stderr, "V: sample %ld/%ld %s\n", i + 1, samples,
+                 runs[i].ok ? "ok" : "failed");
+    }
+  free (proxy_arg);
+  if (startup)
+    print_startup_report (helper, tlsdate, helper_ms, tlsdate_ms, samples);
+  else
+    print_report (host, port, proxy, http, runs, samples);
+  if (listen_fd >= 0)
+    close (listen_fd);
+  free (helper_ms);
+  free (tlsdate_ms);
+  free (runs);
+  return ok ? 0 : 1;
+}
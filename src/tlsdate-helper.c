@@ -85,6 +85,9 @@ know:
 #endif
 
 #include "src/compat/clock.h"
+#include "src/nts.h"
+#include "src/probes.h"
+#include "src/sample.h"
 
 #ifndef MAP_ANONYMOUS
 #define MAP_ANONYMOUS MAP_ANON
@@ -96,6 +99,75 @@ know:
 #include "polarssl/ssl.h"
 #endif
 
+/** CLOCK_MONOTONIC in nanoseconds, or 0 if there is no such clock. */
+static uint64_t
+monotonic_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  if (0 == clock_gettime(CLOCK_MONOTONIC, &ts))
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+  return 0;
+}
+
+#define PROXY_OPTIMISTIC "+optimistic"
+
+/* The phase the SSL child is in, for deadline_expired(); -1 for none. */
+static volatile sig_atomic_t phase = -1;
+
+/* SIGALRM handler: the current phase ran out of time.  The exit status
+ * tells the caller which one it was.
+ */
+static void
+deadline_expired(int sig)
+{
+  (void) sig;
+  // A timer that fired as its phase ended is stale.
+  if (phase < 0)
+    return;
+  _exit(HELPER_DEADLINE_EXIT + phase);
+}
+
+/* Moves on to |next| (-1 for none) and gives it |seconds| to finish. */
+static void
+arm_phase(int next, double seconds)
+{
+  struct itimerval it;
+
+  // Stop the old phase's timer before it can be blamed on the new one.
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_REAL, &it, NULL);
+  phase = next;
+  if (next < 0 || seconds <= 0)
+    return;
+  it.it_value.tv_sec = (time_t) seconds;
+  it.it_value.tv_usec = (suseconds_t) ((seconds - it.it_value.tv_sec) * 1e6);
+  if (!it.it_value.tv_sec && !it.it_value.tv_usec)
+    it.it_value.tv_usec = 1;
+  setitimer(ITIMER_REAL, &it, NULL);
+}
+
+static void
+enter_phase(int next)
+{
+  arm_phase(next, next >= 0 ? deadlines[next] : 0);
+}
+
+#if defined(USE_POLARSSL) || !defined(BIO_CONN_S_OK)
+/* Name resolution and the TCP connect, where they can't be timed apart:
+ * they get both deadlines together, and a miss counts against connecting.
+ */
+static void
+enter_connect_phases(void)
+{
+  double resolve = deadlines[HELPER_RESOLVE];
+  double connect = deadlines[HELPER_CONNECT];
+
+  arm_phase(HELPER_CONNECT, resolve > 0 && connect > 0 ? resolve + connect : 0);
+}
+#endif
+
 static void
 validate_proxy_scheme(const char *scheme)
 {
@@ -128,8 +200,11 @@ validate_proxy_port(const char *port)
 }
 
 static void
-parse_proxy_uri(char *proxy, char **scheme, char **host, char **port)
+parse_proxy_uri(char *proxy, char **scheme, char **host, char **port,
+                int *optimistic)
 {
+  size_t len;
+
   /* Expecting a URI, so: <scheme> '://' <host> ':' <port> */
   *scheme = proxy;
   proxy = strstr(proxy, "://");
@@ -138,6 +213,17 @@ parse_proxy_uri(char *proxy, char **scheme, char **host, char **port)
   *proxy = '\0'; /* terminate scheme string */
   proxy += strlen("://");
 
+  /* <scheme>+optimistic sends the proxy request along with the ClientHello
+   * instead of waiting on the proxy's answer first. */
+  *optimistic = 0;
+  len = strlen(*scheme);
+  if (len > strlen(PROXY_OPTIMISTIC) &&
+      !strcmp(*scheme + len - strlen(PROXY_OPTIMISTIC), PROXY_OPTIMISTIC))
+  {
+    (*scheme)[len - strlen(PROXY_OPTIMISTIC)] = '\0';
+    *optimistic = 1;
+  }
+
   *host = proxy;
   proxy = strchr(proxy, ':');
   if (!proxy)
@@ -159,6 +245,7 @@ setup_proxy(BIO *ssl)
   char *scheme;
   char *proxy_host;
   char *proxy_port;
+  int optimistic;
 
   if (!proxy)
     return;
@@ -169,16 +256,101 @@ setup_proxy(BIO *ssl)
    * target) and swap out the connect BIO's target host and port so it'll
    * connect to the proxy instead.
    */
-  parse_proxy_uri(proxy, &scheme, &proxy_host, &proxy_port);
+  parse_proxy_uri(proxy, &scheme, &proxy_host, &proxy_port, &optimistic);
   bio = BIO_new_proxy();
   BIO_proxy_set_type(bio, scheme);
   BIO_proxy_set_host(bio, host);
   BIO_proxy_set_port(bio, atoi(port));
+  BIO_proxy_set_optimistic(bio, optimistic);
   host = proxy_host;
   port = proxy_port;
   BIO_push(ssl, bio);
 }
 
+#ifdef BIO_CONN_S_OK
+/* Where connect_state_callback() stamps the end of name resolution. */
+static struct tlsdate_sample *connect_stamps;
+
+/* Asks for TCP Fast Open on the socket |bio| is about to connect, so the
+ * first write (the ClientHello, or the proxy's greeting) rides in the SYN
+ * once the kernel holds a cookie for the server.  Until then the SYN goes
+ * out bare and asks for one.
+ */
+static void
+request_fastopen(BIO *bio)
+{
+#ifdef TCP_FASTOPEN_CONNECT
+  int one = 1;
+  int fd = -1;
+
+  if (BIO_get_fd(bio, &fd) < 0 || fd < 0)
+    return;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)))
+  {
+    verb_debug("V: no TCP Fast Open: %s", strerror(errno));
+    return;
+  }
+  if (connect_stamps)
+    connect_stamps->flags |= TLSDATE_SAMPLE_TFO_TRIED;
+#endif
+}
+
+/* BIO_s_connect() reports each state it moves into; use that to split
+ * name resolution from the TCP handshake.  OpenSSL 1.1 made the states
+ * private, so there resolved_ns stays zero and these two probes don't fire.
+ */
+static int
+connect_state_callback(const BIO *bio, int state, int ret)
+{
+  if (state == BIO_CONN_S_CREATE_SOCKET)
+  {
+    enter_phase(HELPER_CONNECT);
+    PROBE0(dns_done);
+    if (connect_stamps && !connect_stamps->resolved_ns)
+      connect_stamps->resolved_ns = monotonic_ns();
+  }
+  else if (state == BIO_CONN_S_CONNECT)
+    request_fastopen((BIO *) bio);
+  else if (state == BIO_CONN_S_OK)
+    PROBE0(tcp_connected);
+  return ret;
+}
+#endif
+
+/* Whether the server acknowledged the data we sent in our SYN. */
+static int
+fastopen_accepted(BIO *bio)
+{
+#if defined(TCP_INFO) && defined(TCPI_OPT_SYN_DATA)
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  int fd = -1;
+
+  if (BIO_get_fd(bio, &fd) < 0 || fd < 0)
+    return 0;
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len))
+    return 0;
+  return !!(info.tcpi_options & TCPI_OPT_SYN_DATA);
+#else
+  return 0;
+#endif
+}
+
+#ifdef HAVE_SYS_SDT_H
+static void
+handshake_probe_callback(int write_p, int version, int content_type,
+                         const void *buf, size_t len, SSL *ssl, void *arg)
+{
+  const unsigned char *msg = buf;
+  if (content_type != SSL3_RT_HANDSHAKE || len < 1)
+    return;
+  if (write_p && msg[0] == SSL3_MT_CLIENT_HELLO)
+    PROBE0(client_hello);
+  else if (!write_p && msg[0] == SSL3_MT_SERVER_HELLO)
+    PROBE0(server_hello);
+}
+#endif
+
 static BIO *
 make_ssl_bio(SSL_CTX *ctx)
 {
@@ -187,6 +359,10 @@ make_ssl_bio(SSL_CTX *ctx)
 
   if (!(con = BIO_new(BIO_s_connect())))
     die("BIO_s_connect failed");
+#ifdef BIO_CONN_S_OK
+  BIO_callback_ctrl(con, BIO_CTRL_SET_CALLBACK,
+                    (bio_info_cb *) connect_state_callback);
+#endif
   if (!(ssl = BIO_new_ssl(ctx, 1)))
     die("BIO_new_ssl failed");
   setup_proxy(ssl);
@@ -370,11 +546,60 @@ xfree (void *ptr)
   free(ptr);
 }
 
+/** server_random doesn't hold a sane time and there is nothing else to
+ * check certificates against.  The exit status tells tlsdated to try the
+ * HTTP Date header instead. */
+static void
+false_ticker (uint32_t server_time)
+{
+  fprintf (stderr, "V: the remote server is a false ticker! server: %u "
+           "compile: %u\n", server_time, (uint32_t) RECENT_COMPILE_DATE);
+  exit (HELPER_FALSE_TICKER_EXIT);
+}
+
+/** The server's certificate won't do.  Like die(), but the exit status
+ * tells tlsdated to stop asking this server. */
+static void
+reject_certificate (const char *fmt, ...)
+{
+  va_list ap;
+  va_start (ap, fmt);
+  vfprintf (stderr, fmt, ap);
+  fprintf (stderr, "\n");
+  va_end (ap);
+  exit (HELPER_BAD_CERT_EXIT);
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_STORE_get0_param(store) ((store)->param)
+#define ASN1_STRING_get0_data(str) ASN1_STRING_data(str)
+
+static size_t
+SSL_get_server_random (const SSL *ssl, unsigned char *out, size_t outlen)
+{
+  if (outlen > sizeof (ssl->s3->server_random))
+    outlen = sizeof (ssl->s3->server_random);
+  memcpy (out, ssl->s3->server_random, outlen);
+  return outlen;
+}
+#endif
+
+/** Whether the handshake has just taken in the ServerHello. */
+static int
+server_hello_read (const SSL *ssl)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  return SSL_get_state (ssl) == TLS_ST_CR_SRVR_HELLO;
+#else
+  return ssl->state == SSL3_ST_CR_SRVR_HELLO_A ||
+         ssl->state == SSL3_ST_CR_SRVR_HELLO_B;
+#endif
+}
+
 void
 openssl_time_callback (const SSL* ssl, int where, int ret)
 {
-  if (where == SSL_CB_CONNECT_LOOP &&
-      (ssl->state == SSL3_ST_CR_SRVR_HELLO_A || ssl->state == SSL3_ST_CR_SRVR_HELLO_B))
+  if (where == SSL_CB_CONNECT_LOOP && server_hello_read (ssl))
   {
     // XXX TODO: If we want to trust the remote system for time,
     // can we just read that time out of the remote system and if the
@@ -387,7 +612,8 @@ openssl_time_callback (const SSL* ssl, int where, int ret)
     uint32_t max_reasonable_time = MAX_REASONABLE_TIME;
     uint32_t server_time;
     verb("V: freezing time for x509 verification");
-    memcpy(&server_time, ssl->s3->server_random, sizeof(uint32_t));
+    SSL_get_server_random(ssl, (unsigned char *) &server_time,
+                          sizeof(uint32_t));
     if (compiled_time < ntohl(server_time)
         &&
         ntohl(server_time) < max_reasonable_time)
@@ -395,11 +621,15 @@ openssl_time_callback (const SSL* ssl, int where, int ret)
       verb("V: remote peer provided: %d, preferred over compile time: %d",
             ntohl(server_time), compiled_time);
       verb("V: freezing time with X509_VERIFY_PARAM_set_time");
-      X509_VERIFY_PARAM_set_time(ssl->ctx->cert_store->param,
-                                 (time_t) ntohl(server_time) + 86400);
+      verify_time = (time_t) ntohl(server_time) + 86400;
+      X509_VERIFY_PARAM_set_time(
+        X509_STORE_get0_param(SSL_CTX_get_cert_store(SSL_get_SSL_CTX(ssl))),
+        verify_time);
+    } else if (http_date) {
+      // The time comes from the Date header; check against our own clock.
+      verb("V: server_random carries no time: %u", ntohl(server_time));
     } else {
-      die("V: the remote server is a false ticker! server: %d compile: %d",
-           ntohl(server_time), compiled_time);
+      false_ticker(ntohl(server_time));
     }
   }
 }
@@ -411,50 +641,27 @@ get_certificate_keybits (EVP_PKEY *public_key)
     In theory, we could use check_bitlen_dsa() and check_bitlen_rsa()
    */
   uint32_t key_bits;
-  switch (public_key->type)
+  switch (EVP_PKEY_base_id(public_key))
   {
     case EVP_PKEY_RSA:
       verb("V: key type: EVP_PKEY_RSA");
-      key_bits = BN_num_bits(public_key->pkey.rsa->n);
-      break;
-    case EVP_PKEY_RSA2:
-      verb("V: key type: EVP_PKEY_RSA2");
-      key_bits = BN_num_bits(public_key->pkey.rsa->n);
       break;
     case EVP_PKEY_DSA:
       verb("V: key type: EVP_PKEY_DSA");
-      key_bits = BN_num_bits(public_key->pkey.dsa->p);
-      break;
-    case EVP_PKEY_DSA1:
-      verb("V: key type: EVP_PKEY_DSA1");
-      key_bits = BN_num_bits(public_key->pkey.dsa->p);
-      break;
-    case EVP_PKEY_DSA2:
-      verb("V: key type: EVP_PKEY_DSA2");
-      key_bits = BN_num_bits(public_key->pkey.dsa->p);
-      break;
-    case EVP_PKEY_DSA3:
-      verb("V: key type: EVP_PKEY_DSA3");
-      key_bits = BN_num_bits(public_key->pkey.dsa->p);
-      break;
-    case EVP_PKEY_DSA4:
-      verb("V: key type: EVP_PKEY_DSA4");
-      key_bits = BN_num_bits(public_key->pkey.dsa->p);
       break;
     case EVP_PKEY_DH:
       verb("V: key type: EVP_PKEY_DH");
-      key_bits = BN_num_bits(public_key->pkey.dh->pub_key);
       break;
     case EVP_PKEY_EC:
       verb("V: key type: EVP_PKEY_EC");
-      key_bits = EVP_PKEY_bits(public_key);
       break;
     // Should we also care about EVP_PKEY_HMAC and EVP_PKEY_CMAC?
     default:
-      key_bits = 0;
       die ("unknown public key type");
       break;
   }
+  // The modulus for RSA, the prime for DSA and DH, the order for EC.
+  key_bits = EVP_PKEY_bits(public_key);
   verb ("V: keybits: %d", key_bits);
   return key_bits;
 }
@@ -610,23 +817,32 @@ check_wildcard_match_rfc2595 (const char *orig_hostname,
 */
 uint32_t
 check_cn (SSL *ssl, const char *hostname)
+{
+  uint32_t ok;
+  X509 *certificate;
+
+  certificate = SSL_get_peer_certificate(ssl);
+  if (NULL == certificate)
+  {
+    die ("Unable to extract certificate");
+  }
+  ok = check_cert_cn(certificate, hostname);
+  X509_free(certificate);
+  return ok;
+}
+
+uint32_t
+check_cert_cn (X509 *certificate, const char *hostname)
 {
   int ok = 0;
   int ret;
   char *cn_buf;
-  X509 *certificate;
   X509_NAME *xname;
 
   // We cast this to cast away g++ complaining about the following:
   // error: invalid conversion from ‘void*’ to ‘char*’
   cn_buf = (char *) xmalloc(TLSDATE_HOST_NAME_MAX + 1);
 
-  certificate = SSL_get_peer_certificate(ssl);
-  if (NULL == certificate)
-  {
-    die ("Unable to extract certificate");
-  }
-
   memset(cn_buf, '\0', (TLSDATE_HOST_NAME_MAX + 1));
   xname = X509_get_subject_name(certificate);
   ret = X509_NAME_get_text_by_NID(xname, NID_commonName,
@@ -634,7 +850,7 @@ check_cn (SSL *ssl, const char *hostname)
 
   if (-1 == ret || ret != (int) strlen(cn_buf))
   {
-    die ("Unable to extract commonName");
+    reject_certificate ("Unable to extract commonName");
   }
   if (strcasecmp(cn_buf, hostname))
   {
@@ -645,8 +861,7 @@ check_cn (SSL *ssl, const char *hostname)
     ok = 1;
   }
 
-  X509_NAME_free(xname);
-  X509_free(certificate);
+  // xname belongs to the certificate; don't free it.
   xfree(cn_buf);
 
   return ok;
@@ -658,14 +873,22 @@ check_cn (SSL *ssl, const char *hostname)
 uint32_t
 check_san (SSL *ssl, const char *hostname)
 {
+  uint32_t ok;
   X509 *cert;
-  int extcount, ok = 0;
-  /* What an OpenSSL mess ... */
   if (NULL == (cert = SSL_get_peer_certificate(ssl)))
   {
     die ("Getting certificate failed");
   }
+  ok = check_cert_san(cert, hostname);
+  X509_free(cert);
+  return ok;
+}
 
+uint32_t
+check_cert_san (X509 *cert, const char *hostname)
+{
+  int extcount, ok = 0;
+  /* What an OpenSSL mess ... */
   if ((extcount = X509_get_ext_count(cert)) > 0)
   {
     int i;
@@ -682,6 +905,7 @@ check_san (SSL *ssl, const char *hostname)
         int j;
         void *extvalstr;
         const unsigned char *tmp;
+        ASN1_OCTET_STRING *value;
 
         STACK_OF(CONF_VALUE) *val;
         CONF_VALUE *nval;
@@ -695,13 +919,14 @@ check_san (SSL *ssl, const char *hostname)
           break;
         }
 
-        tmp = ext->value->data;
+        value = X509_EXTENSION_get_data(ext);
+        tmp = ASN1_STRING_get0_data(value);
         if (method->it)
         {
-          extvalstr = ASN1_item_d2i(NULL, &tmp, ext->value->length,
+          extvalstr = ASN1_item_d2i(NULL, &tmp, ASN1_STRING_length(value),
                                     ASN1_ITEM_ptr(method->it));
         } else {
-          extvalstr = method->d2i(NULL, &tmp, ext->value->length);
+          extvalstr = method->d2i(NULL, &tmp, ASN1_STRING_length(value));
         }
 
         if (!extvalstr)
@@ -748,105 +973,61 @@ check_san (SSL *ssl, const char *hostname)
   } else {
     verb_debug ("V: no X509_EXTENSION field(s) found");
   }
-  X509_free(cert);
   return ok;
 }
 
 uint32_t
-check_name (SSL *ssl, const char *hostname)
+check_cert_name (X509 *certificate, const char *hostname)
 {
   uint32_t ret;
-  ret = check_cn(ssl, hostname);
-  ret += check_san(ssl, hostname);
+  ret = check_cert_cn(certificate, hostname);
+  ret += check_cert_san(certificate, hostname);
   if (0 != ret && 0 < ret)
   {
     verb ("V: hostname verification passed");
   } else {
-    die ("hostname verification failed for host %s!", host);
+    reject_certificate ("hostname verification failed for host %s!", host);
   }
   return ret;
 }
 #endif
 
 #ifdef USE_POLARSSL
-uint32_t
-verify_signature (ssl_context *ssl, const char *hostname)
+void
+check_verify_flags (int flags)
 {
-  int ssl_verify_result;
-
-  ssl_verify_result = ssl_get_verify_result (ssl);
-  if (ssl_verify_result & BADCERT_EXPIRED)
+  if (flags & BADCERT_EXPIRED)
   {
-    die ("certificate has expired");
+    reject_certificate ("certificate has expired");
   }
-  if (ssl_verify_result & BADCERT_REVOKED)
+  if (flags & BADCERT_REVOKED)
   {
-    die ("certificate has been revoked");
+    reject_certificate ("certificate has been revoked");
   }
-  if (ssl_verify_result & BADCERT_CN_MISMATCH)
+  if (flags & BADCERT_CN_MISMATCH)
   {
-    die ("CN and subject AltName mismatch for certificate");
+    reject_certificate ("CN and subject AltName mismatch for certificate");
   }
-  if (ssl_verify_result & BADCERT_NOT_TRUSTED)
+  if (flags & BADCERT_NOT_TRUSTED)
   {
-    die ("certificate is self-signed or not signed by a trusted CA");
+    reject_certificate ("certificate is self-signed or not signed by a "
+                        "trusted CA");
   }
-
-  if (0 == ssl_verify_result)
-  {
-    verb ("V: verify success");
-  }
-  else
-  {
-    die ("certificate verification error: -0x%04x", -ssl_verify_result);
-  }
-  return 0;
-}
-#else
-uint32_t
-verify_signature (SSL *ssl, const char *hostname)
-{
-  long ssl_verify_result;
-  X509 *certificate;
-
-  certificate = SSL_get_peer_certificate(ssl);
-  if (NULL == certificate)
+  if (0 != flags)
   {
-    die ("Getting certificate failed");
+    reject_certificate ("certificate verification error: -0x%04x", -flags);
   }
-  // In theory, we verify that the cert is valid
-  ssl_verify_result = SSL_get_verify_result(ssl);
-  switch (ssl_verify_result)
-  {
-  case X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT:
-  case X509_V_ERR_SELF_SIGNED_CERT_IN_CHAIN:
-    die ("certificate is self signed");
-  case X509_V_OK:
-    verb ("V: certificate verification passed");
-    break;
-  default:
-    die ("certification verification error: %ld",
-         ssl_verify_result);
-  }
- return 0;
 }
 #endif
 
 #ifdef USE_POLARSSL
 void
-check_key_length (ssl_context *ssl)
+check_cert_key_length (const x509_cert *certificate)
 {
   uint32_t key_bits;
-  const x509_cert *certificate;
   const rsa_context *public_key;
   char buf[1024];
 
-  certificate = ssl_get_peer_cert (ssl);
-  if (NULL == certificate)
-  {
-    die ("Getting certificate failed");
-  }
-
   x509parse_dn_gets(buf, 1024, &certificate->subject);
   verb_debug ("V: Certificate for subject '%s'", buf);
 
@@ -860,67 +1041,345 @@ check_key_length (ssl_context *ssl)
   key_bits = mpi_msb (&public_key->N);
   if (MIN_PUB_KEY_LEN >= key_bits)
   {
-    die ("Unsafe public key size: %d bits", key_bits);
+    reject_certificate ("Unsafe public key size: %d bits", key_bits);
   } else {
     verb_debug ("V: key length appears safe");
   }
 }
+
+/** Checks each certificate as PolarSSL walks the chain, so a bad one ends
+ * the run as soon as the Certificate message is in rather than after the
+ * handshake and any HTTP request. */
+int
+verify_polarssl_cert (void *data, x509_cert *certificate, int depth,
+                      int *flags)
+{
+  (void) data;
+  if (0 == depth)
+  {
+    certificate_checked = 1;
+    check_cert_key_length (certificate);
+  }
+  if (ca_racket)
+  {
+    check_verify_flags (*flags);
+    if (0 == depth)
+      verb ("V: verify success");
+  }
+  return 0;
+}
 #else
 void
-check_key_length (SSL *ssl)
+check_cert_key_length (X509 *certificate)
 {
   uint32_t key_bits;
-  X509 *certificate;
   EVP_PKEY *public_key;
-  certificate = SSL_get_peer_certificate (ssl);
-  if (NULL == certificate)
-  {
-    die ("Getting certificate failed");
-  }
   public_key = X509_get_pubkey (certificate);
   if (NULL == public_key)
   {
-    die ("public key extraction failure");
+    reject_certificate ("public key extraction failure");
   } else {
     verb_debug ("V: public key is ready for inspection");
   }
 
   key_bits = get_certificate_keybits (public_key);
-  if (MIN_PUB_KEY_LEN >= key_bits && public_key->type != EVP_PKEY_EC)
+  if (MIN_PUB_KEY_LEN >= key_bits && EVP_PKEY_base_id(public_key) != EVP_PKEY_EC)
   {
-    die ("Unsafe public key size: %d bits", key_bits);
+    reject_certificate ("Unsafe public key size: %d bits", key_bits);
   } else {
-     if (public_key->type == EVP_PKEY_EC)
+     if (EVP_PKEY_base_id(public_key) == EVP_PKEY_EC)
        if(key_bits >= MIN_ECC_PUB_KEY_LEN
           && key_bits <= MAX_ECC_PUB_KEY_LEN)
        {
          verb_debug ("V: ECC key length appears safe");
        } else {
-         die ("Unsafe ECC key size: %d bits", key_bits);
+         reject_certificate ("Unsafe ECC key size: %d bits", key_bits);
      } else {
        verb_debug ("V: key length appears safe");
      }
   }
   EVP_PKEY_free (public_key);
 }
+
+/** Hash a certificate's SubjectPublicKeyInfo; returns 0 on success. */
+int
+hash_spki (X509 *certificate, uint8_t out[SHA256_DIGEST_LENGTH])
+{
+  unsigned char *der = NULL;
+  int len;
+  len = i2d_X509_PUBKEY (X509_get_X509_PUBKEY (certificate), &der);
+  if (len > 0)
+    SHA256 (der, len, out);
+  OPENSSL_free (der);
+  return len > 0 ? 0 : 1;
+}
+
+/** Hash the leaf's SubjectPublicKeyInfo, the usual thing to pin, so
+ * tlsdated can tell which key vouched for the time. */
+void
+hash_leaf_spki (SSL *ssl, uint8_t out[SHA256_DIGEST_LENGTH])
+{
+  X509 *certificate;
+  certificate = SSL_get_peer_certificate (ssl);
+  if (NULL == certificate)
+    return;
+  hash_spki (certificate, out);
+  X509_free (certificate);
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_STORE_CTX_get0_cert(store) ((store)->cert)
+#define X509_STORE_CTX_get0_untrusted(store) ((store)->untrusted)
 #endif
 
-#ifdef USE_POLARSSL
+/** Stands in for chain building when the source is pinned: the leaf's key
+ * must be the pinned one, or the leaf must be signed, through the chain
+ * the server sent, by a certificate whose key is.  The CA store is never
+ * loaded, and a mismatch dies here, before the handshake goes any
+ * further. */
+int
+verify_pin (X509_STORE_CTX *store, void *arg)
+{
+  STACK_OF(X509) *sent = X509_STORE_CTX_get0_untrusted (store);
+  X509 *certificate = X509_STORE_CTX_get0_cert (store);
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  int depth, i;
+  (void) arg;
+  if (NULL == certificate)
+    reject_certificate ("no certificate to check against the pin");
+  for (depth = 0; depth <= sk_X509_num (sent); depth++)
+  {
+    X509 *issuer = NULL;
+    if (0 == hash_spki (certificate, digest) &&
+        0 == memcmp (digest, spki_pin, sizeof (digest)))
+    {
+      verb ("V: certificate %d in the chain matches the pin", depth);
+      X509_STORE_CTX_set_error (store, X509_V_OK);
+      return 1;
+    }
+    for (i = 0; sent && i < sk_X509_num (sent) && NULL == issuer; i++)
+    {
+      X509 *candidate = sk_X509_value (sent, i);
+      EVP_PKEY *key;
+      if (candidate == certificate ||
+          X509_V_OK != X509_check_issued (candidate, certificate))
+        continue;
+      key = X509_get_pubkey (candidate);
+      if (key && 1 == X509_verify (certificate, key))
+        issuer = candidate;
+      EVP_PKEY_free (key);
+    }
+    if (NULL == issuer)
+      break;
+    certificate = issuer;
+  }
+  reject_certificate ("certificate doesn't match the pin");
+  return 0;
+}
+
+/** Hash the DER of every certificate in |chain|, then those hashes in
+ * order; returns 0 on success. */
+int
+hash_chain (STACK_OF(X509) *chain, uint8_t out[SHA256_DIGEST_LENGTH])
+{
+  uint8_t digests[MAX_CHAIN_LEN][SHA256_DIGEST_LENGTH];
+  int i, n = chain ? sk_X509_num (chain) : 0;
+  if (n <= 0 || n > MAX_CHAIN_LEN)
+    return 1;
+  for (i = 0; i < n; i++)
+  {
+    unsigned char *der = NULL;
+    int len = i2d_X509 (sk_X509_value (chain, i), &der);
+    if (len <= 0)
+      return 1;
+    SHA256 (der, len, digests[i]);
+    OPENSSL_free (der);
+  }
+  SHA256 (&digests[0][0], n * SHA256_DIGEST_LENGTH, out);
+  return 0;
+}
+
+/** Whether every certificate in |chain| is valid at the time certificates
+ * are checked against. */
+int
+chain_in_date (STACK_OF(X509) *chain)
+{
+  time_t *when = verify_time ? &verify_time : NULL;
+  int i;
+  for (i = 0; i < sk_X509_num (chain); i++)
+  {
+    X509 *certificate = sk_X509_value (chain, i);
+    if (X509_cmp_time (X509_get_notBefore (certificate), when) >= 0 ||
+        X509_cmp_time (X509_get_notAfter (certificate), when) <= 0)
+      return 0;
+  }
+  return 1;
+}
+
+/** The earliest notAfter in |chain|, in seconds since the epoch, or 0 if
+ * it can't be told. */
+int64_t
+chain_not_after (STACK_OF(X509) *chain)
+{
+  int64_t earliest = 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  time_t now = time (NULL);
+  int i;
+  for (i = 0; i < sk_X509_num (chain); i++)
+  {
+    int days, secs;
+    int64_t t;
+    if (!ASN1_TIME_diff (&days, &secs, NULL,
+                         X509_get_notAfter (sk_X509_value (chain, i))))
+      return 0;
+    t = (int64_t) now + (int64_t) days * 86400 + secs;
+    if (0 == earliest || t < earliest)
+      earliest = t;
+  }
+#endif
+  return earliest;
+}
+
+/** Point |ctx| at the CA certificates in ca_cert_container. */
 void
-inspect_key (ssl_context *ssl, const char *hostname)
+load_ca_store (SSL_CTX *ctx)
 {
-  verify_signature (ssl, hostname);
+  struct stat statbuf;
+  if (-1 == stat(ca_cert_container, &statbuf))
+  {
+    die("Unable to stat CA certficate container %s", ca_cert_container);
+  } else
+  {
+    switch (statbuf.st_mode & S_IFMT)
+    {
+    case S_IFREG:
+      if (1 != SSL_CTX_load_verify_locations(ctx, ca_cert_container, NULL))
+        fprintf(stderr, "SSL_CTX_load_verify_locations failed");
+      break;
+    case S_IFDIR:
+      if (1 != SSL_CTX_load_verify_locations(ctx, NULL, ca_cert_container))
+        fprintf(stderr, "SSL_CTX_load_verify_locations failed");
+      break;
+    default:
+      if (1 != SSL_CTX_load_verify_locations(ctx, NULL, ca_cert_container))
+      {
+        fprintf(stderr, "SSL_CTX_load_verify_locations failed");
+        die("Unable to load CA certficate container %s", ca_cert_container);
+      }
+    }
+  }
+}
 
-  // ssl_get_verify_result() already checks for CN / subjectAltName match
-  // and reports the mismatch as error. So check_name() is not called
+/** Stands in for chain building when tlsdated has recently seen a chain
+ * pass the CA store: if the server sends exactly that chain again and it
+ * is still in date, the verdict stands and the store is never loaded.
+ * Any other chain gets the store and a full verification. */
+int
+verify_cached_chain (X509_STORE_CTX *store, void *arg)
+{
+  STACK_OF(X509) *sent = X509_STORE_CTX_get0_untrusted (store);
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  if (0 == hash_chain (sent, digest) &&
+      0 == memcmp (digest, chain_hint, sizeof (digest)) &&
+      chain_in_date (sent))
+  {
+    verb ("V: certificate chain matches the one verified before");
+    chain_cached = 1;
+    X509_STORE_CTX_set_error (store, X509_V_OK);
+    return 1;
+  }
+  verb ("V: certificate chain has changed; verifying it in full");
+  load_ca_store ((SSL_CTX *) arg);
+  return X509_verify_cert (store);
 }
-#else
+
+/** Checks the server's certificate as soon as the Certificate message is
+ * in, rather than after the handshake and any HTTP request: the leaf's key
+ * must be long enough and, unless verification is off, name the host and
+ * pass the pin, the cached chain or the CA store.  Anything wrong ends the
+ * run with HELPER_BAD_CERT_EXIT. */
+int
+verify_certificate (X509_STORE_CTX *store, void *arg)
+{
+  X509 *certificate = X509_STORE_CTX_get0_cert (store);
+  int ok;
+  if (NULL == certificate)
+    reject_certificate ("Getting certificate failed");
+  certificate_checked = 1;
+  check_cert_key_length (certificate);
+  if (!pinned && !ca_racket)
+  {
+    verb ("V: Certificate verification skipped!");
+    return 1;
+  }
+  check_cert_name (certificate, hostname_to_verify);
+  if (pinned)
+    return verify_pin (store, arg);
+  ok = chain_hinted ? verify_cached_chain (store, arg)
+                    : X509_verify_cert (store);
+  if (1 != ok)
+  {
+    switch (X509_STORE_CTX_get_error (store))
+    {
+    case X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT:
+    case X509_V_ERR_SELF_SIGNED_CERT_IN_CHAIN:
+      reject_certificate ("certificate is self signed");
+    default:
+      reject_certificate ("certification verification error: %d",
+                          X509_STORE_CTX_get_error (store));
+    }
+  }
+  verb ("V: certificate verification passed");
+  return 1;
+}
+
+/** Run NTS-KE (RFC 8915) over the verified connection: ask for keys and
+ * cookies for NTPv4 and export the keys from the TLS session. */
 void
-inspect_key (SSL *ssl, const char *hostname)
+nts_key_exchange (BIO *bio, SSL *ssl, struct nts_session *result)
 {
+  uint8_t request[NTS_KE_REQUEST_LEN], response[NTS_KE_MAX_RESPONSE];
+  uint8_t context[5];
+  const unsigned char *alpn = NULL;
+  unsigned int alpn_len = 0;
+  size_t len;
+  int ret = 1;
+  int i;
 
-    verify_signature (ssl, hostname);
-    check_name (ssl, hostname);
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  SSL_get0_alpn_selected (ssl, &alpn, &alpn_len);
+#endif
+  if (alpn_len != NTS_KE_ALPN_LEN - 1 ||
+      memcmp (alpn, NTS_KE_ALPN + 1, alpn_len))
+    die ("server did not agree to NTS-KE");
+  len = nts_ke_encode_request (request);
+  if ((int) len != BIO_write (bio, request, len))
+    die ("NTS-KE request failed");
+  len = 0;
+  while (1 == ret && len < sizeof (response))
+  {
+    int n = BIO_read (bio, response + len, sizeof (response) - len);
+    if (n <= 0)
+      die ("NTS-KE response cut short");
+    len += n;
+    ret = nts_ke_parse_response (response, len, result);
+  }
+  if (0 != ret)
+    die ("unusable NTS-KE response");
+  for (i = 0; i < 2; ++i)
+  {
+    nts_exporter_context (result->aead, i, context);
+    if (1 != SSL_export_keying_material (ssl,
+                                         i ? result->s2c_key : result->c2s_key,
+                                         NTS_KEY_LEN, NTS_EXPORTER_LABEL,
+                                         strlen (NTS_EXPORTER_LABEL),
+                                         context, sizeof (context), 1))
+      die ("NTS key export failed");
+  }
+  verb ("V: NTS-KE gave %u cookies for %s:%u",
+        (unsigned int) result->num_cookies,
+        result->ntp_server[0] ? result->ntp_server : host,
+        (unsigned int) result->ntp_port);
 }
 #endif
 
@@ -937,8 +1396,7 @@ check_timestamp (uint32_t server_time)
     verb("V: remote peer provided: %d, preferred over compile time: %d",
           server_time, compiled_time);
   } else {
-    die("V: the remote server is a false ticker! server: %d compile: %d",
-         server_time, compiled_time);
+    false_ticker(server_time);
   }
 }
 
@@ -966,16 +1424,16 @@ static int ssl_do_handshake_part(ssl_context *ssl)
 }
 
 /**
- * Run SSL handshake and store the resulting time value in the
- * 'time_map'.
+ * Run SSL handshake and store the resulting time value, and when each
+ * phase finished, in 'result'.
  *
- * @param time_map where to store the current time
+ * @param result shared with the parent; receives the time and phase stamps
  * @param time_is_an_illusion
  * @param http whether to do an http request and take the date from that
  *     instead.
  */
 static void
-run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
+run_ssl (struct tlsdate_sample *result, int time_is_an_illusion, int http)
 {
   entropy_context entropy;
   ctr_drbg_context ctr_drbg;
@@ -1030,9 +1488,12 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
   ssl_set_ca_chain (&ssl, &cacert, NULL, hostname_to_verify);
   if (ca_racket)
   {
-      // You can do SSL_VERIFY_REQUIRED here, but then the check in
-      // inspect_key() never happens as the ssl_handshake() will fail.
+      // verify_polarssl_cert() turns away a bad certificate itself, with
+      // its own exit status, so the handshake needn't fail on its own.
       ssl_set_authmode (&ssl, SSL_VERIFY_OPTIONAL);
+      ssl_set_verify (&ssl, verify_polarssl_cert, NULL);
+  } else {
+    verb ("V: Certificate verification skipped!");
   }
 
   if (proxy)
@@ -1040,41 +1501,66 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
     char *scheme;
     char *proxy_host;
     char *proxy_port;
+    int optimistic;
 
-    parse_proxy_uri (proxy, &scheme, &proxy_host, &proxy_port);
+    parse_proxy_uri (proxy, &scheme, &proxy_host, &proxy_port, &optimistic);
 
     verb("V: opening socket to proxy %s:%s", proxy_host, proxy_port);
+    result->start_ns = monotonic_ns();
+    PROBE1(dns_start, proxy_host);
+    enter_connect_phases();
     if (0 != net_connect (&server_fd, proxy_host, atoi(proxy_port)))
     {
       die ("SSL connection failed");
     }
+    PROBE0(tcp_connected);
+    result->connected_ns = monotonic_ns();
 
     proxy_polarssl_init (&proxy_ctx);
     proxy_polarssl_set_bio (&proxy_ctx, net_recv, &server_fd, net_send, &server_fd);
     proxy_polarssl_set_host (&proxy_ctx, host);
     proxy_polarssl_set_port (&proxy_ctx, atoi(port));
     proxy_polarssl_set_scheme (&proxy_ctx, scheme);
+    proxy_polarssl_set_optimistic (&proxy_ctx, optimistic);
 
     ssl_set_bio (&ssl, proxy_polarssl_recv, &proxy_ctx, proxy_polarssl_send, &proxy_ctx);
 
-    verb("V: Handle proxy connection");
-    if (0 == proxy_ctx.f_connect (&proxy_ctx))
-      die("Proxy connection failed");
+    // An optimistic tunnel comes up with the handshake, so its time
+    // lands in the handshake's.
+    if (!optimistic)
+    {
+      verb("V: Handle proxy connection");
+      enter_phase(HELPER_PROXY);
+      PROBE0(proxy_start);
+      ret = proxy_ctx.f_connect (&proxy_ctx);
+      PROBE1(proxy_done, ret);
+      if (0 == ret)
+        die("Proxy connection failed");
+    }
+    result->proxied_ns = monotonic_ns();
   }
   else
   {
     verb("V: opening socket to %s:%s", host, port);
+    result->start_ns = monotonic_ns();
+    PROBE1(dns_start, host);
+    enter_connect_phases();
     if (0 != net_connect (&server_fd, host, atoi(port)))
     {
       die ("SSL connection failed");
     }
+    PROBE0(tcp_connected);
+    result->connected_ns = monotonic_ns();
 
     ssl_set_bio (&ssl, net_recv, &server_fd, net_send, &server_fd);
   }
 
   verb("V: starting handshake");
+  enter_phase(HELPER_HANDSHAKE);
+  PROBE0(client_hello);
   if (0 != ssl_do_handshake_part (&ssl))
     die("SSL handshake first part failed");
+  PROBE0(server_hello);
 
   uint32_t timestamp = ( (uint32_t) ssl.in_msg[6] << 24 )
                      | ( (uint32_t) ssl.in_msg[7] << 16 )
@@ -1092,41 +1578,56 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
       die("SSL handshake failed");
     }
   }
-
-  // Verify the peer certificate against the CA certs on the local system
-  if (ca_racket) {
-    inspect_key (&ssl, hostname_to_verify);
-  } else {
-    verb ("V: Certificate verification skipped!");
+  PROBE0(handshake_done);
+  enter_phase(-1);
+  result->handshake_ns = monotonic_ns();
+  result->tls_ns = result->handshake_ns;
+  result->random_time = timestamp;
+
+  // The certificate was checked as it arrived unless nothing verifies it.
+  PROBE0(verify_start);
+  if (!certificate_checked)
+  {
+    if (NULL == ssl_get_peer_cert (&ssl))
+      reject_certificate ("Getting certificate failed");
+    check_cert_key_length (ssl_get_peer_cert (&ssl));
   }
-  check_key_length (&ssl);
+  PROBE0(verify_done);
+  result->verified_ns = monotonic_ns();
 
-  memcpy (time_map, &timestamp, sizeof(uint32_t));
+  memcpy (&result->time, &timestamp, sizeof(uint32_t));
   proxy_polarssl_free (&proxy_ctx);
   ssl_free (&ssl);
   x509_free (&cacert);
 }
 #else /* USE_POLARSSL */
 /**
- * Run SSL handshake and store the resulting time value in the
- * 'time_map'.
+ * Run SSL handshake and store the resulting time value, and when each
+ * phase finished, in 'result'.
  *
- * @param time_map where to store the current time
+ * @param result shared with the parent; receives the time and phase stamps
  * @param time_is_an_illusion
  * @param http whether to do an http request and take the date from that
  *     instead.
  */
 static void
-run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
+run_ssl (struct tlsdate_sample *result, int time_is_an_illusion, int http)
 {
   BIO *s_bio;
   SSL_CTX *ctx;
   SSL *ssl;
-  struct stat statbuf;
   uint32_t result_time;
 
-  SSL_load_error_strings();
+  // The error string tables are a large share of startup; only load them
+  // when someone will read the messages.
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  OPENSSL_init_ssl(verbose ? 0 : (OPENSSL_INIT_NO_LOAD_SSL_STRINGS |
+                                  OPENSSL_INIT_NO_LOAD_CRYPTO_STRINGS), NULL);
+#else
+  if (verbose)
+    SSL_load_error_strings();
   SSL_library_init();
+#endif
 
   ctx = NULL;
   if (0 == strcmp("sslv23", protocol))
@@ -1135,8 +1636,11 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
     ctx = SSL_CTX_new(SSLv23_client_method());
   } else if (0 == strcmp("sslv3", protocol))
   {
+    // Left out of most builds since POODLE; the NULL check below says so.
+#ifndef OPENSSL_NO_SSL3_METHOD
     verb ("V: using SSLv3_client_method()");
     ctx = SSL_CTX_new(SSLv3_client_method());
+#endif
   } else if (0 == strcmp("tlsv1", protocol))
   {
     verb ("V: using TLSv1_client_method()");
@@ -1147,33 +1651,39 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
   if (ctx == NULL)
     die("OpenSSL failed to support protocol `%s'", protocol);
 
+  if (nts_result)
+  {
+    // RFC 8915 forbids NTS-KE over anything older than TLS 1.3.
+#ifdef TLS1_3_VERSION
+    if (1 != SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION))
+      die ("Failed to require TLS 1.3 for NTS-KE");
+#else
+    die ("NTS-KE needs TLS 1.3, which needs OpenSSL 1.1.1 or later");
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    if (0 != SSL_CTX_set_alpn_protos(ctx,
+                                     (const unsigned char *) NTS_KE_ALPN,
+                                     NTS_KE_ALPN_LEN))
+      die ("Failed to offer NTS-KE");
+#else
+    die ("NTS-KE needs ALPN, which needs OpenSSL 1.0.2 or later");
+#endif
+  }
+
   verb("V: Using OpenSSL for SSL");
-  if (ca_racket)
+  if (pinned)
   {
-    if (-1 == stat(ca_cert_container, &statbuf))
-    {
-      die("Unable to stat CA certficate container %s", ca_cert_container);
-    } else
-    {
-      switch (statbuf.st_mode & S_IFMT)
-      {
-      case S_IFREG:
-        if (1 != SSL_CTX_load_verify_locations(ctx, ca_cert_container, NULL))
-          fprintf(stderr, "SSL_CTX_load_verify_locations failed");
-        break;
-      case S_IFDIR:
-        if (1 != SSL_CTX_load_verify_locations(ctx, NULL, ca_cert_container))
-          fprintf(stderr, "SSL_CTX_load_verify_locations failed");
-        break;
-      default:
-        if (1 != SSL_CTX_load_verify_locations(ctx, NULL, ca_cert_container))
-        {
-          fprintf(stderr, "SSL_CTX_load_verify_locations failed");
-          die("Unable to load CA certficate container %s", ca_cert_container);
-        }
-      }
-    }
+    // The pin decides on its own; there is no chain to build.
+    verb ("V: certificate pinned, skipping the CA store");
+  } else if (ca_racket && !chain_hinted)
+  {
+    // Only a chain other than the hinted one needs the CA store.
+    load_ca_store (ctx);
   }
+  // Check the certificate when it arrives, not after the handshake.
+  if (pinned || ca_racket)
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+  SSL_CTX_set_cert_verify_callback(ctx, verify_certificate, ctx);
 
   if (NULL == (s_bio = make_ssl_bio(ctx)))
     die ("SSL BIO setup failed");
@@ -1183,10 +1693,14 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
 
   if (time_is_an_illusion)
   {
+    http_date = http;
     SSL_set_info_callback(ssl, openssl_time_callback);
   }
 
   SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);
+#ifdef HAVE_SYS_SDT_H
+  SSL_set_msg_callback(ssl, handshake_probe_callback);
+#endif
   verb("V: opening socket to %s:%s", host, port);
   if ( (1 != BIO_set_conn_hostname(s_bio, host)) ||
        (1 != BIO_set_conn_port(s_bio, port)) )
@@ -1197,17 +1711,56 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
 
   // This should run in seccomp
   // eg:     prctl(PR_SET_SECCOMP, 1);
+#ifdef BIO_CONN_S_OK
+  connect_stamps = result;
+#endif
+  result->start_ns = monotonic_ns();
+  PROBE1(dns_start, host);
+#ifdef BIO_CONN_S_OK
+  enter_phase(HELPER_RESOLVE);
+#else
+  enter_connect_phases();
+#endif
+  // Connect the socket, then the proxy tunnel if there is one, on their
+  // own first so each can be timed apart from the handshake;
+  // BIO_do_connect() on the SSL BIO does it all at once.  An optimistic
+  // tunnel only comes up with the handshake, so its time lands there.
+  if (proxy)
+  {
+    if (1 != BIO_do_connect(BIO_next(BIO_next(s_bio))))
+      die ("SSL connection failed");
+    result->connected_ns = monotonic_ns();
+    enter_phase(HELPER_PROXY);
+    if (1 != BIO_do_connect(BIO_next(s_bio)))
+      die ("Proxy connection failed");
+    result->proxied_ns = monotonic_ns();
+  } else {
+    if (1 != BIO_do_connect(BIO_next(s_bio)))
+      die ("SSL connection failed");
+    result->connected_ns = monotonic_ns();
+  }
+  enter_phase(HELPER_HANDSHAKE);
   if (1 != BIO_do_connect(s_bio)) // XXX TODO: BIO_should_retry() later?
     die ("SSL connection failed");
   if (1 != BIO_do_handshake(s_bio))
     die ("SSL handshake failed");
+  PROBE0(handshake_done);
+  enter_phase(-1);
+  result->tls_ns = monotonic_ns();
+  if ((result->flags & TLSDATE_SAMPLE_TFO_TRIED) && fastopen_accepted(s_bio))
+  {
+    result->flags |= TLSDATE_SAMPLE_TFO;
+    verb("V: TCP Fast Open: the server took our SYN's data");
+  }
 
-  // from /usr/include/openssl/ssl3.h
-  //  ssl->s3->server_random is an unsigned char of 32 bits
-  memcpy(&result_time, ssl->s3->server_random, sizeof (uint32_t));
+  // The first four bytes of server_random; see openssl_time_callback().
+  SSL_get_server_random(ssl, (unsigned char *) &result_time,
+                        sizeof (uint32_t));
   verb("V: In TLS response, T=%lu", (unsigned long)ntohl(result_time));
+  result->random_time = ntohl(result_time);
 
   if (http) {
+    result->flags |= TLSDATE_SAMPLE_HTTP;
     char buf[1024];
     verb_debug ("V: Starting HTTP");
     if (snprintf(buf, sizeof(buf),
@@ -1215,25 +1768,46 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
       die("hostname too long");
     buf[1023]='\0'; /* Unneeded. */
     verb_debug ("V: Writing HTTP request");
+    enter_phase(HELPER_HTTP);
+    PROBE0(http_start);
     if (1 != write_all_to_bio(s_bio, buf))
       die ("write all to bio failed.");
     verb_debug ("V: Reading HTTP response");
     if (1 != read_http_date_from_bio(s_bio, &result_time))
       die ("read all from bio failed.");
+    enter_phase(-1);
+    PROBE1(http_done, result_time);
     verb ("V: Received HTTP response. T=%lu", (unsigned long)result_time);
 
     result_time = htonl(result_time);
   }
+  // With http, the Date header counts as part of the handshake phase.
+  result->handshake_ns = monotonic_ns();
+
+  // verify_certificate() already checked the certificate as it arrived.
+  PROBE0(verify_start);
+  if (!certificate_checked)
+    reject_certificate ("Getting certificate failed");
+  if (!pinned && ca_racket) {
+    STACK_OF(X509) *chain = SSL_get_peer_cert_chain (ssl);
+    // Tell tlsdated what passed so it can spare the next run the store.
+    if (0 == hash_chain (chain, result->chain_sha256))
+      result->not_after = chain_not_after (chain);
+    if (chain_cached)
+      result->flags |= TLSDATE_SAMPLE_CHAIN_CACHED;
+  }
+  hash_leaf_spki (ssl, result->spki_sha256);
+  PROBE0(verify_done);
+  result->verified_ns = monotonic_ns();
 
-  // Verify the peer certificate against the CA certs on the local system
-  if (ca_racket) {
-    inspect_key (ssl, hostname_to_verify);
-  } else {
-    verb ("V: Certificate verification skipped!");
+  if (nts_result)
+  {
+    enter_phase(HELPER_HTTP);
+    nts_key_exchange (s_bio, ssl, nts_result);
+    enter_phase(-1);
   }
-  check_key_length(ssl);
 
-  memcpy(time_map, &result_time, sizeof (uint32_t));
+  memcpy(&result->time, &result_time, sizeof (uint32_t));
 
   SSL_free(ssl);
   SSL_CTX_free(ctx);
@@ -1241,9 +1815,11 @@ run_ssl (uint32_t *time_map, int time_is_an_illusion, int http)
 #endif /* USE_POLARSSL */
 /** drop root rights and become 'nobody' */
 
+#ifdef TLSDATE_HELPER_MAIN
 int
 main(int argc, char **argv)
 {
+  struct tlsdate_sample *shared;
   uint32_t *time_map;
   struct tlsdate_time start_time, end_time, warp_time;
   int status;
@@ -1253,11 +1829,17 @@ main(int argc, char **argv)
   int setclock;
   int showtime;
   int showtime_raw;
+  int showtime_sample;
+  int nts;
   int timewarp;
   int leap;
   int http;
+  uid_t unpriv_uid = 0;
+  gid_t unpriv_gid = 0;
+  const char *ids = NULL;
+  int i;
 
-  if (argc != 13)
+  if (argc < HELPER_ARGC || argc > HELPER_MAX_ARGC)
     return 1;
   host = argv[1];
   hostname_to_verify = argv[1];
@@ -1270,10 +1852,67 @@ main(int argc, char **argv)
   setclock = (0 == strcmp ("setclock", argv[7]));
   showtime = (0 == strcmp ("showtime", argv[8]));
   showtime_raw = (0 == strcmp ("showtime=raw", argv[8]));
+  showtime_sample = (0 == strcmp ("showtime=sample", argv[8]));
+  nts = (0 == strcmp ("showtime=nts", argv[8]));
   timewarp = (0 == strcmp ("timewarp", argv[9]));
   leap = (0 == strcmp ("leapaway", argv[10]));
   proxy = (0 == strcmp ("none", argv[11]) ? NULL : argv[11]);
   http = (0 == (strcmp("http", argv[12])));
+#ifdef USE_POLARSSL
+  if (nts)
+    die ("NTS-KE is only supported with OpenSSL");
+#endif
+  if (nts && http)
+    die ("NTS-KE doesn't speak HTTP");
+  for (i = HELPER_ARGC; i < argc; i++)
+  {
+    if (0 == strncmp(argv[i], "ids=", strlen("ids=")))
+      ids = argv[i];
+    else if (0 == strncmp(argv[i], HELPER_DEADLINES_WORD,
+                          strlen(HELPER_DEADLINES_WORD)))
+    {
+      if (helper_parse_deadlines(argv[i] + strlen(HELPER_DEADLINES_WORD),
+                                 deadlines))
+        die ("bad deadlines `%s'", argv[i]);
+    }
+    else if (0 == strncmp(argv[i], HELPER_PIN_WORD, strlen(HELPER_PIN_WORD)))
+    {
+      if (helper_parse_pin(argv[i] + strlen(HELPER_PIN_WORD), spki_pin))
+        die ("bad pin `%s'", argv[i]);
+      pinned = 1;
+    }
+    else if (0 == strncmp(argv[i], HELPER_CHAIN_WORD,
+                          strlen(HELPER_CHAIN_WORD)))
+    {
+      if (helper_parse_chain(argv[i] + strlen(HELPER_CHAIN_WORD), chain_hint))
+        die ("bad chain `%s'", argv[i]);
+      chain_hinted = 1;
+    }
+    else
+      die ("unknown argument `%s'", argv[i]);
+  }
+#ifdef USE_POLARSSL
+  if (pinned)
+    die ("pins are only supported with OpenSSL");
+#endif
+
+  /* Look the unprivileged user up once, before either fork below; with
+   * "ids=UID:GID" from tlsdated the user database isn't consulted at all.
+   */
+  if (0 == getuid())
+  {
+    if (ids)
+    {
+      unsigned long uid, gid;
+      char extra;
+      if (2 != sscanf(ids, "ids=%lu:%lu%c", &uid, &gid, &extra))
+        die ("bad unprivileged ids `%s'", ids);
+      unpriv_uid = (uid_t) uid;
+      unpriv_gid = (gid_t) gid;
+    } else {
+      lookup_privs (UNPRIV_USER, UNPRIV_GROUP, &unpriv_uid, &unpriv_gid);
+    }
+  }
 
   /* Initalize warp_time with RECENT_COMPILE_DATE */
   clock_init_time(&warp_time, RECENT_COMPILE_DATE, 0);
@@ -1291,21 +1930,33 @@ main(int argc, char **argv)
   if (0 == setclock && 0 == timewarp)
   {
     verb ("V: attemping to drop administrator privileges");
-    drop_privs_to (UNPRIV_USER, UNPRIV_GROUP);
+    drop_privs_to_ids (unpriv_uid, unpriv_gid);
   }
 
   // We cast the mmap value to remove this error when compiling with g++:
   // src/tlsdate-helper.c: In function ‘int main(int, char**)’:
   // src/tlsdate-helper.c:822:41: error: invalid conversion from ‘void*’ to ‘uint32_t
-  time_map = (uint32_t *) mmap (NULL, sizeof (uint32_t),
+  shared = (struct tlsdate_sample *) mmap (NULL, sizeof (*shared),
        PROT_READ | PROT_WRITE,
        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-   if (MAP_FAILED == time_map)
+   if (MAP_FAILED == shared)
   {
     fprintf (stderr, "mmap failed: %s",
              strerror (errno));
     return 1;
   }
+  time_map = &shared->time;
+  if (nts)
+  {
+    nts_result = (struct nts_session *) mmap (NULL, sizeof (*nts_result),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == nts_result)
+    {
+      fprintf (stderr, "mmap failed: %s", strerror (errno));
+      return 1;
+    }
+    memset (nts_result, 0, sizeof (*nts_result));
+  }
 
   /* Get the current time from the system clock. */
   if (0 != clock_get_real_time(&start_time))
@@ -1352,16 +2003,45 @@ main(int argc, char **argv)
     die ("fork failed: %s", strerror (errno));
   if (0 == ssl_child)
   {
-    drop_privs_to (UNPRIV_USER, UNPRIV_GROUP);
-    run_ssl (time_map, leap, http);
-    (void) munmap (time_map, sizeof (uint32_t));
+    struct sigaction sa;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = deadline_expired;
+    sigaction (SIGALRM, &sa, NULL);
+    drop_privs_to_ids (unpriv_uid, unpriv_gid);
+    run_ssl (shared, leap, http);
+    (void) munmap (shared, sizeof (*shared));
     _exit (0);
   }
   if (ssl_child != platform->process_wait (ssl_child, &status, 1))
     die ("waitpid failed: %s", strerror (errno));
+  if (WIFEXITED (status) && helper_deadline_phase (WEXITSTATUS (status)) >= 0)
+  {
+    fprintf (stderr, "ran out of time in the %s phase\n",
+             helper_phase_str (helper_deadline_phase (WEXITSTATUS (status))));
+    return WEXITSTATUS (status);
+  }
+  // Pass these on, so tlsdated knows to look for the time elsewhere.
+  if (WIFEXITED (status) &&
+      (HELPER_FALSE_TICKER_EXIT == WEXITSTATUS (status) ||
+       HELPER_BAD_CERT_EXIT == WEXITSTATUS (status)))
+    return WEXITSTATUS (status);
   if (! (WIFEXITED (status) && (0 == WEXITSTATUS (status)) ))
     die ("child process failed in SSL handshake");
 
+  // NTS-KE carries no time; tlsdated asks the NTP server it names.
+  if (nts)
+  {
+    if (NTS_SESSION_MAGIC != nts_result->magic)
+      die ("child process failed to finish NTS-KE");
+    nts_result->pid = (uint32_t) getpid ();
+    // One fwrite, flushed at exit as a single write(2) to tlsdated's pipe.
+    fwrite (nts_result, sizeof (*nts_result), 1, stdout);
+    munmap (nts_result, sizeof (*nts_result));
+    munmap (shared, sizeof (*shared));
+    return 0;
+  }
+
   if (0 != clock_get_real_time(&end_time))
     die ("Failed to read current time of day: %s", strerror (errno));
 
@@ -1378,7 +2058,6 @@ main(int argc, char **argv)
   // It either stayed zero or we have a false ticker.
   if ( 0 == server_time_s )
     die ("child process failed to update time map; weird platform issues?");
-  munmap (time_map, sizeof (uint32_t));
 
   verb ("V: server time %u (difference is about %d s) was fetched in %lld ms",
   (unsigned int) server_time_s,
@@ -1400,6 +2079,35 @@ main(int argc, char **argv)
     fwrite(&server_time_s, sizeof(server_time_s), 1, stdout);
   }
 
+  if (showtime_sample)
+  {
+    struct tlsdate_sample sample;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.time = server_time_s;
+    sample.magic = TLSDATE_SAMPLE_MAGIC;
+    sample.rtt_ms = (uint32_t) rt_time_ms;
+    sample.flags = shared->flags;
+    sample.connected_ns = shared->connected_ns;
+    sample.handshake_ns = shared->handshake_ns;
+    sample.verified_ns = shared->verified_ns;
+    sample.start_ns = shared->start_ns;
+    sample.resolved_ns = shared->resolved_ns;
+    sample.proxied_ns = shared->proxied_ns;
+    sample.tls_ns = shared->tls_ns;
+    sample.random_time = shared->random_time;
+    memcpy(sample.spki_sha256, shared->spki_sha256,
+           sizeof(sample.spki_sha256));
+    memcpy(sample.chain_sha256, shared->chain_sha256,
+           sizeof(sample.chain_sha256));
+    sample.not_after = shared->not_after;
+    sample.pid = (uint32_t) getpid();
+    sample.sent_ns = monotonic_ns();
+    // One fwrite, flushed at exit as a single write(2) to tlsdated's pipe.
+    fwrite(&sample, sizeof(sample), 1, stdout);
+  }
+  munmap (shared, sizeof (*shared));
+
   if (showtime)
   {
      struct tm  ltm;
@@ -1437,3 +2145,4 @@ main(int argc, char **argv)
   }
   return 0;
 }
+#endif /* TLSDATE_HELPER_MAIN */
@@ -19,6 +19,7 @@
 #include <bsd/string.h>
 #endif
 #include <unistd.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -28,6 +29,8 @@
 #include <pwd.h>
 #include <grp.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <ctype.h>
 #ifdef HAVE_PRCTL
 #include <sys/prctl.h>
@@ -41,11 +44,13 @@
 #include <openssl/x509.h>
 #include <openssl/conf.h>
 #include <openssl/x509v3.h>
+#include <openssl/sha.h>
 #endif
 
 int verbose;
 int verbose_debug;
 
+#include "src/helper-argv.h"
 #include "src/util.h"
 
 /** Name of user that we feel safe to run SSL handshake with. */
@@ -103,6 +108,9 @@ int verbose_debug;
 // Define a max length for HTTP headers
 #define MAX_HTTP_HEADERS_SIZE 8192
 
+// Define the longest certificate chain a cached verification covers
+#define MAX_CHAIN_LEN 16
+
 // Define our basic HTTP request
 #define HTTP_REQUEST    \
   "HEAD / HTTP/1.1\r\n" \
@@ -123,22 +131,61 @@ static const char *protocol;
 static char *proxy;
 
 static const char *ca_cert_container;
+
+/* Where run_ssl() leaves the result of NTS-KE; NULL unless asked for. */
+static struct nts_session *nts_result;
+
+/* Seconds each phase may take; zero for no limit. */
+static double deadlines[HELPER_PHASES];
+
+/* The key to trust in place of the CA store, if |pinned|. */
+static int pinned;
+static uint8_t spki_pin[HELPER_PIN_DIGEST_LEN];
+
+/* A chain tlsdated saw pass the CA store, if |chain_hinted|, and whether
+ * the server sent it again.
+ */
+static int chain_hinted;
+static uint8_t chain_hint[HELPER_CHAIN_DIGEST_LEN];
+static int chain_cached;
+
+/* The time certificates are checked against, if frozen; 0 for now. */
+static time_t verify_time;
+
+/* Whether the time comes from the HTTP Date header rather than
+ * server_random.
+ */
+static int http_date;
+
+/* Whether the server's certificate has been checked yet. */
+static int certificate_checked;
 #ifndef USE_POLARSSL
 void openssl_time_callback (const SSL* ssl, int where, int ret);
 uint32_t get_certificate_keybits (EVP_PKEY *public_key);
 uint32_t check_cn (SSL *ssl, const char *hostname);
 uint32_t check_san (SSL *ssl, const char *hostname);
+uint32_t check_cert_cn (X509 *certificate, const char *hostname);
+uint32_t check_cert_san (X509 *cert, const char *hostname);
 long openssl_check_against_host_and_verify (SSL *ssl);
-uint32_t check_name (SSL *ssl, const char *hostname);
-uint32_t verify_signature (SSL *ssl, const char *hostname);
-void check_key_length (SSL *ssl);
-void inspect_key (SSL *ssl, const char *hostname);
-void check_key_length (SSL *ssl);
-void inspect_key (SSL *ssl, const char *hostname);
+uint32_t check_cert_name (X509 *certificate, const char *hostname);
+void check_cert_key_length (X509 *certificate);
+int hash_spki (X509 *certificate, uint8_t out[SHA256_DIGEST_LENGTH]);
+void hash_leaf_spki (SSL *ssl, uint8_t out[SHA256_DIGEST_LENGTH]);
+int verify_pin (X509_STORE_CTX *store, void *arg);
+int hash_chain (STACK_OF(X509) *chain, uint8_t out[SHA256_DIGEST_LENGTH]);
+int chain_in_date (STACK_OF(X509) *chain);
+int64_t chain_not_after (STACK_OF(X509) *chain);
+void load_ca_store (SSL_CTX *ctx);
+int verify_cached_chain (X509_STORE_CTX *store, void *arg);
+int verify_certificate (X509_STORE_CTX *store, void *arg);
+void nts_key_exchange (BIO *bio, SSL *ssl, struct nts_session *result);
 #endif
 uint32_t dns_label_count (char *label, char *delim);
 uint32_t check_wildcard_match_rfc2595 (const char *orig_hostname,
                                        const char *orig_cert_wild_card);
-static void run_ssl (uint32_t *time_map, int time_is_an_illusion, int http);
+struct tlsdate_sample;
+struct nts_session;
+static void run_ssl (struct tlsdate_sample *result, int time_is_an_illusion,
+                     int http);
 
 #endif
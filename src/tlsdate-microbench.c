@@ -0,0 +1,340 @@
+/*
+ * tlsdate-microbench.c - microbenchmarks for tlsdate-helper hot paths
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Run with `make bench-micro`, or directly as
+ *   src/tlsdate-microbench [-d fixture_dir] [-t seconds] [filter]
+ * Each benchmark whose name contains |filter| is run for about |seconds|
+ * (default 1) and reported in the format Go's testing package uses, so
+ * results from two commits can be compared with benchstat:
+ *   BenchmarkName  <iterations>  <ns> ns/op  <allocs> allocs/op
+ * Allocation counts need glibc; elsewhere they are reported as 0.
+ */
+
+#include "config.h"
+
+/* The functions under test are static, so build the helper (minus its
+ * main()) and the test BIO straight into this file.
+ */
+#include "src/tlsdate-helper.c"
+#include "src/test-bio.c"
+
+#include <limits.h>
+#include <openssl/pem.h>
+
+#include "src/conf.h"
+#include "src/proxy-bio.h"
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+
+static uint64_t alloc_count;
+
+void *
+malloc (size_t size)
+{
+  alloc_count++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  alloc_count++;
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  alloc_count++;
+  return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+  __libc_free (ptr);
+}
+#else
+static uint64_t alloc_count;
+#endif
+
+typedef void (*bench_fn) (uint64_t iterations, void *arg);
+
+static double bench_seconds = 1.0;
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Grows the iteration count until one run takes |bench_seconds|, the way
+ * `go test -bench` does, then reports that run.
+ */
+static void
+run_bench (const char *filter, const char *name, bench_fn fn, void *arg)
+{
+  uint64_t n = 1;
+  uint64_t allocs;
+  double elapsed;
+  if (filter && !strstr (name, filter))
+    return;
+  for (;;)
+    {
+      double start;
+      alloc_count = 0;
+      start = now_ns ();
+      fn (n, arg);
+      elapsed = now_ns () - start;
+      allocs = alloc_count;
+      if (elapsed >= bench_seconds * 1e9 || n >= 1000000000ULL)
+        break;
+      if (elapsed < 1e6)
+        n *= 100;
+      else
+        n = (uint64_t) (n * 1.2 * bench_seconds * 1e9 / elapsed) + 1;
+    }
+  printf ("Benchmark%s\t%llu\t%.1f ns/op\t%.2f allocs/op\n", name,
+          (unsigned long long) n, elapsed / n, (double) allocs / n);
+  fflush (stdout);
+}
+
+/* Keeps the compiler from discarding results. */
+static volatile uint32_t sink;
+
+static void
+bench_handle_date_line (uint64_t n, void *arg)
+{
+  const char *line = arg;
+  uint32_t t;
+  while (n--)
+    {
+      handle_date_line (line, &t);
+      sink += t;
+    }
+}
+
+static const char kHttpResponse[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Server: gws\r\n"
+  "Cache-Control: private, max-age=0\r\n"
+  "Content-Type: text/html; charset=ISO-8859-1\r\n"
+  "X-XSS-Protection: 1; mode=block\r\n"
+  "X-Frame-Options: SAMEORIGIN\r\n"
+  "Date: Sun, 18 Oct 2026 12:10:42 GMT\r\n"
+  "Expires: -1\r\n"
+  "\r\n";
+
+static void
+bench_read_http_date (uint64_t n, void *arg)
+{
+  uint32_t t;
+  while (n--)
+    {
+      BIO *test = BIO_new_test ();
+      BIO_test_add_input (test, (const unsigned char *) kHttpResponse,
+                          sizeof (kHttpResponse) - 1);
+      read_http_date_from_bio (test, &t);
+      sink += t;
+      BIO_free (test);
+    }
+}
+
+struct name_pair
+{
+  const char *host;
+  const char *pattern;
+};
+
+static void
+bench_wildcard (uint64_t n, void *arg)
+{
+  const struct name_pair *p = arg;
+  while (n--)
+    sink += check_wildcard_match_rfc2595 (p->host, p->pattern);
+}
+
+struct cert_case
+{
+  X509 *cert;
+  const char *host;
+};
+
+static void
+bench_check_cn (uint64_t n, void *arg)
+{
+  const struct cert_case *c = arg;
+  while (n--)
+    sink += check_cert_cn (c->cert, c->host);
+}
+
+static void
+bench_check_san (uint64_t n, void *arg)
+{
+  const struct cert_case *c = arg;
+  while (n--)
+    sink += check_cert_san (c->cert, c->host);
+}
+
+static const unsigned char kSocks4aReply[] =
+{
+  0x00, 0x5a, 0x01, 0xbb, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char kSocks5Replies[] =
+{
+  0x05, 0x00,                                 /* no auth */
+  0x05, 0x00, 0x00, 0x01, 127, 0, 0, 1, 0x01, 0xbb  /* connected */
+};
+
+struct socks_case
+{
+  const char *type;
+  const unsigned char *reply;
+  size_t reply_len;
+};
+
+/* Covers building the proxy BIO too; the handshake alone is a few small
+ * reads and writes on the test BIO.
+ */
+static void
+bench_socks (uint64_t n, void *arg)
+{
+  const struct socks_case *c = arg;
+  static const char kPayload[] = "x";
+  while (n--)
+    {
+      BIO *test = BIO_new_test ();
+      BIO *proxy = BIO_new_proxy ();
+      BIO_proxy_set_type (proxy, c->type);
+      BIO_proxy_set_host (proxy, "www.example.com");
+      BIO_proxy_set_port (proxy, 443);
+      BIO_push (proxy, test);
+      BIO_test_add_input (test, c->reply, c->reply_len);
+      sink += BIO_write (proxy, kPayload, 1);
+      BIO_free_all (proxy);
+    }
+}
+
+static void
+bench_conf_parse (uint64_t n, void *arg)
+{
+  FILE *f = arg;
+  while (n--)
+    {
+      struct conf_entry *e;
+      rewind (f);
+      e = conf_parse (f);
+      sink += e != NULL;
+      conf_free (e);
+    }
+}
+
+/* Writes a config with |sources| source blocks, like a long host list. */
+static FILE *
+make_conf (int sources)
+{
+  FILE *f = tmpfile ();
+  int i;
+  if (!f)
+    die ("tmpfile() failed: %s", strerror (errno));
+  fputs ("# generated for tlsdate-microbench\n"
+         "base-path /var/cache/tlsdated\n"
+         "steady-state-interval 86400\n"
+         "verbose no\n", f);
+  for (i = 0; i < sources; ++i)
+    fprintf (f, "source\n\thost host%d.example.com\n\tport 443\n"
+             "\tproxy none\nend\n", i);
+  fflush (f);
+  return f;
+}
+
+static X509 *
+load_cert (const char *dir, const char *name)
+{
+  char path[PATH_MAX];
+  X509 *cert;
+  FILE *f;
+  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  if (!(f = fopen (path, "r")))
+    die ("can't open %s: %s", path, strerror (errno));
+  cert = PEM_read_X509 (f, NULL, NULL, NULL);
+  fclose (f);
+  if (!cert)
+    die ("can't parse %s", path);
+  return cert;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *fixtures = "src/test";
+  const char *filter = NULL;
+  struct name_pair wild_hit = { "www.example.com", "*.example.com" };
+  struct name_pair wild_miss = { "www.example.com", "*.example.org" };
+  struct cert_case cn, san_last;
+  struct socks_case socks4a = { "socks4a", kSocks4aReply,
+                                sizeof (kSocks4aReply) };
+  struct socks_case socks5 = { "socks5", kSocks5Replies,
+                               sizeof (kSocks5Replies) };
+  FILE *conf_small, *conf_large;
+  int opt;
+  while ((opt = getopt (argc, argv, "d:t:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'd':
+          fixtures = optarg;
+          break;
+        case 't':
+          bench_seconds = atof (optarg);
+          break;
+        default:
+          fprintf (stderr, "usage: %s [-d fixture_dir] [-t seconds] "
+                   "[filter]\n", argv[0]);
+          return 1;
+        }
+    }
+  if (optind < argc)
+    filter = argv[optind];
+  SSL_load_error_strings ();
+  SSL_library_init ();
+  cn.cert = load_cert (fixtures, "cert-cn.pem");
+  cn.host = "www.example.com";
+  /* The matching name is the last of 100, so every entry is looked at. */
+  san_last.cert = load_cert (fixtures, "cert-san.pem");
+  san_last.host = "www.example.com";
+  conf_small = make_conf (4);
+  conf_large = make_conf (1000);
+
+  run_bench (filter, "HandleDateLine/rfc1123", bench_handle_date_line,
+             "\r\nDate: Sun, 06 Nov 1994 08:49:37 GMT");
+  run_bench (filter, "HandleDateLine/rfc850", bench_handle_date_line,
+             "\r\nDate: Sunday, 06-Nov-94 08:49:37 GMT");
+  run_bench (filter, "HandleDateLine/asctime", bench_handle_date_line,
+             "\r\nDate: Sun Nov  6 08:49:37 1994");
+  run_bench (filter, "ReadHttpDateFromBio", bench_read_http_date, NULL);
+  run_bench (filter, "CheckWildcardMatch/hit", bench_wildcard, &wild_hit);
+  run_bench (filter, "CheckWildcardMatch/miss", bench_wildcard, &wild_miss);
+  run_bench (filter, "CheckCN", bench_check_cn, &cn);
+  run_bench (filter, "CheckSAN/100names", bench_check_san, &san_last);
+  run_bench (filter, "Socks4aConnect", bench_socks, &socks4a);
+  run_bench (filter, "Socks5Connect", bench_socks, &socks5);
+  run_bench (filter, "ConfParse/4sources", bench_conf_parse, conf_small);
+  run_bench (filter, "ConfParse/1000sources", bench_conf_parse, conf_large);
+
+  fclose (conf_small);
+  fclose (conf_large);
+  X509_free (cn.cert);
+  X509_free (san_last.cert);
+  return 0;
+}
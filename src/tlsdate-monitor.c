@@ -14,33 +14,185 @@
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <spawn.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "src/helper-argv.h"
+#include "src/probes.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 
+/* Whether |src| has its time taken from the HTTP Date header. */
+int
+source_uses_http (const struct source *src)
+{
+  if (src->http == SOURCE_HTTP_AUTO)
+    return random_kind_lacks_time (src->random.kind);
+  return src->http == SOURCE_HTTP_YES;
+}
+
+/* Whether |src| is kept to TLS but its server_random carries no time. */
+int
+source_lacks_time (const struct source *src)
+{
+  return src->http == SOURCE_HTTP_NO &&
+         random_kind_lacks_time (src->random.kind);
+}
+
+/* Whether |src| may be tried again this sync: it has max-tries left and
+ * its certificate hasn't been refused.
+ */
+int
+source_has_tries (const struct source *src)
+{
+  return !src->rejected && (!src->max_tries || src->tries < src->max_tries);
+}
+
+/* Chooses the next source in the list; at the end, it starts over.
+ * Sources that have used up their own max-tries this sync, or whose
+ * certificate was refused, are passed over, as are sources that can't give
+ * the time while any other is left.
+ * Returns NULL if that is all of them.
+ */
+struct source *
+advance_source (struct opts *opts)
+{
+  struct source *s;
+  struct source *n;
+  int last_resort;
+  assert (opts->sources);
+  for (last_resort = 0; last_resort < 2; last_resort++)
+    {
+      s = opts->cur_source;
+      for (n = opts->sources; n; n = n->next)
+        {
+          s = (!s || !s->next) ? opts->sources : s->next;
+          if (source_has_tries (s) &&
+              (last_resort || !source_lacks_time (s)))
+            {
+              opts->cur_source = s;
+              return s;
+            }
+        }
+    }
+  return NULL;
+}
+
+/* Gives every source its max-tries again, for the next sync. */
+void
+reset_source_tries (struct opts *opts)
+{
+  struct source *s;
+  for (s = opts->sources; s; s = s->next)
+    {
+      s->tries = 0;
+      s->rejected = 0;
+    }
+}
+
+/* Returns how many tlsdate runs are in flight. */
+int
+tlsdate_runs (const struct state *state)
+{
+  int i, n = 0;
+  for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
+    if (state->runs[i].pid)
+      n++;
+  return n;
+}
+
+/* Returns the run in flight with |pid|, or NULL. */
+struct tlsdate_run *
+find_tlsdate_run (struct state *state, pid_t pid)
+{
+  int i;
+  for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
+    if (state->runs[i].pid == pid)
+      return &state->runs[i];
+  return NULL;
+}
+
+/* Kills the runs in flight once one of them has the time; their deaths
+ * are neither failures nor a reason to retry, and anything they already
+ * wrote is thrown away.
+ */
+void
+cancel_tlsdate_runs (struct state *state)
+{
+  int i;
+  for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
+    {
+      struct tlsdate_run *run = &state->runs[i];
+      if (!run->pid || run->cancelled)
+        continue;
+      verb ("[tlsdate-monitor] cancelling tlsdate %d", run->pid);
+      run->cancelled = 1;
+      kill (run->pid, SIGKILL);
+    }
+  drain_tlsdate_responses (state);
+}
+
+/* Returns the chain |src| last sent that passed the CA store, in hex, if
+ * it may still vouch for a run at |mono| (CLOCK_MONOTONIC seconds) and
+ * |now|.  Once chain-cache-age is up or the chain has expired, returns NULL
+ * so the helper verifies in full again.
+ */
+const char *
+cached_chain (const struct opts *opts, const struct source *src,
+              time_t mono, time_t now)
+{
+  if (!opts->chain_cache_age || !src->chain[0] || src->pin)
+    return NULL;
+  if (mono - src->chain_verified >= opts->chain_cache_age)
+    return NULL;
+  if (src->chain_not_after && now >= src->chain_not_after)
+    return NULL;
+  return src->chain;
+}
+
+/* Remembers the chain a run against |src| reported at |mono|.  A chain the
+ * helper took on the cache's word keeps its old verification time, so a
+ * full one still comes round every chain-cache-age.
+ */
+void
+note_verified_chain (struct source *src, const struct tlsdate_sample *sample,
+                     time_t mono)
+{
+  static const uint8_t zero[sizeof (sample->chain_sha256)];
+  size_t i;
+  if (sample->flags & TLSDATE_SAMPLE_CHAIN_CACHED)
+    return;
+  if (!memcmp (sample->chain_sha256, zero, sizeof (zero)))
+    {
+      src->chain[0] = '\0';
+      return;
+    }
+  for (i = 0; i < sizeof (sample->chain_sha256); ++i)
+    snprintf (src->chain + 2 * i, 3, "%02x", sample->chain_sha256[i]);
+  src->chain_verified = mono;
+  src->chain_not_after = (time_t) sample->not_after;
+}
+
+/* Builds the command line for |opts->cur_source|. */
 static
 char **
 build_argv (struct opts *opts)
 {
   int argc;
   char **new_argv;
-  assert (opts->sources);
-  /* choose the next source in the list; if we're at the end, start over. */
-  if (!opts->cur_source || !opts->cur_source->next)
-    opts->cur_source = opts->sources;
-  else
-    opts->cur_source = opts->cur_source->next;
+  const char *chain;
+  struct timespec mono;
+  assert (opts->cur_source);
   for (argc = 0; opts->base_argv[argc]; argc++)
     ;
   /* Put an arbitrary limit on the number of args. */
   if (argc > 1024)
     return NULL;
   argc++; /* uncounted null terminator */
-  argc += 9;  /* -H host -p port -x proxy -Vraw -n -l */
+  argc += 16;  /* -H -p -x -d -k -c and values; -Vsample -n -l -w */
   new_argv = malloc (argc * sizeof (char *));
   if (!new_argv)
     return NULL;
@@ -59,7 +211,27 @@ build_argv (struct opts *opts)
           new_argv[argc++] = proxy;
         }
     }
-  new_argv[argc++] = "-Vraw";
+  if (opts->helper_deadlines[0])
+    {
+      new_argv[argc++] = (char *) "-d";
+      new_argv[argc++] = opts->helper_deadlines;
+    }
+  if (opts->cur_source->pin)
+    {
+      new_argv[argc++] = (char *) "-k";
+      new_argv[argc++] = opts->cur_source->pin;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  chain = cached_chain (opts, opts->cur_source, mono.tv_sec, time (NULL));
+  if (chain)
+    {
+      new_argv[argc++] = (char *) "-c";
+      new_argv[argc++] = (char *) chain;
+    }
+  if (!opts->cur_source->nts && source_uses_http (opts->cur_source))
+    new_argv[argc++] = "-w";
+  /* An NTS source's run ends in keys and cookies, not a time. */
+  new_argv[argc++] = opts->cur_source->nts ? "-Vnts" : "-Vsample";
   new_argv[argc++] = "-n";
   if (opts->leap)
     new_argv[argc++] = "-l";
@@ -67,33 +239,105 @@ build_argv (struct opts *opts)
   return new_argv;
 }
 
-/* Run tlsdate and redirects stdout to the monitor_fd */
+/* Fills |helper| with the helper's command line for |argv|, a tlsdate
+ * command line, parsed into |opts|; |helper| points into |opts|.  Returns
+ * 0, or 1 if it can't be translated and tlsdate has to be run after all.
+ */
+static int
+to_helper_argv (char **argv, struct helper_opts *opts,
+                char *helper[HELPER_MAX_ARGC + 1])
+{
+  char **args;
+  int argc;
+  int err;
+  for (argc = 0; argv[argc]; argc++)
+    ;
+  /* getopt permutes what it parses; |argv| may yet be run as it is. */
+  if (!(args = malloc ((argc + 1) * sizeof (*args))))
+    return 1;
+  memcpy (args, argv, (argc + 1) * sizeof (*args));
+  helper_opts_init (opts);
+  err = helper_opts_parse (opts, argc, args) || opts->help;
+  free (args);
+  if (err)
+    return 1;
+  /* tlsdated has already dropped privileges, so no ids are needed. */
+  helper_argv (opts, NULL, helper);
+  return 0;
+}
+
+/* Run tlsdate and redirects stdout to the monitor_fd.  The stock tlsdate
+ * is skipped: its only job is to exec the helper, so the helper is spawned
+ * directly with the command line tlsdate would have built.  So is the
+ * helper any tlsdate command names with -e.  With a run already in
+ * flight, this one is a hedge in the same attempt.
+ */
 int
 tlsdate (struct state *state)
 {
   char **new_argv;
+  struct helper_opts helper_opts;
+  char *helper[HELPER_MAX_ARGC + 1];
+  char *const *spawn_argv;
+  const char *path;
+  posix_spawn_file_actions_t actions;
+  struct timespec before, after;
+  struct tlsdate_run *run = NULL;
   pid_t pid;
-  switch ((pid = fork()))
+  int err;
+  int i;
+  for (i = 0; i < MAX_TLSDATE_RUNS && !run; ++i)
+    if (!state->runs[i].pid)
+      run = &state->runs[i];
+  if (!run)
     {
-    case 0: /* child! */
-      break;
-    case -1:
-      perror ("fork() failed!");
+      error ("[tlsdate-monitor] too many tlsdate runs in flight");
       return -1;
-    default:
-      verb_debug ("[tlsdate-monitor] spawned tlsdate: %d", pid);
-      state->tlsdate_pid = pid;
-      return 0;
-   }
+    }
   if (!(new_argv = build_argv (&state->opts)))
-    fatal ("out of memory building argv");
+    {
+      error ("[tlsdate-monitor] out of memory building argv");
+      return -1;
+    }
+  path = new_argv[0];
+  spawn_argv = new_argv;
+  if (!to_helper_argv (new_argv, &helper_opts, helper) &&
+      (!strcmp (new_argv[0], DEFAULT_TLSDATE) ||
+       strcmp (helper_opts.helper, TLSDATE_HELPER)))
+    {
+      path = helper_opts.helper;
+      spawn_argv = helper;
+    }
+  if ((err = posix_spawn_file_actions_init (&actions)))
+    {
+      free (new_argv);
+      errno = err;
+      perror ("posix_spawn_file_actions_init() failed");
+      return -1;
+    }
   /* Replace stdout with the pipe back to tlsdated */
-  if (dup2 (state->tlsdate_monitor_fd, STDOUT_FILENO) < 0)
+  posix_spawn_file_actions_adddup2 (&actions, state->tlsdate_monitor_fd,
+                                    STDOUT_FILENO);
+  clock_gettime (CLOCK_MONOTONIC, &before);
+  PROBE0 (tlsdate_spawn);
+  err = posix_spawn (&pid, path, &actions, NULL, spawn_argv, state->envp);
+  clock_gettime (CLOCK_MONOTONIC, &after);
+  posix_spawn_file_actions_destroy (&actions);
+  free (new_argv);
+  if (err)
     {
-      perror ("dup2 failed");
-      _exit (2);
+      errno = err;
+      perror ("[tlsdate-monitor] posix_spawn(%s) failed", path);
+      return -1;
     }
-  execve (new_argv[0], new_argv, state->envp);
-  perror ("[tlsdate-monitor] execve() failed");
-  _exit (1);
+  if (tlsdate_runs (state))
+    metrics_hedge_started (&state->metrics, &before, &after);
+  else
+    metrics_run_started (&state->metrics, &before, &after);
+  PROBE1 (tlsdate_spawned, pid);
+  verb_debug ("[tlsdate-monitor] spawned %s: %d", path, pid);
+  run->pid = pid;
+  run->cancelled = 0;
+  run->source = state->opts.cur_source;
+  return 0;
 }
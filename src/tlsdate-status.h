@@ -0,0 +1,133 @@
+/*
+ * tlsdate-status.h - read tlsdated's shared time-status page
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * With `status-page` set in tlsdated.conf, tlsdated keeps a small file
+ * mapped in memory and rewrites it whenever its view of the clock changes.
+ * A client maps it once and can then check the clock's quality without a
+ * system call:
+ *
+ *   struct tlsdate_status st;
+ *   const struct tlsdate_status_page *page =
+ *     tlsdate_status_open ("/run/tlsdated/status");
+ *   if (page && !tlsdate_status_read (page, &st) &&
+ *       (st.flags & TLSDATE_STATUS_NET_SYNCED))
+ *     ... trust the clock to within st.error_ns ...
+ *
+ * The page is guarded by a sequence lock: the writer makes |seq| odd while
+ * it updates the page and even again afterwards, and readers retry if
+ * |seq| was odd or moved while they copied.  Needs GCC or Clang.
+ */
+
+#ifndef TLSDATE_STATUS_H
+#define TLSDATE_STATUS_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TLSDATE_STATUS_MAGIC 0x746c7364  /* "tlsd" */
+#define TLSDATE_STATUS_VERSION 1
+#define TLSDATE_STATUS_PAGE_SIZE 4096
+
+/* |sync_type| values; these match tlsdated's own. */
+#define TLSDATE_STATUS_SYNC_NONE 0
+#define TLSDATE_STATUS_SYNC_BUILD (1 << 0)
+#define TLSDATE_STATUS_SYNC_DISK (1 << 1)
+#define TLSDATE_STATUS_SYNC_RTC (1 << 2)
+#define TLSDATE_STATUS_SYNC_PLATFORM (1 << 3)
+#define TLSDATE_STATUS_SYNC_NET (1 << 4)
+
+/* |flags| */
+#define TLSDATE_STATUS_NET_SYNCED (1 << 0)  /* a network sync still holds */
+#define TLSDATE_STATUS_DRY_RUN (1 << 1)     /* tlsdated isn't setting it */
+
+/* Everything a reader gets; times are nanoseconds unless noted. */
+struct tlsdate_status
+{
+  uint64_t generation;     /* bumped on every update */
+  uint32_t sync_type;      /* where the clock was last set from */
+  uint32_t flags;
+  int64_t last_time;       /* seconds; the time that was set */
+  int64_t net_sync_time;   /* seconds; last network sync, 0 if never */
+  int64_t net_sync_mono;   /* CLOCK_MONOTONIC of that sync */
+  int64_t offset_ns;       /* server minus local clock before that sync */
+  uint64_t error_ns;       /* bound on the server time's error then */
+  int64_t drift_ppb;       /* local clock rate error; + is fast, 0 unknown */
+};
+
+struct tlsdate_status_page
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  uint32_t reserved;
+  struct tlsdate_status status;
+};
+
+/* Maps the page read-only; returns NULL if it can't, e.g. because
+ * tlsdated hasn't started yet.  The mapping can be kept for the life of
+ * the process: tlsdated reuses the same file when it restarts.
+ */
+static inline const struct tlsdate_status_page *
+tlsdate_status_open (const char *path)
+{
+  const struct tlsdate_status_page *page;
+  struct stat st;
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &st) < 0 || st.st_size < TLSDATE_STATUS_PAGE_SIZE)
+    {
+      close (fd);
+      return NULL;
+    }
+  page = (const struct tlsdate_status_page *)
+         mmap (NULL, TLSDATE_STATUS_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (page == MAP_FAILED)
+    return NULL;
+  if (page->magic != TLSDATE_STATUS_MAGIC ||
+      page->version != TLSDATE_STATUS_VERSION)
+    {
+      munmap ((void *) page, TLSDATE_STATUS_PAGE_SIZE);
+      return NULL;
+    }
+  return page;
+}
+
+/* One attempt at a consistent copy; returns 0 on success, or -1 if the
+ * page was being written and the caller should try again.
+ */
+static inline int
+tlsdate_status_try_read (const struct tlsdate_status_page *page,
+                         struct tlsdate_status *out)
+{
+  uint32_t seq = __atomic_load_n (&page->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1)
+    return -1;
+  memcpy (out, (const void *) &page->status, sizeof (*out));
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  return __atomic_load_n (&page->seq, __ATOMIC_RELAXED) == seq ? 0 : -1;
+}
+
+/* Returns 0 with a consistent copy in |out|, or -1 if the writer kept the
+ * page busy, which only happens if tlsdated died mid-update.
+ */
+static inline int
+tlsdate_status_read (const struct tlsdate_status_page *page,
+                     struct tlsdate_status *out)
+{
+  int tries;
+  for (tries = 0; tries < 1000; ++tries)
+    if (!tlsdate_status_try_read (page, out))
+      return 0;
+  return -1;
+}
+
+#endif /* TLSDATE_STATUS_H */
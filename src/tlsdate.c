@@ -75,6 +75,7 @@ know:
  */
 
 #include "config.h"
+#include "src/helper-argv.h"
 #include "src/tlsdate.h"
 
 
@@ -91,145 +92,49 @@ usage (void)
            " [-P|--protocol] [sslv23|sslv3|tlsv1]\n"
            " [-C|--certcontainer] [dirname|filename]\n"
            " [-v|--verbose]\n"
-           " [-V|--showtime] [human|raw]\n"
+           " [-V|--showtime] [human|raw|sample|nts]\n"
            " [-t|--timewarp]\n"
            " [-l|--leap]\n"
            " [-x|--proxy] [url]\n"
-           " [-w|--http]\n");
+           " [-w|--http]\n"
+           " [-d|--deadlines] [resolve,connect,proxy,handshake,http]\n"
+           " [-k|--pin] [sha256/base64]\n"
+           " [-c|--cached-chain] [sha256 hex]\n"
+           " [-e|--helper] [path]\n");
 }
 
 
 int
 main (int argc, char **argv)
 {
-  int verbose;
-  int ca_racket;
-  int showtime;
-  int setclock;
-  const char *host;
-  const char *port;
-  const char *protocol;
-  const char *ca_cert_container;
-  int timewarp;
-  int leap;
-  const char *proxy;
-  int http;
-
-  host = DEFAULT_HOST;
-  port = DEFAULT_PORT;
-  protocol = DEFAULT_PROTOCOL;
-  ca_cert_container = DEFAULT_CERTFILE;
-  verbose = 0;
-  ca_racket = 1;
-  showtime = 0;
-  setclock = 1;
-  timewarp = 0;
-  leap = 0;
-  proxy = NULL;
-  http = 0;
-
-  while (1)
+  struct helper_opts opts;
+  char *helper[HELPER_MAX_ARGC + 1];
+
+  helper_opts_init (&opts);
+  if (helper_opts_parse (&opts, argc, argv))
+    {
+      fprintf (stderr, "Unknown option!\n");
+      usage();
+      exit (1);
+    }
+  if (opts.help)
     {
-      int option_index = 0;
-      int c;
-      static struct option long_options[] =
-      {
-        {"verbose", 0, 0, 'v'},
-        {"showtime", 2, 0, 'V'},
-        {"skip-verification", 0, 0, 's'},
-        {"help", 0, 0, 'h'},
-        {"host", 0, 0, 'H'},
-        {"port", 0, 0, 'p'},
-        {"protocol", 0, 0, 'P'},
-        {"dont-set-clock", 0, 0, 'n'},
-        {"certcontainer", 0, 0, 'C'},
-        {"timewarp", 0, 0, 't'},
-        {"leap", 0, 0, 'l'},
-        {"proxy", 0, 0, 'x'},
-        {"http", 0, 0, 'w'},
-        {0, 0, 0, 0}
-      };
-
-      c = getopt_long (argc, argv, "vV::shH:p:P:nC:tlx:w",
-                       long_options, &option_index);
-      if (c == -1)
-        break;
-      switch (c)
-        {
-        case 'v':
-          verbose = 1;
-          break;
-        case 'V':
-          showtime = (optarg && 0 == strcmp ("raw", optarg) ? 2:1);
-          break;
-        case 's':
-          ca_racket = 0;
-          break;
-        case 'h':
-          usage();
-          exit (1);
-          break;
-        case 'H':
-          host = optarg;
-          break;
-        case 'p':
-          port = optarg;
-          break;
-        case 'P':
-          protocol = optarg;
-          break;
-        case 'n':
-          setclock = 0;
-          break;
-        case 'C':
-          ca_cert_container = optarg;
-          break;
-        case 't':
-          timewarp = 1;
-          break;
-        case 'l':
-          leap = 1;
-          break;
-        case 'x':
-          proxy = optarg;
-          break;
-        case 'w':
-          http = 1;
-          break;
-        case '?':
-          break;
-        default :
-          fprintf (stderr, "Unknown option!\n");
-          usage();
-          exit (1);
-        }
+      usage();
+      exit (1);
     }
-  if (1 == verbose) {
+  if (1 == opts.verbose) {
     fprintf(stderr,
       "V: tlsdate version %s\n"
             "V: We were called with the following arguments:\n"
             "V: %s host = %s:%s\n",
             PACKAGE_VERSION,
-      ca_racket ? "validate SSL certificates" : "disable SSL certificate check",
-            host, port);
-    if (0 == ca_racket)
+      opts.ca_racket ? "validate SSL certificates" : "disable SSL certificate check",
+            opts.host, opts.port);
+    if (0 == opts.ca_racket)
       fprintf(stderr, "WARNING: Skipping certificate verification!\n");
   }
-  execlp (TLSDATE_HELPER,
-          "tlsdate",
-          host,
-          port,
-          protocol,
-          (ca_racket ? "racket" : "unchecked"),
-          (verbose ? "verbose" : "quiet"),
-          ca_cert_container,
-          (setclock ? "setclock" : "dont-set-clock"),
-          (showtime ? (showtime == 2 ? "showtime=raw" : "showtime") : "no-showtime"),
-            (timewarp ? "timewarp" : "no-fun"),
-            (leap ? "leapaway" : "holdfast"),
-            (proxy ? proxy : "none"),
-            (http ? "http" : "tls"),
-            NULL);
+  helper_argv (&opts, NULL, helper);
+  execvp (opts.helper, helper);
   perror ("Failed to run tlsdate-helper");
   return 1;
 }
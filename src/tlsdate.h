@@ -22,7 +22,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "src/backoff.h"
+#include "src/helper-argv.h"
+#include "src/metrics.h"
+#include "src/nts.h"
+#include "src/random-time.h"
 #include "src/rtc.h"
+#include "src/sample.h"
+#include "src/trace.h"
 
 #define DEFAULT_HOST "google.com"
 #define DEFAULT_PORT "443"
@@ -51,7 +58,20 @@
 #define DEFAULT_SAVE_TO_DISK 1
 #define DEFAULT_USE_NETLINK 1
 #define DEFAULT_DRY_RUN 0
+#define FAST_BOOT_RETRY 1
+#define FAST_BOOT_TIMEOUT 60
+#define PEER_TIMEOUT 1
+/* Peers pass on samples at most an hour old. */
+#define PEER_MAX_AGE (60*60)
 #define MAX_SANE_BACKOFF (10*60) /* exponential backoff should only go this far */
+/* Wake-triggered syncs start up to this many seconds late. */
+#define WAKE_JITTER 60
+/* tlsdate runs in flight at once: the first, and a hedge if it is slow. */
+#define MAX_TLSDATE_RUNS 2
+/* Runs to see before there is enough history to hedge on. */
+#define HEDGE_MIN_RUNS 5
+/* A chain that passed the CA store is taken on trust for this long. */
+#define CHAIN_CACHE_AGE (24*60*60)
 
 #ifndef TLSDATED_MAX_DATE
 #define TLSDATED_MAX_DATE 1999991337L /* this'll be a great bug some day */
@@ -98,6 +118,14 @@ static const char kTestHost[] = { TEST_HOST, 0 };
 #define MAXPATHLEN PATH_MAX
 #endif
 
+/* Whether a TLS source's time comes from its HTTP Date header. */
+enum source_http_t
+{
+  SOURCE_HTTP_AUTO = 0,  /* once its server_random turns out not to carry it */
+  SOURCE_HTTP_NO,        /* never; it is tried last instead */
+  SOURCE_HTTP_YES,
+};
+
 struct source
 {
 	struct source *next;
@@ -105,6 +133,22 @@ struct source
 	char *port;
 	char *proxy;
 	int id;
+	int roughtime;  /* a Roughtime server rather than a TLS one */
+	uint8_t roughtime_key[32];  /* its Ed25519 public key */
+	int nts;  /* port is NTS-KE's; the time comes over NTP after it */
+	char *pin;  /* "sha256/<base64>" to trust in place of the CA store */
+	/* The chain it last sent that passed the CA store, as a hex SHA-256
+	 * (empty for none), when that was in CLOCK_MONOTONIC seconds, and the
+	 * chain's earliest notAfter (0 if unknown).
+	 */
+	char chain[HELPER_CHAIN_HEX_LEN + 1];
+	time_t chain_verified;
+	time_t chain_not_after;
+	int http;  /* enum source_http_t */
+	struct random_time random;  /* what its server_random carries */
+	int max_tries;  /* failed tries per sync before it is skipped; 0: any */
+	int tries;  /* failed tries this sync */
+	int rejected;  /* its certificate was refused this sync */
 };
 
 struct opts
@@ -133,6 +177,28 @@ struct opts
   char *proxy;
   int leap;
   int should_dbus;
+  const char *metrics_socket;
+  const char *trace_file;
+  int watch_conf;
+  int fast_boot;
+  int fast_boot_retry;
+  int fast_boot_timeout;
+  const char *status_page;
+  int ntp_shm_unit;  /* -1 if off */
+  int sntp_port;  /* 0 if off */
+  const char *sntp_address;
+  const char *peer_key_file;
+  const char *peers;  /* "addr[:port] ..." */
+  int peer_port;  /* 0 if off */
+  int peer_timeout;
+  int peer_max_age;
+  /* Passed to tlsdate as -d; empty for none.  See helper_parse_deadlines. */
+  char helper_deadlines[HELPER_DEADLINES_LEN];
+  int hedge_percentile;  /* 0 if off */
+  int backoff_policy;  /* enum backoff_policy_t */
+  int backoff_cap;
+  int wake_jitter;
+  int chain_cache_age;  /* seconds; 0 if off */
 };
 
 #define MAX_FQDN_LEN 255
@@ -151,10 +217,46 @@ enum event_id_t
   E_SIGTERM,
   E_STEADYSTATE,
   E_ROUTEUP,
+  E_METRICS,
+  E_CONTINUITY,
+  E_TIME_SET,
+  E_DUMP_TRACE,
+  E_SIGHUP,
+  E_CONF_WATCH,
+  E_RELOAD,
+  E_BOOT_TIMEOUT,
+  E_SNTP,
+  E_PEER,
+  E_PEER_TIMEOUT,
+  E_ROUGHTIME,
+  E_NTS,
+  E_HEDGE,
   E_MAX
 };
 
 struct event_base;
+struct tlsdate_status_page;
+struct ntp_shm_time;
+struct peers;
+struct roughtime_query;
+struct nts_query;
+struct evdns_base;
+
+/* What a run of tlsdate writes back: a time, or keys to get one with. */
+union tlsdate_response
+{
+  struct tlsdate_sample sample;
+  struct nts_session nts;
+};
+
+/* One spawned tlsdate. */
+struct tlsdate_run
+{
+  pid_t pid;  /* 0 if the slot is free */
+  int cancelled;  /* killed because another run got the time first */
+  struct source *source;  /* what it was spawned against; NULL once the
+                           * sources have been reloaded */
+};
 
 /* This struct is used for passing tlsdated runtime state between
  * events/ in its event loop.
@@ -162,6 +264,7 @@ struct event_base;
 struct state
 {
   struct opts opts;
+  struct opts cmdline_opts;  /* before the config file; see reload_conf() */
   struct event_base *base;
   void *dbus;
   char **envp;
@@ -171,21 +274,32 @@ struct state
   time_t last_time;
 
   char timestamp_path[PATH_MAX];
+  char trace_path[PATH_MAX];
   struct rtc_handle hwclock;
   char dynamic_proxy[MAX_PROXY_URL];
   /* Event triggered events */
 
   struct event *events[E_MAX];
   int tlsdate_monitor_fd;
-  pid_t tlsdate_pid;
+  struct tlsdate_run runs[MAX_TLSDATE_RUNS];
   pid_t setter_pid;
   int setter_save_fd;
   int setter_notify_fd;
   uint32_t backoff;
   int tries;
   int resolving;
-  int running;  /* tlsdate itself */
+  int running;  /* a sync attempt, of one or more runs, is in flight */
   int exitting;
+  int booting;  /* fast-boot: no network time yet, still retrying fast */
+  int ready;  /* readiness has been reported to the service manager */
+  struct metrics metrics;
+  struct trace trace;
+  struct tlsdate_status_page *status;  /* shared status page, if any */
+  struct ntp_shm_time *ntp_shm;  /* NTP SHM refclock segment, if any */
+  struct peers *peers;  /* sample sharing, if any */
+  struct roughtime_query *roughtime;  /* set up by the first query */
+  struct nts_query *nts;  /* likewise */
+  struct evdns_base *dns;  /* for the queries tlsdated makes itself */
 };
 
 char timestamp_path[PATH_MAX];
@@ -194,24 +308,62 @@ int is_sane_time (time_t ts);
 int load_disk_timestamp (const char *path, time_t * t);
 void save_disk_timestamp (const char *path, time_t t);
 int add_jitter (int base, int jitter);
+uint32_t random_u32 (void);
 void time_setter_coprocess (int time_fd, int notify_fd, struct state *state);
+struct source *advance_source (struct opts *opts);
+void reset_source_tries (struct opts *opts);
 int tlsdate (struct state *state);
 
 int save_timestamp_to_fd (int fd, time_t t);
 void set_conf_defaults (struct opts *opts);
+int load_conf (struct opts *opts);
+int reload_conf (struct state *state);
+void free_sources (struct source *sources);
 int new_tlsdate_monitor_pipe (int fds[2]);
-int read_tlsdate_response (int fd, time_t *t);
+int read_tlsdate_response (int fd, union tlsdate_response *resp);
+void take_tlsdate_responses (struct state *state);
+void drain_tlsdate_responses (struct state *state);
+int handle_tlsdate_sample (struct state *state, struct source *src,
+                           const struct tlsdate_sample *sample);
+void charge_source (struct state *state, struct source *src);
+void schedule_tlsdate_retry (struct state *state, struct source *src);
+int tlsdate_runs (const struct state *state);
+struct tlsdate_run *find_tlsdate_run (struct state *state, pid_t pid);
+int source_uses_http (const struct source *src);
+int source_lacks_time (const struct source *src);
+int source_has_tries (const struct source *src);
+const char *cached_chain (const struct opts *opts, const struct source *src,
+                          time_t mono, time_t now);
+void note_verified_chain (struct source *src,
+                          const struct tlsdate_sample *sample, time_t mono);
+void cancel_tlsdate_runs (struct state *state);
 
 void invalidate_time (struct state *state);
 int check_continuity (time_t *delta);
 
+void report_ready (struct state *state, const char *status);
+int status_page_open (struct state *state);
+void status_page_update (struct state *state);
+void status_page_net_synced (struct state *state);
+void end_fast_boot (struct state *state);
+
+void action_boot_timeout (int fd, short what, void *arg);
 void action_check_continuity (int fd, short what, void *arg);
+void action_dump_trace (int fd, short what, void *arg);
+void action_hedge_tlsdate (int fd, short what, void *arg);
 void action_kickoff_time_sync (int fd, short what, void *arg);
+void action_metrics_request (int fd, short what, void *arg);
+void action_peer_packet (int fd, short what, void *arg);
+void action_peer_timeout (int fd, short what, void *arg);
+void action_reload_conf (int fd, short what, void *arg);
+void action_roughtime_reply (int fd, short what, void *arg);
+void action_nts_reply (int fd, short what, void *arg);
 void action_invalidate_time (int fd, short what, void *arg);
 void action_stdin_wakeup (int fd, short what, void *arg);
 void action_netlink_ready (int fd, short what, void *arg);
 void action_run_tlsdate (int fd, short what, void *arg);
 void action_sigterm (int fd, short what, void *arg);
+void action_sntp_request (int fd, short what, void *arg);
 void action_sync_and_save (int fd, short what, void *arg);
 void action_time_set (int fd, short what, void *arg);
 void action_tlsdate_status (int fd, short what, void *arg);
@@ -222,6 +374,28 @@ int setup_event_route_up (struct state *state);
 int setup_time_setter (struct state *state);
 int setup_tlsdate_status (struct state *state);
 int setup_sigchld_event (struct state *state, int persist);
+int setup_metrics_socket (struct state *state);
+int setup_event_dump_trace (struct state *state);
+int setup_event_reload_conf (struct state *state);
+int setup_event_boot_timeout (struct state *state);
+int setup_sntp_server (struct state *state);
+int setup_peers (struct state *state);
+int peer_query (struct state *state);
+void peer_note_sample (struct state *state, const struct source *src,
+                       const struct tlsdate_sample *sample);
+int roughtime_query (struct state *state);
+int roughtime_pending (const struct state *state);
+void roughtime_cancel (struct state *state);
+void roughtime_time_out (struct state *state);
+void roughtime_forget_source (struct state *state);
+struct evdns_base *fresh_resolver (struct state *state);
+int nts_query (struct state *state);
+int nts_pending (const struct state *state);
+void nts_cancel (struct state *state);
+void nts_time_out (struct state *state);
+void nts_forget_source (struct state *state);
+void nts_take_session (struct state *state, struct source *src,
+                       const struct nts_session *s);
 
 void report_setter_error (siginfo_t *info);
 
@@ -7,15 +7,31 @@
 
 #include "config.h"
 
+#include "src/helper-argv.h"
+#include "src/notify.h"
+#include "src/ntp-shm.h"
+#include "src/nts.h"
+#include "src/peer.h"
+#include "src/roughtime.h"
+#include "src/sntp.h"
 #include "src/test_harness.h"
+#include "src/tlsdate-status.h"
 #include "src/tlsdate.h"
 #include "src/util.h"
+#include "src/test/nts-server.h"
+#ifdef HAVE_EVP_PKEY_NEW_RAW_PUBLIC_KEY
+#include "src/test/roughtime-server.h"
+#endif
 
 #include <event2/event.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 FIXTURE (tempdir)
@@ -126,6 +142,7 @@ FIXTURE_SETUP (tlsdate)
 {
   memset (self, 0, sizeof (*self));
   /* TODO(wad) make this use the same function tlsdated uses. */
+  metrics_init (&self->state.metrics);
   self->state.base = event_base_new();
   set_conf_defaults (&self->state.opts);
   ASSERT_NE (NULL, self->state.base);
@@ -157,10 +174,12 @@ FIXTURE_TEARDOWN (tlsdate)
     }
   /* The other half was closed above. */
   close (self->state.tlsdate_monitor_fd);
-  if (self->state.tlsdate_pid)
+  for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
     {
-      kill (self->state.tlsdate_pid, SIGKILL);
-      waitpid (self->state.tlsdate_pid, NULL, WNOHANG);
+      if (!self->state.runs[i].pid)
+        continue;
+      kill (self->state.runs[i].pid, SIGKILL);
+      waitpid (self->state.runs[i].pid, NULL, WNOHANG);
     }
   if (self->state.base)
     event_base_free (self->state.base);
@@ -217,6 +236,307 @@ TEST_F (tlsdate, runner_multi)
   EXPECT_EQ (0, runner (self, NULL));
 }
 
+/* Queued responses come off the monitor pipe one at a time. */
+TEST (tlsdate_response_framing)
+{
+  union tlsdate_response resp;
+  struct tlsdate_sample sample;
+  struct nts_session nts;
+  uint32_t raw = RECENT_COMPILE_DATE + 3;
+  int fds[2];
+  ASSERT_EQ (0, pipe (fds));
+  ASSERT_EQ (0, fcntl (fds[0], F_SETFL, O_NONBLOCK));
+  memset (&sample, 0, sizeof (sample));
+  sample.time = RECENT_COMPILE_DATE + 1;
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.pid = 1234;
+  memset (&nts, 0, sizeof (nts));
+  nts.magic = NTS_SESSION_MAGIC;
+  nts.pid = 5678;
+  ASSERT_EQ (sizeof (sample), write (fds[1], &sample, sizeof (sample)));
+  ASSERT_EQ (sizeof (nts), write (fds[1], &nts, sizeof (nts)));
+  sample.time++;
+  ASSERT_EQ (sizeof (sample), write (fds[1], &sample, sizeof (sample)));
+  EXPECT_EQ (0, read_tlsdate_response (fds[0], &resp));
+  EXPECT_EQ (RECENT_COMPILE_DATE + 1, resp.sample.time);
+  EXPECT_EQ (1234, resp.sample.pid);
+  EXPECT_EQ (0, read_tlsdate_response (fds[0], &resp));
+  EXPECT_EQ (NTS_SESSION_MAGIC, resp.nts.magic);
+  EXPECT_EQ (5678, resp.nts.pid);
+  EXPECT_EQ (0, read_tlsdate_response (fds[0], &resp));
+  EXPECT_EQ (RECENT_COMPILE_DATE + 2, resp.sample.time);
+  EXPECT_EQ (1, read_tlsdate_response (fds[0], &resp));
+  /* -Vraw is a bare time. */
+  ASSERT_EQ (sizeof (raw), write (fds[1], &raw, sizeof (raw)));
+  EXPECT_EQ (0, read_tlsdate_response (fds[0], &resp));
+  EXPECT_EQ (raw, resp.sample.time);
+  /* Anything else is a bad response. */
+  sample.magic = 0;
+  ASSERT_EQ (sizeof (sample), write (fds[1], &sample, sizeof (sample)));
+  EXPECT_EQ (-1, read_tlsdate_response (fds[0], &resp));
+  close (fds[0]);
+  close (fds[1]);
+}
+
+/* Only a run still in flight, and not cancelled, is listened to. */
+TEST_F (tlsdate, stale_responses)
+{
+  struct tlsdate_sample sample;
+  memset (&sample, 0, sizeof (sample));
+  sample.time = RECENT_COMPILE_DATE + 1;
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  /* No run has that pid: it is left over from an earlier attempt. */
+  self->state.runs[0].pid = 424242;
+  self->state.runs[1].pid = 424243;
+  self->state.runs[1].cancelled = 1;
+  sample.pid = 424241;
+  ASSERT_EQ (sizeof (sample), write (self->state.tlsdate_monitor_fd, &sample,
+                                     sizeof (sample)));
+  /* The run that lost the race. */
+  sample.pid = 424243;
+  ASSERT_EQ (sizeof (sample), write (self->state.tlsdate_monitor_fd, &sample,
+                                     sizeof (sample)));
+  take_tlsdate_responses (&self->state);
+  EXPECT_EQ (0, self->state.last_time);
+  EXPECT_EQ (0, self->state.metrics.failures[F_BAD_RESPONSE]);
+  /* The run in flight is heard. */
+  sample.pid = 424242;
+  sample.time++;
+  ASSERT_EQ (sizeof (sample), write (self->state.tlsdate_monitor_fd, &sample,
+                                     sizeof (sample)));
+  take_tlsdate_responses (&self->state);
+  EXPECT_EQ (RECENT_COMPILE_DATE + 2, self->state.last_time);
+  /* Once the attempt is over, what is left is thrown away. */
+  sample.time++;
+  ASSERT_EQ (sizeof (sample), write (self->state.tlsdate_monitor_fd, &sample,
+                                     sizeof (sample)));
+  drain_tlsdate_responses (&self->state);
+  take_tlsdate_responses (&self->state);
+  EXPECT_EQ (RECENT_COMPILE_DATE + 2, self->state.last_time);
+  /* None of those pids are ours to kill. */
+  memset (self->state.runs, 0, sizeof (self->state.runs));
+}
+
+/* A sample is credited to the source its run went to, not the one a hedge
+ * has moved on to since.
+ */
+TEST_F (tlsdate, response_source)
+{
+  struct source fast = { .next = NULL, .host = "fast", .port = "443" };
+  struct source slow = { .next = &fast, .host = "slow", .port = "443" };
+  struct tlsdate_sample sample;
+  memset (&sample, 0, sizeof (sample));
+  sample.time = RECENT_COMPILE_DATE + 1;
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.random_time = sample.time;
+  sample.pid = 424242;
+  memset (sample.chain_sha256, 0xab, sizeof (sample.chain_sha256));
+  self->state.opts.sources = &slow;
+  self->state.opts.cur_source = &fast;
+  self->state.runs[0].pid = 424242;
+  self->state.runs[0].source = &slow;
+  ASSERT_EQ (sizeof (sample), write (self->state.tlsdate_monitor_fd, &sample,
+                                     sizeof (sample)));
+  take_tlsdate_responses (&self->state);
+  EXPECT_EQ (RECENT_COMPILE_DATE + 1, self->state.last_time);
+  EXPECT_EQ (0, strncmp ("abababab", slow.chain, 8));
+  EXPECT_STREQ ("", fast.chain);
+  memset (self->state.runs, 0, sizeof (self->state.runs));
+}
+
+TEST (helper_argv_translation)
+{
+  struct helper_opts opts;
+  char *helper[HELPER_MAX_ARGC + 1];
+  char *argv[] =
+  {
+    (char *) "tlsdate", (char *) "-H", (char *) "host1", (char *) "-p",
+    (char *) "port1", (char *) "-x", (char *) "socks5://proxy1",
+    (char *) "-Vsample", (char *) "-n", (char *) "-l", NULL
+  };
+  helper_opts_init (&opts);
+  ASSERT_EQ (0, helper_opts_parse (&opts, 10, argv));
+  helper_argv (&opts, NULL, helper);
+  EXPECT_STREQ ("host1", helper[1]);
+  EXPECT_STREQ ("port1", helper[2]);
+  EXPECT_STREQ (DEFAULT_PROTOCOL, helper[3]);
+  EXPECT_STREQ ("racket", helper[4]);
+  EXPECT_STREQ ("quiet", helper[5]);
+  EXPECT_STREQ ("dont-set-clock", helper[7]);
+  EXPECT_STREQ ("showtime=sample", helper[8]);
+  EXPECT_STREQ ("leapaway", helper[10]);
+  EXPECT_STREQ ("socks5://proxy1", helper[11]);
+  EXPECT_STREQ ("tls", helper[12]);
+  EXPECT_EQ (NULL, helper[HELPER_ARGC]);
+  EXPECT_STREQ (TLSDATE_HELPER, opts.helper);
+  /* -e names the helper; it doesn't reach the helper's own argv. */
+  argv[5] = (char *) "-e";
+  argv[6] = (char *) "/build/src/tlsdate-helper";
+  helper_opts_init (&opts);
+  ASSERT_EQ (0, helper_opts_parse (&opts, 10, argv));
+  helper_argv (&opts, NULL, helper);
+  EXPECT_STREQ ("/build/src/tlsdate-helper", opts.helper);
+  EXPECT_STREQ ("none", helper[11]);
+  EXPECT_EQ (NULL, helper[HELPER_ARGC]);
+  argv[5] = (char *) "-x";
+  argv[6] = (char *) "socks5://proxy1";
+  /* Parsing starts over each time. */
+  helper_opts_init (&opts);
+  ASSERT_EQ (0, helper_opts_parse (&opts, 3, argv));
+  helper_argv (&opts, "ids=1:2", helper);
+  EXPECT_STREQ ("host1", helper[1]);
+  EXPECT_STREQ (DEFAULT_PORT, helper[2]);
+  EXPECT_STREQ ("setclock", helper[7]);
+  EXPECT_STREQ ("none", helper[11]);
+  EXPECT_STREQ ("ids=1:2", helper[HELPER_ARGC]);
+  EXPECT_EQ (NULL, helper[HELPER_ARGC + 1]);
+  /* NTS sources ask for keys rather than a time. */
+  argv[7] = (char *) "-Vnts";
+  helper_opts_init (&opts);
+  ASSERT_EQ (0, helper_opts_parse (&opts, 10, argv));
+  helper_argv (&opts, NULL, helper);
+  EXPECT_STREQ ("showtime=nts", helper[8]);
+  /* Deadlines follow the ids. */
+  argv[8] = (char *) "-d";
+  argv[9] = (char *) "2,2,3,5,5";
+  helper_opts_init (&opts);
+  ASSERT_EQ (0, helper_opts_parse (&opts, 10, argv));
+  helper_argv (&opts, "ids=1:2", helper);
+  EXPECT_STREQ ("ids=1:2", helper[HELPER_ARGC]);
+  EXPECT_STREQ ("deadlines=2,2,3,5,5", helper[HELPER_ARGC + 1]);
+  EXPECT_EQ (NULL, helper[HELPER_ARGC + 2]);
+  /* And a pin follows them both. */
+  argv[5] = (char *) "-k";
+  argv[6] = (char *) "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=";
+  helper_opts_init (&opts);
+  ASSERT_EQ (0, helper_opts_parse (&opts, 10, argv));
+  helper_argv (&opts, "ids=1:2", helper);
+  EXPECT_STREQ ("none", helper[11]);
+  EXPECT_STREQ ("deadlines=2,2,3,5,5", helper[HELPER_ARGC + 1]);
+  EXPECT_STREQ ("pin=sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=",
+                helper[HELPER_ARGC + 2]);
+  EXPECT_EQ (NULL, helper[HELPER_MAX_ARGC]);
+  argv[6] = (char *) "sha1/2jmj7l5rSw0yVb/vlWAYkK/YBwk=";
+  helper_opts_init (&opts);
+  EXPECT_NE (0, helper_opts_parse (&opts, 10, argv));
+  argv[6] = (char *) "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=";
+  argv[9] = (char *) "2,2,3,5";
+  helper_opts_init (&opts);
+  EXPECT_NE (0, helper_opts_parse (&opts, 10, argv));
+}
+
+TEST (helper_pins)
+{
+  /* SHA-256 of nothing at all. */
+  static const uint8_t kEmpty[HELPER_PIN_DIGEST_LEN] =
+  {
+    0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14,
+    0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+    0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c,
+    0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55
+  };
+  uint8_t d[HELPER_PIN_DIGEST_LEN];
+  ASSERT_EQ (0, helper_parse_pin (
+               "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=", d));
+  EXPECT_EQ (0, memcmp (kEmpty, d, sizeof (d)));
+  /* No prefix, no padding, padding too soon, stray bits, bad characters. */
+  EXPECT_NE (0, helper_parse_pin (
+               "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=", d));
+  EXPECT_NE (0, helper_parse_pin (
+               "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU", d));
+  EXPECT_NE (0, helper_parse_pin (
+               "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSu==", d));
+  EXPECT_NE (0, helper_parse_pin (
+               "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFV=", d));
+  EXPECT_NE (0, helper_parse_pin (
+               "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hS-FU=", d));
+  EXPECT_NE (0, helper_parse_pin ("sha256/", d));
+}
+
+TEST (chain_cache)
+{
+  struct source src = { .host = "host1", .port = "port1" };
+  struct tlsdate_sample sample;
+  struct opts opts;
+  struct helper_opts hopts;
+  char *helper[HELPER_MAX_ARGC + 1];
+  uint8_t d[HELPER_CHAIN_DIGEST_LEN];
+  char *argv[] =
+  {
+    (char *) "tlsdate", (char *) "-c", NULL, NULL
+  };
+  memset (&opts, 0, sizeof (opts));
+  memset (&sample, 0, sizeof (sample));
+  opts.chain_cache_age = 100;
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.chain_sha256[0] = 0xab;
+  sample.chain_sha256[31] = 0x01;
+  sample.not_after = 5000;
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 10, 1000));
+  note_verified_chain (&src, &sample, 10);
+  ASSERT_NE (NULL, cached_chain (&opts, &src, 10, 1000));
+  EXPECT_STREQ ("ab000000000000000000000000000000"
+                "00000000000000000000000000000001",
+                cached_chain (&opts, &src, 109, 1000));
+  /* It round-trips through tlsdate's command line to the helper's. */
+  ASSERT_EQ (0, helper_parse_chain (src.chain, d));
+  EXPECT_EQ (0, memcmp (sample.chain_sha256, d, sizeof (d)));
+  argv[2] = src.chain;
+  helper_opts_init (&hopts);
+  ASSERT_EQ (0, helper_opts_parse (&hopts, 3, argv));
+  helper_argv (&hopts, NULL, helper);
+  EXPECT_EQ (0, strncmp (HELPER_CHAIN_WORD, helper[HELPER_ARGC],
+                         strlen (HELPER_CHAIN_WORD)));
+  EXPECT_STREQ (src.chain, helper[HELPER_ARGC] + strlen (HELPER_CHAIN_WORD));
+  /* Too old, expired, turned off or pinned: verify in full. */
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 110, 1000));
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 10, 5000));
+  opts.chain_cache_age = 0;
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 10, 1000));
+  opts.chain_cache_age = 100;
+  src.pin = (char *) "sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=";
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 10, 1000));
+  src.pin = NULL;
+  /* A hit doesn't restart the clock on the full verification... */
+  sample.flags = TLSDATE_SAMPLE_CHAIN_CACHED;
+  note_verified_chain (&src, &sample, 50);
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 110, 1000));
+  /* ...but a fresh one does, and an unverified run forgets the chain. */
+  sample.flags = 0;
+  note_verified_chain (&src, &sample, 50);
+  EXPECT_NE (NULL, cached_chain (&opts, &src, 110, 1000));
+  memset (sample.chain_sha256, 0, sizeof (sample.chain_sha256));
+  note_verified_chain (&src, &sample, 60);
+  EXPECT_EQ (NULL, cached_chain (&opts, &src, 60, 1000));
+  EXPECT_NE (0, helper_parse_chain ("ab00", d));
+  EXPECT_NE (0, helper_parse_chain ("zz000000000000000000000000000000"
+                                   "00000000000000000000000000000001", d));
+}
+
+TEST (helper_deadlines)
+{
+  double d[HELPER_PHASES];
+  ASSERT_EQ (0, helper_parse_deadlines ("1,2.5,0,4,5", d));
+  EXPECT_EQ (1, d[HELPER_RESOLVE]);
+  EXPECT_EQ (2.5, d[HELPER_CONNECT]);
+  EXPECT_EQ (0, d[HELPER_PROXY]);
+  EXPECT_EQ (5, d[HELPER_HTTP]);
+  EXPECT_NE (0, helper_parse_deadlines ("1,2,3,4", d));
+  EXPECT_NE (0, helper_parse_deadlines ("1,2,3,4,5,6", d));
+  EXPECT_NE (0, helper_parse_deadlines ("1,2,-3,4,5", d));
+  EXPECT_NE (0, helper_parse_deadlines ("1,2,x,4,5", d));
+  EXPECT_NE (0, helper_parse_deadlines ("1,2,3,4,9999", d));
+  EXPECT_NE (0, helper_parse_deadlines ("", d));
+  EXPECT_STREQ ("handshake", helper_phase_str (HELPER_HANDSHAKE));
+  EXPECT_EQ (HELPER_PROXY, helper_deadline_phase (HELPER_DEADLINE_EXIT + 2));
+  EXPECT_EQ (-1, helper_deadline_phase (1));
+  EXPECT_EQ (-1, helper_deadline_phase (HELPER_DEADLINE_EXIT + HELPER_PHASES));
+  /* Neither a verdict nor a phase of -1 reads as a deadline. */
+  EXPECT_EQ (-1, helper_deadline_phase (HELPER_DEADLINE_EXIT - 1));
+  EXPECT_EQ (-1, helper_deadline_phase (HELPER_FALSE_TICKER_EXIT));
+  EXPECT_EQ (-1, helper_deadline_phase (HELPER_BAD_CERT_EXIT));
+}
+
 TEST (jitter)
 {
   int i = 0;
@@ -265,6 +585,8 @@ TEST_F (tlsdate, rotate_hosts)
   args[0] = "src/test/check-host-2";
   self->state.last_sync_type = SYNC_TYPE_NONE;
   EXPECT_EQ (0, runner (self, NULL));
+  /* The source list is walked in tlsdated, not in the child. */
+  EXPECT_EQ (&s2, self->state.opts.cur_source);
   self->state.tries = 0;
   args[0] = "src/test/check-host-1";
   self->state.last_sync_type = SYNC_TYPE_NONE;
@@ -275,6 +597,128 @@ TEST_F (tlsdate, rotate_hosts)
   EXPECT_EQ (0, runner (self, NULL));
 }
 
+TEST (source_budgets)
+{
+  struct source s2 = { .next = NULL, .host = "host2", .port = "port2" };
+  struct source s1 = { .next = &s2, .host = "host1", .port = "port1" };
+  struct opts opts;
+  memset (&opts, 0, sizeof (opts));
+  opts.sources = &s1;
+  EXPECT_EQ (&s1, advance_source (&opts));
+  EXPECT_EQ (&s2, advance_source (&opts));
+  /* host1 has had its one try this sync, so it is passed over. */
+  s1.max_tries = 1;
+  s1.tries = 1;
+  EXPECT_EQ (&s2, advance_source (&opts));
+  EXPECT_EQ (&s2, advance_source (&opts));
+  s2.max_tries = 2;
+  s2.tries = 2;
+  EXPECT_EQ (NULL, advance_source (&opts));
+  reset_source_tries (&opts);
+  EXPECT_EQ (&s1, advance_source (&opts));
+}
+
+TEST (server_random_kinds)
+{
+  const uint32_t t = RECENT_COMPILE_DATE + 1000;
+  struct random_time r;
+  /* Zero and insane values settle it at once. */
+  memset (&r, 0, sizeof (r));
+  EXPECT_EQ (RANDOM_ZERO, random_time_observe (&r, 0, 100, 0));
+  memset (&r, 0, sizeof (r));
+  EXPECT_EQ (RANDOM_NOISE, random_time_observe (&r, 1234, 100, 0));
+  /* A sane value alone proves nothing; two that keep time with us do. */
+  memset (&r, 0, sizeof (r));
+  EXPECT_EQ (RANDOM_UNKNOWN, random_time_observe (&r, t, 100, 0));
+  EXPECT_EQ (RANDOM_UNKNOWN, random_time_observe (&r, t + 50, 150, 0));
+  EXPECT_EQ (RANDOM_TIME, random_time_observe (&r, t + 100, 200, 0));
+  /* One stray sample isn't enough to change its mind. */
+  EXPECT_EQ (RANDOM_TIME, random_time_observe (&r, t + 10000000, 210, 0));
+  EXPECT_EQ (RANDOM_NOISE, random_time_observe (&r, t + 5000000, 220, 0));
+  EXPECT_FALSE (random_kind_lacks_time (RANDOM_TIME));
+  EXPECT_TRUE (random_kind_lacks_time (RANDOM_NOISE));
+  /* An HTTP Date header is better than the last sample. */
+  EXPECT_EQ (RANDOM_NOISE, random_time_observe (&r, t + 5, 230, t));
+  EXPECT_EQ (RANDOM_TIME, random_time_observe (&r, t + 20, 240, t + 15));
+  random_time_false_ticker (&r);
+  EXPECT_EQ (RANDOM_NOISE, r.kind);
+  EXPECT_STREQ ("random", random_kind_str (r.kind));
+}
+
+TEST (source_http_modes)
+{
+  struct source s2 = { .next = NULL, .host = "host2", .port = "port2" };
+  struct source s1 = { .next = &s2, .host = "host1", .port = "port1" };
+  struct opts opts;
+  memset (&opts, 0, sizeof (opts));
+  opts.sources = &s1;
+  /* auto switches to HTTP once server_random is found wanting. */
+  EXPECT_FALSE (source_uses_http (&s1));
+  s1.random.kind = RANDOM_NOISE;
+  EXPECT_TRUE (source_uses_http (&s1));
+  EXPECT_FALSE (source_lacks_time (&s1));
+  s1.random.kind = RANDOM_TIME;
+  EXPECT_FALSE (source_uses_http (&s1));
+  s1.http = SOURCE_HTTP_YES;
+  EXPECT_TRUE (source_uses_http (&s1));
+  /* no keeps it on TLS, tried only when nothing else is left. */
+  s1.http = SOURCE_HTTP_NO;
+  s1.random.kind = RANDOM_ZERO;
+  EXPECT_FALSE (source_uses_http (&s1));
+  EXPECT_TRUE (source_lacks_time (&s1));
+  EXPECT_EQ (&s2, advance_source (&opts));
+  EXPECT_EQ (&s2, advance_source (&opts));
+  s2.max_tries = 1;
+  s2.tries = 1;
+  EXPECT_EQ (&s1, advance_source (&opts));
+}
+
+TEST (refused_certificates)
+{
+  struct source s2 = { .next = NULL, .host = "host2", .port = "port2" };
+  struct source s1 = { .next = &s2, .host = "host1", .port = "port1" };
+  struct opts opts;
+  memset (&opts, 0, sizeof (opts));
+  opts.sources = &s1;
+  EXPECT_TRUE (source_has_tries (&s1));
+  /* A refused certificate takes the source out of this sync. */
+  s1.rejected = 1;
+  EXPECT_FALSE (source_has_tries (&s1));
+  EXPECT_EQ (&s2, advance_source (&opts));
+  EXPECT_EQ (&s2, advance_source (&opts));
+  s2.rejected = 1;
+  EXPECT_EQ (NULL, advance_source (&opts));
+  reset_source_tries (&opts);
+  EXPECT_EQ (0, s1.rejected);
+  EXPECT_EQ (&s1, advance_source (&opts));
+}
+
+TEST (backoff_policies)
+{
+  uint32_t d = 10;
+  int i;
+  EXPECT_EQ (BACKOFF_DOUBLE, backoff_policy_parse ("double"));
+  EXPECT_EQ (BACKOFF_DECORRELATED, backoff_policy_parse ("decorrelated"));
+  EXPECT_EQ (-1, backoff_policy_parse ("linear"));
+  EXPECT_STREQ ("decorrelated", backoff_policy_str (BACKOFF_DECORRELATED));
+  /* Doubling is what tlsdated has always done. */
+  EXPECT_EQ (20, backoff_next (BACKOFF_DOUBLE, 10, 600, 10, 0));
+  EXPECT_EQ (640, backoff_next (BACKOFF_DOUBLE, 10, 600, 320, 0));
+  EXPECT_EQ (640, backoff_next (BACKOFF_DOUBLE, 10, 600, 640, 0));
+  /* Decorrelated delays stay within [base, min (cap, 3 * last)]. */
+  EXPECT_EQ (10, backoff_next (BACKOFF_DECORRELATED, 10, 600, 10, 0));
+  EXPECT_EQ (30, backoff_next (BACKOFF_DECORRELATED, 10, 600, 10, 20));
+  EXPECT_EQ (10, backoff_next (BACKOFF_DECORRELATED, 10, 600, 10, 21));
+  EXPECT_EQ (600, backoff_next (BACKOFF_DECORRELATED, 10, 600, 500, 590));
+  EXPECT_EQ (900, backoff_next (BACKOFF_DECORRELATED, 900, 600, 10, 7));
+  for (i = 0; i < 1000; ++i)
+    {
+      d = backoff_next (BACKOFF_DECORRELATED, 10, 600, d, random_u32 ());
+      EXPECT_GE (d, 10);
+      EXPECT_LE (d, 600);
+    }
+}
+
 TEST_F (tlsdate, proxy_override)
 {
   struct source s1 =
@@ -305,6 +749,1305 @@ TEST_F (tlsdate, proxy_override)
   EXPECT_EQ (RECENT_COMPILE_DATE + 2, self->state.last_time);
 }
 
+TEST_F (tlsdate, metrics_runs)
+{
+  struct source s1 =
+  {
+    .next = NULL,
+    .host = "host",
+    .port = "port",
+    .proxy = NULL,
+  };
+  char *args[] = { "/bin/false", NULL };
+  extern char **environ;
+  self->state.envp = environ;
+  self->state.opts.sources = &s1;
+  self->state.opts.base_argv = args;
+  self->state.opts.subprocess_tries = 2;
+  self->state.opts.subprocess_wait_between_tries = 1;
+  self->state.opts.max_tries = 1;
+  EXPECT_EQ (1, runner (self, NULL));
+  EXPECT_EQ (1, self->state.metrics.attempts);
+  EXPECT_EQ (1, self->state.metrics.failures[F_EXIT]);
+  EXPECT_EQ (0, self->state.metrics.successes);
+  EXPECT_EQ (1, self->state.metrics.spawn_latency.count);
+  /* Usage comes from wait4() on that one child. */
+  EXPECT_EQ (1, self->state.metrics.child_cpu.count);
+  EXPECT_EQ (1, self->state.metrics.child_rss.count);
+  EXPECT_LT (0, self->state.metrics.child_rss.sum);
+  args[0] = "src/test/proxy-override";
+  self->state.tries = 0;
+  self->state.last_sync_type = SYNC_TYPE_NONE;
+  EXPECT_EQ (0, runner (self, NULL));
+  EXPECT_EQ (2, self->state.metrics.attempts);
+  EXPECT_EQ (1, self->state.metrics.successes);
+  EXPECT_EQ (1, self->state.metrics.sync_offset.count);
+  /* proxy-override only speaks -Vraw, so there is no round trip. */
+  EXPECT_EQ (0, self->state.metrics.handshake_rtt.count);
+  EXPECT_EQ (0, self->state.metrics.tls_handshake.count);
+}
+
+TEST_F (tlsdate, hedged_run)
+{
+  struct source fast =
+  {
+    .next = NULL,
+    .host = "0",
+    .port = "port",
+    .proxy = NULL,
+  };
+  struct source slow =
+  {
+    .next = &fast,
+    .host = "5",
+    .port = "port",
+    .proxy = NULL,
+  };
+  /* The host is how long the run takes; see the sh -c positionals. */
+  char *args[] = { "/bin/sh", "-c", "exec src/test/sleep-wrap \"$1\"", NULL };
+  extern char **environ;
+  time_t t;
+  int i;
+  self->state.envp = environ;
+  self->state.opts.sources = &slow;
+  self->state.opts.base_argv = args;
+  self->state.opts.max_tries = 1;
+  /* Without history there is no hedge, and the slow run is all there is. */
+  self->state.opts.hedge_percentile = 90;
+  EXPECT_EQ (1, runner (self, &t));
+  EXPECT_EQ (0, self->state.metrics.hedges);
+  EXPECT_EQ (1, tlsdate_runs (&self->state));
+  trigger_event (&self->state, E_TLSDATE_TIMEOUT, 0);
+  event_base_loopexit (self->state.base, &self->timeout);
+  event_base_dispatch (self->state.base);
+  EXPECT_EQ (0, tlsdate_runs (&self->state));
+  EXPECT_EQ (1, self->state.metrics.failures[F_TIMEOUT]);
+  /* Past attempts took 0.1s, so after about that long the next source is
+   * tried as well; it answers first and the slow run is cancelled.
+   */
+  for (i = 0; i < HEDGE_MIN_RUNS; ++i)
+    metrics_observe (&self->state.metrics.sync_duration, 0.1);
+  self->state.tries = 0;
+  self->state.opts.cur_source = NULL;
+  self->state.metrics.failures[F_TIMEOUT] = 0;
+  event_del (self->state.events[E_TLSDATE]);
+  EXPECT_EQ (0, runner (self, &t));
+  EXPECT_EQ (RECENT_COMPILE_DATE + 1, t);
+  EXPECT_EQ (1, self->state.metrics.hedges);
+  EXPECT_EQ (1, self->state.metrics.successes);
+  EXPECT_EQ (0, tlsdate_runs (&self->state));
+  EXPECT_EQ (0, self->state.running);
+  for (i = 0; i < F_MAX; ++i)
+    EXPECT_EQ (0, self->state.metrics.failures[i]);
+  EXPECT_EQ (0, event_pending (self->state.events[E_TLSDATE], EV_TIMEOUT,
+                               NULL));
+}
+
+/* A hedged-out run's verdict on its server lands on that server. */
+TEST_F (tlsdate, hedged_false_ticker)
+{
+  struct source fast =
+  {
+    .next = NULL,
+    .host = "0.6",
+    .port = "0",
+    .proxy = NULL,
+  };
+  struct source slow =
+  {
+    .next = &fast,
+    .host = "0.3",
+    .port = "39",
+    .proxy = NULL,
+  };
+  /* Each run sleeps for its host, then exits with its port, or emits a
+   * time for port 0.
+   */
+  char *args[] =
+  {
+    "/bin/sh", "-c",
+    "sleep \"$1\"; test \"$3\" = 0 && exec src/test/emit; exit \"$3\"",
+    NULL
+  };
+  extern char **environ;
+  time_t t;
+  int i;
+  self->state.envp = environ;
+  self->state.opts.sources = &slow;
+  self->state.opts.base_argv = args;
+  self->state.opts.max_tries = 1;
+  self->state.opts.hedge_percentile = 90;
+  for (i = 0; i < HEDGE_MIN_RUNS; ++i)
+    metrics_observe (&self->state.metrics.sync_duration, 0.1);
+  /* The slow run's server is the false ticker, though the hedge went on to
+   * the next source before it said so.
+   */
+  EXPECT_EQ (0, runner (self, &t));
+  EXPECT_EQ (1, self->state.metrics.hedges);
+  EXPECT_EQ (RANDOM_NOISE, slow.random.kind);
+  EXPECT_EQ (RANDOM_UNKNOWN, fast.random.kind);
+  EXPECT_EQ (0, tlsdate_runs (&self->state));
+}
+
+/* A sample that is turned down doesn't cancel the rest of the attempt. */
+TEST_F (tlsdate, hedged_bad_sample)
+{
+  struct source fast =
+  {
+    .next = NULL,
+    .host = "0.6",
+    .port = "0",
+    .proxy = NULL,
+  };
+  struct source slow =
+  {
+    .next = &fast,
+    .host = "0.3",
+    .port = "1",
+    .proxy = NULL,
+  };
+  /* Each run sleeps for its host, then emits its port as the time, or a
+   * sane one for port 0.
+   */
+  char *args[] =
+  {
+    "/bin/sh", "-c",
+    "sleep \"$1\"; test \"$3\" = 0 && exec src/test/emit; "
+    "exec src/test/emit \"$3\"",
+    NULL
+  };
+  extern char **environ;
+  time_t t;
+  int i;
+  self->state.envp = environ;
+  self->state.opts.sources = &slow;
+  self->state.opts.base_argv = args;
+  self->state.opts.max_tries = 1;
+  self->state.opts.hedge_percentile = 90;
+  for (i = 0; i < HEDGE_MIN_RUNS; ++i)
+    metrics_observe (&self->state.metrics.sync_duration, 0.1);
+  /* The slow run's time is insane; the hedge's is the one taken. */
+  EXPECT_EQ (0, runner (self, &t));
+  EXPECT_EQ (RECENT_COMPILE_DATE + 1, t);
+  EXPECT_EQ (1, self->state.metrics.hedges);
+  EXPECT_EQ (1, self->state.metrics.failures[F_INSANE_TIME]);
+  EXPECT_EQ (1, self->state.metrics.successes);
+  EXPECT_EQ (0, tlsdate_runs (&self->state));
+}
+
+/* Each run of a hedged attempt that fails costs its own source a try. */
+TEST_F (tlsdate, hedged_failures)
+{
+  struct source fast =
+  {
+    .next = NULL,
+    .host = "0.6",
+    .port = "1",
+    .proxy = NULL,
+  };
+  struct source slow =
+  {
+    .next = &fast,
+    .host = "0.3",
+    .port = "1",
+    .proxy = NULL,
+  };
+  /* Each run sleeps for its host, then exits with its port. */
+  char *args[] = { "/bin/sh", "-c", "sleep \"$1\"; exit \"$3\"", NULL };
+  extern char **environ;
+  int i;
+  self->state.envp = environ;
+  self->state.opts.sources = &slow;
+  self->state.opts.base_argv = args;
+  self->state.opts.max_tries = 5;
+  self->state.opts.hedge_percentile = 90;
+  self->state.backoff = self->state.opts.wait_between_tries;
+  for (i = 0; i < HEDGE_MIN_RUNS; ++i)
+    metrics_observe (&self->state.metrics.sync_duration, 0.1);
+  /* The slow run fails while the hedge is still out, then the hedge. */
+  EXPECT_EQ (1, runner (self, NULL));
+  EXPECT_EQ (1, self->state.metrics.hedges);
+  EXPECT_EQ (1, slow.tries);
+  EXPECT_EQ (1, fast.tries);
+  EXPECT_EQ (0, tlsdate_runs (&self->state));
+  EXPECT_EQ (1, event_pending (self->state.events[E_TLSDATE], EV_TIMEOUT,
+                               NULL) != 0);
+}
+
+TEST (metrics_quantiles)
+{
+  static const double bounds[] = { 1, 2, 4 };
+  struct histogram h;
+  memset (&h, 0, sizeof (h));
+  h.bounds = bounds;
+  h.nbounds = 3;
+  EXPECT_EQ (0, metrics_quantile (&h, 0.5));
+  metrics_observe (&h, 0.5);
+  metrics_observe (&h, 1.5);
+  metrics_observe (&h, 3);
+  metrics_observe (&h, 3);
+  /* Half are at most 2; the 75th percentile is halfway into (2, 4]. */
+  EXPECT_EQ (2, metrics_quantile (&h, 0.5));
+  EXPECT_EQ (3, metrics_quantile (&h, 0.75));
+  metrics_observe (&h, 100);
+  EXPECT_EQ (4, metrics_quantile (&h, 0.99));
+}
+
+TEST_F (tlsdate, fast_boot_retry)
+{
+  struct source s1 =
+  {
+    .next = NULL,
+    .host = "host",
+    .port = "port",
+    .proxy = NULL,
+  };
+  char *args[] = { "/bin/false", NULL };
+  extern char **environ;
+  self->state.envp = environ;
+  self->state.opts.sources = &s1;
+  self->state.opts.base_argv = args;
+  self->state.opts.subprocess_wait_between_tries = 1;
+  self->state.opts.max_tries = 1;
+  self->state.opts.fast_boot_retry = 5;
+  self->state.booting = 1;
+  self->state.backoff = self->state.opts.wait_between_tries;
+  EXPECT_EQ (1, runner (self, NULL));
+  /* No doubling, and failures don't use up max-tries while booting. */
+  EXPECT_EQ (5, self->state.backoff);
+  EXPECT_EQ (0, self->state.tries);
+  EXPECT_EQ (1, event_pending (self->state.events[E_TLSDATE], EV_TIMEOUT,
+                               NULL) != 0);
+  end_fast_boot (&self->state);
+  EXPECT_EQ (0, self->state.booting);
+  EXPECT_EQ (WAIT_BETWEEN_TRIES, self->state.backoff);
+}
+
+TEST (metrics_deadline_exit)
+{
+  struct metrics m;
+  siginfo_t info;
+  memset (&info, 0, sizeof (info));
+  metrics_init (&m);
+  info.si_code = CLD_EXITED;
+  info.si_status = HELPER_DEADLINE_EXIT + HELPER_CONNECT;
+  metrics_child_reaped (&m, &info, NULL);
+  EXPECT_EQ (1, m.failures[F_CONNECT_TIMEOUT]);
+  EXPECT_EQ (0, m.failures[F_EXIT]);
+  EXPECT_STREQ ("connect-timeout", metrics_failure_str (F_CONNECT_TIMEOUT));
+  info.si_status = 1;
+  metrics_child_reaped (&m, &info, NULL);
+  EXPECT_EQ (1, m.failures[F_EXIT]);
+  EXPECT_EQ (-1, helper_deadline_phase (HELPER_BAD_CERT_EXIT));
+  info.si_status = HELPER_BAD_CERT_EXIT;
+  metrics_child_reaped (&m, &info, NULL);
+  EXPECT_EQ (1, m.failures[F_BAD_CERT]);
+  EXPECT_EQ (1, m.failures[F_EXIT]);
+}
+
+TEST (metrics_exposition)
+{
+  static char buf[METRICS_MAX_RESPONSE];
+  struct state state;
+  struct tlsdate_sample sample = { RECENT_COMPILE_DATE + 1,
+                                   TLSDATE_SAMPLE_MAGIC, 250, 0 };
+  memset (&state, 0, sizeof (state));
+  sample.connected_ns = 1000000000ULL;
+  sample.handshake_ns = sample.connected_ns + 3000000;
+  sample.verified_ns = sample.handshake_ns + 500000;
+  metrics_init (&state.metrics);
+  state.last_sync_type = SYNC_TYPE_NET;
+  state.backoff = 20;
+  metrics_observe (&state.metrics.spawn_latency, 0.0003);
+  metrics_observe (&state.metrics.spawn_latency, 0.002);
+  metrics_run_succeeded (&state.metrics, RECENT_COMPILE_DATE + 1, &sample);
+  metrics_run_failed (&state.metrics, F_TIMEOUT);
+  ASSERT_LT (0, metrics_render (&state, buf, sizeof (buf)));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_spawn_latency_seconds_bucket{le=\"0.0005\"} 1\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_spawn_latency_seconds_bucket{le=\"0.0025\"} 2\n"));
+  EXPECT_NE (NULL, strstr (buf, "tlsdated_spawn_latency_seconds_count 2\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_handshake_rtt_seconds_bucket{le=\"0.25\"} 1\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_tls_handshake_seconds_bucket{le=\"0.0025\"} 0\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_tls_handshake_seconds_bucket{le=\"0.005\"} 1\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_verify_seconds_bucket{le=\"0.0005\"} 1\n"));
+  /* No spawn time or send time to measure from. */
+  EXPECT_NE (NULL, strstr (buf, "tlsdated_connect_latency_seconds_count 0\n"));
+  EXPECT_NE (NULL, strstr (buf, "tlsdated_delivery_seconds_count 0\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_failures_total{cause=\"timeout\"} 1\n"));
+  EXPECT_NE (NULL, strstr (buf, "tlsdated_backoff_seconds 20\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_last_sync_type{type=\"network\"} 1\n"));
+  EXPECT_NE (NULL, strstr (buf,
+             "tlsdated_last_sync_type{type=\"system-clock\"} 0\n"));
+  EXPECT_EQ (-1, metrics_render (&state, buf, 64));
+}
+
+TEST_F (tempdir, trace_dump)
+{
+  struct state state;
+  struct trace_header header;
+  struct trace_record first, last;
+  char path[PATH_MAX];
+  int fd;
+  int i;
+  memset (&state, 0, sizeof (state));
+  snprintf (path, sizeof (path), "%s/trace", self->path);
+  /* Wrap the ring so the dump has to stitch two runs back together. */
+  for (i = 0; i < TRACE_RECORDS + 3; ++i)
+    {
+      state.tries = i;
+      trace_child (&state, E_SIGCHLD, 100 + i, 1, CLD_EXITED);
+    }
+  state.backoff = 40;
+  trace_event (&state, E_TLSDATE);
+  ASSERT_EQ (0, trace_dump (&state.trace, path));
+  fd = open (path, O_RDONLY);
+  ASSERT_LE (0, fd);
+  ASSERT_EQ (sizeof (header), read (fd, &header, sizeof (header)));
+  EXPECT_EQ (TRACE_MAGIC, header.magic);
+  EXPECT_EQ (TRACE_RECORDS, header.count);
+  EXPECT_EQ (4, header.dropped);
+  ASSERT_EQ (sizeof (first), read (fd, &first, sizeof (first)));
+  EXPECT_EQ (4, first.tries);
+  EXPECT_EQ (104, first.pid);
+  EXPECT_EQ (E_SIGCHLD, first.event);
+  ASSERT_EQ (0, lseek (fd, -(off_t) sizeof (last), SEEK_END) < 0);
+  ASSERT_EQ (sizeof (last), read (fd, &last, sizeof (last)));
+  EXPECT_EQ (E_TLSDATE, last.event);
+  EXPECT_EQ (40, last.backoff);
+  EXPECT_LE (first.mono_ns, last.mono_ns);
+  close (fd);
+  unlink (path);
+}
+
+static int
+write_conf (const char *path, const char *contents)
+{
+  FILE *f = fopen (path, "w");
+  if (!f)
+    return 1;
+  fputs (contents, f);
+  return fclose (f);
+}
+
+TEST_F (tempdir, reload_conf)
+{
+  struct state state;
+  char path[PATH_MAX];
+  memset (&state, 0, sizeof (state));
+  snprintf (path, sizeof (path), "%s/tlsdated.conf", self->path);
+  ASSERT_EQ (0, write_conf (path,
+                            "max-tries 5\n"
+                            "source\n\thost a.example.com\n\tport 443\nend\n"
+                            "source\n\thost b.example.com\n\tport 443\nend\n"));
+  set_conf_defaults (&state.opts);
+  state.opts.conf_file = path;
+  state.opts.wait_between_tries = 7;  /* as if from the command line */
+  state.cmdline_opts = state.opts;
+  ASSERT_EQ (0, load_conf (&state.opts));
+  ASSERT_NE (NULL, state.opts.sources);
+  ASSERT_NE (NULL, state.opts.sources->next);
+  state.opts.cur_source = state.opts.sources->next;
+  state.last_sync_type = SYNC_TYPE_NET;
+  state.clock_delta = 12;
+  ASSERT_EQ (0, write_conf (path,
+                            "steady-state-interval 600\n"
+                            "continuity-interval 60\n"
+                            "source\n\thost c.example.com\n\tport 8443\n"
+                            "\tpin sha256/"
+                            "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=\n"
+                            "\thttp no\n"
+                            "end\n"));
+  ASSERT_EQ (0, reload_conf (&state));
+  /* The file no longer sets max-tries, so the default comes back. */
+  EXPECT_EQ (MAX_TRIES, state.opts.max_tries);
+  EXPECT_EQ (7, state.opts.wait_between_tries);
+  EXPECT_EQ (600, state.opts.steady_state_interval);
+  EXPECT_EQ (60, state.opts.continuity_interval);
+  ASSERT_NE (NULL, state.opts.sources);
+  EXPECT_STREQ ("c.example.com", state.opts.sources->host);
+  EXPECT_STREQ ("8443", state.opts.sources->port);
+  EXPECT_STREQ ("sha256/47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=",
+                state.opts.sources->pin);
+  EXPECT_EQ (SOURCE_HTTP_NO, state.opts.sources->http);
+  EXPECT_EQ (NULL, state.opts.sources->next);
+  EXPECT_EQ (NULL, state.opts.cur_source);
+  EXPECT_EQ (SYNC_TYPE_NET, state.last_sync_type);
+  EXPECT_EQ (12, state.clock_delta);
+  /* A broken file leaves everything as it was. */
+  ASSERT_EQ (0, write_conf (path,
+                            "steady-state-interval 30\n"
+                            "source\n\thost d.example.com\n"));
+  EXPECT_EQ (1, reload_conf (&state));
+  ASSERT_EQ (0, write_conf (path,
+                            "source\n\thost d.example.com\n\tport 443\n"
+                            "\tpin sha256/47DEQ\nend\n"));
+  EXPECT_EQ (1, reload_conf (&state));
+  ASSERT_EQ (0, write_conf (path,
+                            "source\n\thost d.example.com\n\tport 443\n"
+                            "\thttp sometimes\nend\n"));
+  EXPECT_EQ (1, reload_conf (&state));
+  EXPECT_EQ (600, state.opts.steady_state_interval);
+  EXPECT_STREQ ("c.example.com", state.opts.sources->host);
+  ASSERT_EQ (0, write_conf (path, "jitter 900\nsteady-state-interval 600\n"));
+  EXPECT_EQ (1, reload_conf (&state));
+  EXPECT_EQ (0, state.opts.jitter);
+  free_sources (state.opts.sources);
+  unlink (path);
+}
+
+TEST_F (tempdir, notify)
+{
+  struct sockaddr_un addr;
+  char buf[256];
+  ssize_t len;
+  int fd;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  snprintf (addr.sun_path, sizeof (addr.sun_path), "%s/notify", self->path);
+  fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+  ASSERT_LE (0, fd);
+  ASSERT_EQ (0, bind (fd, (struct sockaddr *) &addr, sizeof (addr)));
+  /* Without a socket, sending is a quiet no-op. */
+  unsetenv ("NOTIFY_SOCKET");
+  EXPECT_EQ (0, notify_init ());
+  EXPECT_EQ (0, notify_send ("READY=1"));
+  setenv ("NOTIFY_SOCKET", addr.sun_path, 1);
+  EXPECT_EQ (1, notify_init ());
+  /* Children must not see it. */
+  EXPECT_EQ (NULL, getenv ("NOTIFY_SOCKET"));
+  EXPECT_EQ (0, notify_send ("READY=1\nSTATUS=%s", "Synchronized"));
+  len = recv (fd, buf, sizeof (buf) - 1, MSG_DONTWAIT);
+  ASSERT_LT (0, len);
+  buf[len] = '\0';
+  EXPECT_STREQ ("READY=1\nSTATUS=Synchronized", buf);
+  close (fd);
+  unlink (addr.sun_path);
+  setenv ("NOTIFY_SOCKET", "relative/path", 1);
+  EXPECT_EQ (0, notify_init ());
+}
+
+TEST_F (tempdir, status_page)
+{
+  struct state state;
+  struct tlsdate_status st;
+  const struct tlsdate_status_page *page;
+  char buf[PATH_MAX];
+  uint64_t generation;
+  snprintf (buf, sizeof (buf), "%s/status", self->path);
+  memset (&state, 0, sizeof (state));
+  state.opts.status_page = buf;
+  state.last_sync_type = SYNC_TYPE_DISK;
+  state.last_time = 1000000000;
+  /* Nothing to read until tlsdated has set it up. */
+  EXPECT_EQ (NULL, tlsdate_status_open (buf));
+  ASSERT_EQ (0, status_page_open (&state));
+  page = tlsdate_status_open (buf);
+  ASSERT_NE (NULL, page);
+  ASSERT_EQ (0, tlsdate_status_read (page, &st));
+  EXPECT_EQ (SYNC_TYPE_DISK, st.sync_type);
+  EXPECT_EQ (0, st.flags);
+  EXPECT_EQ (0, st.net_sync_time);
+  generation = st.generation;
+  state.last_sync_type = SYNC_TYPE_NET;
+  state.last_time = 1000000100;
+  state.clock_delta = 1;
+  state.metrics.last_offset = -2.5;
+  state.metrics.last_rtt = 0.2;
+  status_page_net_synced (&state);
+  ASSERT_EQ (0, tlsdate_status_read (page, &st));
+  EXPECT_EQ (generation + 1, st.generation);
+  EXPECT_EQ (SYNC_TYPE_NET, st.sync_type);
+  EXPECT_EQ (TLSDATE_STATUS_NET_SYNCED, st.flags);
+  EXPECT_EQ (1000000100, st.net_sync_time);
+  EXPECT_NE (0, st.net_sync_mono);
+  EXPECT_EQ (-2500000000LL, st.offset_ns);
+  EXPECT_EQ (600000000ULL, st.error_ns);
+  /* Only a second sync tells us anything about drift. */
+  EXPECT_EQ (0, st.drift_ppb);
+  invalidate_time (&state);
+  ASSERT_EQ (0, tlsdate_status_read (page, &st));
+  EXPECT_EQ (generation + 2, st.generation);
+  EXPECT_EQ (SYNC_TYPE_RTC, st.sync_type);
+  EXPECT_EQ (1000000100, st.net_sync_time);
+  /* Readers back off while an update is in progress. */
+  state.status->seq++;
+  EXPECT_EQ (-1, tlsdate_status_try_read (page, &st));
+  state.status->seq++;
+  EXPECT_EQ (0, tlsdate_status_try_read (page, &st));
+  munmap ((void *) page, TLSDATE_STATUS_PAGE_SIZE);
+  munmap (state.status, TLSDATE_STATUS_PAGE_SIZE);
+  EXPECT_EQ (0, unlink (buf));
+}
+
+TEST (ntp_shm)
+{
+  struct tlsdate_sample sample;
+  struct ntp_shm_time *shm;
+  struct timespec before;
+  int count;
+  int id;
+  /* A high unit, so a real NTP daemon here is left alone. */
+  shm = ntp_shm_open (NTP_SHM_MAX_UNIT);
+  ASSERT_NE (NULL, shm);
+  EXPECT_EQ (1, shm->mode);
+  EXPECT_EQ (0, (int) shm->valid);
+  count = shm->count;
+  memset (&sample, 0, sizeof (sample));
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.rtt_ms = 4000;
+  clock_gettime (CLOCK_REALTIME, &before);
+  ntp_shm_post (shm, 1000000000, &sample);
+  EXPECT_EQ (1, (int) shm->valid);
+  EXPECT_EQ (count + 2, (int) shm->count);
+  EXPECT_EQ (1000000000, shm->clock_sec);
+  EXPECT_EQ (500000000, shm->clock_nsec);
+  EXPECT_EQ (500000, shm->clock_usec);
+  /* Received half the round trip before it was read. */
+  EXPECT_LE (before.tv_sec - 2, shm->receive_sec);
+  EXPECT_GE (before.tv_sec - 1, shm->receive_sec);
+  EXPECT_EQ (shm->receive_nsec / 1000, shm->receive_usec);
+  EXPECT_EQ (-1, shm->precision);
+  id = shmget (NTP_SHM_KEY + NTP_SHM_MAX_UNIT, 0, 0);
+  shmdt (shm);
+  EXPECT_EQ (0, shmctl (id, IPC_RMID, NULL));
+}
+
+TEST (sntp_packets)
+{
+  struct state state;
+  struct timespec mono, rx, tx;
+  uint8_t request[SNTP_PACKET_LEN];
+  uint8_t reply[SNTP_PACKET_LEN];
+  uint32_t word;
+  memset (&state, 0, sizeof (state));
+  memset (request, 0, sizeof (request));
+  request[0] = (4 << 3) | SNTP_MODE_CLIENT;
+  request[2] = 6;
+  memcpy (request + 40, "\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  clock_gettime (CLOCK_REALTIME, &rx);
+  tx = rx;
+  /* Never synced: an alarm and a kiss code. */
+  state.last_sync_type = SYNC_TYPE_RTC;
+  EXPECT_EQ (0, sntp_prepare (&state, &mono, &rx, reply));
+  ASSERT_EQ (0, sntp_answer (reply, request, sizeof (request), &rx, &tx));
+  EXPECT_EQ ((SNTP_LEAP_ALARM << 6) | (4 << 3) | SNTP_MODE_SERVER, reply[0]);
+  EXPECT_EQ (0, reply[1]);
+  EXPECT_EQ (0, memcmp (reply + 12, "INIT", 4));
+  /* Synced a second ago over a 200ms round trip. */
+  state.last_sync_type = SYNC_TYPE_NET;
+  state.metrics.last_net_sync = mono;
+  state.metrics.last_net_sync.tv_sec--;
+  state.metrics.last_rtt = 0.2;
+  EXPECT_EQ (1, sntp_prepare (&state, &mono, &rx, reply));
+  request[0] = (3 << 3) | SNTP_MODE_CLIENT;
+  ASSERT_EQ (0, sntp_answer (reply, request, sizeof (request), &rx, &tx));
+  EXPECT_EQ ((SNTP_LEAP_NONE << 6) | (3 << 3) | SNTP_MODE_SERVER, reply[0]);
+  EXPECT_EQ (2, reply[1]);
+  EXPECT_EQ (6, reply[2]);
+  memcpy (&word, reply + 4, 4);
+  EXPECT_EQ ((uint32_t) (0.2 * 65536), ntohl (word));
+  memcpy (&word, reply + 8, 4);
+  EXPECT_EQ ((uint32_t) ((0.6 + 15e-6) * 65536), ntohl (word));
+  /* The reference time is the sync, a second before |rx|. */
+  memcpy (&word, reply + 16, 4);
+  EXPECT_EQ ((uint32_t) (rx.tv_sec - 1 + 2208988800UL), ntohl (word));
+  EXPECT_EQ (0, memcmp (reply + 24, request + 40, 8));
+  memcpy (&word, reply + 40, 4);
+  EXPECT_EQ ((uint32_t) (tx.tv_sec + 2208988800UL), ntohl (word));
+  /* Not ours to answer. */
+  state.opts.dry_run = 1;
+  EXPECT_EQ (0, sntp_prepare (&state, &mono, &rx, reply));
+  EXPECT_EQ (-1, sntp_answer (reply, request, sizeof (request) - 1, &rx, &tx));
+  request[0] = (4 << 3) | SNTP_MODE_SERVER;
+  EXPECT_EQ (-1, sntp_answer (reply, request, sizeof (request), &rx, &tx));
+}
+
+TEST_F (tlsdate, sntp_server)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+  uint8_t request[SNTP_PACKET_LEN];
+  uint8_t reply[SNTP_PACKET_LEN + 1];
+  int client;
+  self->state.opts.sntp_address = "127.0.0.1";
+  self->state.opts.sntp_port = 0;
+  ASSERT_EQ (0, setup_sntp_server (&self->state));
+  ASSERT_EQ (0, getsockname (event_get_fd (self->state.events[E_SNTP]),
+                             (struct sockaddr *) &addr, &addr_len));
+  client = socket (AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE (0, client);
+  memset (request, 0, sizeof (request));
+  request[0] = (4 << 3) | SNTP_MODE_CLIENT;
+  ASSERT_EQ (sizeof (request), sendto (client, request, sizeof (request), 0,
+                                       (struct sockaddr *) &addr, addr_len));
+  /* Garbage is dropped without a reply. */
+  ASSERT_EQ (4, sendto (client, "junk", 4, 0, (struct sockaddr *) &addr,
+                        addr_len));
+  usleep (10000);
+  event_base_loop (self->state.base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+  EXPECT_EQ (SNTP_PACKET_LEN, recv (client, reply, sizeof (reply),
+                                    MSG_DONTWAIT));
+  EXPECT_EQ ((SNTP_LEAP_ALARM << 6) | (4 << 3) | SNTP_MODE_SERVER, reply[0]);
+  EXPECT_EQ (-1, recv (client, reply, sizeof (reply), MSG_DONTWAIT));
+  EXPECT_EQ (1, self->state.metrics.sntp_unsynced);
+  EXPECT_EQ (1, self->state.metrics.sntp_dropped);
+  close (client);
+}
+
+static const char kPeerKey1[] =
+  "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+static const char kPeerKey2[] =
+  "ffeeddccbbaa99887766554433221100ffeeddccbbaa99887766554433221100";
+
+static int
+write_peer_keys (const char *path, const char *contents)
+{
+  FILE *f = fopen (path, "w");
+  if (!f)
+    return 1;
+  fputs (contents, f);
+  return fclose (f);
+}
+
+TEST_F (tempdir, peer_keys)
+{
+  struct peers peers;
+  char path[PATH_MAX];
+  char buf[512];
+  snprintf (path, sizeof (path), "%s/keys", self->path);
+  memset (&peers, 0, sizeof (peers));
+  snprintf (buf, sizeof (buf), "# rotated in\n7 %s\n\n  3 %s  \n",
+            kPeerKey2, kPeerKey1);
+  ASSERT_EQ (0, write_peer_keys (path, buf));
+  ASSERT_EQ (0, peer_load_keys (&peers, path));
+  EXPECT_EQ (2, peers.num_keys);
+  EXPECT_EQ (7, peers.keys[0].id);
+  EXPECT_EQ (32, peers.keys[0].len);
+  EXPECT_EQ (0xff, peers.keys[0].secret[0]);
+  EXPECT_EQ (3, peers.keys[1].id);
+  EXPECT_EQ (0x1f, peers.keys[1].secret[31]);
+  /* Too short to be safe. */
+  ASSERT_EQ (0, write_peer_keys (path, "1 00112233\n"));
+  EXPECT_EQ (1, peer_load_keys (&peers, path));
+  EXPECT_EQ (0, peers.num_keys);
+  snprintf (buf, sizeof (buf), "1 %s\n1 %s\n", kPeerKey1, kPeerKey2);
+  ASSERT_EQ (0, write_peer_keys (path, buf));
+  EXPECT_EQ (1, peer_load_keys (&peers, path));
+  snprintf (buf, sizeof (buf), "1 %sx\n", kPeerKey1);
+  ASSERT_EQ (0, write_peer_keys (path, buf));
+  EXPECT_EQ (1, peer_load_keys (&peers, path));
+  EXPECT_EQ (0, unlink (path));
+  EXPECT_EQ (1, peer_load_keys (&peers, path));
+  EXPECT_EQ (0, peer_parse_dests (&peers, "127.0.0.1:99 239.1.2.3", 4460));
+  EXPECT_EQ (2, peers.num_dests);
+  EXPECT_EQ (htons (99), peers.dests[0].sin_port);
+  EXPECT_EQ (htons (4460), peers.dests[1].sin_port);
+  EXPECT_EQ (1, peer_parse_dests (&peers, "example.com", 4460));
+  EXPECT_EQ (1, peer_parse_dests (&peers, "127.0.0.1:0", 4460));
+}
+
+static void
+set_peer_key (struct peers *peers, int i, uint32_t id, uint8_t fill)
+{
+  peers->keys[i].id = id;
+  peers->keys[i].len = 32;
+  memset (peers->keys[i].secret, fill, 32);
+}
+
+TEST (peer_packets)
+{
+  struct peers a, b;
+  struct peer_record rec, got;
+  uint8_t nonce[PEER_NONCE_LEN];
+  uint8_t buf[PEER_REPLY_LEN];
+  memset (&a, 0, sizeof (a));
+  memset (&b, 0, sizeof (b));
+  set_peer_key (&a, 0, 1, 0x11);
+  a.num_keys = 1;
+  /* |b| has moved on to key 2 but still takes key 1. */
+  set_peer_key (&b, 0, 2, 0x22);
+  set_peer_key (&b, 1, 1, 0x11);
+  b.num_keys = 2;
+  memset (a.nonce, 0x5a, sizeof (a.nonce));
+  ASSERT_EQ (PEER_QUERY_LEN, peer_encode_query (&a, buf));
+  EXPECT_EQ (1, peer_check_query (&b, buf, PEER_QUERY_LEN, nonce));
+  EXPECT_EQ (0, memcmp (nonce, a.nonce, sizeof (nonce)));
+  buf[10] ^= 1;
+  EXPECT_EQ (-1, peer_check_query (&b, buf, PEER_QUERY_LEN, nonce));
+  memset (&rec, 0, sizeof (rec));
+  memcpy (rec.nonce, nonce, sizeof (nonce));
+  strcpy (rec.host, "time.example.com");
+  memset (rec.spki_sha256, 0xab, sizeof (rec.spki_sha256));
+  rec.server_time = 1400000000;
+  rec.rtt_ms = 120;
+  rec.sync_mono_ns = 5000000000ULL;
+  rec.sent_mono_ns = 6500000000ULL;
+  /* Answered under the key the query used. */
+  ASSERT_EQ (PEER_REPLY_LEN, peer_encode_reply (&b, 1, &rec, buf));
+  ASSERT_EQ (0, peer_decode_reply (&a, buf, PEER_REPLY_LEN, &got));
+  EXPECT_EQ (0, memcmp (got.nonce, a.nonce, sizeof (got.nonce)));
+  EXPECT_STREQ ("time.example.com", got.host);
+  EXPECT_EQ (0xab, got.spki_sha256[31]);
+  EXPECT_EQ (1400000000, got.server_time);
+  EXPECT_EQ (120, got.rtt_ms);
+  EXPECT_EQ (5000000000ULL, got.sync_mono_ns);
+  EXPECT_EQ (6500000000ULL, got.sent_mono_ns);
+  EXPECT_EQ (-1, peer_decode_reply (&a, buf, PEER_REPLY_LEN - 1, &got));
+  buf[PEER_REPLY_LEN - 40] ^= 1;
+  EXPECT_EQ (-1, peer_decode_reply (&a, buf, PEER_REPLY_LEN, &got));
+  /* A key |a| doesn't hold. */
+  ASSERT_EQ (PEER_REPLY_LEN, peer_encode_reply (&b, 0, &rec, buf));
+  EXPECT_EQ (-1, peer_decode_reply (&a, buf, PEER_REPLY_LEN, &got));
+}
+
+/* Two instances on loopback: |a| has done a handshake, |b| wants time. */
+TEST_F (tempdir, peer_loopback)
+{
+  struct state a, b;
+  struct tlsdate_sample sample;
+  struct source source = { .host = (char *) DEFAULT_HOST };
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+  char keys[PATH_MAX], buf[512], dest[64];
+  time_t now = time (NULL);
+  snprintf (keys, sizeof (keys), "%s/keys", self->path);
+  snprintf (buf, sizeof (buf), "1 %s\n", kPeerKey1);
+  ASSERT_EQ (0, write_peer_keys (keys, buf));
+  memset (&a, 0, sizeof (a));
+  memset (&b, 0, sizeof (b));
+  set_conf_defaults (&a.opts);
+  set_conf_defaults (&b.opts);
+  a.base = event_base_new ();
+  b.base = event_base_new ();
+  ASSERT_NE (NULL, a.base);
+  ASSERT_NE (NULL, b.base);
+  event_base_priority_init (a.base, MAX_EVENT_PRIORITIES);
+  event_base_priority_init (b.base, MAX_EVENT_PRIORITIES);
+  metrics_init (&a.metrics);
+  metrics_init (&b.metrics);
+  a.opts.peer_key_file = b.opts.peer_key_file = keys;
+  a.opts.peer_port = b.opts.peer_port = 0;
+  ASSERT_EQ (0, setup_peers (&a));
+  EXPECT_EQ (0, unlink (keys));
+  ASSERT_EQ (0, getsockname (event_get_fd (a.events[E_PEER]),
+                             (struct sockaddr *) &addr, &addr_len));
+  snprintf (dest, sizeof (dest), "127.0.0.1:%d", ntohs (addr.sin_port));
+  b.opts.peers = dest;
+  ASSERT_EQ (0, write_peer_keys (keys, buf));
+  ASSERT_EQ (0, setup_peers (&b));
+  EXPECT_EQ (0, unlink (keys));
+  b.opts.sources = &source;
+  /* Nobody has time yet, so the query goes unanswered. */
+  ASSERT_EQ (1, peer_query (&b));
+  usleep (10000);
+  event_base_loop (a.base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+  EXPECT_EQ (0, a.metrics.peer_answered);
+  memset (&sample, 0, sizeof (sample));
+  sample.time = now;
+  sample.magic = TLSDATE_SAMPLE_MAGIC;
+  sample.rtt_ms = 100;
+  a.last_sync_type = SYNC_TYPE_NET;
+  peer_note_sample (&a, a.opts.cur_source, &sample);
+  /* One query per round. */
+  b.peers->querying = 0;
+  EXPECT_EQ (0, peer_query (&b));
+  b.peers->tried = 0;
+  ASSERT_EQ (1, peer_query (&b));
+  usleep (10000);
+  event_base_loop (a.base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+  EXPECT_EQ (1, a.metrics.peer_answered);
+  usleep (10000);
+  event_base_loop (b.base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+  EXPECT_EQ (1, b.metrics.peer_accepted);
+  EXPECT_EQ (SYNC_TYPE_NET, b.last_sync_type);
+  EXPECT_LE (now, b.last_time);
+  EXPECT_GE (now + 1, b.last_time);
+  EXPECT_EQ (0, b.peers->querying);
+  /* Samples from peers aren't passed on. */
+  EXPECT_EQ (0, b.peers->have_own);
+  event_free (a.events[E_PEER]);
+  event_free (a.events[E_PEER_TIMEOUT]);
+  event_free (b.events[E_PEER]);
+  event_free (b.events[E_PEER_TIMEOUT]);
+  event_base_free (a.base);
+  event_base_free (b.base);
+  free (a.peers);
+  free (b.peers);
+}
+
+/* The parts of Roughtime that don't need Ed25519. */
+TEST (roughtime_encoding)
+{
+  uint8_t key[ROUGHTIME_KEY_LEN], nonce[ROUGHTIME_NONCE_LEN];
+  uint8_t request[ROUGHTIME_REQUEST_LEN];
+  uint8_t leaf[ROUGHTIME_HASH_LEN], other[ROUGHTIME_HASH_LEN];
+  uint8_t zero[ROUGHTIME_HASH_LEN];
+  const uint8_t *value;
+  size_t value_len;
+  EXPECT_EQ (0, roughtime_parse_key (
+               "0GD7c3yP8xEc4Zl2zeuN2SlLvDVVocjsPSL8/Rl/7zg=", key));
+  EXPECT_EQ (0xd0, key[0]);
+  EXPECT_EQ (0x38, key[31]);
+  EXPECT_EQ (0, roughtime_parse_key (
+               "D060FB737C8FF3111CE19976CDEB8DD9294BBC3555A1C8EC3D22FCFD197FEF38",
+               key));
+  EXPECT_EQ (0xd0, key[0]);
+  EXPECT_EQ (1, roughtime_parse_key ("0GD7c3yP8xEc4Zl2zeuN2SlLvDVVocjs", key));
+  EXPECT_EQ (1, roughtime_parse_key (
+               "0GD7c3yP8xEc4Zl2zeuN2SlLvDVVocjsPSL8/Rl/7z==", key));
+  memset (nonce, 0x42, sizeof (nonce));
+  ASSERT_EQ (ROUGHTIME_REQUEST_LEN, roughtime_encode_request (nonce, request));
+  ASSERT_EQ (0, roughtime_find_tag (request, sizeof (request),
+                                    ROUGHTIME_NONC, &value, &value_len));
+  EXPECT_EQ (ROUGHTIME_NONCE_LEN, value_len);
+  EXPECT_EQ (0, memcmp (nonce, value, value_len));
+  /* Leaves hash with SHA-512; a failed digest would leave zeros. */
+  memset (zero, 0, sizeof (zero));
+  roughtime_leaf_hash (nonce, leaf);
+  EXPECT_NE (0, memcmp (leaf, zero, sizeof (zero)));
+  nonce[0] ^= 1;
+  roughtime_leaf_hash (nonce, other);
+  EXPECT_NE (0, memcmp (leaf, other, sizeof (leaf)));
+  /* Tags out of order make a malformed message. */
+  memcpy (request + 8, "PAD\xff", 4);
+  memcpy (request + 12, "NONC", 4);
+  EXPECT_EQ (-1, roughtime_find_tag (request, sizeof (request),
+                                     ROUGHTIME_NONC, &value, &value_len));
+}
+
+#ifdef HAVE_EVP_PKEY_NEW_RAW_PUBLIC_KEY
+static const uint8_t kRoughtimeSeed[ROUGHTIME_KEY_LEN] = { 1, 2, 3, 4 };
+
+TEST (roughtime_packets)
+{
+  struct roughtime_server srv, other;
+  struct roughtime_result res;
+  uint8_t nonce[ROUGHTIME_NONCE_LEN];
+  uint8_t request[ROUGHTIME_REQUEST_LEN], reply[ROUGHTIME_MAX_REPLY];
+  const uint8_t *value;
+  size_t len, value_len;
+  ASSERT_EQ (0, roughtime_server_init (&srv, kRoughtimeSeed));
+  memset (nonce, 0x42, sizeof (nonce));
+  ASSERT_EQ (ROUGHTIME_REQUEST_LEN, roughtime_encode_request (nonce, request));
+  /* Servers drop requests that would amplify. */
+  EXPECT_EQ (0, roughtime_server_reply (&srv, request, 512, 0, 0, reply));
+  len = roughtime_server_reply (&srv, request, sizeof (request),
+                                1400000000123456ULL, 250000, reply);
+  ASSERT_LT (0, len);
+  ASSERT_EQ (0, roughtime_verify_reply (srv.public_key, nonce, reply, len,
+                                        &res));
+  EXPECT_EQ (1400000000123456ULL, res.midpoint_us);
+  EXPECT_EQ (250000, res.radius_us);
+  /* Someone else's key, or an answer to someone else's nonce. */
+  ASSERT_EQ (0, roughtime_server_init (&other, kRoughtimeSeed));
+  memset (other.public_key, 0, sizeof (other.public_key));
+  EXPECT_EQ (-1, roughtime_verify_reply (other.public_key, nonce, reply, len,
+                                         &res));
+  nonce[0] ^= 1;
+  EXPECT_EQ (-1, roughtime_verify_reply (srv.public_key, nonce, reply, len,
+                                         &res));
+  nonce[0] ^= 1;
+  EXPECT_EQ (-1, roughtime_verify_reply (srv.public_key, nonce, reply,
+                                         len - 4, &res));
+  /* The signed time itself. */
+  ASSERT_EQ (0, roughtime_find_tag (reply, len, ROUGHTIME_SREP, &value,
+                                    &value_len));
+  reply[value - reply + value_len - 1] ^= 1;
+  EXPECT_EQ (-1, roughtime_verify_reply (srv.public_key, nonce, reply, len,
+                                         &res));
+}
+
+/* Answers one request on |fd| with the time |offset| seconds from ours. */
+static void
+serve_roughtime (int fd, const struct roughtime_server *srv, long offset)
+{
+  uint8_t request[ROUGHTIME_MAX_REPLY], reply[ROUGHTIME_MAX_REPLY];
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof (from);
+  ssize_t n = recvfrom (fd, request, sizeof (request), 0,
+                        (struct sockaddr *) &from, &from_len);
+  size_t len;
+  if (n < 0)
+    _exit (1);
+  len = roughtime_server_reply (srv, request, n,
+                                (uint64_t) (time (NULL) + offset) * 1000000,
+                                1000, reply);
+  sendto (fd, reply, len, 0, (struct sockaddr *) &from, from_len);
+}
+
+TEST_F (tlsdate, roughtime_source)
+{
+  struct roughtime_server srv;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+  char port[8];
+  struct source source =
+  {
+    .next = NULL,
+    .host = "127.0.0.1",
+    .port = port,
+    .roughtime = 1,
+  };
+  time_t before;
+  time_t t;
+  pid_t pid;
+  int fd = socket (AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE (0, fd);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  ASSERT_EQ (0, bind (fd, (struct sockaddr *) &addr, sizeof (addr)));
+  ASSERT_EQ (0, getsockname (fd, (struct sockaddr *) &addr, &addr_len));
+  snprintf (port, sizeof (port), "%d", ntohs (addr.sin_port));
+  ASSERT_EQ (0, roughtime_server_init (&srv, kRoughtimeSeed));
+  memcpy (source.roughtime_key, srv.public_key, ROUGHTIME_KEY_LEN);
+  self->state.opts.sources = &source;
+  self->state.opts.max_tries = 1;
+  self->state.opts.subprocess_wait_between_tries = 1;
+  before = time (NULL);
+  pid = fork ();
+  ASSERT_LE (0, pid);
+  if (!pid)
+    {
+      serve_roughtime (fd, &srv, 1000);
+      _exit (0);
+    }
+  EXPECT_EQ (0, runner (self, &t));
+  waitpid (pid, NULL, 0);
+  EXPECT_LE (before + 999, t);
+  EXPECT_GE (time (NULL) + 1000, t);
+  EXPECT_EQ (SYNC_TYPE_NET, self->state.last_sync_type);
+  EXPECT_EQ (1, self->state.metrics.successes);
+  EXPECT_EQ (0, roughtime_pending (&self->state));
+  EXPECT_EQ (0, self->state.running);
+  /* Nobody answers this time; the run times out like a hung tlsdate. */
+  self->state.last_time = 0;
+  self->state.last_sync_type = SYNC_TYPE_NONE;
+  EXPECT_EQ (1, runner (self, &t));
+  EXPECT_EQ (1, self->state.metrics.failures[F_TIMEOUT]);
+  EXPECT_EQ (0, roughtime_pending (&self->state));
+  EXPECT_EQ (0, self->state.running);
+  close (fd);
+}
+#else
+/* Without Ed25519 nothing could be verified, so the config is refused. */
+TEST_F (tempdir, roughtime_needs_ed25519)
+{
+  struct opts opts;
+  char path[PATH_MAX];
+  memset (&opts, 0, sizeof (opts));
+  snprintf (path, sizeof (path), "%s/tlsdated.conf", self->path);
+  ASSERT_EQ (0, write_conf (path,
+                            "source\n\thost roughtime.example.com\n"
+                            "\tport 2002\n\troughtime-key "
+                            "0GD7c3yP8xEc4Zl2zeuN2SlLvDVVocjsPSL8/Rl/7zg=\n"
+                            "end\n"));
+  set_conf_defaults (&opts);
+  opts.conf_file = path;
+  EXPECT_NE (0, load_conf (&opts));
+  EXPECT_EQ (NULL, opts.sources);
+  unlink (path);
+}
+#endif
+
+#if !HAVE_DECL_TLS1_3_VERSION
+/* NTS-KE over anything older than TLS 1.3 is forbidden; refuse the source. */
+TEST_F (tempdir, nts_needs_tls13)
+{
+  struct opts opts;
+  char path[PATH_MAX];
+  memset (&opts, 0, sizeof (opts));
+  snprintf (path, sizeof (path), "%s/tlsdated.conf", self->path);
+  ASSERT_EQ (0, write_conf (path,
+                            "source\n\thost nts.example.com\n"
+                            "\tport 4460\n\tnts yes\nend\n"));
+  set_conf_defaults (&opts);
+  opts.conf_file = path;
+  EXPECT_NE (0, load_conf (&opts));
+  EXPECT_EQ (NULL, opts.sources);
+  unlink (path);
+}
+#endif
+
+TEST (nts_packets)
+{
+  /* RFC 5297, appendix A.1 */
+  static const uint8_t kKey[NTS_KEY_LEN] =
+  {
+    0xff, 0xfe, 0xfd, 0xfc, 0xfb, 0xfa, 0xf9, 0xf8,
+    0xf7, 0xf6, 0xf5, 0xf4, 0xf3, 0xf2, 0xf1, 0xf0,
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+    0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+  };
+  static const uint8_t kAd[24] =
+  {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+  };
+  static const uint8_t kPlain[14] =
+  {
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+    0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee,
+  };
+  static const uint8_t kSealed[30] =
+  {
+    0x85, 0x63, 0x2d, 0x07, 0xc6, 0xe8, 0xf3, 0x7f,
+    0x95, 0x0a, 0xcd, 0x32, 0x0a, 0x2e, 0xcc, 0x93,
+    0x40, 0xc0, 0x2b, 0x96, 0x90, 0xc4, 0xdc, 0x04,
+    0xda, 0xef, 0x7f, 0x6a, 0xfe, 0x5c,
+  };
+  struct iovec ad = { (void *) kAd, sizeof (kAd) };
+  struct nts_server srv, other;
+  struct nts_session s, before;
+  struct nts_reply reply;
+  uint8_t out[sizeof (kSealed)], ke[NTS_KE_MAX_RESPONSE];
+  uint8_t request[NTS_MAX_PACKET], answer[NTS_MAX_PACKET];
+  uint8_t uid[NTS_UID_LEN], xmt[8];
+  uint64_t now = (uint64_t) 3900000000U << 32;
+  size_t len, n;
+  ASSERT_EQ (0, nts_aead_seal (kKey, &ad, 1, kPlain, sizeof (kPlain), out));
+  EXPECT_EQ (0, memcmp (kSealed, out, sizeof (kSealed)));
+  ASSERT_EQ (0, nts_aead_open (kKey, &ad, 1, kSealed, sizeof (kSealed),
+                               out));
+  EXPECT_EQ (0, memcmp (kPlain, out, sizeof (kPlain)));
+  memcpy (out, kSealed, sizeof (kSealed));
+  out[20] ^= 1;
+  EXPECT_EQ (1, nts_aead_open (kKey, &ad, 1, out, sizeof (kSealed), out));
+  /* NTS-KE, with the keys TLS would export. */
+  ASSERT_EQ (0, nts_server_init (&srv));
+  len = nts_ke_encode_request (request);
+  EXPECT_EQ (NTS_KE_REQUEST_LEN, len);
+  memset (uid, 1, sizeof (uid));
+  memset (xmt, 2, sizeof (xmt));
+  len = nts_server_ke_response (&srv, request, len, uid, uid,
+                                NTS_MAX_COOKIES, NULL, 4123, ke);
+  ASSERT_LT (0, len);
+  EXPECT_EQ (1, nts_ke_parse_response (ke, len - 4, &s));
+  ASSERT_EQ (0, nts_ke_parse_response (ke, len, &s));
+  EXPECT_EQ (NTS_MAX_COOKIES, s.num_cookies);
+  EXPECT_EQ (4123, s.ntp_port);
+  EXPECT_STREQ ("", s.ntp_server);
+  memcpy (s.c2s_key, uid, NTS_KEY_LEN);
+  memcpy (s.s2c_key, uid, NTS_KEY_LEN);
+  /* A query spends a cookie and the reply brings one back. */
+  len = nts_encode_request (&s, uid, xmt, request);
+  ASSERT_LT (0, len);
+  EXPECT_EQ (NTS_MAX_COOKIES - 1, s.num_cookies);
+  n = nts_server_reply (&srv, request, len, now, answer);
+  ASSERT_LT (0, n);
+  before = s;
+  ASSERT_EQ (0, nts_parse_reply (&s, uid, xmt, answer, n, &reply));
+  EXPECT_EQ (NTS_MAX_COOKIES, s.num_cookies);
+  EXPECT_EQ (1, reply.stratum);
+  EXPECT_EQ (now, reply.transmit);
+  /* Not our request, or not from the server: both are ignored. */
+  xmt[0] ^= 1;
+  EXPECT_EQ (-1, nts_parse_reply (&before, uid, xmt, answer, n, &reply));
+  xmt[0] ^= 1;
+  answer[n - 1] ^= 1;
+  EXPECT_EQ (-1, nts_parse_reply (&before, uid, xmt, answer, n, &reply));
+  EXPECT_EQ (NTS_MAX_COOKIES - 1, before.num_cookies);
+  /* A server that can't read the cookie says so. */
+  ASSERT_EQ (0, nts_server_init (&other));
+  len = nts_encode_request (&s, uid, xmt, request);
+  n = nts_server_reply (&other, request, len, now, answer);
+  ASSERT_LT (0, n);
+  EXPECT_EQ (1, nts_parse_reply (&s, uid, xmt, answer, n, &reply));
+}
+
+/* Answers one NTP request on |fd| with the time |offset| seconds from ours. */
+static void
+serve_nts (int fd, const struct nts_server *srv, long offset)
+{
+  uint8_t request[NTS_MAX_PACKET], reply[NTS_MAX_PACKET];
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof (from);
+  ssize_t n = recvfrom (fd, request, sizeof (request), 0,
+                        (struct sockaddr *) &from, &from_len);
+  size_t len;
+  if (n < 0)
+    _exit (1);
+  len = nts_server_reply (srv, request, n,
+                          (uint64_t) (time (NULL) + offset +
+                                      NTS_NTP_UNIX_OFFSET) << 32, reply);
+  sendto (fd, reply, len, 0, (struct sockaddr *) &from, from_len);
+}
+
+/* Runs tlsdated once against |srv|.  Returns 0, or -1 if it can't. */
+static int
+run_nts_server (FIXTURE_DATA (tlsdate) *self, int fd,
+                const struct nts_server *srv, time_t *t)
+{
+  pid_t pid = fork ();
+  if (pid < 0)
+    return -1;
+  if (!pid)
+    {
+      serve_nts (fd, srv, 1000);
+      _exit (0);
+    }
+  self->state.last_time = 0;
+  self->state.last_sync_type = SYNC_TYPE_NONE;
+  self->state.tries = 0;
+  runner (self, t);
+  waitpid (pid, NULL, 0);
+  return 0;
+}
+
+TEST_F (tlsdate, nts_source)
+{
+  struct nts_server srv, other;
+  struct nts_session s;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+  char dir[] = "/tmp/tlsdated-nts-XXXXXX";
+  char cache[PATH_MAX];
+  char keys[PATH_MAX];
+  uint8_t request[NTS_KE_REQUEST_LEN], ke[NTS_KE_MAX_RESPONSE];
+  uint8_t c2s[NTS_KEY_LEN], s2c[NTS_KEY_LEN];
+  /* Stands in for tlsdate -Vnts: writes what NTS-KE would have got. */
+  char *args[] = { "/bin/sh", "-c", "exec cat \"$0\"", keys, NULL };
+  struct source source =
+  {
+    .next = NULL,
+    .host = "127.0.0.1",
+    .port = "4460",
+    .nts = 1,
+  };
+  extern char **environ;
+  size_t len;
+  time_t before;
+  time_t t;
+  FILE *f;
+  int fd = socket (AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE (0, fd);
+  ASSERT_NE (NULL, mkdtemp (dir));
+  snprintf (cache, sizeof (cache), "%s/nts-127.0.0.1-4460", dir);
+  snprintf (keys, sizeof (keys), "%s/keys", dir);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  ASSERT_EQ (0, bind (fd, (struct sockaddr *) &addr, sizeof (addr)));
+  ASSERT_EQ (0, getsockname (fd, (struct sockaddr *) &addr, &addr_len));
+  ASSERT_EQ (0, nts_server_init (&srv));
+  memset (c2s, 5, sizeof (c2s));
+  memset (s2c, 6, sizeof (s2c));
+  len = nts_server_ke_response (&srv, request, nts_ke_encode_request (request),
+                                c2s, s2c, NTS_MAX_COOKIES, "127.0.0.1",
+                                ntohs (addr.sin_port), ke);
+  ASSERT_EQ (0, nts_ke_parse_response (ke, len, &s));
+  memcpy (s.c2s_key, c2s, sizeof (c2s));
+  memcpy (s.s2c_key, s2c, sizeof (s2c));
+  self->state.opts.sources = &source;
+  self->state.opts.base_argv = args;
+  self->state.opts.base_path = dir;
+  self->state.opts.max_tries = 1;
+  self->state.opts.subprocess_wait_between_tries = 1;
+  self->state.envp = environ;
+  /* The first run is tlsdate doing NTS-KE, then the NTP query. */
+  f = fopen (keys, "w");
+  ASSERT_NE (NULL, f);
+  ASSERT_EQ (1, fwrite (&s, sizeof (s), 1, f));
+  ASSERT_EQ (0, fclose (f));
+  /* The server's clock can tick over before tlsdated reads ours. */
+  before = time (NULL);
+  ASSERT_EQ (0, run_nts_server (self, fd, &srv, &t));
+  EXPECT_LE (before + 999, t);
+  EXPECT_GE (time (NULL) + 1000, t);
+  EXPECT_EQ (1, self->state.metrics.successes);
+  EXPECT_EQ (0, nts_pending (&self->state));
+  EXPECT_EQ (0, self->state.running);
+  ASSERT_EQ (0, nts_session_load (cache, &s));
+  EXPECT_EQ (NTS_MAX_COOKIES, s.num_cookies);
+  /* The next spends a cookie; tlsdate would fail if it were run. */
+  args[0] = "/bin/false";
+  before = time (NULL);
+  ASSERT_EQ (0, run_nts_server (self, fd, &srv, &t));
+  EXPECT_LE (before + 999, t);
+  EXPECT_EQ (2, self->state.metrics.successes);
+  EXPECT_EQ (0, self->state.metrics.failures[F_LAUNCH]);
+  /* A server that has lost its key throws the jar out. */
+  ASSERT_EQ (0, nts_server_init (&other));
+  ASSERT_EQ (0, run_nts_server (self, fd, &other, &t));
+  EXPECT_EQ (0, self->state.last_time);
+  EXPECT_EQ (1, self->state.metrics.failures[F_BAD_RESPONSE]);
+  EXPECT_EQ (0, self->state.running);
+  EXPECT_NE (0, access (cache, F_OK));
+  unlink (cache);
+  unlink (keys);
+  rmdir (dir);
+  close (fd);
+}
+
+#if HAVE_DECL_TLS1_3_VERSION
+/* The config is reloaded while tlsdate is doing NTS-KE: the keys it comes
+ * back with have no source to go to any more, so the run fails.
+ */
+TEST_F (tlsdate, nts_reload_mid_run)
+{
+  struct nts_session s;
+  char dir[] = "/tmp/tlsdated-nts-XXXXXX";
+  char conf[PATH_MAX];
+  char cache[PATH_MAX];
+  char keys[PATH_MAX];
+  char *args[] = { "/bin/sh", "-c", "sleep 0.2; exec cat \"$0\"", keys,
+                   NULL };
+  extern char **environ;
+  FILE *f;
+  ASSERT_NE (NULL, mkdtemp (dir));
+  snprintf (conf, sizeof (conf), "%s/tlsdated.conf", dir);
+  snprintf (cache, sizeof (cache), "%s/nts-127.0.0.1-4460", dir);
+  snprintf (keys, sizeof (keys), "%s/keys", dir);
+  memset (&s, 0, sizeof (s));
+  s.magic = NTS_SESSION_MAGIC;
+  s.num_cookies = 1;
+  s.cookie_len[0] = 16;
+  f = fopen (keys, "w");
+  ASSERT_NE (NULL, f);
+  ASSERT_EQ (1, fwrite (&s, sizeof (s), 1, f));
+  ASSERT_EQ (0, fclose (f));
+  ASSERT_EQ (0, write_conf (conf, "source\n\thost 127.0.0.1\n"
+                                  "\tport 4460\n\tnts yes\nend\n"));
+  self->state.opts.conf_file = conf;
+  self->state.cmdline_opts = self->state.opts;
+  ASSERT_EQ (0, load_conf (&self->state.opts));
+  self->state.opts.base_argv = args;
+  self->state.opts.base_path = dir;
+  self->state.envp = environ;
+  self->state.opts.cur_source = self->state.opts.sources;
+  self->state.backoff = self->state.opts.wait_between_tries;
+  self->state.running = 1;
+  trigger_event (&self->state, E_TLSDATE_STATUS, -1);
+  ASSERT_EQ (0, tlsdate (&self->state));
+  ASSERT_EQ (0, reload_conf (&self->state));
+  EXPECT_EQ (NULL, self->state.runs[0].source);
+  event_base_loopexit (self->state.base, &self->timeout);
+  event_base_dispatch (self->state.base);
+  EXPECT_EQ (0, tlsdate_runs (&self->state));
+  EXPECT_EQ (0, self->state.running);
+  EXPECT_EQ (0, nts_pending (&self->state));
+  EXPECT_EQ (1, self->state.metrics.failures[F_BAD_RESPONSE]);
+  EXPECT_NE (0, access (cache, F_OK));
+  /* The retry is left to run with the reloaded source. */
+  EXPECT_NE (0, event_pending (self->state.events[E_TLSDATE], EV_TIMEOUT,
+                               NULL));
+  free_sources (self->state.opts.sources);
+  unlink (keys);
+  unlink (conf);
+  rmdir (dir);
+}
+#endif
+
 FIXTURE(mock_platform) {
   struct platform platform;
   struct platform *old_platform;
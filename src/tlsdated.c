@@ -36,10 +36,13 @@
 #include <event2/event.h>
 
 #include "src/conf.h"
+#include "src/roughtime.h"
 #include "src/routeup.h"
 #include "src/util.h"
 #include "src/tlsdate.h"
 #include "src/dbus.h"
+#include "src/notify.h"
+#include "src/ntp-shm.h"
 #include "src/platform.h"
 
 const char *kCacheDir = DEFAULT_DAEMON_CACHEDIR;
@@ -139,6 +142,27 @@ set_conf_defaults (struct opts *opts)
   opts->cur_source = NULL;
   opts->proxy = NULL;
   opts->leap = 0;
+  opts->metrics_socket = NULL;
+  opts->status_page = NULL;
+  opts->ntp_shm_unit = -1;
+  opts->sntp_port = 0;
+  opts->sntp_address = NULL;
+  opts->peer_key_file = NULL;
+  opts->peers = NULL;
+  opts->peer_port = 0;
+  opts->peer_timeout = PEER_TIMEOUT;
+  opts->peer_max_age = PEER_MAX_AGE;
+  opts->trace_file = NULL;
+  opts->watch_conf = 0;
+  opts->fast_boot = 0;
+  opts->fast_boot_retry = FAST_BOOT_RETRY;
+  opts->fast_boot_timeout = FAST_BOOT_TIMEOUT;
+  opts->helper_deadlines[0] = '\0';
+  opts->hedge_percentile = 0;
+  opts->backoff_policy = BACKOFF_DOUBLE;
+  opts->backoff_cap = MAX_SANE_BACKOFF;
+  opts->wake_jitter = WAKE_JITTER;
+  opts->chain_cache_age = CHAIN_CACHE_AGE;
 }
 
 void
@@ -220,8 +244,13 @@ parse_argv (struct opts *opts, int argc, char *argv[])
   /* Validate arguments */
 }
 
+/* |roughtime_key| is NULL for a TLS source; |nts| marks an NTS-KE one.
+ * Returns the new source.
+ */
 static
-void add_source_to_conf (struct opts *opts, char *host, char *port, char *proxy)
+struct source *add_source_to_conf (struct opts *opts, char *host, char *port,
+                                   char *proxy, const uint8_t *roughtime_key,
+                                   int nts)
 {
   struct source *s;
   struct source *source = (struct source *) calloc (1, sizeof *source);
@@ -239,6 +268,12 @@ void add_source_to_conf (struct opts *opts, char *host, char *port, char *proxy)
       if (!source->proxy)
         fatal ("out of memory for proxy");
     }
+  if (roughtime_key)
+    {
+      source->roughtime = 1;
+      memcpy (source->roughtime_key, roughtime_key, ROUGHTIME_KEY_LEN);
+    }
+  source->nts = nts;
   if (!opts->sources)
     {
       opts->sources = source;
@@ -251,19 +286,49 @@ void add_source_to_conf (struct opts *opts, char *host, char *port, char *proxy)
       source->id = s->id + 1;
       s->next = source;
     }
+  return source;
+}
+
+void
+free_sources (struct source *sources)
+{
+  while (sources)
+    {
+      struct source *next = sources->next;
+      free (sources->host);
+      free (sources->port);
+      free (sources->proxy);
+      free (sources->pin);
+      free (sources);
+      sources = next;
+    }
 }
 
+/* Returns the "end" entry closing the stanza, or NULL if it is malformed. */
 static struct conf_entry *
 parse_source (struct opts *opts, struct conf_entry *conf)
 {
   char *host = NULL;
   char *port = NULL;
   char *proxy = NULL;
+  char *pin = NULL;
+  int http = SOURCE_HTTP_AUTO;
+  struct source *source;
+  uint8_t key[ROUGHTIME_KEY_LEN];
+  uint8_t digest[HELPER_PIN_DIGEST_LEN];
+  int roughtime = 0;
+  int nts = 0;
+  int max_tries = 0;
   /* a source entry:
    * source
    *   host <host>
    *   port <port>
    *   [proxy <proxy>]
+   *   [roughtime-key <base64 or hex Ed25519 public key>]
+   *   [nts yes]
+   *   [max-tries <count>]
+   *   [pin sha256/<base64 SubjectPublicKeyInfo hash>]
+   *   [http yes|no|auto]
    * end
    */
   assert (!strcmp (conf->key, "source"));
@@ -276,19 +341,116 @@ parse_source (struct opts *opts, struct conf_entry *conf)
         port = conf->value;
       else if (!strcmp (conf->key, "proxy"))
         proxy = conf->value;
+      else if (!strcmp (conf->key, "roughtime-key"))
+        {
+#ifndef HAVE_EVP_PKEY_NEW_RAW_PUBLIC_KEY
+          error ("roughtime-key needs a TLS library with Ed25519");
+          return NULL;
+#endif
+          if (!conf->value || roughtime_parse_key (conf->value, key))
+            {
+              error ("bad roughtime-key in source stanza");
+              return NULL;
+            }
+          roughtime = 1;
+        }
+      else if (!strcmp (conf->key, "pin"))
+        {
+          if (!conf->value || helper_parse_pin (conf->value, digest))
+            {
+              error ("bad pin in source stanza");
+              return NULL;
+            }
+          pin = conf->value;
+        }
+      else if (!strcmp (conf->key, "http"))
+        {
+          if (!conf->value || !strcmp (conf->value, "yes"))
+            http = SOURCE_HTTP_YES;
+          else if (!strcmp (conf->value, "no"))
+            http = SOURCE_HTTP_NO;
+          else if (!strcmp (conf->value, "auto"))
+            http = SOURCE_HTTP_AUTO;
+          else
+            {
+              error ("bad http in source stanza");
+              return NULL;
+            }
+        }
+      else if (!strcmp (conf->key, "nts"))
+        {
+          nts = conf->value ? !strcmp (conf->value, "yes") : 1;
+#if !HAVE_DECL_TLS1_3_VERSION
+          if (nts)
+            {
+              error ("nts needs a TLS library with TLS 1.3");
+              return NULL;
+            }
+#endif
+        }
+      else if (!strcmp (conf->key, "max-tries"))
+        {
+          max_tries = conf->value ? atoi (conf->value) : -1;
+          if (max_tries < 0)
+            {
+              error ("bad max-tries in source stanza");
+              return NULL;
+            }
+        }
       else
-        fatal ("malformed config: '%s' in source stanza", conf->key);
+        {
+          error ("malformed config: '%s' in source stanza", conf->key);
+          return NULL;
+        }
       conf = conf->next;
     }
   if (!conf)
-    fatal ("unclosed source stanza");
+    {
+      error ("unclosed source stanza");
+      return NULL;
+    }
   if (!host || !port)
-    fatal ("incomplete source stanza (needs host, port)");
-  add_source_to_conf (opts, host, port, proxy);
+    {
+      error ("incomplete source stanza (needs host, port)");
+      return NULL;
+    }
+  /* Roughtime is a UDP protocol; no proxy could carry it. */
+  if (roughtime && proxy)
+    {
+      error ("a roughtime source can't have a proxy");
+      return NULL;
+    }
+  /* NTS-KE could go through one, but the NTP queries after it can't. */
+  if (nts && (proxy || roughtime))
+    {
+      error ("an nts source can't have a proxy or a roughtime-key");
+      return NULL;
+    }
+  if (roughtime && pin)
+    {
+      error ("a roughtime source can't have a pin");
+      return NULL;
+    }
+  /* Nor is there a Date header to take the time from. */
+  if ((roughtime || nts) && http == SOURCE_HTTP_YES)
+    {
+      error ("a roughtime or nts source can't use http");
+      return NULL;
+    }
+  source = add_source_to_conf (opts, host, port, proxy,
+                               roughtime ? key : NULL, nts);
+  source->max_tries = max_tries;
+  source->http = http;
+  if (pin && !(source->pin = strdup (pin)))
+    fatal ("out of memory for pin");
   return conf;
 }
 
-void
+/* Applies the config file on top of |opts|.  Returns 0 on success.  On
+ * failure |opts| may be partly updated, and any sources it gained are
+ * still on its list for the caller to free.
+ */
+int
 load_conf (struct opts *opts)
 {
   FILE *f;
@@ -301,17 +463,19 @@ load_conf (struct opts *opts)
     {
       if (opts->conf_file)
         {
-          pfatal ("can't open conf file '%s'", opts->conf_file);
-        }
-      else
-        {
-          pinfo ("can't open conf file '%s'", conf_file);
-          return;
+          perror ("can't open conf file '%s'", opts->conf_file);
+          return 1;
         }
+      pinfo ("can't open conf file '%s'", conf_file);
+      return 0;
     }
   conf = conf_parse (f);
+  fclose (f);
   if (!conf)
-    pfatal ("can't parse config file");
+    {
+      perror ("can't parse config file");
+      return 1;
+    }
 
   for (e = conf; e; e = e->next)
     {
@@ -339,6 +503,10 @@ load_conf (struct opts *opts)
         {
           opts->steady_state_interval = atoi (e->value);
         }
+      else if (!strcmp (e->key, "continuity-interval") && e->value)
+        {
+          opts->continuity_interval = atoi (e->value);
+        }
       else if (!strcmp (e->key, "base-path") && e->value)
         {
           opts->base_path = strdup (e->value);
@@ -365,6 +533,26 @@ load_conf (struct opts *opts)
         {
           opts->dry_run = e->value ? !strcmp (e->value, "yes") : 1;
         }
+      else if (!strcmp (e->key, "backoff-policy") && e->value)
+        {
+          opts->backoff_policy = backoff_policy_parse (e->value);
+        }
+      else if (!strcmp (e->key, "backoff-cap") && e->value)
+        {
+          opts->backoff_cap = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "wake-jitter") && e->value)
+        {
+          opts->wake_jitter = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "chain-cache-age") && e->value)
+        {
+          opts->chain_cache_age = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "hedge-percentile") && e->value)
+        {
+          opts->hedge_percentile = atoi (e->value);
+        }
       else if (!strcmp (e->key, "jitter") && e->value)
         {
           opts->jitter = atoi (e->value);
@@ -376,30 +564,276 @@ load_conf (struct opts *opts)
       else if (!strcmp (e->key, "source"))
         {
           e = parse_source (opts, e);
+          if (!e)
+            {
+              conf_free (conf);
+              return 1;
+            }
         }
      else if (!strcmp (e->key, "leap"))
         {
           opts->leap = e->value ? !strcmp (e->value, "yes") : 1;
         }
+      else if (!strcmp (e->key, "metrics-socket") && e->value)
+        {
+          opts->metrics_socket = strdup (e->value);
+          if (!opts->metrics_socket)
+            fatal ("out of memory for metrics socket path");
+        }
+      else if (!strcmp (e->key, "ntp-shm-unit") && e->value)
+        {
+          opts->ntp_shm_unit = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "peer-key-file") && e->value)
+        {
+          opts->peer_key_file = strdup (e->value);
+          if (!opts->peer_key_file)
+            fatal ("out of memory for peer key file path");
+        }
+      else if (!strcmp (e->key, "peers") && e->value)
+        {
+          opts->peers = strdup (e->value);
+          if (!opts->peers)
+            fatal ("out of memory for peers list");
+        }
+      else if (!strcmp (e->key, "peer-port") && e->value)
+        {
+          opts->peer_port = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "peer-timeout") && e->value)
+        {
+          opts->peer_timeout = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "peer-max-age") && e->value)
+        {
+          opts->peer_max_age = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "sntp-port") && e->value)
+        {
+          opts->sntp_port = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "sntp-address") && e->value)
+        {
+          opts->sntp_address = strdup (e->value);
+          if (!opts->sntp_address)
+            fatal ("out of memory for SNTP address");
+        }
+      else if (!strcmp (e->key, "status-page") && e->value)
+        {
+          opts->status_page = strdup (e->value);
+          if (!opts->status_page)
+            fatal ("out of memory for status page path");
+        }
+      else if (!strcmp (e->key, "trace-file") && e->value)
+        {
+          opts->trace_file = strdup (e->value);
+          if (!opts->trace_file)
+            fatal ("out of memory for trace file path");
+        }
+      else if (!strcmp (e->key, "watch-config"))
+        {
+          opts->watch_conf = e->value ? !strcmp (e->value, "yes") : 1;
+        }
+      else if (!strcmp (e->key, "fast-boot"))
+        {
+          opts->fast_boot = e->value ? !strcmp (e->value, "yes") : 1;
+        }
+      else if (!strcmp (e->key, "fast-boot-retry") && e->value)
+        {
+          opts->fast_boot_retry = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "fast-boot-timeout") && e->value)
+        {
+          opts->fast_boot_timeout = atoi (e->value);
+        }
+      else if (!strcmp (e->key, "helper-deadlines") && e->value)
+        {
+          snprintf (opts->helper_deadlines, sizeof (opts->helper_deadlines),
+                    "%s", e->value);
+        }
    }
+  conf_free (conf);
+  return 0;
 }
 
-void
-check_conf (struct state *state)
+/* Returns what is wrong with the tunables in |opts|, or NULL. */
+static const char *
+conf_problem (const struct opts *opts)
 {
-  struct opts *opts = &state->opts;
   if (!opts->max_tries)
-    fatal ("-t argument must be nonzero");
+    return "max-tries (-t) must be nonzero";
   if (!opts->wait_between_tries)
-    fatal ("-d argument must be nonzero");
+    return "wait-between-tries (-d) must be nonzero";
   if (!opts->steady_state_interval)
-    fatal ("-a argument must be nonzero");
+    return "steady-state-interval (-a) must be nonzero";
+  if (opts->continuity_interval <= 0)
+    return "continuity-interval must be positive";
+  if (opts->jitter >= opts->steady_state_interval)
+    return "jitter must be less than steady state interval";
+  if (opts->fast_boot && opts->fast_boot_retry <= 0)
+    return "fast-boot-retry must be positive";
+  if (opts->fast_boot && opts->fast_boot_timeout <= 0)
+    return "fast-boot-timeout must be positive";
+  if (opts->ntp_shm_unit < -1 || opts->ntp_shm_unit > NTP_SHM_MAX_UNIT)
+    return "ntp-shm-unit must be between 0 and 255";
+  if (opts->sntp_port < 0 || opts->sntp_port > 65535)
+    return "sntp-port must be between 0 and 65535";
+  if (opts->peer_port < 0 || opts->peer_port > 65535)
+    return "peer-port must be between 0 and 65535";
+  if (opts->peer_port && !opts->peer_key_file)
+    return "peer-port needs a peer-key-file";
+  if (opts->peer_timeout <= 0)
+    return "peer-timeout must be positive";
+  if (opts->peer_max_age <= 0)
+    return "peer-max-age must be positive";
+  if (opts->backoff_policy < 0)
+    return "backoff-policy must be double or decorrelated";
+  if (opts->backoff_cap <= 0)
+    return "backoff-cap must be positive";
+  if (opts->wake_jitter < 0)
+    return "wake-jitter can't be negative";
+  if (opts->chain_cache_age < 0)
+    return "chain-cache-age can't be negative";
+  if (opts->hedge_percentile < 0 || opts->hedge_percentile > 99)
+    return "hedge-percentile must be between 0 and 99";
+  if (opts->helper_deadlines[0])
+    {
+      double deadlines[HELPER_PHASES];
+      if (helper_parse_deadlines (opts->helper_deadlines, deadlines))
+        return "helper-deadlines must be five second counts, comma-separated";
+    }
+  return NULL;
+}
+
+void
+check_conf (struct state *state)
+{
+  struct opts *opts = &state->opts;
+  const char *problem = conf_problem (opts);
+  if (problem)
+    fatal ("%s", problem);
   if (snprintf (state->timestamp_path, sizeof (state->timestamp_path),
                 "%s/timestamp", opts->base_path) >= sizeof (state->timestamp_path))
     fatal ("supplied base path is too long: '%s'", opts->base_path);
-  if (opts->jitter >= opts->steady_state_interval)
-    fatal ("jitter must be less than steady state interval (%d >= %d)",
-           opts->jitter, opts->steady_state_interval);
+  if (opts->trace_file)
+    {
+      if (snprintf (state->trace_path, sizeof (state->trace_path), "%s",
+                    opts->trace_file) >= sizeof (state->trace_path))
+        fatal ("supplied trace file is too long: '%s'", opts->trace_file);
+    }
+  else if (snprintf (state->trace_path, sizeof (state->trace_path),
+                     "%s/trace", opts->base_path) >= sizeof (state->trace_path))
+    fatal ("supplied base path is too long: '%s'", opts->base_path);
+}
+
+static int
+str_changed (const char *a, const char *b)
+{
+  if (!a || !b)
+    return a != b;
+  return strcmp (a, b) != 0;
+}
+
+/* Frees a path load_conf() duplicated into |fresh| over |orig|. */
+static void
+drop_conf_string (const char *fresh, const char *orig)
+{
+  if (fresh != orig)
+    free ((char *) fresh);
+}
+
+/*
+ * Re-reads the config file over the command line options and swaps the
+ * result into |state|: sources and retry/interval tunables take effect at
+ * once, everything else needs a restart.  Sync state, the setter and any
+ * running tlsdate are left alone.  On any error nothing is changed.
+ * Returns 0 on success.  The caller re-arms timers whose interval changed.
+ */
+int
+reload_conf (struct state *state)
+{
+  struct opts fresh = state->cmdline_opts;
+  struct opts *cur = &state->opts;
+  const char *problem;
+  int ret = 1;
+  fresh.sources = NULL;
+  fresh.cur_source = NULL;
+  if (load_conf (&fresh))
+    goto out;
+  if ((problem = conf_problem (&fresh)))
+    {
+      error ("not reloading config: %s", problem);
+      goto out;
+    }
+  if (!fresh.sources)
+    add_source_to_conf (&fresh, DEFAULT_HOST, DEFAULT_PORT, DEFAULT_PROXY,
+                        NULL, 0);
+  if (str_changed (fresh.base_path, cur->base_path) ||
+      str_changed (fresh.metrics_socket, cur->metrics_socket) ||
+      str_changed (fresh.status_page, cur->status_page) ||
+      str_changed (fresh.trace_file, cur->trace_file) ||
+      fresh.should_sync_hwclock != cur->should_sync_hwclock ||
+      fresh.should_load_disk != cur->should_load_disk ||
+      fresh.should_save_disk != cur->should_save_disk ||
+      fresh.should_netlink != cur->should_netlink ||
+      fresh.dry_run != cur->dry_run ||
+      fresh.watch_conf != cur->watch_conf ||
+      fresh.fast_boot != cur->fast_boot ||
+      fresh.ntp_shm_unit != cur->ntp_shm_unit ||
+      fresh.sntp_port != cur->sntp_port ||
+      str_changed (fresh.sntp_address, cur->sntp_address) ||
+      str_changed (fresh.peer_key_file, cur->peer_key_file) ||
+      str_changed (fresh.peers, cur->peers) ||
+      fresh.peer_port != cur->peer_port)
+    info ("paths, should-* options, dry-run, watch-config, fast-boot, "
+          "ntp-shm-unit, sntp-*, peers and peer-port only change on restart");
+  cur->max_tries = fresh.max_tries;
+  cur->min_steady_state_interval = fresh.min_steady_state_interval;
+  cur->wait_between_tries = fresh.wait_between_tries;
+  cur->subprocess_tries = fresh.subprocess_tries;
+  cur->subprocess_wait_between_tries = fresh.subprocess_wait_between_tries;
+  cur->steady_state_interval = fresh.steady_state_interval;
+  cur->continuity_interval = fresh.continuity_interval;
+  cur->jitter = fresh.jitter;
+  cur->leap = fresh.leap;
+  cur->peer_timeout = fresh.peer_timeout;
+  cur->peer_max_age = fresh.peer_max_age;
+  memcpy (cur->helper_deadlines, fresh.helper_deadlines,
+          sizeof (cur->helper_deadlines));
+  cur->hedge_percentile = fresh.hedge_percentile;
+  cur->backoff_policy = fresh.backoff_policy;
+  cur->backoff_cap = fresh.backoff_cap;
+  cur->wake_jitter = fresh.wake_jitter;
+  cur->chain_cache_age = fresh.chain_cache_age;
+  /* The platform resolver keeps per-source state keyed by source id. */
+  if (state->events[E_RESOLVER])
+    {
+      info ("sources only change on restart with a proxy resolver");
+    }
+  else
+    {
+      struct source *old = cur->sources;
+      int i;
+      cur->sources = fresh.sources;
+      cur->cur_source = NULL;
+      /* Runs in flight can't be credited to sources that are going away. */
+      for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
+        state->runs[i].source = NULL;
+      roughtime_forget_source (state);
+      nts_forget_source (state);
+      fresh.sources = old;
+    }
+  ret = 0;
+out:
+  free_sources (fresh.sources);
+  drop_conf_string (fresh.base_path, state->cmdline_opts.base_path);
+  drop_conf_string (fresh.metrics_socket, state->cmdline_opts.metrics_socket);
+  drop_conf_string (fresh.status_page, state->cmdline_opts.status_page);
+  drop_conf_string (fresh.sntp_address, state->cmdline_opts.sntp_address);
+  drop_conf_string (fresh.peer_key_file, state->cmdline_opts.peer_key_file);
+  drop_conf_string (fresh.peers, state->cmdline_opts.peers);
+  drop_conf_string (fresh.trace_file, state->cmdline_opts.trace_file);
+  return ret;
 }
 
 int
@@ -417,12 +851,18 @@ cleanup_main (struct state *state)
           event_free (e);
         }
     }
+  /* Best effort; the directory is usually not ours after dropping privs. */
+  if (state->opts.metrics_socket)
+    unlink (state->opts.metrics_socket);
   /* The other half was closed above. */
   platform->file_close (state->tlsdate_monitor_fd);
-  if (state->tlsdate_pid)
+  for (i = 0; i < MAX_TLSDATE_RUNS; ++i)
     {
-      platform->process_signal (state->tlsdate_pid, SIGKILL);
-      platform->process_wait (state->tlsdate_pid, NULL, 0 /* !forever */);
+      pid_t pid = state->runs[i].pid;
+      if (!pid)
+        continue;
+      platform->process_signal (pid, SIGKILL);
+      platform->process_wait (pid, NULL, 0 /* !forever */);
     }
   /* Best effort to tear it down if it is still alive. */
   close(state->setter_notify_fd);
@@ -460,13 +900,19 @@ main (int argc, char *argv[], char *envp[])
    */
   event_base_priority_init (base, MAX_EVENT_PRIORITIES);
   memset (&state, 0, sizeof (state));
+  metrics_init (&state.metrics);
+  /* before anything is forked so no child inherits the socket path */
+  notify_init ();
   set_conf_defaults (&state.opts);
   parse_argv (&state.opts, argc, argv);
   check_conf (&state);
-  load_conf (&state.opts);
+  state.cmdline_opts = state.opts;
+  if (load_conf (&state.opts))
+    fatal ("can't load config file");
   check_conf (&state);
   if (!state.opts.sources)
-    add_source_to_conf (&state.opts, DEFAULT_HOST, DEFAULT_PORT, DEFAULT_PROXY);
+    add_source_to_conf (&state.opts, DEFAULT_HOST, DEFAULT_PORT,
+                        DEFAULT_PROXY, NULL, 0);
   state.base = base;
   state.envp = envp;
   state.backoff = state.opts.wait_between_tries;
@@ -496,6 +942,37 @@ main (int argc, char *argv[], char *envp[])
     {
       platform->rtc_close (&state.hwclock);
     }
+  /* the metrics socket usually lives in a root-owned runtime directory */
+  if (state.opts.metrics_socket && setup_metrics_socket (&state))
+    {
+      error ("Failed to setup metrics socket");
+      goto out;
+    }
+  /* as is the status page, which stays mapped writable after the drop */
+  if (state.opts.status_page && status_page_open (&state))
+    {
+      error ("Failed to setup status page");
+      goto out;
+    }
+  /* NTP daemons usually create root-only segments */
+  if (state.opts.ntp_shm_unit >= 0 &&
+      !(state.ntp_shm = ntp_shm_open (state.opts.ntp_shm_unit)))
+    {
+      error ("Failed to setup NTP SHM segment");
+      goto out;
+    }
+  /* port 123 is privileged */
+  if (state.opts.sntp_port && setup_sntp_server (&state))
+    {
+      error ("Failed to setup SNTP server");
+      goto out;
+    }
+  /* the peer key file should be readable only by root */
+  if (state.opts.peer_port && setup_peers (&state))
+    {
+      error ("Failed to setup peers");
+      goto out;
+    }
   /* drop privileges before touching any untrusted data */
   drop_privs_to (state.opts.user, state.opts.group);
   /* register a signal handler to save time at shutdown */
@@ -508,6 +985,18 @@ main (int argc, char *argv[], char *envp[])
       event_priority_set (event, PRI_SAVE);
       event_add (event, NULL);
     }
+  /* dump the event trace on SIGUSR1 */
+  if (setup_event_dump_trace (&state))
+    {
+      error ("Failed to setup SIGUSR1 event");
+      goto out;
+    }
+  /* re-read the config on SIGHUP, or when it changes with watch-config */
+  if (setup_event_reload_conf (&state))
+    {
+      error ("Failed to setup config reload events");
+      goto out;
+    }
   if (state.opts.should_dbus && init_dbus (&state))
     {
       error ("Failed to initialize DBus");
@@ -591,8 +1080,16 @@ main (int argc, char *argv[], char *envp[])
       error ("Failed to setup continuity timer");
       goto out;
     }
+  /* with fast-boot, hold off readiness until network time lands */
+  if (setup_event_boot_timeout (&state))
+    {
+      error ("Failed to setup the fast-boot timer");
+      goto out;
+    }
   /* Add a forced sync event to the event list. */
   action_kickoff_time_sync (-1, EV_TIMEOUT, &state);
+  if (!state.booting)
+    report_ready (&state, "Started");
   verb ("Entering dispatch . . .");
   event_base_dispatch (base);
   verb ("tlsdated event dispatch terminating gracefully");
@@ -0,0 +1,140 @@
+/*
+ * trace-decode.c - print a tlsdated event trace as a timeline
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * tlsdated writes its trace ring out on SIGUSR1; this reads that file:
+ *   kill -USR1 $(pidof tlsdated); tlsdated-trace /var/cache/tlsdated/trace
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "src/trace.h"
+#include "src/tlsdate.h"
+
+static const char *
+sync_str (int sync_type)
+{
+  switch (sync_type)
+    {
+    case SYNC_TYPE_NONE:
+      return "none";
+    case SYNC_TYPE_BUILD:
+      return "build";
+    case SYNC_TYPE_DISK:
+      return "disk";
+    case SYNC_TYPE_RTC:
+      return "rtc";
+    case SYNC_TYPE_PLATFORM:
+      return "platform";
+    case SYNC_TYPE_NET:
+      return "net";
+    default:
+      return "?";
+    }
+}
+
+static const char *
+code_str (int code)
+{
+  switch (code)
+    {
+    case CLD_EXITED:
+      return "exited";
+    case CLD_KILLED:
+      return "killed";
+    case CLD_DUMPED:
+      return "dumped";
+    case CLD_STOPPED:
+      return "stopped";
+    case CLD_CONTINUED:
+      return "continued";
+    default:
+      return "?";
+    }
+}
+
+static void
+print_record (const struct trace_header *h, const struct trace_record *r,
+              const struct trace_record *prev)
+{
+  uint64_t ago = h->mono_ns - r->mono_ns;
+  uint64_t wall = h->real_ns - ago;
+  time_t secs = wall / 1000000000ULL;
+  struct tm tm;
+  char when[32];
+  double delta = prev ? (r->mono_ns - prev->mono_ns) / 1e9 : 0;
+  if (!gmtime_r (&secs, &tm) ||
+      !strftime (when, sizeof (when), "%Y-%m-%d %H:%M:%S", &tm))
+    strcpy (when, "?");
+  printf ("%s.%06" PRIu64 " %+14.6f  %-15s tries=%d backoff=%u sync=%s",
+          when, (uint64_t) (wall % 1000000000ULL) / 1000, delta,
+          trace_event_str (r->event), r->tries, r->backoff,
+          sync_str (r->sync_type));
+  if (r->pid)
+    printf (" pid=%d", r->pid);
+  if (r->event == E_SIGCHLD)
+    printf (" %s=%d", code_str (r->code), r->status);
+  else if (r->event == E_TIME_SET)
+    printf (" status=%d", r->status);
+  printf ("\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *path = DEFAULT_DAEMON_CACHEDIR "/trace";
+  struct trace_header header;
+  struct trace_record record, prev;
+  uint32_t i;
+  FILE *f;
+  if (argc > 2 || (argc == 2 && !strcmp (argv[1], "-h")))
+    {
+      fprintf (stderr, "usage: %s [trace-file]\n", argv[0]);
+      return 1;
+    }
+  if (argc == 2)
+    path = argv[1];
+  f = fopen (path, "rb");
+  if (!f)
+    {
+      fprintf (stderr, "%s: %s\n", path, strerror (errno));
+      return 1;
+    }
+  if (fread (&header, sizeof (header), 1, f) != 1 ||
+      header.magic != TRACE_MAGIC)
+    {
+      fprintf (stderr, "%s: not a tlsdated trace\n", path);
+      return 1;
+    }
+  if (header.version != TRACE_VERSION ||
+      header.record_size != sizeof (struct trace_record))
+    {
+      fprintf (stderr, "%s: unsupported trace version %u\n", path,
+               header.version);
+      return 1;
+    }
+  printf ("# %u events, %u older events dropped\n", header.count,
+          header.dropped);
+  for (i = 0; i < header.count; ++i)
+    {
+      if (fread (&record, sizeof (record), 1, f) != 1)
+        {
+          fprintf (stderr, "%s: truncated after %u events\n", path, i);
+          return 1;
+        }
+      print_record (&header, &record, i ? &prev : NULL);
+      prev = record;
+    }
+  fclose (f);
+  return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * trace.c - in-memory ring buffer of tlsdated event dispatches
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Every action in events/ appends one record here.  Recording is a
+ * vDSO clock_gettime() and a few stores into a fixed array inside
+ * struct state, so it is always on.  SIGUSR1 writes the ring out with
+ * trace_dump() (see events/dump_trace.c) and tlsdated-trace prints it.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/trace.h"
+#include "src/tlsdate.h"
+#include "src/util.h"
+
+static uint64_t
+clock_ns (clockid_t clock)
+{
+  struct timespec ts;
+  if (clock_gettime (clock, &ts))
+    return 0;
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+trace_child (struct state *state, int id, pid_t pid, int status, int code)
+{
+  struct trace *trace = &state->trace;
+  struct trace_record *r =
+    &trace->records[trace->next++ & (TRACE_RECORDS - 1)];
+  r->mono_ns = clock_ns (CLOCK_MONOTONIC);
+  r->event = id;
+  r->sync_type = state->last_sync_type;
+  r->tries = state->tries;
+  r->backoff = state->backoff;
+  r->pid = pid;
+  r->status = status;
+  r->code = code;
+}
+
+void
+trace_event (struct state *state, int id)
+{
+  trace_child (state, id, 0, 0, 0);
+}
+
+static int
+write_all (int fd, const struct iovec *iov, int iovcnt)
+{
+  struct iovec v[3];
+  ssize_t ret;
+  if (iovcnt > 3)
+    return -1;
+  memcpy (v, iov, iovcnt * sizeof (*iov));
+  while (iovcnt)
+    {
+      ret = IGNORE_EINTR (writev (fd, v, iovcnt));
+      if (ret <= 0)
+        return -1;
+      while (iovcnt && (size_t) ret >= v[0].iov_len)
+        {
+          ret -= v[0].iov_len;
+          memmove (v, v + 1, --iovcnt * sizeof (*v));
+        }
+      if (iovcnt)
+        {
+          v[0].iov_base = (char *) v[0].iov_base + ret;
+          v[0].iov_len -= ret;
+        }
+    }
+  return 0;
+}
+
+/* Writes the ring, oldest record first, to |path| by way of a temporary
+ * file so readers never see a partial dump.  Returns 0 on success.
+ */
+int
+trace_dump (const struct trace *trace, const char *path)
+{
+  char tmp[PATH_MAX];
+  struct trace_header header;
+  struct iovec iov[3];
+  uint64_t count = trace->next;
+  size_t start;
+  int fd;
+  if (count > TRACE_RECORDS)
+    count = TRACE_RECORDS;
+  start = (trace->next - count) & (TRACE_RECORDS - 1);
+  memset (&header, 0, sizeof (header));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof (struct trace_record);
+  header.count = count;
+  header.dropped = trace->next - count;
+  header.mono_ns = clock_ns (CLOCK_MONOTONIC);
+  header.real_ns = clock_ns (CLOCK_REALTIME);
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof (header);
+  /* The ring wraps at most once, so it is at most two runs of records. */
+  iov[1].iov_base = (void *) &trace->records[start];
+  iov[1].iov_len = min (count, TRACE_RECORDS - start) *
+                   sizeof (struct trace_record);
+  iov[2].iov_base = (void *) &trace->records[0];
+  iov[2].iov_len = count * sizeof (struct trace_record) - iov[1].iov_len;
+  if (snprintf (tmp, sizeof (tmp), "%s%s", path, DEFAULT_DAEMON_TMPSUFFIX) >=
+      (int) sizeof (tmp))
+    return 1;
+  fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+             0644);
+  if (fd < 0)
+    return 1;
+  if (write_all (fd, iov, iov[2].iov_len ? 3 : 2))
+    {
+      close (fd);
+      unlink (tmp);
+      return 1;
+    }
+  if (close (fd) || rename (tmp, path))
+    {
+      unlink (tmp);
+      return 1;
+    }
+  return 0;
+}
+
+const char *
+trace_event_str (int id)
+{
+  switch (id)
+    {
+    case E_RESOLVER:
+      return "resolver";
+    case E_TLSDATE:
+      return "tlsdate";
+    case E_TLSDATE_STATUS:
+      return "tlsdate-status";
+    case E_TLSDATE_TIMEOUT:
+      return "tlsdate-timeout";
+    case E_SAVE:
+      return "save";
+    case E_SIGCHLD:
+      return "sigchld";
+    case E_SIGTERM:
+      return "sigterm";
+    case E_STEADYSTATE:
+      return "steady-state";
+    case E_ROUTEUP:
+      return "route-up";
+    case E_METRICS:
+      return "metrics";
+    case E_CONTINUITY:
+      return "continuity";
+    case E_TIME_SET:
+      return "time-set";
+    case E_DUMP_TRACE:
+      return "dump-trace";
+    case E_SIGHUP:
+      return "sighup";
+    case E_CONF_WATCH:
+      return "conf-watch";
+    case E_RELOAD:
+      return "reload";
+    case E_BOOT_TIMEOUT:
+      return "boot-timeout";
+    case E_SNTP:
+      return "sntp";
+    case E_PEER:
+      return "peer";
+    case E_PEER_TIMEOUT:
+      return "peer-timeout";
+    case E_ROUGHTIME:
+      return "roughtime";
+    case E_NTS:
+      return "nts";
+    case E_HEDGE:
+      return "hedge";
+    default:
+      return "unknown";
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * trace.h - in-memory ring buffer of tlsdated event dispatches
+ * Copyright (c) 2026 The tlsdate Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TRACE_MAGIC 0x52544454  /* "TDTR" little-endian */
+#define TRACE_VERSION 1
+/* Must be a power of two. */
+#define TRACE_RECORDS 512
+
+/* One event dispatch.  Fixed-size so recording is a handful of stores. */
+struct trace_record
+{
+  uint64_t mono_ns;       /* CLOCK_MONOTONIC */
+  uint16_t event;         /* enum event_id_t */
+  uint16_t sync_type;     /* state->last_sync_type */
+  int32_t tries;
+  uint32_t backoff;
+  int32_t pid;            /* child involved, if any */
+  int32_t status;         /* exit status or setter status, if any */
+  int32_t code;           /* si_code for reaped children */
+};
+
+/* Written ahead of the records in a dump file. */
+struct trace_header
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t count;         /* records following, oldest first */
+  uint32_t dropped;       /* records overwritten before the dump */
+  uint64_t mono_ns;       /* both clocks at dump time, to map records */
+  uint64_t real_ns;       /* back onto wall time */
+};
+
+struct trace
+{
+  uint64_t next;          /* total records ever written */
+  struct trace_record records[TRACE_RECORDS];
+};
+
+struct state;
+
+void trace_event (struct state *state, int id);
+void trace_child (struct state *state, int id, pid_t pid, int status,
+                  int code);
+int trace_dump (const struct trace *trace, const char *path);
+const char *trace_event_str (int id);
+
+#endif /* TRACE_H */
@@ -33,6 +33,7 @@
 #include <event2/event.h>
 #endif
 
+#include "src/probes.h"
 #include "src/tlsdate.h"
 #include "src/util.h"
 
@@ -150,34 +151,41 @@ void enable_seccomp(void)
 }
 
 void
-drop_privs_to (const char *user, const char *group)
+lookup_privs (const char *user, const char *group, uid_t *uid, gid_t *gid)
 {
-  uid_t uid;
-  gid_t gid;
   struct passwd *pw;
   struct group  *gr;
 
-  if (0 != getuid ())
-    return; /* not running as root to begin with; should (!) be harmless to continue
-         without dropping to 'nobody' (setting time will fail in the end) */
   pw = getpwnam (user);
   gr = getgrnam (group);
   if (NULL == pw)
     die ("Failed to obtain UID for `%s'\n", user);
   if (NULL == gr)
     die ("Failed to obtain GID for `%s'\n", group);
-  uid = pw->pw_uid;
-  if (0 == uid)
+  *uid = pw->pw_uid;
+  if (0 == *uid)
     die ("UID for `%s' is 0, refusing to run SSL\n", user);
-  gid = pw->pw_gid;
-  if (0 == gid || 0 == gr->gr_gid)
+  *gid = pw->pw_gid;
+  if (0 == *gid || 0 == gr->gr_gid)
     die ("GID for `%s' is 0, refusing to run SSL\n", user);
   if (pw->pw_gid != gr->gr_gid)
     die ("GID for `%s' is not `%s' as expected, refusing to run SSL\n",
          user, group);
-  if (0 != initgroups ( (const char *) user, gr->gr_gid))
-    die ("Unable to initgroups for `%s' in group `%s' as expected\n",
-         user, group);
+}
+
+/* Needs no user database, so it is safe to call in a freshly spawned
+ * child.  The supplementary groups are reduced to |gid| alone.
+ */
+void
+drop_privs_to_ids (uid_t uid, gid_t gid)
+{
+  if (0 != getuid ())
+    return; /* see drop_privs_to() */
+  if (0 == uid || 0 == gid)
+    die ("refusing to drop privileges to uid %lu gid %lu\n",
+         (unsigned long) uid, (unsigned long) gid);
+  if (0 != setgroups (1, &gid))
+    die ("Failed to setgroups: %s\n", strerror (errno));
 #ifdef HAVE_SETRESGID
   if (0 != setresgid (gid, gid, gid))
     die ("Failed to setresgid: %s\n", strerror (errno));
@@ -194,6 +202,19 @@ drop_privs_to (const char *user, const char *group)
 #endif
 }
 
+void
+drop_privs_to (const char *user, const char *group)
+{
+  uid_t uid;
+  gid_t gid;
+
+  if (0 != getuid ())
+    return; /* not running as root to begin with; should (!) be harmless to continue
+         without dropping to 'nobody' (setting time will fail in the end) */
+  lookup_privs (user, group, &uid, &gid);
+  drop_privs_to_ids (uid, gid);
+}
+
 #ifdef ENABLE_RTC
 int rtc_open(struct rtc_handle *h)
 {
@@ -399,6 +420,7 @@ trigger_event (struct state *state, enum event_id_t id, int sec)
 #ifdef WITH_EVENTS
   struct event *e = state->events[id];
   struct timeval delay = { sec, 0 };
+  PROBE2 (trigger_event, id, sec);
   /* Fallthrough to tlsdate if there is no resolver. */
   if (!e && id == E_RESOLVER)
     e = state->events[E_TLSDATE];
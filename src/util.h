@@ -63,6 +63,9 @@ static inline int min (int x, int y)
   return x < y ? x : y;
 }
 
+void lookup_privs (const char *user, const char *group, uid_t *uid,
+                   gid_t *gid);
+void drop_privs_to_ids (uid_t uid, gid_t gid);
 void drop_privs_to (const char *user, const char *group);
 void no_new_privs (void);
 const char *sync_type_str (int sync_type);